@@ -6,29 +6,15 @@ int
 main(int argc, char *argv[])
 {
     char *whoami = "P2";
+    int stragglers;
 
     start_up_server(argc, argv, whoami);
     DEBUG_PRINTF("\n\n>\n>>P2>>: server started up correctly\n>\n\n");
 
-    while (get_clock_lamport() != 3) {
-        continue;
-    }
-    DEBUG_PRINTF("\n\n>\n>>P2>>: server received 1 message\n>\n\n");
+    // every client READY_TO_SHUTDOWN, then SHUTDOWN_NOW to all of them at once
+    stragglers = shutdown_coordinate(whoami, SHUTDOWN_TIMEOUT_MS);
+    DEBUG_PRINTF("\n\n>\n>>P2>>: server got the SHUTDOWN_ACKs (%i stragglers)\n>\n\n", stragglers);
 
-    send_msg(whoami, "P1", SHUTDOWN_NOW);
-    DEBUG_PRINTF("\n\n>\n>>P2>>: server sent SHUTDOWN_NOW to P1\n>\n\n");
-
-    while (get_clock_lamport() != 7) {
-        continue;
-    }
-    DEBUG_PRINTF("\n\n>\n>>P2>>: server received 1 message\n>\n\n");
-
-    send_msg(whoami, "P3", SHUTDOWN_NOW);
-    DEBUG_PRINTF("\n\n>\n>>P2>>: server sent SHUTDOWN_NOW to P3\n>\n\n");
-
-    while (get_clock_lamport() != 11) {
-        continue;
-    }
-    terminate_server(EXIT_SUCCESS);
+    terminate_server((stragglers == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
 
 }
\ No newline at end of file
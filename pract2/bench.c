@@ -0,0 +1,1631 @@
+#include "./stub.h"
+#include "./tomcast.h"
+#include "./sim.h"
+#include "./shmring.h"
+#include "./snapshot.h"
+#include "./dmutex.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+#include <malloc.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <sched.h>
+
+
+#define BENCH_ITERS         200000  // clock operations per thread
+#define BENCH_READS_PER_OP  4       // polls (get) done for every update
+#define BENCH_MAX_THREADS   64
+#define BENCH_SOAK_MSGS     1000000 // messages sent through send_msg() in the soak
+#define BENCH_WIRE_MSGS     5000000 // messages encoded and decoded in the wire bench
+#define BENCH_BATCH_MSGS    200000  // messages sent per burst size in the batch bench
+#define BENCH_CLOCK_MSGS    1000000 // messages stamped per clock mode and group size
+#define BENCH_SIM_NODES     1000    // logical processes in the simulated token run
+#define BENCH_SIM_MSGS      1000000 // deliveries of the simulated token run
+#define BENCH_SIM_TOKENS    10      // tokens each simulated node starts with
+#define BENCH_SHUT_DELAY_US  100    // mean one-way delay of the simulated shutdown
+#define BENCH_PINGS         100000  // round trips per transport
+#define BENCH_STREAM_MSGS   2000000 // frames streamed one way per transport
+#define BENCH_STREAM_FRAME  16      // bytes of a frame (a small message, see ./bench wire)
+#define BENCH_STREAM_BATCH  32      // frames per write (as flush_batch() does)
+#define BENCH_XPORT_PORT    5099    // loopback port / AF_UNIX socket of the transport bench
+#define BENCH_TOM_MSGS      5000    // tomcast broadcasts per group size (all members)
+#define BENCH_TOM_HOP       100     // ticks a packet takes at least (1 hop)
+#define BENCH_TOM_JITTER    100     // plus 0 to this - 1 more, at random per packet
+#define BENCH_TOM_GAP       100     // ticks between two broadcasts of a member
+#define BENCH_TOM_ACK_DELAY 50      // (piggyback) ticks an ack waits for data (TOM_ACK_DELAY_US)
+#define BENCH_MESH_PINGS    20000   // P1 <-> P3 round trips per route of the mesh bench
+#define BENCH_MESH_MSGS     200000  // messages P1 streams to P3 per route
+#define BENCH_MESH_PORT     5090    // the mesh bench listens at AF_UNIX 5091..5093
+#define BENCH_SNAP_TRANSFERS 20000  // transfers each node of the snapshot bench sends
+#define BENCH_SNAP_PACE_US  50      // pause after each transfer
+#define BENCH_SNAP_EVERY_MS 10      // every node starts a snapshot this often
+#define BENCH_SNAP_MAX      1024    // snapshots the bench keeps track of (per node)
+#define BENCH_SNAP_BALANCE  1000000L    // money each node starts with
+#define BENCH_SNAP_PORT     5080    // the snapshot bench listens at AF_UNIX 5081..5083
+#define BENCH_SNAP_DIR      "/tmp/sdc-bench-snap"
+#define BENCH_DMX_ENTRIES   2000    // lock entries of each node, back to back
+#define BENCH_DMX_CALM      200     // lock entries of each node with a pause in between
+#define BENCH_DMX_THINK_US  2000    // the pause (low contention)
+#define BENCH_DMX_MAX_NODES 5
+#define BENCH_DMX_PORT      5060    // the lock bench listens at AF_UNIX 5061..5065
+#define BENCH_FLOW_MSGS     100000  // messages P1 sends to P2 per row of the flow bench
+#define BENCH_FLOW_SLOW_US  2       // work P2 does per message when it is the slow one
+#define BENCH_FLOW_PORT     5050    // the flow bench listens at AF_UNIX 5051..5052
+
+
+// in-process tomcast run: one packet between two members (or a timer of one: to == from)
+struct sim_pkt {
+    long at;                    // tick it arrives (or fires) at
+    long seq;                   // order it was sent in: the tie-break
+    int to, from;
+    enum operations type;
+    unsigned int ts;
+    long sent_at;               // payload of the data packets: tick it was broadcast at
+};
+
+// the simulated network of a tomcast run: packets and timers in time order
+struct tom_net {
+    struct sim_pkt *pkts;       // heap by (at, seq)
+    long len, cap, seq;
+    int n;                      // members
+    long *link_last;            // [from * n + to] arrival of the last packet: links are FIFO
+    unsigned int seed;          // of the jitter
+};
+
+struct tom_run {
+    double msgs_per_bcast;      // data + ack packets per broadcast
+    double latency_p50;         // hops from broadcast to delivery
+    double latency_p99;
+    double deliveries_per_s;
+    int same_order;             // every member delivered the same sequence
+};
+
+
+// payload of the mesh bench messages (TOM_DATA, there is no tomcast running)
+struct mesh_ping {
+    int to;                     // node the message is for: P2 relays the others
+    int relayed;                // 1: through P2 (the clients' old route), 0: direct
+    int echo;                   // 1: P3 answers it
+};
+
+
+// payload of the snapshot bench transfers (TOM_DATA, there is no tomcast running)
+struct bank_transfer {
+    long amount;
+    long sent_ns;               // CLOCK_MONOTONIC: the nodes share the host
+};
+
+// what the nodes of the snapshot bench report to the parent (shared memory)
+struct snap_bench {
+    long final_balance[3];
+    long n_latencies[3][2];             // [node][during a snapshot]
+    long latencies[3][2][2 * BENCH_SNAP_TRANSFERS];
+    int n_snaps[3];                     // snapshots each node took (and waited for)
+    int n_overlapped[3];                //  of them, started while another was recorded there
+    int n_lost[3];                      // snapshots it took that never finished there
+    uint32_t snap_ids[3][BENCH_SNAP_MAX];
+    long snap_ns[3 * BENCH_SNAP_MAX];   // snap_take() -> local file written, at the initiator
+    atomic_int snapping;                // nodes still taking snapshots: no shutdown before
+};
+
+
+// what the nodes of the lock bench report to the parent (shared memory)
+struct dmx_bench {
+    atomic_int occupant;                // 1 while some node is in the critical section
+    atomic_int ready;                   // nodes connected: they all start together
+    atomic_int done;                    // nodes past their last entry: no shutdown before
+    atomic_long violations;             // entries that found it occupied
+    int last_occupant;                  // (critical section) node of the previous entry
+    long run, max_run;                  // entries in a row by the same node: starvation
+    long start_ns[BENCH_DMX_MAX_NODES], end_ns[BENCH_DMX_MAX_NODES];
+    long acquired[BENCH_DMX_MAX_NODES], msgs[BENCH_DMX_MAX_NODES];
+};
+
+
+// payload of the flow bench messages (TOM_DATA, there is no tomcast running)
+struct flow_chunk {
+    long work_ns;               // time P2 spends on it
+    int last;                   // P2 answers it (TOM_ACK): everything before arrived
+};
+
+
+// raw struct the stub used to put on the wire before the varint frames
+struct legacy_message {
+    char origin[20];
+    enum operations action;
+    unsigned int clock_lamport;
+};
+
+
+// mutex version of the Lamport clock (the one the stub used before going lock-free)
+int l_clock_mtx = 0;
+pthread_mutex_t mutex_lclock = PTHREAD_MUTEX_INITIALIZER;
+
+void update_clock_lamport_mutex(int *l_clock_loc) {
+    pthread_mutex_lock(&mutex_lclock);
+    if (*l_clock_loc > l_clock_mtx) {
+        l_clock_mtx = *l_clock_loc;
+    }
+    l_clock_mtx++;
+    *l_clock_loc = l_clock_mtx;
+    pthread_mutex_unlock(&mutex_lclock);
+}
+
+int get_clock_lamport_mutex() {
+    int l_clock_copy;
+
+    pthread_mutex_lock(&mutex_lclock);
+    l_clock_copy = l_clock_mtx;
+    pthread_mutex_unlock(&mutex_lclock);
+    return l_clock_copy;
+}
+
+
+//-- returns the nanoseconds elapsed since an arbitrary (monotonic) point
+long now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+//-- (qsort) orders latencies
+int cmp_long(const void *pa, const void *pb) {
+    long a = *(const long *)pa, b = *(const long *)pb;
+    return (a < b) ? -1 : (a > b);
+}
+
+//-- (threads!) send/receive-like updates mixed with application polls
+void *clock_worker_atomic(void *arg) {
+    int i, r, l_clock_loc = 0;
+    volatile int sink;
+
+    for (i = 0; i < BENCH_ITERS; i++) {
+        update_clock_lamport(&l_clock_loc);
+        for (r = 0; r < BENCH_READS_PER_OP; r++) {
+            sink = get_clock_lamport();
+        }
+    }
+    (void)sink;
+    return NULL;
+}
+
+void *clock_worker_mutex(void *arg) {
+    int i, r, l_clock_loc = 0;
+    volatile int sink;
+
+    for (i = 0; i < BENCH_ITERS; i++) {
+        update_clock_lamport_mutex(&l_clock_loc);
+        for (r = 0; r < BENCH_READS_PER_OP; r++) {
+            sink = get_clock_lamport_mutex();
+        }
+    }
+    (void)sink;
+    return NULL;
+}
+
+//-- runs n_threads workers and returns the mean ns per clock operation
+double run_clock_workers(void *(*worker)(void *), int n_threads) {
+    pthread_t threads[BENCH_MAX_THREADS];
+    long beginning, ending;
+    int i;
+
+    beginning = now_ns();
+    for (i = 0; i < n_threads; i++) {
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    for (i = 0; i < n_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    ending = now_ns();
+
+    return (double)(ending - beginning) /
+           ((double)n_threads * BENCH_ITERS * (BENCH_READS_PER_OP + 1));
+}
+
+//-- atomic vs mutex Lamport clock, 1 to 64 threads
+void bench_clock() {
+    int n_threads;
+
+    printf("# lamport clock: %i updates + %i reads per thread\n",
+           BENCH_ITERS, BENCH_ITERS * BENCH_READS_PER_OP);
+    printf("%8s %14s %14s\n", "threads", "mutex ns/op", "atomic ns/op");
+    for (n_threads = 1; n_threads <= BENCH_MAX_THREADS; n_threads *= 2) {
+        double mtx = run_clock_workers(clock_worker_mutex, n_threads);
+        double atm = run_clock_workers(clock_worker_atomic, n_threads);
+        printf("%8i %14.2f %14.2f\n", n_threads, mtx, atm);
+    }
+}
+
+//-- (thread!) drains everything written to the other end of the socketpair
+void *drain_socket(void *fd_ptr) {
+    char sink[4096];
+    int fd = *((int *)fd_ptr);
+
+    while (recv(fd, sink, sizeof(sink), 0) > 0) {
+        continue;
+    }
+    return NULL;
+}
+
+int stdout_copy = -1;
+
+//-- sends stdout to /dev/null (the SEND traces are not part of the measures)
+void mute_stdout() {
+    int devnull = open("/dev/null", O_WRONLY);
+
+    fflush(stdout);
+    stdout_copy = dup(STDOUT_FILENO);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+}
+
+//-- gives stdout back
+void unmute_stdout() {
+    fflush(stdout);
+    dup2(stdout_copy, STDOUT_FILENO);
+    close(stdout_copy);
+}
+
+//-- connects sock_sfd (the clients' route) to a drainer thread
+void open_drained_route(int sv[2], pthread_t *drainer) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair failed");
+        exit(EXIT_FAILURE);
+    }
+    sock_sfd = sv[0];   // send_msg() to an unknown peer goes through sock_sfd
+    pthread_create(drainer, NULL, drain_socket, &sv[1]);
+}
+
+//-- closes the route opened by open_drained_route()
+void close_drained_route(int sv[2], pthread_t drainer) {
+    shutdown(sv[0], SHUT_WR);
+    pthread_join(drainer, NULL);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+//-- soak of the send path: heap in use and allocator calls per message
+void bench_pool() {
+    int sv[2], i;
+    long gets, slabs, beginning, ending;
+    struct mallinfo2 before, after;
+    pthread_t drainer;
+
+    open_drained_route(sv, &drainer);
+    mute_stdout();
+
+    send_msg("P1", "P2", READY_TO_SHUTDOWN);    // warm up: first slab
+    before = mallinfo2();
+    beginning = now_ns();
+    for (i = 0; i < BENCH_SOAK_MSGS; i++) {
+        send_msg("P1", "P2", READY_TO_SHUTDOWN);
+    }
+    ending = now_ns();
+    after = mallinfo2();
+
+    unmute_stdout();
+    close_drained_route(sv, drainer);
+
+    get_msg_pool_stats(&gets, &slabs);
+    printf("# message pool soak: %i messages through send_msg()\n", BENCH_SOAK_MSGS);
+    printf("heap in use growth     : %zd bytes\n", (ssize_t)(after.uordblks - before.uordblks));
+    printf("pool gets              : %li\n", gets);
+    printf("allocator calls        : %li (was 1 per message)\n", slabs);
+    printf("allocator calls / msg  : %.6f\n", (double)slabs / (double)gets);
+    printf("ns / send              : %.1f\n", (double)(ending - beginning) / BENCH_SOAK_MSGS);
+}
+
+//-- bytes per message (raw struct vs frame) and encode+decode cost
+void bench_wire() {
+    unsigned int clocks[] = {1, 100, 20000, 3000000, 4000000000u};
+    unsigned char frame[512];
+    struct message msg, decoded;
+    long beginning, ending, checksum = 0;
+    int i, frame_len;
+
+    memset(&msg, 0, sizeof(msg));   // no payload, no vector
+    printf("# wire format: raw struct message vs varint frame\n");
+    printf("%12s %12s %12s\n", "clock", "raw bytes", "frame bytes");
+    for (i = 0; i < (int)(sizeof(clocks) / sizeof(clocks[0])); i++) {
+        msg.origin = 3;
+        msg.action = SHUTDOWN_ACK;
+        msg.stamp.mode = CLOCK_LAMPORT;
+        msg.clock_lamport = clocks[i];
+        frame_len = encode_msg(&msg, NULL, frame);
+        printf("%12u %12zu %12i\n", clocks[i], sizeof(struct legacy_message), frame_len);
+    }
+
+    beginning = now_ns();
+    for (i = 0; i < BENCH_WIRE_MSGS; i++) {
+        msg.clock_lamport = i;
+        frame_len = encode_msg(&msg, NULL, frame);
+        decode_msg(frame, frame_len, &decoded);
+        checksum += decoded.clock_lamport;
+    }
+    ending = now_ns();
+    printf("encode+decode ns/msg   : %.1f (checksum %li)\n",
+           (double)(ending - beginning) / BENCH_WIRE_MSGS, checksum);
+}
+
+//-- sends bursts of burst messages followed by an explicit flush
+void run_bursts(int burst) {
+    int i;
+
+    for (i = 0; i < BENCH_BATCH_MSGS; i++) {
+        send_msg("P1", "P2", READY_TO_SHUTDOWN);
+        if ((i + 1) % burst == 0) {
+            flush_msgs(-1);
+        }
+    }
+    flush_msgs(-1);
+}
+
+//-- messages per syscall and ns per message, unbatched vs batched bursts
+void bench_batch() {
+    int bursts[] = {1, 4, 16, 64};
+    int sv[2], i, window;
+    long msgs, syscalls, prev_msgs, prev_syscalls, beginning, ending;
+    double per_syscall[2][4], ns_per_msg[2][4];
+    pthread_t drainer;
+
+    open_drained_route(sv, &drainer);
+    mute_stdout();
+
+    for (window = 0; window < 2; window++) {
+        set_batch_window(window == 0 ? 0 : 1000);   // unbatched / 1 ms window
+        for (i = 0; i < 4; i++) {
+            get_batch_stats(&prev_msgs, &prev_syscalls);
+            beginning = now_ns();
+            run_bursts(bursts[i]);
+            ending = now_ns();
+            get_batch_stats(&msgs, &syscalls);
+
+            per_syscall[window][i] = (double)(msgs - prev_msgs) / (double)(syscalls - prev_syscalls);
+            ns_per_msg[window][i] = (double)(ending - beginning) / BENCH_BATCH_MSGS;
+        }
+    }
+
+    unmute_stdout();
+    close_drained_route(sv, drainer);
+
+    printf("# write coalescing: %i messages per burst size, flush after each burst\n", BENCH_BATCH_MSGS);
+    printf("%8s %18s %18s %18s %18s\n", "burst", "unbatched msg/sc", "unbatched ns/msg",
+           "batched msg/sc", "batched ns/msg");
+    for (i = 0; i < 4; i++) {
+        printf("%8i %18.2f %18.1f %18.2f %18.1f\n", bursts[i],
+               per_syscall[0][i], ns_per_msg[0][i], per_syscall[1][i], ns_per_msg[1][i]);
+    }
+}
+//-- encodes + decodes BENCH_CLOCK_MSGS messages of n_procs processes in mode,
+//   as a stream on one connection; returns ns/msg and the mean frame bytes
+double run_clock_stream(enum clock_modes mode, int n_procs, double *frame_bytes) {
+    unsigned char frame[512];
+    unsigned int vc_sent[MAX_NODE_ID], vc_recv[MAX_NODE_ID];
+    struct message msg, decoded;
+    long beginning, ending, total_bytes = 0;
+    int i, len, other;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(vc_sent, 0, sizeof(vc_sent));
+    memset(vc_recv, 0, sizeof(vc_recv));
+    msg.origin = 1;
+    msg.action = READY_TO_SHUTDOWN;
+    msg.stamp.mode = mode;
+    msg.stamp.hlc = (uint64_t)1700000000000 << 16;
+    for (i = 1; i <= n_procs; i++) {
+        msg.stamp.vc[i] = 1000;     // every process already known
+    }
+
+    beginning = now_ns();
+    for (i = 0; i < BENCH_CLOCK_MSGS; i++) {
+        // between two sends the sender ticks itself and learns about one peer
+        other = 2 + i % (n_procs - 1);
+        msg.clock_lamport++;
+        msg.stamp.vc[1]++;
+        msg.stamp.vc[other] += 2;
+        msg.stamp.hlc++;
+
+        len = encode_msg(&msg, vc_sent, frame);
+        memcpy(decoded.stamp.vc, vc_recv, sizeof(vc_recv));
+        decode_msg(frame, len, &decoded);
+        memcpy(vc_recv, decoded.stamp.vc, sizeof(vc_recv));
+        total_bytes += len;
+    }
+    ending = now_ns();
+
+    if (mode == CLOCK_VECTOR && memcmp(vc_recv, msg.stamp.vc, sizeof(vc_recv)) != 0) {
+        fprintf(stderr, "error: vector rebuilt from deltas differs from the sent one\n");
+    }
+    *frame_bytes = (double)total_bytes / BENCH_CLOCK_MSGS;
+    return (double)(ending - beginning) / BENCH_CLOCK_MSGS;
+}
+
+//-- per-message overhead of each clock mode as the number of processes grows
+void bench_clock_modes() {
+    int n_procs[] = {3, 8, 16, 32, 63};
+    char *names[] = {"lamport", "vector", "hybrid"};
+    unsigned char frame[512];
+    struct message msg;
+    double ns, bytes;
+    int i, mode, j;
+
+    printf("# clock modes: %i messages per row (encode + decode, one connection)\n", BENCH_CLOCK_MSGS);
+    printf("%8s %8s %12s %12s %16s\n", "mode", "procs", "ns/msg", "bytes/msg", "full-vector B");
+    for (mode = CLOCK_LAMPORT; mode <= CLOCK_HYBRID; mode++) {
+        for (i = 0; i < (int)(sizeof(n_procs) / sizeof(n_procs[0])); i++) {
+            ns = run_clock_stream(mode, n_procs[i], &bytes);
+
+            if (mode != CLOCK_VECTOR) {
+                printf("%8s %8i %12.1f %12.1f %16s\n", names[mode], n_procs[i], ns, bytes, "-");
+                continue;
+            }
+
+            // what the first frame of a connection costs (no delta base yet)
+            memset(&msg, 0, sizeof(msg));
+            msg.stamp.mode = mode;
+            for (j = 1; j <= n_procs[i]; j++) {
+                msg.stamp.vc[j] = 1000;
+            }
+            printf("%8s %8i %12.1f %12.1f %16i\n", names[mode], n_procs[i], ns, bytes,
+                   encode_msg(&msg, NULL, frame));
+        }
+    }
+}
+
+//-- (run_tomcast) returns 1 when packet a leaves the network before b
+int sim_pkt_before(const struct sim_pkt *a, const struct sim_pkt *b) {
+    return a->at < b->at || (a->at == b->at && a->seq < b->seq);
+}
+
+//-- (run_tomcast) schedules pkt (its time set already): a heap in time order
+void tom_net_push(struct tom_net *net, struct sim_pkt pkt) {
+    struct sim_pkt *pkts, tmp;
+    long pos, parent;
+
+    if (net->len == net->cap) {
+        pkts = realloc(net->pkts, 2 * net->cap * sizeof(struct sim_pkt));
+        if (pkts == NULL) {
+            perror("realloc failed");
+            exit(EXIT_FAILURE);
+        }
+        net->pkts = pkts;
+        net->cap *= 2;
+    }
+    pkt.seq = net->seq++;
+    pos = net->len++;
+    net->pkts[pos] = pkt;
+    while (pos > 0) {
+        parent = (pos - 1) / 2;
+        if (!sim_pkt_before(&net->pkts[pos], &net->pkts[parent])) {
+            break;
+        }
+        tmp = net->pkts[pos];
+        net->pkts[pos] = net->pkts[parent];
+        net->pkts[parent] = tmp;
+        pos = parent;
+    }
+}
+
+//-- (run_tomcast) takes the earliest packet (or timer) out of net
+struct sim_pkt tom_net_pop(struct tom_net *net) {
+    struct sim_pkt first = net->pkts[0], tmp;
+    long pos = 0, child;
+
+    net->pkts[0] = net->pkts[--net->len];
+    while ((child = 2 * pos + 1) < net->len) {
+        if (child + 1 < net->len && sim_pkt_before(&net->pkts[child + 1], &net->pkts[child])) {
+            child++;
+        }
+        if (!sim_pkt_before(&net->pkts[child], &net->pkts[pos])) {
+            break;
+        }
+        tmp = net->pkts[pos];
+        net->pkts[pos] = net->pkts[child];
+        net->pkts[child] = tmp;
+        pos = child;
+    }
+    return first;
+}
+
+//-- (run_tomcast) a timer of member at time at: its next broadcast (TOM_DATA) or the
+//   end of the wait of its ack (TOM_ACK)
+void tom_net_timer(struct tom_net *net, long at, int member, enum operations type) {
+    struct sim_pkt pkt = {.at = at, .to = member, .from = member, .type = type};
+
+    tom_net_push(net, pkt);
+}
+
+//-- (run_tomcast) sends a packet from -> every other member at time now: each one
+//   arrives a hop plus some jitter later, never before the ones sent earlier on its
+//   link (FIFO channels, as the stub's); returns the packets sent
+long tom_net_multicast(struct tom_net *net, long now, int from, enum operations type,
+                       unsigned int ts, long sent_at) {
+    struct sim_pkt pkt = {.from = from, .type = type, .ts = ts, .sent_at = sent_at};
+    long *last;
+
+    for (pkt.to = 0; pkt.to < net->n; pkt.to++) {
+        if (pkt.to == from) {
+            continue;
+        }
+        last = &net->link_last[from * net->n + pkt.to];
+        pkt.at = now + BENCH_TOM_HOP + rand_r(&net->seed) % BENCH_TOM_JITTER;
+        if (pkt.at < *last) {
+            pkt.at = *last;
+        }
+        *last = pkt.at;
+        tom_net_push(net, pkt);
+    }
+    return net->n - 1;
+}
+
+//-- n members broadcast BENCH_TOM_MSGS messages over a simulated network: each of
+//   the first senders members broadcasts every BENCH_TOM_GAP ticks, a packet takes a
+//   hop plus jitter. With piggyback, an ack waits BENCH_TOM_ACK_DELAY ticks for data
+//   of its member to ride on (as tomcast.c does); without it, every data message is
+//   acked on arrival. A message is delivered once every member was heard past it:
+//   the latency is what waiting for those acks costs
+void run_tomcast(int n, int senders, int piggyback, struct tom_run *res) {
+    struct tom_group *members = calloc(n, sizeof(struct tom_group));
+    unsigned int *clocks = calloc(n, sizeof(unsigned int));
+    unsigned long *order_hash = calloc(n, sizeof(unsigned long));
+    int *sent = calloc(n, sizeof(int)), *ack_waiting = calloc(n, sizeof(int));
+    int per_sender = BENCH_TOM_MSGS / senders, i, m;
+    long packets = 0, deliveries = 0, total = (long)n * senders * per_sender;
+    long *latencies = malloc(total * sizeof(long));
+    long beginning, ending, now, sent_at;
+    struct tom_net net = {.n = n, .cap = 1024, .seed = (unsigned int)(n * 2 + piggyback)};
+    struct tom_delivery d;
+    struct tom_group *g;
+    struct sim_pkt pkt;
+
+    net.pkts = malloc(net.cap * sizeof(struct sim_pkt));
+    net.link_last = calloc((size_t)n * n, sizeof(long));
+    if (members == NULL || clocks == NULL || order_hash == NULL || sent == NULL ||
+        ack_waiting == NULL || latencies == NULL || net.pkts == NULL || net.link_last == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n; i++) {
+        tom_init(&members[i], i, n);
+    }
+    for (i = 0; i < senders; i++) {
+        tom_net_timer(&net, (long)i * BENCH_TOM_GAP / senders, i, TOM_DATA);
+    }
+
+    beginning = now_ns();
+    while (net.len > 0) {
+        pkt = tom_net_pop(&net);
+        now = pkt.at;
+        m = pkt.to;
+        g = &members[m];
+        if (pkt.from == m && pkt.type == TOM_DATA) {
+            // m broadcasts: its timestamp also acks everything it received before
+            clocks[m]++;
+            tom_hold(g, m, clocks[m], &now, sizeof(now));
+            g->ack_owed = 0;
+            packets += tom_net_multicast(&net, now, m, TOM_DATA, clocks[m], now);
+            if (++sent[m] < per_sender) {
+                tom_net_timer(&net, now + BENCH_TOM_GAP, m, TOM_DATA);
+            }
+        } else if (pkt.from == m) {
+            // the ack found no data to ride on
+            ack_waiting[m] = 0;
+            if (g->ack_owed) {
+                clocks[m]++;
+                g->ack_owed = 0;
+                packets += tom_net_multicast(&net, now, m, TOM_ACK, clocks[m], 0);
+            }
+        } else {
+            clocks[m] = (pkt.ts > clocks[m] ? pkt.ts : clocks[m]) + 1;
+            if (pkt.type == TOM_DATA) {
+                tom_hold(g, pkt.from, pkt.ts, &pkt.sent_at, sizeof(pkt.sent_at));
+                if (!piggyback) {
+                    clocks[m]++;
+                    g->ack_owed = 0;
+                    packets += tom_net_multicast(&net, now, m, TOM_ACK, clocks[m], 0);
+                } else if (!ack_waiting[m]) {
+                    ack_waiting[m] = 1;
+                    tom_net_timer(&net, now + BENCH_TOM_ACK_DELAY, m, TOM_ACK);
+                }
+            } else {
+                tom_heard(g, pkt.from, pkt.ts);
+            }
+        }
+        while (tom_next(g, &d) && deliveries < total) {
+            memcpy(&sent_at, d.payload, sizeof(sent_at));
+            latencies[deliveries++] = now - sent_at;
+            order_hash[m] = order_hash[m] * 1000003 + d.ts * 131 + d.sender;
+        }
+    }
+    ending = now_ns();
+
+    qsort(latencies, deliveries, sizeof(long), cmp_long);
+    res->msgs_per_bcast = (double)packets / ((double)senders * per_sender);
+    res->latency_p50 = deliveries ? (double)latencies[deliveries / 2] / BENCH_TOM_HOP : 0;
+    res->latency_p99 = deliveries ? (double)latencies[(deliveries * 99) / 100] / BENCH_TOM_HOP : 0;
+    res->deliveries_per_s = (double)deliveries / ((double)(ending - beginning) / 1e9);
+    res->same_order = (deliveries == total);
+    for (i = 1; i < n; i++) {
+        if (order_hash[i] != order_hash[0]) {
+            res->same_order = 0;
+        }
+    }
+
+    free(members);
+    free(clocks);
+    free(order_hash);
+    free(sent);
+    free(ack_waiting);
+    free(latencies);
+    free(net.pkts);
+    free(net.link_last);
+}
+
+//-- tomcast delivery latency, throughput and message count for 3 to 64 members
+void bench_tomcast() {
+    int sizes[] = {3, 4, 8, 16, 32, 64};
+    struct tom_run with, without;
+    int i, all;
+
+    printf("# tomcast: %i broadcasts per group (in-process engines, simulated network: a hop is"
+           " %i ticks + 0..%i of jitter,\n#   a member broadcasts every %i ticks, with piggyback"
+           " an ack waits %i for data), latency in hops\n", BENCH_TOM_MSGS, BENCH_TOM_HOP,
+           BENCH_TOM_JITTER - 1, BENCH_TOM_GAP, BENCH_TOM_ACK_DELAY);
+    for (all = 1; all >= 0; all--) {
+        printf("%s\n", all ? "## every member broadcasts" : "## a single member broadcasts");
+        printf("%8s %11s %13s %8s %8s %12s %12s %14s %6s\n", "members", "msgs/bcast", "(no piggyb.)",
+               "p50", "p99", "p50 (no pb.)", "p99 (no pb.)", "deliveries/s", "order");
+        for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+            run_tomcast(sizes[i], all ? sizes[i] : 1, 1, &with);
+            run_tomcast(sizes[i], all ? sizes[i] : 1, 0, &without);
+            printf("%8i %11.1f %13.1f %8.2f %8.2f %12.2f %12.2f %14.0f %6s\n", sizes[i],
+                   with.msgs_per_bcast, without.msgs_per_bcast, with.latency_p50, with.latency_p99,
+                   without.latency_p50, without.latency_p99, with.deliveries_per_s,
+                   (with.same_order && without.same_order) ? "ok" : "BAD");
+        }
+    }
+}
+
+//-- (sim handler) the P1 / P2 / P3 shutdown of the real processes, as nodes 1, 2, 3
+void sim_shutdown_node(int node, int from, const struct message *msg) {
+    static int readys = 0;
+
+    if (node == 2 && msg->action == READY_TO_SHUTDOWN && ++readys == 2) {
+        readys = 0;
+        sim_send(2, 1, SHUTDOWN_NOW, NULL, 0);
+    } else if (node == 2 && msg->action == SHUTDOWN_ACK && from == 1) {
+        sim_send(2, 3, SHUTDOWN_NOW, NULL, 0);
+    } else if (msg->action == SHUTDOWN_NOW) {
+        sim_send(node, 2, SHUTDOWN_ACK, NULL, 0);
+    }
+}
+
+//-- (sim handler) passes the token to a random node until the run is over
+void sim_token_node(int node, int from, const struct message *msg) {
+    sim_send(node, (int)(sim_random() % BENCH_SIM_NODES), TOM_DATA, msg->payload, msg->payload_len);
+}
+
+//-- runs the token scenario with seed, returns its stats and the seconds it took
+double run_sim_tokens(uint64_t seed, int fifo, struct sim_stats *stats) {
+    struct sim_config config = {seed, SIM_DELAY_UNIFORM, 100, 80, fifo, 0.001};
+    double beginning, ending;
+    int node, token;
+
+    sim_init(&config, BENCH_SIM_NODES, sim_token_node);
+    beginning = now_ns();
+    for (node = 0; node < BENCH_SIM_NODES; node++) {
+        for (token = 0; token < BENCH_SIM_TOKENS; token++) {
+            sim_send(node, (int)(sim_random() % BENCH_SIM_NODES), TOM_DATA, &token, sizeof(token));
+        }
+    }
+    sim_run(BENCH_SIM_MSGS);
+    ending = now_ns();
+    sim_get_stats(stats);
+    return (ending - beginning) / 1e9;
+}
+
+void bench_sim(uint64_t seed) {
+    struct sim_config config = {seed, SIM_DELAY_EXP, 200, 0, 1, 0};
+    struct sim_stats first, again, other;
+    double secs;
+    int fifo;
+
+    printf("# sim: seed %llu\n", (unsigned long long)seed);
+
+    // the three real processes, now nodes of one simulation
+    sim_init(&config, 4, sim_shutdown_node);
+    sim_send(1, 2, READY_TO_SHUTDOWN, NULL, 0);
+    sim_send(3, 2, READY_TO_SHUTDOWN, NULL, 0);
+    sim_run(0);
+    sim_get_stats(&first);
+    printf("## P1/P2/P3 shutdown: %li messages, P2 ends at t(lamport) = %i (%s), %.0f us virtual\n",
+           first.delivered, sim_clock(2), (sim_clock(2) == 11) ? "ok" : "BAD",
+           (double)first.now_us);
+
+    printf("## %i nodes, %i deliveries, uniform 100+-80 us, 0.1%% drops\n",
+           BENCH_SIM_NODES, BENCH_SIM_MSGS);
+    printf("%6s %8s %12s %10s %10s %12s %14s %18s %7s\n", "links", "seconds", "deliveries/s",
+           "dropped", "reordered", "in flight", "virtual us", "fingerprint", "replay");
+    for (fifo = 0; fifo <= 1; fifo++) {
+        secs = run_sim_tokens(seed, fifo, &first);
+        run_sim_tokens(seed, fifo, &again);
+        run_sim_tokens(seed + 1, fifo, &other);
+        printf("%6s %8.2f %12.0f %10li %10li %12li %14llu %18llx %7s\n", fifo ? "fifo" : "any",
+               secs, first.delivered / secs, first.dropped, first.reordered, first.max_in_flight,
+               (unsigned long long)first.now_us, (unsigned long long)first.fingerprint,
+               (first.fingerprint == again.fingerprint &&
+                first.fingerprint != other.fingerprint) ? "ok" : "BAD");
+    }
+    sim_free();
+}
+
+// simulated shutdown: node 0 coordinates clients 1..shut_clients
+int shut_clients, shut_parallel, shut_readys, shut_acks;
+uint64_t shut_started_us, shut_done_us;
+
+//-- (sim handler) the coordinator (node 0) and its clients, sequential or parallel
+void sim_shutdown_coord(int node, int from, const struct message *msg) {
+    int i;
+
+    if (node != 0) {
+        sim_send(node, 0, SHUTDOWN_ACK, NULL, 0);   // clients only get SHUTDOWN_NOW
+        return;
+    }
+    if (msg->action == READY_TO_SHUTDOWN && ++shut_readys == shut_clients) {
+        shut_started_us = sim_now();
+        for (i = 1; i <= (shut_parallel ? shut_clients : 1); i++) {
+            sim_send(0, i, SHUTDOWN_NOW, NULL, 0);
+        }
+    } else if (msg->action == SHUTDOWN_ACK) {
+        if (++shut_acks == shut_clients) {
+            shut_done_us = sim_now();
+        } else if (!shut_parallel) {
+            sim_send(0, from + 1, SHUTDOWN_NOW, NULL, 0);  // the P2.c way: one by one
+        }
+    }
+}
+
+//-- returns the virtual us from the last READY_TO_SHUTDOWN to the last SHUTDOWN_ACK
+double run_sim_shutdown(int clients, int parallel, uint64_t seed) {
+    struct sim_config config = {seed, SIM_DELAY_EXP, BENCH_SHUT_DELAY_US, 0, 1, 0};
+    int i;
+
+    shut_clients = clients;
+    shut_parallel = parallel;
+    shut_readys = shut_acks = 0;
+    sim_init(&config, clients + 1, sim_shutdown_coord);
+    for (i = 1; i <= clients; i++) {
+        sim_send(i, 0, READY_TO_SHUTDOWN, NULL, 0);
+    }
+    sim_run(0);
+    return (double)(shut_done_us - shut_started_us);
+}
+
+void bench_shutdown() {
+    int sizes[] = {2, 8, 64, 256, 1000};
+    double sequential, parallel;
+    int i;
+
+    printf("# shutdown: READY -> last ACK, simulated, exponential delay (mean %i us)\n",
+           BENCH_SHUT_DELAY_US);
+    printf("%8s %16s %16s %12s\n", "clients", "one by one (us)", "parallel (us)", "round trips");
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        sequential = run_sim_shutdown(sizes[i], 0, 1);
+        parallel = run_sim_shutdown(sizes[i], 1, 1);
+        printf("%8i %16.0f %16.0f %12.2f\n", sizes[i], sequential, parallel,
+               parallel / (2.0 * BENCH_SHUT_DELAY_US));
+    }
+    sim_free();
+}
+
+//-- writes all len bytes through the ring of link, or the socket fd without one
+int xport_write(int fd, struct shm_link *link, const void *buf, size_t len) {
+    struct iovec iov = {(void *)buf, len};
+    ssize_t n;
+
+    if (link != NULL) {
+        return (shm_writev(link, &iov, 1) == (ssize_t)len) ? F_SUCCESS : F_FAILURE;
+    }
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            return F_FAILURE;
+        }
+        buf = (const char *)buf + n;
+        len -= n;
+    }
+    return F_SUCCESS;
+}
+
+//-- reads exactly len bytes through the ring of link, or the socket fd without one
+int xport_read(int fd, struct shm_link *link, void *buf, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = (link != NULL) ? shm_read(link, buf, len) : recv(fd, buf, len, 0);
+        if (n <= 0) {
+            return F_FAILURE;
+        }
+        buf = (char *)buf + n;
+        len -= n;
+    }
+    return F_SUCCESS;
+}
+
+//-- (child process) echoes the pings, then swallows the stream and acks it
+void xport_echo(int listen_fd, int kind) {
+    unsigned char buf[BENCH_STREAM_FRAME * BENCH_STREAM_BATCH];
+    long i, left = (long)BENCH_STREAM_MSGS * BENCH_STREAM_FRAME;
+    struct shm_link *link = NULL;
+    int conn_fd = accept(listen_fd, NULL, NULL);
+    ssize_t n;
+
+    if (kind == 2 && shm_accept(conn_fd) == F_SUCCESS) {
+        link = shm_link_of(conn_fd);
+    }
+    for (i = 0; i < BENCH_PINGS; i++) {
+        if (xport_read(conn_fd, link, buf, BENCH_STREAM_FRAME) == F_FAILURE ||
+            xport_write(conn_fd, link, buf, BENCH_STREAM_FRAME) == F_FAILURE) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    while (left > 0) {
+        n = (link != NULL) ? shm_read(link, buf, sizeof(buf)) : recv(conn_fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            exit(EXIT_FAILURE);
+        }
+        left -= n;
+    }
+    xport_write(conn_fd, link, buf, 1);
+    shm_detach(conn_fd);
+    close(conn_fd);
+    exit(EXIT_SUCCESS);
+}
+
+//-- measures round trips and one-way streaming over one transport
+//   (kind: 0 loopback TCP, 1 AF_UNIX, 2 shared-memory ring)
+void run_transport(int kind) {
+    const char *names[] = {"tcp", "unix", "shm"};
+    unsigned char buf[BENCH_STREAM_FRAME * BENCH_STREAM_BATCH];
+    struct sockaddr_storage addr;
+    struct sockaddr_in *inaddr = (struct sockaddr_in *)&addr;
+    struct sockaddr_un *unaddr = (struct sockaddr_un *)&addr;
+    struct shm_link *link = NULL;
+    long *rtts = malloc(BENCH_PINGS * sizeof(long));
+    long i, beginning, ending;
+    int listen_fd, fd, one = 1;
+    socklen_t addr_len;
+    pid_t child;
+
+    memset(&addr, 0, sizeof(addr));
+    memset(buf, 7, sizeof(buf));
+    if (kind == 0) {
+        inaddr->sin_family = AF_INET;
+        inaddr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        inaddr->sin_port = htons(BENCH_XPORT_PORT);
+        addr_len = sizeof(*inaddr);
+    } else {
+        unaddr->sun_family = AF_UNIX;
+        snprintf(unaddr->sun_path, sizeof(unaddr->sun_path), "/tmp/sdc-%i.sock", BENCH_XPORT_PORT);
+        unlink(unaddr->sun_path);
+        addr_len = sizeof(*unaddr);
+    }
+
+    listen_fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listen_fd, (struct sockaddr *)&addr, addr_len) < 0 || listen(listen_fd, 1) < 0) {
+        perror("bench bind failed");
+        exit(EXIT_FAILURE);
+    }
+    fflush(stdout);     // or the child prints it again
+    child = fork();
+    if (child == 0) {
+        xport_echo(listen_fd, kind);
+    }
+
+    fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&addr, addr_len) < 0 ||
+        (kind == 2 && shm_connect(fd) == F_FAILURE)) {
+        perror("bench connect failed");
+        exit(EXIT_FAILURE);
+    }
+    link = shm_link_of(fd);
+
+    for (i = 0; i < BENCH_PINGS; i++) {
+        beginning = now_ns();
+        xport_write(fd, link, buf, BENCH_STREAM_FRAME);
+        xport_read(fd, link, buf, BENCH_STREAM_FRAME);
+        rtts[i] = now_ns() - beginning;
+    }
+    qsort(rtts, BENCH_PINGS, sizeof(long), cmp_long);
+
+    beginning = now_ns();
+    for (i = 0; i < BENCH_STREAM_MSGS; i += BENCH_STREAM_BATCH) {
+        xport_write(fd, link, buf, sizeof(buf));
+    }
+    xport_read(fd, link, buf, 1);  // the child got every byte
+    ending = now_ns();
+
+    printf("%6s %12.2f %12.2f %14.0f %10.1f\n", names[kind],
+           rtts[BENCH_PINGS / 2] / 1e3, rtts[(BENCH_PINGS * 99) / 100] / 1e3,
+           BENCH_STREAM_MSGS / ((ending - beginning) / 1e9),
+           (double)BENCH_STREAM_MSGS * BENCH_STREAM_FRAME / ((ending - beginning) / 1e3));
+
+    waitpid(child, NULL, 0);
+    shm_detach(fd);
+    close(fd);
+    close(listen_fd);
+    if (kind != 0) {
+        unlink(unaddr->sun_path);
+    }
+    free(rtts);
+}
+
+void bench_transport() {
+    int kind;
+
+    printf("# transport: %i round trips of %i bytes, %i frames of %i bytes streamed (%i per write)\n",
+           BENCH_PINGS, BENCH_STREAM_FRAME, BENCH_STREAM_MSGS, BENCH_STREAM_FRAME, BENCH_STREAM_BATCH);
+    printf("%6s %12s %12s %14s %10s\n", "", "rtt p50 us", "rtt p99 us", "frames/s", "MB/s");
+    for (kind = 0; kind <= 2; kind++) {
+        run_transport(kind);
+    }
+}
+
+// mesh bench: the answers P1 got and the stop of the other nodes (mesh_mutex)
+int mesh_pongs = 0, mesh_stop = 0;
+pthread_mutex_t mesh_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t mesh_cond = PTHREAD_COND_INITIALIZER;
+
+//-- (mesh handler) P3 answers, P2 relays, P1 counts the answers
+void mesh_on_data(int peer_id, const struct message *msg) {
+    struct mesh_ping ping;
+    char to_name[20];
+    int to_id;
+
+    memcpy(&ping, msg->payload, sizeof(ping));
+    snprintf(to_name, sizeof(to_name), "P%i", ping.to);
+    if (strcmp(stub_whoami, to_name) != 0) {
+        to_id = peer_lookup(to_name);      // the relay: one more hop
+        multicast_msg(&to_id, 1, TOM_DATA, &ping, sizeof(ping));
+    } else if (ping.to == 3 && ping.echo) {
+        ping.to = 1;
+        to_id = peer_lookup(ping.relayed ? "P2" : "P1");
+        multicast_msg(&to_id, 1, TOM_DATA, &ping, sizeof(ping));
+    } else if (ping.to == 1) {
+        pthread_mutex_lock(&mesh_mutex);
+        mesh_pongs++;
+        pthread_cond_signal(&mesh_cond);
+        pthread_mutex_unlock(&mesh_mutex);
+    }
+}
+
+//-- (mesh handler) P1 is done: P2 and P3 may terminate
+void mesh_on_stop(int peer_id, const struct message *msg) {
+    pthread_mutex_lock(&mesh_mutex);
+    mesh_stop = 1;
+    pthread_cond_signal(&mesh_cond);
+    pthread_mutex_unlock(&mesh_mutex);
+}
+
+//-- writes a peer list with names[0..n-1] at AF_UNIX base_port + 1...
+void write_peer_list(const char *path, char *names[], int n, int base_port) {
+    FILE *file = fopen(path, "w");
+    int i;
+
+    if (file == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n; i++) {
+        fprintf(file, "%s unix %i\n", names[i], base_port + i + 1);
+    }
+    fclose(file);
+}
+
+//-- (P1) sends ping to P3 (through P2 if relayed) and waits for the answer
+void mesh_ping_pong(struct mesh_ping *ping) {
+    int first = peer_lookup(ping->relayed ? "P2" : "P3"), pongs;
+
+    pthread_mutex_lock(&mesh_mutex);
+    pongs = mesh_pongs;
+    pthread_mutex_unlock(&mesh_mutex);
+
+    multicast_msg(&first, 1, TOM_DATA, ping, sizeof(*ping));
+
+    pthread_mutex_lock(&mesh_mutex);
+    while (mesh_pongs == pongs) {
+        pthread_cond_wait(&mesh_cond, &mesh_mutex);
+    }
+    pthread_mutex_unlock(&mesh_mutex);
+}
+
+//-- (P1) round trips and a one-way stream to P3, prints one row
+void run_mesh_route(int relayed) {
+    struct mesh_ping ping = {3, relayed, 1};
+    long *rtts = malloc(BENCH_MESH_PINGS * sizeof(long));
+    long i, beginning, ending;
+    int first = peer_lookup(relayed ? "P2" : "P3");
+
+    for (i = 0; i < BENCH_MESH_PINGS; i++) {
+        beginning = now_ns();
+        mesh_ping_pong(&ping);
+        rtts[i] = now_ns() - beginning;
+    }
+    qsort(rtts, BENCH_MESH_PINGS, sizeof(long), cmp_long);
+
+    // only the last message of the stream is answered: P3 got all of them
+    ping.echo = 0;
+    beginning = now_ns();
+    for (i = 0; i < BENCH_MESH_MSGS - 1; i++) {
+        multicast_msg(&first, 1, TOM_DATA, &ping, sizeof(ping));
+    }
+    ping.echo = 1;
+    mesh_ping_pong(&ping);
+    ending = now_ns();
+
+    unmute_stdout();
+    printf("%8s %6i %12.2f %12.2f %12.0f\n", relayed ? "via P2" : "direct", relayed ? 2 : 1,
+           rtts[BENCH_MESH_PINGS / 2] / 1e3, rtts[(BENCH_MESH_PINGS * 99) / 100] / 1e3,
+           BENCH_MESH_MSGS / ((ending - beginning) / 1e9));
+    mute_stdout();
+    free(rtts);
+}
+
+//-- (child process) one node of the mesh bench, P1 measures
+void mesh_node(char *whoami, char *peer_list) {
+    char *args[] = {"bench", "mesh", peer_list, NULL};
+    int others[2];
+
+    mute_stdout();
+    set_print_trace(0);
+    set_batch_window(0);    // a round trip must not wait for company
+    set_msg_handler(TOM_DATA, mesh_on_data);
+    set_msg_handler(SHUTDOWN_NOW, mesh_on_stop);
+    start_up_server(3, args, whoami);
+
+    if (strcmp(whoami, "P1") == 0) {
+        run_mesh_route(0);
+        run_mesh_route(1);
+        others[0] = peer_lookup("P2");
+        others[1] = peer_lookup("P3");
+        multicast_msg(others, 2, SHUTDOWN_NOW, NULL, 0);
+    } else {
+        pthread_mutex_lock(&mesh_mutex);
+        while (!mesh_stop) {
+            pthread_cond_wait(&mesh_cond, &mesh_mutex);
+        }
+        pthread_mutex_unlock(&mesh_mutex);
+    }
+    terminate_server(EXIT_SUCCESS);
+}
+
+void bench_mesh() {
+    char *names[] = {"P1", "P2", "P3"}, peer_list[] = "/tmp/sdc-bench-mesh.txt";
+    pid_t children[3];
+    int i;
+
+    write_peer_list(peer_list, names, 3, BENCH_MESH_PORT);
+
+    printf("# mesh: P1 -> P3 over AF_UNIX, %i round trips, %i messages streamed per route\n",
+           BENCH_MESH_PINGS, BENCH_MESH_MSGS);
+    printf("%8s %6s %12s %12s %12s\n", "route", "hops", "rtt p50 us", "rtt p99 us", "msgs/s");
+    fflush(stdout);     // or every child prints it again
+    for (i = 0; i < 3; i++) {
+        children[i] = fork();
+        if (children[i] == 0) {
+            mesh_node(names[i], peer_list);
+        }
+    }
+    for (i = 0; i < 3; i++) {
+        waitpid(children[i], NULL, 0);
+    }
+    unlink(peer_list);
+}
+
+// snapshot bench: the balance of this node, changed and sent with bank_lock held
+long bank_balance = BENCH_SNAP_BALANCE;
+pthread_mutex_t bank_lock = PTHREAD_MUTEX_INITIALIZER;
+struct snap_bench *snap_shared = NULL;
+int snap_node_idx = 0;
+atomic_int bank_done = 0;
+
+//-- (snapshot handler, bank_lock held) a transfer arrives
+void bank_on_transfer(int peer_id, const struct message *msg) {
+    struct bank_transfer transfer;
+    int during = snap_active();
+
+    memcpy(&transfer, msg->payload, sizeof(transfer));
+    bank_balance += transfer.amount;
+    snap_shared->latencies[snap_node_idx][during][snap_shared->n_latencies[snap_node_idx][during]++] =
+        monotonic_ns() - transfer.sent_ns;
+}
+
+//-- (snapshot state, bank_lock held) the local state is the balance
+unsigned int bank_state(void *buf, unsigned int max) {
+    memcpy(buf, &bank_balance, sizeof(bank_balance));
+    return sizeof(bank_balance);
+}
+
+//-- (thread of every node) starts a snapshot every BENCH_SNAP_EVERY_MS while money
+//   moves: the three initiators' snapshots overlap
+void *bank_snapshots() {
+    int *n_snaps = &snap_shared->n_snaps[snap_node_idx];
+    long beginning;
+    int snap_id, overlapped;
+
+    while (!atomic_load(&bank_done) && *n_snaps < BENCH_SNAP_MAX) {
+        usleep(BENCH_SNAP_EVERY_MS * 1000);
+        pthread_mutex_lock(&bank_lock);
+        overlapped = snap_active();
+        pthread_mutex_unlock(&bank_lock);
+        beginning = now_ns();
+        snap_id = snap_take();
+        if (snap_id == F_FAILURE || snap_wait(snap_id, 2000) == F_FAILURE) {
+            snap_shared->n_lost[snap_node_idx]++;
+            continue;
+        }
+        snap_shared->snap_ns[snap_node_idx * BENCH_SNAP_MAX + *n_snaps] = now_ns() - beginning;
+        snap_shared->snap_ids[snap_node_idx][(*n_snaps)++] = snap_id;
+        snap_shared->n_overlapped[snap_node_idx] += overlapped;
+    }
+    return NULL;
+}
+
+//-- (child process) one node of the snapshot bench: moves money to the others
+void bank_node(char *names[], int idx, char *peer_list) {
+    char *args[] = {"bench", "mesh", peer_list, NULL};
+    struct bank_transfer transfer;
+    pthread_t snapshots;
+    int i, others[2];
+
+    mute_stdout();
+    set_print_trace(0);
+    set_batch_window(0);
+    snap_node_idx = idx;
+    set_msg_handler(TOM_DATA, bank_on_transfer);
+    stub_whoami = names[idx];   // snap_start() before the connections: no transfer skips it
+    if (snap_start(names, 3, &bank_lock, bank_state, BENCH_SNAP_DIR) == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+    start_up_server(3, args, names[idx]);
+    others[0] = peer_lookup(names[(idx + 1) % 3]);
+    others[1] = peer_lookup(names[(idx + 2) % 3]);
+
+    pthread_create(&snapshots, NULL, bank_snapshots, NULL);
+    srand(idx + 1);
+    for (i = 0; i < BENCH_SNAP_TRANSFERS; i++) {
+        transfer.amount = 1 + rand() % 100;
+        pthread_mutex_lock(&bank_lock);
+        bank_balance -= transfer.amount;
+        transfer.sent_ns = monotonic_ns();
+        multicast_msg(&others[rand() % 2], 1, TOM_DATA, &transfer, sizeof(transfer));
+        pthread_mutex_unlock(&bank_lock);
+        usleep(BENCH_SNAP_PACE_US);
+    }
+    atomic_store(&bank_done, 1);
+    pthread_join(snapshots, NULL);
+    // the others may still take one: its markers need this node connected
+    atomic_fetch_sub(&snap_shared->snapping, 1);
+    while (atomic_load(&snap_shared->snapping) > 0) {
+        usleep(1000);
+    }
+
+    // every transfer (and marker) is in before the two-phase shutdown (FIFO channels)
+    if (idx == 1) {
+        shutdown_coordinate(names[idx], SHUTDOWN_TIMEOUT_MS);
+    } else {
+        shutdown_participate(names[idx], names[1]);
+    }
+    pthread_mutex_lock(&bank_lock);
+    snap_shared->final_balance[idx] = bank_balance;
+    pthread_mutex_unlock(&bank_lock);
+    terminate_server(EXIT_SUCCESS);
+}
+
+//-- adds up the states and the transfers in flight of snapshot snap_id,
+//   returns the money it holds or F_FAILURE if a file is missing
+long snap_money(char *names[], uint32_t snap_id, long *in_flight, long *bytes) {
+    struct snap_file file;
+    struct bank_transfer transfer;
+    struct message msg;
+    char path[128];
+    long money = 0, balance;
+    uint32_t offset;
+    int i, c;
+    struct stat info;
+
+    for (i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s/snap-%08x-%s.bin", BENCH_SNAP_DIR, snap_id, names[i]);
+        if (snap_load(path, &file) == F_FAILURE) {
+            return F_FAILURE;
+        }
+        if (stat(path, &info) == 0) {
+            *bytes += info.st_size;
+        }
+        memcpy(&balance, file.state, sizeof(balance));
+        money += balance;
+        for (c = 0; c < file.header.n_channels; c++) {
+            offset = 0;
+            while (snap_next_msg(&file.channels[c], &offset, &msg) == 1) {
+                memcpy(&transfer, msg.payload, sizeof(transfer));
+                money += transfer.amount;
+                (*in_flight)++;
+            }
+        }
+        snap_file_free(&file);
+        unlink(path);
+    }
+    return money;
+}
+
+//-- prints p50 / p99 of the n latencies (ns) in us
+void print_latencies(const char *label, long *latencies, long n) {
+    qsort(latencies, n, sizeof(long), cmp_long);
+    printf("%18s %10li %12.2f %12.2f\n", label, n, n ? latencies[n / 2] / 1e3 : 0,
+           n ? latencies[(n * 99) / 100] / 1e3 : 0);
+}
+
+void bench_snapshot() {
+    char *names[] = {"P1", "P2", "P3"}, peer_list[] = "/tmp/sdc-bench-snap.txt";
+    struct snap_bench *shared;
+    long total = 3 * BENCH_SNAP_BALANCE, money, in_flight = 0, bytes = 0, n, final = 0;
+    int i, consistent = 0, missing = 0, node, n_snaps = 0, overlapped = 0, lost = 0;
+    pid_t children[3];
+
+    shared = mmap(NULL, sizeof(struct snap_bench), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap failed");
+        exit(EXIT_FAILURE);
+    }
+    snap_shared = shared;
+    atomic_store(&shared->snapping, 3);
+    mkdir(BENCH_SNAP_DIR, 0755);
+    write_peer_list(peer_list, names, 3, BENCH_SNAP_PORT);
+
+    printf("# snapshot: 3 nodes, %i transfers each (one per %i us), each starts a snapshot every %i ms\n",
+           BENCH_SNAP_TRANSFERS, BENCH_SNAP_PACE_US, BENCH_SNAP_EVERY_MS);
+    fflush(stdout);     // or every child prints it again
+    for (i = 0; i < 3; i++) {
+        children[i] = fork();
+        if (children[i] == 0) {
+            bank_node(names, i, peer_list);
+        }
+    }
+    for (i = 0; i < 3; i++) {
+        waitpid(children[i], NULL, 0);
+        final += shared->final_balance[i];
+    }
+    unlink(peer_list);
+
+    // Chandy-Lamport: the states plus the messages in flight hold all the money
+    for (node = 0; node < 3; node++) {
+        for (i = 0; i < shared->n_snaps[node]; i++) {
+            money = snap_money(names, shared->snap_ids[node][i], &in_flight, &bytes);
+            if (money == F_FAILURE) {
+                missing++;
+            } else if (money == total) {
+                consistent++;
+            }
+        }
+        // (the times of all the initiators side by side, for the percentiles)
+        memmove(&shared->snap_ns[n_snaps], &shared->snap_ns[node * BENCH_SNAP_MAX],
+                shared->n_snaps[node] * sizeof(long));
+        n_snaps += shared->n_snaps[node];
+        overlapped += shared->n_overlapped[node];
+        lost += shared->n_lost[node];
+    }
+    rmdir(BENCH_SNAP_DIR);
+
+    printf("snapshots: %i taken (P1 %i, P2 %i, P3 %i; %i started during another), %i consistent, "
+           "%i incomplete, %i never finished; money at the end: %s\n", n_snaps, shared->n_snaps[0],
+           shared->n_snaps[1], shared->n_snaps[2], overlapped, consistent, missing, lost,
+           (final == total) ? "ok" : "BAD");
+    if (n_snaps > 0) {
+        qsort(shared->snap_ns, n_snaps, sizeof(long), cmp_long);
+        printf("per snapshot: %.1f transfers in flight, %.0f bytes of files, "
+               "take -> file p50 %.0f us, p99 %.0f us\n",
+               (double)in_flight / n_snaps, (double)bytes / n_snaps,
+               shared->snap_ns[n_snaps / 2] / 1e3, shared->snap_ns[(n_snaps * 99) / 100] / 1e3);
+    }
+
+    printf("%18s %10s %12s %12s\n", "transfer latency", "count", "p50 us", "p99 us");
+    for (i = 0; i <= 1; i++) {
+        n = 0;
+        for (node = 0; node < 3; node++) {
+            memmove(&shared->latencies[0][i][n], shared->latencies[node][i],
+                    shared->n_latencies[node][i] * sizeof(long));
+            n += shared->n_latencies[node][i];
+        }
+        print_latencies(i ? "during snapshot" : "no snapshot", shared->latencies[0][i], n);
+    }
+    munmap(shared, sizeof(struct snap_bench));
+}
+
+//-- (child process) one node of the lock bench: entries critical sections, with
+//   think_us between them
+void dmx_node(char *names[], int n, int idx, char *peer_list, enum dmx_algorithms algorithm,
+              int entries, long think_us, struct dmx_bench *shared) {
+    char *args[] = {"bench", "mesh", peer_list, NULL};
+    int i;
+
+    mute_stdout();
+    set_print_trace(0);
+    set_batch_window(0);
+    stub_whoami = names[idx];   // handlers before the connections: no request is lost
+    if (dmx_start(names, n, algorithm) == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+    start_up_server(3, args, names[idx]);
+
+    // nobody starts before the others can ask for the lock too
+    atomic_fetch_add(&shared->ready, 1);
+    while (atomic_load(&shared->ready) < n) {
+        usleep(100);
+    }
+
+    shared->start_ns[idx] = now_ns();
+    for (i = 0; i < entries; i++) {
+        dmx_lock();
+        if (atomic_exchange(&shared->occupant, 1) != 0) {
+            atomic_fetch_add(&shared->violations, 1);
+        }
+        shared->run = (shared->last_occupant == idx) ? shared->run + 1 : 1;
+        shared->last_occupant = idx;
+        if (shared->run > shared->max_run && atomic_load(&shared->done) == 0) {
+            shared->max_run = shared->run;
+        }
+        atomic_store(&shared->occupant, 0);
+        dmx_unlock();
+        if (think_us > 0) {
+            usleep(think_us);
+        } else {
+            sched_yield();  // back to back, but the other nodes get a CPU to ask on
+        }
+    }
+    shared->end_ns[idx] = now_ns();
+    dmx_get_stats(&shared->acquired[idx], &shared->msgs[idx]);
+
+    // the others may still need our replies or the token: the shutdown waits until no
+    // DMX message is due any more, or it would be sent to a peer already gone
+    atomic_fetch_add(&shared->done, 1);
+    while (atomic_load(&shared->done) < n) {
+        usleep(100);
+    }
+    if (idx == 1) {
+        shutdown_coordinate(names[idx], SHUTDOWN_TIMEOUT_MS);
+    } else {
+        shutdown_participate(names[idx], names[1]);
+    }
+    terminate_server(EXIT_SUCCESS);
+}
+
+//-- runs n nodes of the lock bench and prints one row
+void run_dmx(enum dmx_algorithms algorithm, int n, int calm, struct dmx_bench *shared) {
+    char *names[] = {"P1", "P2", "P3", "P4", "P5"}, peer_list[] = "/tmp/sdc-bench-dmx.txt";
+    long first_ns = 0, last_ns = 0, acquired = 0, msgs = 0;
+    pid_t children[BENCH_DMX_MAX_NODES];
+    int i;
+
+    memset(shared, 0, sizeof(*shared));
+    shared->last_occupant = -1;
+    write_peer_list(peer_list, names, n, BENCH_DMX_PORT);
+    fflush(stdout);     // or every child prints it again
+    for (i = 0; i < n; i++) {
+        children[i] = fork();
+        if (children[i] == 0) {
+            dmx_node(names, n, i, peer_list, algorithm, calm ? BENCH_DMX_CALM : BENCH_DMX_ENTRIES,
+                     calm ? BENCH_DMX_THINK_US : 0, shared);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        waitpid(children[i], NULL, 0);
+        if (i == 0 || shared->start_ns[i] < first_ns) {
+            first_ns = shared->start_ns[i];
+        }
+        if (shared->end_ns[i] > last_ns) {
+            last_ns = shared->end_ns[i];
+        }
+        acquired += shared->acquired[i];
+        msgs += shared->msgs[i];
+    }
+    unlink(peer_list);
+
+    printf("%18s %6i %11s %12.0f %12.2f %11li %9li\n",
+           (algorithm == DMX_SUZUKI_KASAMI) ? "token" : "ricart-agrawala", n, calm ? "low" : "high",
+           acquired / ((last_ns - first_ns) / 1e9), acquired ? (double)msgs / acquired : 0,
+           atomic_load(&shared->violations), shared->max_run);
+}
+
+void bench_dmutex() {
+    int sizes[] = {3, 5}, i, calm;
+    struct dmx_bench *shared = mmap(NULL, sizeof(struct dmx_bench), PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (shared == MAP_FAILED) {
+        perror("mmap failed");
+        exit(EXIT_FAILURE);
+    }
+    printf("# dmutex: %i entries per node back to back (high), %i with %i us between (low)\n",
+           BENCH_DMX_ENTRIES, BENCH_DMX_CALM, BENCH_DMX_THINK_US);
+    printf("# max run: most entries in a row by one node (1 is a perfect interleaving)\n");
+    printf("%18s %6s %11s %12s %12s %11s %9s\n", "algorithm", "nodes", "contention",
+           "entries/s", "msgs/entry", "violations", "max run");
+    for (calm = 0; calm <= 1; calm++) {
+        for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+            run_dmx(DMX_RICART_AGRAWALA, sizes[i], calm, shared);
+            run_dmx(DMX_SUZUKI_KASAMI, sizes[i], calm, shared);
+        }
+    }
+    munmap(shared, sizeof(struct dmx_bench));
+}
+
+int flow_acks = 0;          // (flow bench, P1) TOM_ACK's received
+pthread_mutex_t flow_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t flow_cond = PTHREAD_COND_INITIALIZER;
+
+//-- (flow bench handler) P2 works on a chunk, the last one is answered
+void flow_on_chunk(int peer_id, const struct message *msg) {
+    struct flow_chunk chunk;
+    long until;
+
+    memcpy(&chunk, msg->payload, sizeof(chunk));
+    until = now_ns() + chunk.work_ns;
+    while (now_ns() < until) {
+        ;   // a slow consumer
+    }
+    if (chunk.last) {
+        multicast_msg(&peer_id, 1, TOM_ACK, NULL, 0);
+        flush_all_msgs();
+    }
+}
+
+//-- (flow bench handler) P1: P2 got a whole row
+void flow_on_ack(int peer_id, const struct message *msg) {
+    pthread_mutex_lock(&flow_mutex);
+    flow_acks++;
+    pthread_cond_signal(&flow_cond);
+    pthread_mutex_unlock(&flow_mutex);
+}
+
+//-- (P1) sends BENCH_FLOW_MSGS chunks to P2 with send_msg() semantics or
+//   try_send_msg() (retrying what is refused), prints one row
+void run_flow_row(int use_try, long work_ns) {
+    struct flow_stats before, after;
+    struct flow_chunk chunk = {work_ns, 0};
+    long i, beginning, sent, ending;
+    int p2 = peer_lookup("P2"), acks;
+
+    pthread_mutex_lock(&flow_mutex);
+    acks = flow_acks;
+    pthread_mutex_unlock(&flow_mutex);
+    reset_flow_max_queued(p2);  // the max queued of this row only
+    get_flow_stats(p2, &before);
+
+    beginning = now_ns();
+    for (i = 0; i < BENCH_FLOW_MSGS; i++) {
+        chunk.last = (i == BENCH_FLOW_MSGS - 1);
+        if (!use_try) {
+            multicast_msg(&p2, 1, TOM_DATA, &chunk, sizeof(chunk));
+            continue;
+        }
+        while (try_send_msg(p2, TOM_DATA, &chunk, sizeof(chunk)) == F_WOULDBLOCK) {
+            sched_yield();  // something else to do: here, let P2 catch up
+        }
+    }
+    sent = now_ns();
+    flush_all_msgs();
+
+    pthread_mutex_lock(&flow_mutex);
+    while (flow_acks == acks) {
+        pthread_cond_wait(&flow_cond, &flow_mutex);
+    }
+    pthread_mutex_unlock(&flow_mutex);
+    ending = now_ns();
+    get_flow_stats(p2, &after);
+
+    unmute_stdout();
+    printf("%10s %9li %10.1f %12.0f %11i %8li %10.1f %10li\n", use_try ? "try_send" : "send_msg",
+           work_ns / 1000, (sent - beginning) / 1e6, BENCH_FLOW_MSGS / ((ending - beginning) / 1e9),
+           after.max_queued, after.stalls - before.stalls, (after.stall_ns - before.stall_ns) / 1e6,
+           after.would_block - before.would_block);
+    mute_stdout();
+}
+
+//-- (child process) one node of the flow bench, P1 sends and measures
+void flow_node(char *whoami, char *peer_list) {
+    char *args[] = {"bench", "mesh", peer_list, NULL};
+    int p2;
+
+    mute_stdout();
+    set_print_trace(0);
+    set_msg_handler(TOM_DATA, flow_on_chunk);
+    set_msg_handler(TOM_ACK, flow_on_ack);
+    set_msg_handler(SHUTDOWN_NOW, mesh_on_stop);
+    start_up_server(3, args, whoami);
+
+    if (strcmp(whoami, "P1") == 0) {
+        run_flow_row(0, 0);
+        run_flow_row(0, BENCH_FLOW_SLOW_US * 1000L);
+        run_flow_row(1, BENCH_FLOW_SLOW_US * 1000L);
+        p2 = peer_lookup("P2");
+        multicast_msg(&p2, 1, SHUTDOWN_NOW, NULL, 0);
+    } else {
+        pthread_mutex_lock(&mesh_mutex);
+        while (!mesh_stop) {
+            pthread_cond_wait(&mesh_cond, &mesh_mutex);
+        }
+        pthread_mutex_unlock(&mesh_mutex);
+    }
+    terminate_server(EXIT_SUCCESS);
+}
+
+void bench_flow() {
+    char *names[] = {"P1", "P2"}, peer_list[] = "/tmp/sdc-bench-flow.txt";
+    pid_t children[2];
+    int i;
+
+    printf("# flow: P1 -> P2 over AF_UNIX, %i messages per row, window of %i frames\n",
+           BENCH_FLOW_MSGS, FLOW_WINDOW);
+    printf("%10s %9s %10s %12s %11s %8s %10s %10s\n", "sender", "work us", "send ms",
+           "msgs/s", "max queued", "stalls", "stall ms", "refused");
+    write_peer_list(peer_list, names, 2, BENCH_FLOW_PORT);
+    fflush(stdout);     // or every child prints it again
+    for (i = 0; i < 2; i++) {
+        children[i] = fork();
+        if (children[i] == 0) {
+            flow_node(names[i], peer_list);
+        }
+    }
+    for (i = 0; i < 2; i++) {
+        waitpid(children[i], NULL, 0);
+    }
+    unlink(peer_list);
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc != 2 && !(argc == 3 && strcmp(argv[1], "sim") == 0)) {
+        fprintf(stderr, "usage: %s clock|pool|wire|batch|modes|tomcast|sim [seed]|shutdown|transport|mesh|snapshot|dmutex|flow\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (strcmp(argv[1], "clock") == 0) {
+        bench_clock();
+    } else if (strcmp(argv[1], "pool") == 0) {
+        bench_pool();
+    } else if (strcmp(argv[1], "wire") == 0) {
+        bench_wire();
+    } else if (strcmp(argv[1], "batch") == 0) {
+        bench_batch();
+    } else if (strcmp(argv[1], "modes") == 0) {
+        bench_clock_modes();
+    } else if (strcmp(argv[1], "tomcast") == 0) {
+        bench_tomcast();
+    } else if (strcmp(argv[1], "transport") == 0) {
+        bench_transport();
+    } else if (strcmp(argv[1], "flow") == 0) {
+        bench_flow();
+    } else if (strcmp(argv[1], "dmutex") == 0) {
+        bench_dmutex();
+    } else if (strcmp(argv[1], "snapshot") == 0) {
+        bench_snapshot();
+    } else if (strcmp(argv[1], "mesh") == 0) {
+        bench_mesh();
+    } else if (strcmp(argv[1], "shutdown") == 0) {
+        bench_shutdown();
+    } else if (strcmp(argv[1], "sim") == 0) {
+        bench_sim((argc == 3) ? strtoull(argv[2], NULL, 10) : 1);
+    } else {
+        fprintf(stderr, "error: unknown benchmark '%s'\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    exit(EXIT_SUCCESS);
+}
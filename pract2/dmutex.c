@@ -0,0 +1,313 @@
+#include "./dmutex.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+
+// GLOBAL VARIABLES (stub glue, one lock per process):
+enum dmx_algorithms dmx_algorithm = DMX_RICART_AGRAWALA;
+int dmx_n_members = 0;
+int dmx_self = 0;                           // member index of this process
+int dmx_peer_ids[DMX_MAX_MEMBERS];          // member index -> stub peer id
+int dmx_member_of[MAX_PEERS];               // stub peer id -> member index (-1: none)
+int dmx_others[DMX_MAX_MEMBERS];            // peer ids of every member but self
+
+    // Ricart-Agrawala (mutex_dmx)
+int dmx_requesting = 0;                     // wants the lock or holds it
+int dmx_holding = 0;
+unsigned int dmx_request_ts = 0;            // Lamport time of our pending request
+int dmx_replies_left = 0;
+uint64_t dmx_deferred = 0;                  // members whose REQUEST waits for our release
+
+    // Suzuki-Kasami token (mutex_dmx)
+int dmx_have_token = 0;
+_Atomic uint32_t dmx_requested[DMX_TOKEN_MEMBERS];  // RN: highest request number heard of each
+                                            // member (stored before mutex_dmx is taken)
+struct dmx_token dmx_tok;                   // valid while dmx_have_token
+int dmx_token_entries = 0;                  // our entries since the token came
+
+long dmx_acquired   = 0;    // entries to the critical section (mutex_dmx)
+long dmx_msgs_sent  = 0;    // messages this process sent for the lock (mutex_dmx)
+
+pthread_mutex_t mutex_dmx   = PTHREAD_MUTEX_INITIALIZER;    // protects the lock state
+pthread_cond_t cond_dmx     = PTHREAD_COND_INITIALIZER;     // a reply or the token arrived
+
+
+//-- (mutex_dmx held!) sends action (with payload) to the members set in the bitmap
+void dmx_send(uint64_t members, enum operations action, const void *payload, unsigned int len) {
+    int ids[DMX_MAX_MEMBERS], n_ids = 0, i;
+
+    for (i = 0; i < dmx_n_members; i++) {
+        if (members & (1ULL << i)) {
+            ids[n_ids++] = dmx_peer_ids[i];
+        }
+    }
+    if (n_ids > 0) {
+        multicast_msg(ids, n_ids, action, payload, len);
+        flush_all_msgs();   // somebody waits for it
+        dmx_msgs_sent += n_ids;
+    }
+}
+
+//-- (mutex_dmx held!) returns 1 when the request (ts, member) goes before ours
+int dmx_before_us(unsigned int ts, int member) {
+    return ts < dmx_request_ts || (ts == dmx_request_ts && member < dmx_self);
+}
+
+//-- (mutex_dmx held!) gives the token to the first member queued in it, if any
+void dmx_pass_token() {
+    int next, i;
+
+    if (!dmx_have_token || dmx_holding || dmx_tok.queue_len == 0) {
+        return;
+    }
+    next = dmx_tok.queue[0];
+    dmx_tok.queue_len--;
+    for (i = 0; i < dmx_tok.queue_len; i++) {
+        dmx_tok.queue[i] = dmx_tok.queue[i + 1];
+    }
+    dmx_have_token = 0;
+    dmx_token_entries = 0;
+    dmx_send(1ULL << next, DMX_TOKEN, &dmx_tok, sizeof(dmx_tok));
+}
+
+//-- (mutex_dmx held!) returns 1 when some other member has an unserved request
+int dmx_others_waiting() {
+    int i;
+
+    for (i = 0; i < dmx_n_members; i++) {
+        if (i != dmx_self && (uint16_t)dmx_requested[i] == (uint16_t)(dmx_tok.last[i] + 1)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//-- (mutex_dmx held!) queues in the token every member with an unserved request
+void dmx_queue_waiting() {
+    int i, j, queued;
+
+    for (i = 0; i < dmx_n_members; i++) {
+        if (i == dmx_self || (uint16_t)dmx_requested[i] != (uint16_t)(dmx_tok.last[i] + 1)) {
+            continue;
+        }
+        for (j = 0, queued = 0; j < dmx_tok.queue_len && !queued; j++) {
+            queued = (dmx_tok.queue[j] == i);
+        }
+        if (!queued) {
+            dmx_tok.queue[dmx_tok.queue_len++] = i;
+        }
+    }
+}
+
+//-- (receiver threads!) DMX_REQUEST, DMX_REPLY and DMX_TOKEN handler
+void dmx_on_msg(int peer_id, const struct message *msg) {
+    uint32_t number;
+    int member;
+
+    if (peer_id < 0 || peer_id >= MAX_PEERS || dmx_member_of[peer_id] < 0) {
+        return;     // not from a member of the group
+    }
+    member = dmx_member_of[peer_id];
+
+    // a request counts before the lock is ours: dmx_lock() sees it even when it
+    // takes mutex_dmx again and again while this thread waits for it
+    if (dmx_algorithm == DMX_SUZUKI_KASAMI && msg->action == DMX_REQUEST &&
+        msg->payload_len == sizeof(number)) {
+        memcpy(&number, msg->payload, sizeof(number));
+        if (number > dmx_requested[member]) {
+            dmx_requested[member] = number;     // (only this thread writes it)
+        }
+    }
+
+    pthread_mutex_lock(&mutex_dmx);         // lock (X)
+    if (dmx_algorithm == DMX_RICART_AGRAWALA) {
+        if (msg->action == DMX_REQUEST) {
+            // ours goes first: the reply waits in a bit until we release
+            if (dmx_holding || (dmx_requesting && !dmx_before_us(msg->clock_lamport, member))) {
+                dmx_deferred |= 1ULL << member;
+            } else {
+                dmx_send(1ULL << member, DMX_REPLY, NULL, 0);
+            }
+        } else if (msg->action == DMX_REPLY && dmx_requesting && dmx_replies_left > 0) {
+            if (--dmx_replies_left == 0) {
+                pthread_cond_broadcast(&cond_dmx);
+            }
+        }
+    } else {
+        if (msg->action == DMX_REQUEST && msg->payload_len == sizeof(number)) {
+            if (dmx_have_token && !dmx_holding) {
+                dmx_queue_waiting();
+                dmx_pass_token();
+                pthread_cond_broadcast(&cond_dmx);  // dmx_lock() may be waiting for it
+            }
+        } else if (msg->action == DMX_TOKEN && msg->payload_len == sizeof(dmx_tok)) {
+            memcpy(&dmx_tok, msg->payload, sizeof(dmx_tok));
+            dmx_have_token = 1;
+            pthread_cond_broadcast(&cond_dmx);
+        }
+    }
+    pthread_mutex_unlock(&mutex_dmx);       // unlock (o)
+}
+
+//-- joins this process to the lock of member_names (same list, same order, in every
+//   member), the first member starts with the token of DMX_SUZUKI_KASAMI
+int dmx_start(char **member_names, int n_members, enum dmx_algorithms algorithm) {
+    int i, n_others = 0, max = (algorithm == DMX_SUZUKI_KASAMI) ? DMX_TOKEN_MEMBERS : DMX_MAX_MEMBERS;
+
+    if (n_members < 1 || n_members > max) {
+        fprintf(stderr, "error: this distributed lock takes 1 to %i members\n", max);
+        return F_FAILURE;
+    }
+
+    dmx_self = F_FAILURE;
+    for (i = 0; i < MAX_PEERS; i++) {
+        dmx_member_of[i] = -1;
+    }
+    for (i = 0; i < n_members; i++) {
+        dmx_peer_ids[i] = peer_intern(member_names[i]);
+        if (dmx_peer_ids[i] == F_FAILURE) {
+            return F_FAILURE;
+        }
+        dmx_member_of[dmx_peer_ids[i]] = i;
+        if (strcmp(member_names[i], stub_whoami) == 0) {
+            dmx_self = i;
+        } else {
+            dmx_others[n_others++] = dmx_peer_ids[i];
+        }
+    }
+    if (dmx_self == F_FAILURE) {
+        fprintf(stderr, "error: %s is not a member of the distributed lock\n", stub_whoami);
+        return F_FAILURE;
+    }
+
+    dmx_algorithm = algorithm;
+    dmx_n_members = n_members;
+    for (i = 0; i < DMX_TOKEN_MEMBERS; i++) {
+        dmx_requested[i] = 0;
+    }
+    memset(&dmx_tok, 0, sizeof(dmx_tok));
+    dmx_have_token = (algorithm == DMX_SUZUKI_KASAMI && dmx_self == 0);
+
+    set_msg_handler(DMX_REQUEST, dmx_on_msg);
+    set_msg_handler(DMX_REPLY, dmx_on_msg);
+    set_msg_handler(DMX_TOKEN, dmx_on_msg);
+    return F_SUCCESS;
+}
+
+//-- (mutex_dmx held!) we entered last with the token and nobody asked for it: the
+//   REQUESTs sent meanwhile may still be on their way, they get DMX_TOKEN_GRACE_US to
+//   arrive (or the holder takes the lock again and again while the others wait)
+void dmx_token_grace() {
+    struct timespec deadline;
+    int wait_status = 0;
+
+    if (!dmx_have_token || dmx_token_entries == 0 || dmx_others_waiting()) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += DMX_TOKEN_GRACE_US * 1000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (dmx_have_token && !dmx_others_waiting() && wait_status != ETIMEDOUT) {
+        wait_status = pthread_cond_timedwait(&cond_dmx, &mutex_dmx, &deadline);
+    }
+}
+
+//-- blocks until this process holds the distributed lock
+int dmx_lock() {
+    uint32_t number;
+    int ts;
+
+    pthread_mutex_lock(&mutex_dmx);         // lock (X)
+    if (dmx_requesting) {
+        pthread_mutex_unlock(&mutex_dmx);   // unlock (o)
+        fprintf(stderr, "error: the distributed lock is not reentrant\n");
+        return F_FAILURE;
+    }
+    dmx_requesting = 1;
+
+    if (dmx_algorithm == DMX_RICART_AGRAWALA) {
+        // the request time and our state go together: a REQUEST handled in between
+        // would be compared against a stale dmx_request_ts
+        dmx_replies_left = dmx_n_members - 1;
+        if (dmx_replies_left > 0) {
+            ts = multicast_msg(dmx_others, dmx_n_members - 1, DMX_REQUEST, NULL, 0);
+            if (ts == F_FAILURE) {
+                dmx_requesting = 0;
+                pthread_mutex_unlock(&mutex_dmx);   // unlock (o)
+                return F_FAILURE;
+            }
+            flush_all_msgs();
+            dmx_request_ts = ts;
+            dmx_msgs_sent += dmx_n_members - 1;
+        }
+        while (dmx_replies_left > 0) {
+            pthread_cond_wait(&cond_dmx, &mutex_dmx);
+        }
+    } else {
+        dmx_token_grace();  // (the REQUEST handler may pass the token meanwhile)
+        if (dmx_have_token && dmx_others_waiting()) {
+            // the others asked first: the token serves them and comes back, we wait in
+            // its queue behind them (no REQUEST needed, the token itself carries ours)
+            dmx_requested[dmx_self]++;
+            dmx_queue_waiting();
+            dmx_tok.queue[dmx_tok.queue_len++] = dmx_self;
+            dmx_pass_token();
+            while (!dmx_have_token) {
+                pthread_cond_wait(&cond_dmx, &mutex_dmx);
+            }
+        } else if (!dmx_have_token) {
+            number = ++dmx_requested[dmx_self];
+            multicast_msg(dmx_others, dmx_n_members - 1, DMX_REQUEST, &number, sizeof(number));
+            flush_all_msgs();
+            dmx_msgs_sent += dmx_n_members - 1;
+            while (!dmx_have_token) {
+                pthread_cond_wait(&cond_dmx, &mutex_dmx);
+            }
+        }
+        dmx_token_entries++;
+    }
+
+    dmx_holding = 1;
+    dmx_acquired++;
+    pthread_mutex_unlock(&mutex_dmx);       // unlock (o)
+    return F_SUCCESS;
+}
+
+//-- releases the distributed lock: answers the deferred requests (Ricart-Agrawala)
+//   or hands the token to the next member waiting for it
+int dmx_unlock() {
+    uint64_t deferred;
+
+    pthread_mutex_lock(&mutex_dmx);         // lock (X)
+    if (!dmx_holding) {
+        pthread_mutex_unlock(&mutex_dmx);   // unlock (o)
+        return F_FAILURE;
+    }
+    dmx_holding = 0;
+    dmx_requesting = 0;
+
+    if (dmx_algorithm == DMX_RICART_AGRAWALA) {
+        // one multicast answers every deferred request at once
+        deferred = dmx_deferred;
+        dmx_deferred = 0;
+        dmx_send(deferred, DMX_REPLY, NULL, 0);
+    } else {
+        dmx_tok.last[dmx_self] = (uint16_t)dmx_requested[dmx_self];
+        dmx_queue_waiting();
+        dmx_pass_token();
+    }
+    pthread_mutex_unlock(&mutex_dmx);       // unlock (o)
+    return F_SUCCESS;
+}
+
+//-- reports the entries to the critical section and the messages sent for them
+void dmx_get_stats(long *acquired, long *msgs_sent) {
+    pthread_mutex_lock(&mutex_dmx);         // lock (X)
+    *acquired = dmx_acquired;
+    *msgs_sent = dmx_msgs_sent;
+    pthread_mutex_unlock(&mutex_dmx);       // unlock (o)
+}
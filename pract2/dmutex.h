@@ -0,0 +1,32 @@
+#ifndef DMUTEX_H
+#define DMUTEX_H
+
+#include "./stub.h"
+
+
+#define DMX_MAX_MEMBERS     MAX_PEERS   // Ricart-Agrawala (deferred replies: one bit each)
+#define DMX_TOKEN_MEMBERS   20          // DMX_SUZUKI_KASAMI: its LN and queue fit a payload
+#define DMX_TOKEN_GRACE_US  200         // a holder entering again waits this for REQUESTs on
+                                        // their way before it keeps the token for itself
+
+
+enum dmx_algorithms {
+    DMX_RICART_AGRAWALA,        // permission of every member: 2(N-1) messages per entry
+    DMX_SUZUKI_KASAMI,          // token: N messages, 0 if it is already here
+};
+
+// the token of the Suzuki-Kasami variant, as it travels (DMX_TOKEN payload)
+struct dmx_token {
+    uint16_t last[DMX_TOKEN_MEMBERS];   // LN: request number last served of each member
+    uint8_t queue_len;
+    uint8_t queue[DMX_TOKEN_MEMBERS];   // members waiting for the token, in order
+};
+
+
+// on top of the stub (one lock per process, every member connected to every other)
+int dmx_start(char **member_names, int n_members, enum dmx_algorithms algorithm);
+int dmx_lock();
+int dmx_unlock();
+void dmx_get_stats(long *acquired, long *msgs_sent);
+
+#endif // DMUTEX_H
@@ -0,0 +1,305 @@
+#define _GNU_SOURCE     // memfd_create()
+#include "./shmring.h"
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+
+
+#define SHM_NUM_FDS     5   // memfd + 4 eventfds sent by shm_connect()
+
+
+// GLOBAL VARIABLES:
+struct shm_link shm_links[SHM_MAX_FDS];     // indexed by connection fd (never freed)
+int shm_spins = SHM_SPIN;                   // 0 on a single CPU: spinning only delays the peer
+
+
+//-- returns the link carried by connection fd, NULL when it is a plain socket
+struct shm_link *shm_link_of(int fd) {
+    if (fd < 0 || fd >= SHM_MAX_FDS || !shm_links[fd].attached) {
+        return NULL;
+    }
+    return &shm_links[fd];
+}
+
+//-- maps the region and sets the link of fd up (is_client picks the directions)
+int shm_attach(int fd, int memfd, const int *efds, int is_client) {
+    struct shm_link *link = &shm_links[fd];
+    void *region;
+
+    region = mmap(NULL, sizeof(struct shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (region == MAP_FAILED) {
+        perror("mmap failed");
+        return F_FAILURE;
+    }
+
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        shm_spins = 0;
+    }
+    link->ctrl_fd = fd;
+    link->region = region;
+    link->tx = &link->region->ring[is_client ? 0 : 1];
+    link->rx = &link->region->ring[is_client ? 1 : 0];
+    link->tx_data_efd  = efds[is_client ? 0 : 2];
+    link->tx_space_efd = efds[is_client ? 1 : 3];
+    link->rx_data_efd  = efds[is_client ? 2 : 0];
+    link->rx_space_efd = efds[is_client ? 3 : 1];
+    pthread_mutex_init(&link->tx_mutex, NULL);
+    link->attached = 1;
+    return F_SUCCESS;
+}
+
+//-- (client side) creates the shared region and its eventfds and sends them to the
+//   server through the connected AF_UNIX socket sock_fd
+int shm_connect(int sock_fd) {
+    int fds[SHM_NUM_FDS], i, status;
+    char control[CMSG_SPACE(sizeof(fds))], tag = 'S';
+    struct iovec iov = {&tag, 1};
+    struct msghdr hdr;
+    struct cmsghdr *cmsg;
+
+    if (sock_fd < 0 || sock_fd >= SHM_MAX_FDS) {
+        fprintf(stderr, "error: fd %i can't carry a shared-memory ring\n", sock_fd);
+        return F_FAILURE;
+    }
+
+    fds[0] = memfd_create("sdc-shm", MFD_CLOEXEC);
+    if (fds[0] < 0 || ftruncate(fds[0], sizeof(struct shm_region)) < 0) {
+        perror("memfd_create failed");
+        return F_FAILURE;
+    }
+    for (i = 1; i < SHM_NUM_FDS; i++) {
+        fds[i] = eventfd(0, EFD_CLOEXEC);
+        if (fds[i] < 0) {
+            perror("eventfd failed");
+            return F_FAILURE;
+        }
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(sock_fd, &hdr, 0) < 0) {
+        perror("sendmsg failed");
+        return F_FAILURE;
+    }
+
+    status = shm_attach(sock_fd, fds[0], &fds[1], 1);
+    close(fds[0]);  // the mapping stays
+    return status;
+}
+
+//-- (server side) receives the region and eventfds shm_connect() sent on conn_fd
+int shm_accept(int conn_fd) {
+    int fds[SHM_NUM_FDS], status;
+    char control[CMSG_SPACE(sizeof(fds))], tag;
+    struct iovec iov = {&tag, 1};
+    struct msghdr hdr;
+    struct cmsghdr *cmsg;
+
+    if (conn_fd < 0 || conn_fd >= SHM_MAX_FDS) {
+        fprintf(stderr, "error: fd %i can't carry a shared-memory ring\n", conn_fd);
+        return F_FAILURE;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    if (recvmsg(conn_fd, &hdr, MSG_CMSG_CLOEXEC) <= 0) {
+        perror("recvmsg failed");
+        return F_FAILURE;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        fprintf(stderr, "error: the client sent no shared-memory ring\n");
+        return F_FAILURE;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    status = shm_attach(conn_fd, fds[0], &fds[1], 0);
+    close(fds[0]);
+    return status;
+}
+
+//-- wakes whoever sleeps on the eventfd efd
+void shm_kick(int efd) {
+    uint64_t one = 1;
+
+    if (write(efd, &one, sizeof(one)) < 0) {
+        perror("eventfd write failed");
+    }
+}
+
+//-- sleeps until efd is kicked, returns F_CONN_CLOSE if the connection ended meanwhile
+int shm_sleep(struct shm_link *link, int efd) {
+    struct pollfd waits[2] = {{efd, POLLIN, 0}, {link->ctrl_fd, POLLIN, 0}};
+    uint64_t count;
+
+    while (poll(waits, 2, -1) < 0) {
+        if (errno != EINTR) {
+            return F_FAILURE;
+        }
+    }
+    if (waits[0].revents & POLLIN) {
+        if (read(efd, &count, sizeof(count)) < 0) {
+            return F_FAILURE;
+        }
+        return F_SUCCESS;
+    }
+    // nothing else travels on the socket: readable means closed (or shut down)
+    return F_CONN_CLOSE;
+}
+
+//-- detaches the link of fd (before closing fd), the peer reads the end of the stream
+void shm_detach(int fd) {
+    struct shm_link *link = shm_link_of(fd);
+
+    if (link == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&link->tx_mutex);    // lock (X)
+    atomic_store(&link->tx->closed, 1);
+    shm_kick(link->tx_data_efd);
+    link->attached = 0;
+    munmap(link->region, sizeof(struct shm_region));
+    close(link->tx_data_efd);
+    close(link->tx_space_efd);
+    close(link->rx_data_efd);
+    close(link->rx_space_efd);
+    pthread_mutex_unlock(&link->tx_mutex);  // unlock (o)
+}
+
+//-- writes every buffer of iov to the link, waiting for room when the ring is full,
+//   returns the bytes written or F_FAILURE (errno EPIPE) if the peer is gone
+ssize_t shm_writev(struct shm_link *link, const struct iovec *iov, int iovcnt) {
+    struct shm_ring *ring = link->tx;
+    unsigned long head, tail, room, pos, first;
+    ssize_t total = 0;
+    size_t done, n;
+    int i, spins;
+
+    pthread_mutex_lock(&link->tx_mutex);    // lock (X)
+    if (!link->attached) {
+        pthread_mutex_unlock(&link->tx_mutex);  // unlock (o)
+        errno = EPIPE;
+        return F_FAILURE;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        const unsigned char *src = iov[i].iov_base;
+
+        for (done = 0; done < iov[i].iov_len; done += n) {
+            head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+            room = SHM_RING_SIZE - (head - tail);
+
+            // full ring: spin a little, then sleep until the reader makes room
+            for (spins = 0; room == 0; spins++) {
+                if (spins >= shm_spins) {
+                    atomic_store(&ring->writer_sleeping, 1);
+                    atomic_thread_fence(memory_order_seq_cst);
+                    tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+                    if (SHM_RING_SIZE - (head - tail) == 0 &&
+                        shm_sleep(link, link->tx_space_efd) != F_SUCCESS) {
+                        atomic_store(&ring->writer_sleeping, 0);
+                        pthread_mutex_unlock(&link->tx_mutex);  // unlock (o)
+                        errno = EPIPE;
+                        return F_FAILURE;
+                    }
+                    atomic_store(&ring->writer_sleeping, 0);
+                    spins = 0;
+                }
+                tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+                room = SHM_RING_SIZE - (head - tail);
+            }
+
+            n = iov[i].iov_len - done;
+            if (n > room) {
+                n = room;
+            }
+            pos = head & (SHM_RING_SIZE - 1);
+            first = (n < SHM_RING_SIZE - pos) ? n : SHM_RING_SIZE - pos;
+            memcpy(&ring->data[pos], &src[done], first);
+            memcpy(&ring->data[0], &src[done + first], n - first);
+            atomic_store_explicit(&ring->head, head + n, memory_order_release);
+            total += n;
+
+            // the reader checks head after raising its flag: one of both sees the other
+            atomic_thread_fence(memory_order_seq_cst);
+            if (atomic_load_explicit(&ring->reader_sleeping, memory_order_relaxed)) {
+                shm_kick(link->tx_data_efd);
+            }
+        }
+    }
+    pthread_mutex_unlock(&link->tx_mutex);  // unlock (o)
+    return total;
+}
+
+//-- reads up to len bytes from the link, waiting for at least one,
+//   returns the bytes read, 0 when the peer closed or F_FAILURE
+ssize_t shm_read(struct shm_link *link, void *buf, size_t len) {
+    struct shm_ring *ring = link->rx;
+    unsigned long head, tail, pos, first;
+    size_t n;
+    int spins, status;
+
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    // empty ring: spin a little, then sleep until the writer brings data
+    for (spins = 0; head == tail; spins++) {
+        if (atomic_load_explicit(&ring->closed, memory_order_acquire)) {
+            head = atomic_load_explicit(&ring->head, memory_order_acquire);
+            if (head != tail) {
+                break;  // written before closing
+            }
+            return 0;
+        }
+        if (spins >= shm_spins) {
+            atomic_store(&ring->reader_sleeping, 1);
+            atomic_thread_fence(memory_order_seq_cst);
+            head = atomic_load_explicit(&ring->head, memory_order_acquire);
+            if (head == tail) {
+                status = shm_sleep(link, link->rx_data_efd);
+                if (status != F_SUCCESS) {
+                    atomic_store(&ring->reader_sleeping, 0);
+                    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+                    if (head != tail) {
+                        break;  // what was written before closing is still read
+                    }
+                    return (status == F_CONN_CLOSE) ? 0 : F_FAILURE;
+                }
+            }
+            atomic_store(&ring->reader_sleeping, 0);
+            spins = 0;
+        }
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    }
+
+    n = head - tail;
+    if (n > len) {
+        n = len;
+    }
+    pos = tail & (SHM_RING_SIZE - 1);
+    first = (n < SHM_RING_SIZE - pos) ? n : SHM_RING_SIZE - pos;
+    memcpy(buf, &ring->data[pos], first);
+    memcpy((unsigned char *)buf + first, &ring->data[0], n - first);
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+
+    // the writer checks tail after raising its flag: one of both sees the other
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->writer_sleeping, memory_order_relaxed)) {
+        shm_kick(link->rx_space_efd);
+    }
+    return n;
+}
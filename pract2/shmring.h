@@ -0,0 +1,52 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include "./stub.h"
+
+
+#define SHM_RING_SIZE       (256 * 1024)    // bytes of each direction (power of 2)
+#define SHM_MAX_FDS         1024            // connection fds that can carry a ring
+#define SHM_SPIN            2000            // polls of the ring before sleeping (multi-CPU)
+
+
+// one direction of a link: a byte stream, one writer process and one reader process
+struct shm_ring {
+    _Alignas(64) atomic_ulong head;         // bytes ever written (writer only)
+    atomic_int reader_sleeping;             // reader waits on the data eventfd
+    _Alignas(64) atomic_ulong tail;         // bytes ever read (reader only)
+    atomic_int writer_sleeping;             // writer waits on the space eventfd
+    _Alignas(64) atomic_int closed;         // the writer detached
+    _Alignas(64) unsigned char data[SHM_RING_SIZE];
+};
+
+// memory shared by the two ends of a connection
+struct shm_region {
+    struct shm_ring ring[2];                // [0]: client -> server, [1]: server -> client
+};
+
+// this process' end of a connection
+struct shm_link {
+    int attached;
+    int ctrl_fd;                            // the AF_UNIX connection: EOF when the peer is gone
+    struct shm_region *region;
+    struct shm_ring *tx, *rx;
+    int tx_data_efd, tx_space_efd;          // the peer sleeps on / we sleep on (tx ring)
+    int rx_data_efd, rx_space_efd;          // we sleep on / the peer sleeps on (rx ring)
+    pthread_mutex_t tx_mutex;               // writers of this process take turns
+};
+
+
+// set-up over a connected AF_UNIX socket (fds travel with SCM_RIGHTS)
+int shm_connect(int sock_fd);
+int shm_accept(int conn_fd);
+void shm_detach(int fd);
+struct shm_link *shm_link_of(int fd);
+
+// byte stream I/O, same results as writev() and recv()
+ssize_t shm_writev(struct shm_link *link, const struct iovec *iov, int iovcnt);
+ssize_t shm_read(struct shm_link *link, void *buf, size_t len);
+
+#endif // SHMRING_H
@@ -0,0 +1,303 @@
+#include "./sim.h"
+#include <math.h>
+
+
+#define FNV_OFFSET      1469598103934665603ULL
+#define FNV_PRIME       1099511628211ULL
+
+
+// GLOBAL VARIABLES (one simulation per process):
+struct sim_config sim_cfg;
+struct sim_stats sim_st;
+int sim_nodes = 0;
+int *sim_lamport = NULL;            // Lamport clock of each node
+uint64_t *sim_link_last = NULL;     // [from * n + to] latest delivery time scheduled
+uint64_t sim_rng = 0;               // xorshift64* state
+uint64_t sim_seq = 0;
+void (*sim_handler)(int node, int from, const struct message *msg) = NULL;
+
+struct sim_event *sim_events = NULL;    // slots of the messages in flight
+int *sim_free_slots = NULL;
+int sim_free_len = 0;
+int sim_capacity = 0;
+int *sim_heap = NULL;                   // slot indexes, min-heap on (at_us, seq)
+int sim_heap_len = 0;
+
+
+//-- returns the next number of the seeded generator (xorshift64*)
+uint64_t sim_random() {
+    sim_rng ^= sim_rng >> 12;
+    sim_rng ^= sim_rng << 25;
+    sim_rng ^= sim_rng >> 27;
+    return sim_rng * 2685821657736338717ULL;
+}
+
+//-- returns a uniform double in [0, 1)
+double sim_uniform() {
+    return (sim_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//-- returns the delay of a new message under the configured model
+uint64_t sim_delay() {
+    long delay;
+
+    switch (sim_cfg.delay_model) {
+    case SIM_DELAY_UNIFORM:
+        delay = sim_cfg.delay_us - sim_cfg.jitter_us +
+                (long)(sim_random() % (uint64_t)(2 * sim_cfg.jitter_us + 1));
+        break;
+    case SIM_DELAY_EXP:
+        delay = (long)(-(double)sim_cfg.delay_us * log(1.0 - sim_uniform()));
+        break;
+    default:
+        delay = sim_cfg.delay_us;
+    }
+    return (delay > 0) ? (uint64_t)delay : 0;
+}
+
+//-- returns 1 when the event in slot a is delivered before the one in b
+int sim_before(int a, int b) {
+    return sim_events[a].at_us < sim_events[b].at_us ||
+           (sim_events[a].at_us == sim_events[b].at_us && sim_events[a].seq < sim_events[b].seq);
+}
+
+//-- returns a free event slot, growing the slots when all are in flight
+int sim_alloc_slot() {
+    int i, old = sim_capacity, capacity;
+    struct sim_event *events;
+    int *free_slots, *heap;
+
+    if (sim_free_len == 0) {
+        // each array keeps its old block until its own realloc succeeds,
+        // and the capacity only grows once all three did
+        capacity = old ? old * 2 : 1024;
+        events = realloc(sim_events, capacity * sizeof(struct sim_event));
+        if (events == NULL) {
+            perror("realloc failed");
+            return F_FAILURE;
+        }
+        sim_events = events;
+        free_slots = realloc(sim_free_slots, capacity * sizeof(int));
+        if (free_slots == NULL) {
+            perror("realloc failed");
+            return F_FAILURE;
+        }
+        sim_free_slots = free_slots;
+        heap = realloc(sim_heap, capacity * sizeof(int));
+        if (heap == NULL) {
+            perror("realloc failed");
+            return F_FAILURE;
+        }
+        sim_heap = heap;
+        sim_capacity = capacity;
+        for (i = sim_capacity - 1; i >= old; i--) {
+            sim_free_slots[sim_free_len++] = i;
+        }
+    }
+    return sim_free_slots[--sim_free_len];
+}
+
+//-- puts the event in slot into the delivery heap
+void sim_push(int slot) {
+    int i = sim_heap_len++, parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!sim_before(slot, sim_heap[parent])) {
+            break;
+        }
+        sim_heap[i] = sim_heap[parent];
+        i = parent;
+    }
+    sim_heap[i] = slot;
+}
+
+//-- takes the next event to deliver out of the heap and returns its slot
+int sim_pop() {
+    int top = sim_heap[0], last = sim_heap[--sim_heap_len];
+    int i = 0, child;
+
+    while ((child = 2 * i + 1) < sim_heap_len) {
+        if (child + 1 < sim_heap_len && sim_before(sim_heap[child + 1], sim_heap[child])) {
+            child++;
+        }
+        if (!sim_before(sim_heap[child], last)) {
+            break;
+        }
+        sim_heap[i] = sim_heap[child];
+        i = child;
+    }
+    sim_heap[i] = last;
+    return top;
+}
+
+//-- frees everything the current simulation holds
+void sim_free() {
+    free(sim_lamport);
+    free(sim_link_last);
+    free(sim_events);
+    free(sim_free_slots);
+    free(sim_heap);
+    sim_lamport = NULL;
+    sim_link_last = NULL;
+    sim_events = NULL;
+    sim_free_slots = NULL;
+    sim_heap = NULL;
+    sim_capacity = sim_free_len = sim_heap_len = 0;
+}
+
+//-- starts a simulation of n_nodes logical processes, handler gets every delivery
+int sim_init(const struct sim_config *config, int n_nodes,
+             void (*handler)(int node, int from, const struct message *msg)) {
+    if (n_nodes < 1 || n_nodes > SIM_MAX_NODES) {
+        fprintf(stderr, "error: %i nodes (1..%i)\n", n_nodes, SIM_MAX_NODES);
+        return F_FAILURE;
+    }
+    if (config->drop_rate < 0 || config->drop_rate > 1 || config->delay_us < 0 ||
+        (config->delay_model == SIM_DELAY_UNIFORM && config->jitter_us < 0)) {
+        fprintf(stderr, "error: bad simulation config\n");
+        return F_FAILURE;
+    }
+
+    sim_free();
+    sim_cfg = *config;
+    memset(&sim_st, 0, sizeof(sim_st));
+    sim_st.fingerprint = FNV_OFFSET;
+    sim_nodes = n_nodes;
+    sim_handler = handler;
+    sim_seq = 0;
+    sim_rng = config->seed ? config->seed : FNV_OFFSET;    // xorshift state can't be 0
+
+    sim_lamport = calloc(n_nodes, sizeof(int));
+    sim_link_last = calloc((size_t)n_nodes * n_nodes, sizeof(uint64_t));
+    if (sim_lamport == NULL || sim_link_last == NULL) {
+        perror("calloc failed");
+        sim_free();
+        return F_FAILURE;
+    }
+    return F_SUCCESS;
+}
+
+//-- sends a message (one Lamport tick of from) to be delivered to node to,
+//   returns the Lamport time it was sent with (also when the network drops it)
+int sim_send(int from, int to, enum operations action, const void *payload, unsigned int payload_len) {
+    unsigned char frame[512];
+    struct message msg;
+    struct sim_event *ev;
+    uint64_t *link_last;
+    int len, slot;
+
+    if (from < 0 || from >= sim_nodes || to < 0 || to >= sim_nodes || payload_len > MSG_PAYLOAD_MAX) {
+        return F_FAILURE;
+    }
+
+    // same clock rule as update_clock_lamport(): tick BEFORE sending
+    sim_lamport[from]++;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.origin = from;
+    msg.action = action;
+    msg.clock_lamport = sim_lamport[from];
+    msg.stamp.mode = CLOCK_LAMPORT;
+    if (payload_len > 0) {
+        memcpy(msg.payload, payload, payload_len);
+        msg.payload_len = payload_len;
+    }
+    len = encode_msg(&msg, NULL, frame);     // through the real codec
+    if (len > SIM_FRAME_MAX) {
+        return F_FAILURE;
+    }
+    sim_st.sent++;
+
+    if (sim_cfg.drop_rate > 0 && sim_uniform() < sim_cfg.drop_rate) {
+        sim_st.dropped++;
+        return msg.clock_lamport;
+    }
+
+    slot = sim_alloc_slot();
+    if (slot == F_FAILURE) {
+        return F_FAILURE;
+    }
+    ev = &sim_events[slot];
+    ev->at_us = sim_st.now_us + sim_delay();
+    ev->seq = sim_seq++;
+    ev->to = to;
+    ev->len = len;
+    memcpy(ev->frame, frame, len);
+
+    // a FIFO link never delivers before what it already carries,
+    // otherwise overtaking it is a reordering
+    link_last = &sim_link_last[(size_t)from * sim_nodes + to];
+    if (ev->at_us < *link_last) {
+        if (sim_cfg.fifo) {
+            ev->at_us = *link_last;
+        } else {
+            sim_st.reordered++;
+        }
+    }
+    if (ev->at_us > *link_last) {
+        *link_last = ev->at_us;
+    }
+
+    sim_push(slot);
+    if (sim_heap_len > sim_st.max_in_flight) {
+        sim_st.max_in_flight = sim_heap_len;
+    }
+    return msg.clock_lamport;
+}
+
+//-- delivers messages in virtual time order until none is left or max_deliveries
+//   (<= 0: no limit) were delivered, returns how many were
+long sim_run(long max_deliveries) {
+    struct message msg;
+    struct sim_event *ev;
+    long delivered = 0;
+    int slot, to, from;
+
+    while (sim_heap_len > 0 && (max_deliveries <= 0 || delivered < max_deliveries)) {
+        slot = sim_pop();
+        ev = &sim_events[slot];
+        sim_st.now_us = ev->at_us;
+        to = ev->to;
+
+        memset(&msg, 0, sizeof(msg));
+        if (decode_msg(ev->frame, ev->len, &msg) <= 0) {
+            fprintf(stderr, "error: simulated frame does not decode\n");
+            return F_FAILURE;
+        }
+        sim_free_slots[sim_free_len++] = slot;     // the handler may reuse it
+        from = (int)msg.origin;
+
+        // same clock rule as clock_on_receive(): max(local, received) + 1
+        if ((int)msg.clock_lamport > sim_lamport[to]) {
+            sim_lamport[to] = msg.clock_lamport;
+        }
+        sim_lamport[to]++;
+
+        sim_st.fingerprint = (sim_st.fingerprint ^ (uint64_t)to) * FNV_PRIME;
+        sim_st.fingerprint = (sim_st.fingerprint ^ (uint64_t)from) * FNV_PRIME;
+        sim_st.fingerprint = (sim_st.fingerprint ^ (uint64_t)sim_lamport[to]) * FNV_PRIME;
+        sim_st.delivered++;
+        delivered++;
+
+        if (sim_handler != NULL) {
+            sim_handler(to, from, &msg);
+        }
+    }
+    return delivered;
+}
+
+//-- returns the Lamport clock of node
+int sim_clock(int node) {
+    return sim_lamport[node];
+}
+
+//-- returns the virtual time (us) of the current delivery
+uint64_t sim_now() {
+    return sim_st.now_us;
+}
+
+//-- copies the counters of the current simulation
+void sim_get_stats(struct sim_stats *stats) {
+    *stats = sim_st;
+}
@@ -0,0 +1,61 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "./stub.h"
+
+
+#define SIM_MAX_NODES       1024    // logical processes in one simulation
+#define SIM_FRAME_MAX       96      // a Lamport frame with a full payload fits
+
+
+enum sim_delay_models {
+    SIM_DELAY_FIXED,            // every message takes delay_us
+    SIM_DELAY_UNIFORM,          // delay_us +- jitter_us
+    SIM_DELAY_EXP,              // exponential, mean delay_us
+};
+
+struct sim_config {
+    uint64_t seed;              // same seed (and same handler), same run
+    enum sim_delay_models delay_model;
+    long delay_us;
+    long jitter_us;
+    int fifo;                   // 1: a link never reorders its messages
+    double drop_rate;           // probability a message is lost (0..1)
+};
+
+struct sim_stats {
+    long sent;
+    long delivered;
+    long dropped;
+    long reordered;             // deliveries that overtook an older message of their link
+    long max_in_flight;
+    uint64_t now_us;            // virtual time of the last delivery
+    uint64_t fingerprint;       // hash of the delivery order (compare two runs)
+};
+
+// a message in flight, frame encoded with encode_msg()
+struct sim_event {
+    uint64_t at_us;             // virtual time of the delivery
+    uint64_t seq;               // send order: breaks ties in at_us
+    int to;
+    int len;
+    unsigned char frame[SIM_FRAME_MAX];
+};
+
+
+// one simulation per process, nodes 0..n_nodes-1 ("P<i>" is node i).
+// Not a transport of the stub: the stub keeps one clock and one peer table
+// per process, so the simulated nodes keep their own Lamport clocks (same
+// rules as update_clock_lamport / clock_on_receive) and only the frame codec
+// (encode_msg / decode_msg) is shared with the real send and receive paths
+int sim_init(const struct sim_config *config, int n_nodes,
+             void (*handler)(int node, int from, const struct message *msg));
+int sim_send(int from, int to, enum operations action, const void *payload, unsigned int payload_len);
+long sim_run(long max_deliveries);
+int sim_clock(int node);
+uint64_t sim_now();
+uint64_t sim_random();
+void sim_get_stats(struct sim_stats *stats);
+void sim_free();
+
+#endif // SIM_H
@@ -0,0 +1,435 @@
+#include "./snapshot.h"
+#include <time.h>
+
+
+// GLOBAL VARIABLES (stub glue, every snapshot recorded here):
+int snap_n_members = 0;
+int snap_self = 0;                              // member index of this process
+int snap_peer_ids[SNAP_MAX_MEMBERS];            // member index -> stub peer id
+int snap_member_of[MAX_PEERS];                  // stub peer id -> member index (-1: none)
+int snap_others[SNAP_MAX_MEMBERS];              // peer ids of every member but self
+pthread_mutex_t *snap_lock = NULL;              // the application's: state, sends and recording
+unsigned int (*snap_get_state)(void *buf, unsigned int max) = NULL;
+char snap_dir[256];
+
+    // snapshots being recorded (snap_lock)
+struct snap_run *snap_runs = NULL;              // each one apart: a marker only closes its own
+uint16_t snap_seq = 0;                          // snapshots this process initiated
+
+    // written snapshots (mutex_snapdone)
+uint32_t snap_done_ids[SNAP_DONE_KEEP];         // the last ones written (they finish in any order)
+int snap_done_next = 0;
+long snap_taken = 0;
+long snap_recorded_msgs = 0;
+long snap_file_bytes = 0;
+long snap_last_ns = 0;                          // local state -> file written, last snapshot
+
+pthread_mutex_t mutex_snapdone = PTHREAD_MUTEX_INITIALIZER; // protects the written ones
+pthread_cond_t cond_snapdone    = PTHREAD_COND_INITIALIZER;  // one more snapshot written
+
+
+//-- appends msg (as a wire frame) to the messages recorded on channel
+int snap_append(struct snap_channel *channel, const struct message *msg) {
+    unsigned char frame[WIRE_MAX_FRAME];
+    unsigned char *frames;
+    uint32_t capacity;
+    int len = encode_msg(msg, NULL, frame);     // full vector clock: no base to keep
+
+    if (channel->bytes + len > channel->capacity) {
+        capacity = channel->capacity ? channel->capacity * 2 : 4096;
+        while (capacity < channel->bytes + len) {
+            capacity *= 2;
+        }
+        frames = realloc(channel->frames, capacity);
+        if (frames == NULL) {
+            perror("realloc failed");
+            return F_FAILURE;
+        }
+        channel->frames = frames;
+        channel->capacity = capacity;
+    }
+    memcpy(&channel->frames[channel->bytes], frame, len);
+    channel->bytes += len;
+    channel->n_msgs++;
+    return F_SUCCESS;
+}
+
+//-- (snap_lock held!) returns the snapshot snap_id being recorded here, NULL if none
+struct snap_run *snap_find_locked(uint32_t snap_id) {
+    struct snap_run *run;
+
+    for (run = snap_runs; run != NULL && run->id != snap_id; run = run->next) {
+    }
+    return run;
+}
+
+//-- (snap_lock held!) starts recording snapshot snap_id: records the local state and
+//   queues a marker on every channel, nothing the application sends can get in
+//   between (it sends with snap_lock held); the markers are only queued (a deferred
+//   send never blocks with the lock held), the caller writes them with
+//   flush_all_msgs() once it unlocks. Returns the new run, NULL if out of memory
+struct snap_run *snap_record_locked(uint32_t snap_id) {
+    struct snap_run *run = calloc(1, sizeof(struct snap_run));
+    int i;
+
+    if (run == NULL) {
+        perror("calloc failed");
+        return NULL;
+    }
+    run->id = snap_id;
+    run->record_ns = monotonic_ns();
+    run->lamport = get_clock_lamport();
+    run->state_len = snap_get_state(run->state, SNAP_STATE_MAX);
+    if (run->state_len > SNAP_STATE_MAX) {
+        run->state_len = SNAP_STATE_MAX;
+    }
+    for (i = 0; i < snap_n_members; i++) {
+        run->channels[i].closed = (i == snap_self);
+    }
+    run->markers_left = snap_n_members - 1;
+    run->next = snap_runs;
+    snap_runs = run;
+
+    if (run->markers_left > 0) {
+        set_send_deferred(1);
+        multicast_msg(snap_others, snap_n_members - 1, SNAP_MARKER, &snap_id, sizeof(snap_id));
+        set_send_deferred(0);
+    }
+    return run;
+}
+
+//-- (snap_lock held!) every marker of run arrived: moves its recording out to a file
+//   image (written without the lock, the application goes on meanwhile)
+struct snap_file *snap_finish_locked(struct snap_run *run) {
+    struct snap_file *file = calloc(1, sizeof(struct snap_file));
+    struct snap_run **link;
+    int i, n_channels = 0;
+
+    for (link = &snap_runs; *link != run; link = &(*link)->next) {
+    }
+    *link = run->next;
+    if (file == NULL) {
+        perror("calloc failed");
+        for (i = 0; i < snap_n_members; i++) {
+            free(run->channels[i].frames);
+        }
+        free(run);
+        return NULL;
+    }
+
+    memcpy(file->header.magic, SNAP_MAGIC, sizeof(file->header.magic));
+    file->header.version = SNAP_VERSION;
+    file->header.node_id = node_id_from_name(stub_whoami);
+    file->header.snap_id = run->id;
+    file->header.lamport = run->lamport;
+    file->header.state_len = run->state_len;
+    memcpy(file->state, run->state, run->state_len);
+
+    // the file takes the recorded frames
+    for (i = 0; i < snap_n_members; i++) {
+        if (i == snap_self) {
+            continue;
+        }
+        file->channels[n_channels] = run->channels[i];
+        file->channels[n_channels].peer_node = peer_node(snap_peer_ids[i]);
+        n_channels++;
+    }
+    file->header.n_channels = n_channels;
+    free(run);
+    return file;
+}
+
+//-- writes file to "<dir>/snap-<id>-<whoami>.bin", returns the bytes written or F_FAILURE
+long snap_write(const struct snap_file *file) {
+    struct snap_channel_header channel;
+    char path[sizeof(snap_dir) + 64];
+    long bytes;
+    FILE *out;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/snap-%08x-%s.bin", snap_dir, file->header.snap_id, stub_whoami);
+    out = fopen(path, "wb");
+    if (out == NULL) {
+        perror(path);
+        return F_FAILURE;
+    }
+    fwrite(&file->header, sizeof(file->header), 1, out);
+    fwrite(file->state, 1, file->header.state_len, out);
+    for (i = 0; i < file->header.n_channels; i++) {
+        memset(&channel, 0, sizeof(channel));
+        channel.peer_node = file->channels[i].peer_node;
+        channel.n_msgs = file->channels[i].n_msgs;
+        channel.bytes = file->channels[i].bytes;
+        fwrite(&channel, sizeof(channel), 1, out);
+        fwrite(file->channels[i].frames, 1, channel.bytes, out);
+    }
+    bytes = ftell(out);
+    if (fclose(out) != 0) {
+        perror(path);
+        return F_FAILURE;
+    }
+    return bytes;
+}
+
+//-- writes the local part of a finished snapshot and wakes snap_wait()
+void snap_complete(struct snap_file *file, long started_ns) {
+    long bytes = snap_write(file);
+    int i;
+
+    pthread_mutex_lock(&mutex_snapdone);    // lock (X)
+    snap_taken++;
+    for (i = 0; i < file->header.n_channels; i++) {
+        snap_recorded_msgs += file->channels[i].n_msgs;
+    }
+    if (bytes > 0) {
+        snap_file_bytes += bytes;
+    }
+    snap_last_ns = monotonic_ns() - started_ns;
+    snap_done_ids[snap_done_next] = file->header.snap_id;
+    snap_done_next = (snap_done_next + 1) % SNAP_DONE_KEEP;
+    pthread_cond_broadcast(&cond_snapdone);
+    pthread_mutex_unlock(&mutex_snapdone);  // unlock (o)
+
+    snap_file_free(file);
+    free(file);
+}
+
+//-- (receive hook!) a marker closes its channel in its own snapshot (starting it here
+//   if it is the first), anything else goes to the application and is recorded in
+//   every snapshot whose local state it arrives after, before its channel's marker
+void snap_on_msg(int peer_id, const struct message *msg) {
+    int member = (peer_id >= 0 && peer_id < MAX_PEERS) ? snap_member_of[peer_id] : -1;
+    struct snap_file *done = NULL;
+    struct snap_run *run;
+    long started_ns = 0;
+    int markers_queued = 0;
+    uint32_t snap_id;
+
+    pthread_mutex_lock(snap_lock);          // lock (X)
+    if (msg->action == SNAP_MARKER && member >= 0 && msg->payload_len == sizeof(snap_id)) {
+        memcpy(&snap_id, msg->payload, sizeof(snap_id));
+        run = snap_find_locked(snap_id);
+        if (run == NULL) {
+            run = snap_record_locked(snap_id);  // first marker: its channel is recorded empty
+            markers_queued = 1;
+        }
+        if (run == NULL) {
+            fprintf(stderr, "error: snapshot %08x not recorded here\n", snap_id);
+        } else if (run->channels[member].closed) {
+            fprintf(stderr, "error: second marker of snapshot %08x from %s (ignored)\n",
+                    snap_id, peer_name(peer_id));
+        } else {
+            run->channels[member].closed = 1;
+            if (--run->markers_left == 0) {
+                started_ns = run->record_ns;
+                done = snap_finish_locked(run);
+            }
+        }
+    } else {
+        dispatch_msg(peer_id, msg);
+        for (run = snap_runs; member >= 0 && run != NULL; run = run->next) {
+            if (!run->channels[member].closed) {
+                snap_append(&run->channels[member], msg);   // in flight when its state was taken
+            }
+        }
+    }
+    pthread_mutex_unlock(snap_lock);        // unlock (o)
+
+    if (markers_queued) {
+        flush_all_msgs();   // a marker must not wait for company
+    }
+    if (done != NULL) {
+        snap_complete(done, started_ns);
+    }
+}
+
+//-- joins this process to the snapshots of member_names (same list in every member)
+//   state_lock is the application's: it holds it to change its state and send the
+//   messages that go with the change, the handlers run with it held (they must not
+//   take it) and get_state is called with it held
+//   snapshot files are written into dir
+int snap_start(char **member_names, int n_members, pthread_mutex_t *state_lock,
+               unsigned int (*get_state)(void *buf, unsigned int max), const char *dir) {
+    int i, n_others = 0;
+
+    if (n_members < 1 || n_members > SNAP_MAX_MEMBERS) {
+        fprintf(stderr, "error: snapshots of 1 to %i members\n", SNAP_MAX_MEMBERS);
+        return F_FAILURE;
+    }
+
+    snap_self = F_FAILURE;
+    for (i = 0; i < MAX_PEERS; i++) {
+        snap_member_of[i] = -1;
+    }
+    for (i = 0; i < n_members; i++) {
+        snap_peer_ids[i] = peer_intern(member_names[i]);
+        if (snap_peer_ids[i] == F_FAILURE) {
+            return F_FAILURE;
+        }
+        snap_member_of[snap_peer_ids[i]] = i;
+        if (strcmp(member_names[i], stub_whoami) == 0) {
+            snap_self = i;
+        } else {
+            snap_others[n_others++] = snap_peer_ids[i];
+        }
+    }
+    if (snap_self == F_FAILURE) {
+        fprintf(stderr, "error: %s is not a member of the snapshot group\n", stub_whoami);
+        return F_FAILURE;
+    }
+
+    snap_n_members = n_members;
+    snap_lock = state_lock;
+    snap_get_state = get_state;
+    snprintf(snap_dir, sizeof(snap_dir), "%s", dir);
+    set_recv_hook(snap_on_msg);
+    return F_SUCCESS;
+}
+
+//-- starts a snapshot from this process (the others join at its marker, whatever
+//   other snapshots they are recording), returns its id or F_FAILURE
+int snap_take() {
+    struct snap_file *done = NULL;
+    struct snap_run *run;
+    long started_ns = 0;
+    uint32_t snap_id;
+
+    pthread_mutex_lock(snap_lock);          // lock (X)
+    snap_id = (node_id_from_name(stub_whoami) << 16) | ++snap_seq;
+    run = snap_record_locked(snap_id);
+    if (run != NULL && run->markers_left == 0) {
+        started_ns = run->record_ns;
+        done = snap_finish_locked(run);     // alone in the group
+    }
+    pthread_mutex_unlock(snap_lock);        // unlock (o)
+    if (run == NULL) {
+        return F_FAILURE;
+    }
+
+    flush_all_msgs();   // the markers, which must not wait for company
+    if (done != NULL) {
+        snap_complete(done, started_ns);
+    }
+    return (int)snap_id;
+}
+
+//-- (mutex_snapdone held!) returns 1 if snapshot snap_id is among the last written
+int snap_done_locked(uint32_t snap_id) {
+    int i;
+
+    for (i = 0; i < SNAP_DONE_KEEP; i++) {
+        if (snap_done_ids[i] == snap_id) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//-- waits until the local part of snapshot snap_id is written (timeout_ms at most)
+int snap_wait(uint32_t snap_id, long timeout_ms) {
+    struct timespec deadline;
+    int wait_status = 0, status;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&mutex_snapdone);    // lock (X)
+    while (!snap_done_locked(snap_id) && wait_status != ETIMEDOUT) {
+        wait_status = pthread_cond_timedwait(&cond_snapdone, &mutex_snapdone, &deadline);
+    }
+    status = snap_done_locked(snap_id) ? F_SUCCESS : F_FAILURE;
+    pthread_mutex_unlock(&mutex_snapdone);  // unlock (o)
+    return status;
+}
+
+//-- (state_lock held!) returns 1 while any snapshot is between its local state and
+//   its last marker here
+int snap_active() {
+    return snap_runs != NULL;
+}
+
+//-- reports the snapshots written, the in-flight messages they hold, their bytes
+//   and how long the last one took from local state to file
+void snap_get_stats(long *taken, long *recorded_msgs, long *file_bytes, long *last_ns) {
+    pthread_mutex_lock(&mutex_snapdone);    // lock (X)
+    *taken = snap_taken;
+    *recorded_msgs = snap_recorded_msgs;
+    *file_bytes = snap_file_bytes;
+    *last_ns = snap_last_ns;
+    pthread_mutex_unlock(&mutex_snapdone);  // unlock (o)
+}
+
+//-- reads the snapshot file at path into file (snap_file_free() it afterwards)
+int snap_load(const char *path, struct snap_file *file) {
+    struct snap_channel_header channel;
+    FILE *in = fopen(path, "rb");
+    int i;
+
+    memset(file, 0, sizeof(*file));
+    if (in == NULL) {
+        perror(path);
+        return F_FAILURE;
+    }
+    if (fread(&file->header, sizeof(file->header), 1, in) != 1 ||
+        memcmp(file->header.magic, SNAP_MAGIC, sizeof(file->header.magic)) != 0 ||
+        file->header.version != SNAP_VERSION || file->header.state_len > SNAP_STATE_MAX ||
+        file->header.n_channels > SNAP_MAX_MEMBERS ||
+        fread(file->state, 1, file->header.state_len, in) != file->header.state_len) {
+        fprintf(stderr, "error: %s is not a version %i snapshot file\n", path, SNAP_VERSION);
+        fclose(in);
+        return F_FAILURE;
+    }
+    for (i = 0; i < file->header.n_channels; i++) {
+        if (fread(&channel, sizeof(channel), 1, in) != 1) {
+            break;
+        }
+        file->channels[i].closed = 1;
+        file->channels[i].peer_node = channel.peer_node;
+        file->channels[i].n_msgs = channel.n_msgs;
+        file->channels[i].bytes = file->channels[i].capacity = channel.bytes;
+        file->channels[i].frames = malloc(channel.bytes + 1);
+        if (file->channels[i].frames == NULL ||
+            fread(file->channels[i].frames, 1, channel.bytes, in) != channel.bytes) {
+            break;
+        }
+    }
+    fclose(in);
+    if (i < file->header.n_channels) {
+        fprintf(stderr, "error: %s is truncated\n", path);
+        snap_file_free(file);
+        return F_FAILURE;
+    }
+    return F_SUCCESS;
+}
+
+//-- decodes the message of channel at *offset and moves *offset past it,
+//   returns 1 when a message was decoded, 0 at the end or F_FAILURE
+int snap_next_msg(const struct snap_channel *channel, uint32_t *offset, struct message *msg) {
+    int consumed;
+
+    if (*offset >= channel->bytes) {
+        return 0;
+    }
+    memset(msg, 0, sizeof(*msg));
+    consumed = decode_msg(&channel->frames[*offset], channel->bytes - *offset, msg);
+    if (consumed <= 0) {
+        return F_FAILURE;
+    }
+    *offset += consumed;
+    return 1;
+}
+
+//-- frees the recorded messages of file
+void snap_file_free(struct snap_file *file) {
+    int i;
+
+    for (i = 0; i < SNAP_MAX_MEMBERS; i++) {
+        free(file->channels[i].frames);
+        file->channels[i].frames = NULL;
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <pthread.h>
+#include "./stub.h"
+
+
+#define SNAP_MAX_MEMBERS    MAX_PEERS
+#define SNAP_STATE_MAX      4096    // bytes of local state a process records
+#define SNAP_MAGIC          "SDCS"
+#define SNAP_VERSION        1
+#define SNAP_DONE_KEEP      64      // last snapshots written that snap_wait() still knows
+
+
+// first bytes of a snapshot file: the local state follows, then every channel
+struct snap_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t node_id;           // process that wrote the file
+    uint32_t snap_id;           // initiator node << 16 | its snapshot number
+    uint32_t lamport;           // Lamport time the local state was recorded at
+    uint32_t state_len;
+    uint16_t n_channels;        // incoming channels recorded (members - 1)
+    uint16_t reserved;
+};
+
+// an incoming channel in a snapshot file, its messages follow (encode_msg frames)
+struct snap_channel_header {
+    uint16_t peer_node;         // sender of the channel
+    uint16_t reserved;
+    uint32_t n_msgs;            // messages in flight when the snapshot was taken
+    uint32_t bytes;
+};
+
+// a channel while it is recorded (and in a loaded file)
+struct snap_channel {
+    int closed;                 // its marker arrived: nothing more to record
+    uint16_t peer_node;
+    uint32_t n_msgs;
+    uint32_t bytes, capacity;
+    unsigned char *frames;
+};
+
+// a snapshot while this process records it: any number at once (several initiators,
+// or the next one started before the last marker of this one arrived here)
+struct snap_run {
+    uint32_t id;                // initiator node << 16 | its snapshot number
+    int markers_left;           // channels still without its marker
+    uint32_t lamport;
+    uint32_t state_len;
+    long record_ns;             // when the local state was recorded
+    unsigned char state[SNAP_STATE_MAX];
+    struct snap_channel channels[SNAP_MAX_MEMBERS];
+    struct snap_run *next;
+};
+
+// a snapshot file read back with snap_load()
+struct snap_file {
+    struct snap_header header;
+    unsigned char state[SNAP_STATE_MAX];
+    struct snap_channel channels[SNAP_MAX_MEMBERS];
+};
+
+
+// on top of the stub (any member starts one at any time, every member connected to
+// every other)
+int snap_start(char **member_names, int n_members, pthread_mutex_t *state_lock,
+               unsigned int (*get_state)(void *buf, unsigned int max), const char *dir);
+int snap_take();
+int snap_wait(uint32_t snap_id, long timeout_ms);
+int snap_active();
+void snap_get_stats(long *taken, long *recorded_msgs, long *file_bytes, long *last_ns);
+
+// reading snapshot files back
+int snap_load(const char *path, struct snap_file *file);
+int snap_next_msg(const struct snap_channel *channel, uint32_t *offset, struct message *msg);
+void snap_file_free(struct snap_file *file);
+
+#endif // SNAPSHOT_H
@@ -11,6 +11,11 @@
 #include <err.h>
 #include <errno.h>
 #include <pthread.h> 
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/un.h>
 
 
 #ifdef DEBUG
@@ -26,44 +31,292 @@
 #define F_FAILURE           -1  // returned when a function failed
 #define F_SUCCESS           0   // returned when a function succeded
 #define F_CONN_CLOSE        -3  // returned when recv() returns 0 bytes read
+#define F_WOULDBLOCK        -4  // returned by try_send_msg() when the peer has no credit
 
 #define STUB_EXIT_SIGINT    12  // exit status when terminating by sigint signal
 
-#define NUM_OF_CLIENTS      2
+#define NUM_OF_CLIENTS      2   // default connections the server waits for
+
+#define UNIX_PATH_FORMAT    "/tmp/sdc-%i.sock"  // AF_UNIX socket of the server at port %i
+
+#define MESH_CONNECT_MS     5000    // time a mesh node waits for the peers of its list
+#define MESH_RETRY_MS       20      // pause between two connect() to a peer not up yet
+#define MESH_LINE_LEN       128     // longest line of a peer list
+
+#define SHUT_NONE           0   // two-phase shutdown state of a peer (server only)
+#define SHUT_READY          1   // its READY_TO_SHUTDOWN arrived
+#define SHUT_NOTIFIED       2   // SHUTDOWN_NOW was sent to it
+#define SHUT_ACKED          3   // its SHUTDOWN_ACK arrived
+
+#define WIRE_VERSION        3   // first byte after the length prefix of every frame
+#define WIRE_MAX_FRAME      512 // biggest encoded frame (a full vector clock fits)
+#define RX_BUFFER_SIZE      2048// bytes each receiver thread buffers from recv()
+#define NODE_NAME_LEN       20  // "P<id>" node names
+#define MSG_PAYLOAD_MAX     64  // application bytes a message can carry
+
+#define MAX_PEERS           64  // nodes a process can know (dense ids 0..MAX_PEERS-1)
+#define MAX_NODE_ID         64  // node ids ("P<id>") index vector clocks: 0..MAX_NODE_ID-1
+
+#define CLOCK_EQUAL         0   // clock_compare() results
+#define CLOCK_BEFORE        -1
+#define CLOCK_AFTER         1
+#define CLOCK_CONCURRENT    2
+
+#define HLC_COUNTER_BITS    16  // hybrid clock: wall ms << 16 | logical counter
+#define PEER_HASH_SIZE      128 // open addressing table, power of 2 > MAX_PEERS
+#define PEER_NO_CONN        -1  // conn_fd of a peer that is not connected
+
+#define BATCH_MAX_MSGS      32  // frames coalesced in a single writev()
+#define BATCH_WINDOW_US     200 // default time a queued frame may wait for company
+
+#define FLOW_WINDOW         256     // frames a sender may have unconsumed per connection
+#define FLOW_GRANT          64      // frames consumed before the receiver returns credit
+#define FLOW_QUEUE_BYTES    (64 * 1024) // frames each connection keeps waiting for credit
+#define CONN_MAX_FDS        1024    // connection fds that can be batched and flow controlled
+#define FLOW_DRAIN_MS       2000    // time terminating waits for the credit it lacks
+
+#define TRACE_RING_SIZE     65536   // events buffered in memory (power of 2)
+#define TRACE_FLUSH_MS      20      // how often the trace writer drains the ring
+#define TRACE_MAGIC         "SDCT"
+#define TRACE_VERSION       1       // read back as 256 when the byte order differs
+#define TRACE_SEND          1
+#define TRACE_RECV          2
+
+#define MSG_POOL_SLAB       64  // messages carved from the heap in one malloc
+#define MSG_POOL_CACHE      32  // messages each thread keeps in its own free-list
 
 
 enum operations {
     READY_TO_SHUTDOWN = 0,
     SHUTDOWN_NOW,
-    SHUTDOWN_ACK
+    SHUTDOWN_ACK,
+    TOM_DATA,                   // totally ordered multicast (see tomcast.c)
+    TOM_ACK,
+    MESH_HELLO,                 // names the connector of a mesh connection (no event)
+    SNAP_MARKER,                // Chandy-Lamport marker (see snapshot.c)
+    DMX_REQUEST,                // distributed lock (see dmutex.c)
+    DMX_REPLY,
+    DMX_TOKEN,
+    FLOW_CREDIT,                // frames the receiver consumed: the sender may send more (no event)
+    NUM_OF_OPERATIONS           // keep last
+};
+
+enum clock_modes {
+    CLOCK_LAMPORT = 0,          // scalar Lamport clock only (default)
+    CLOCK_VECTOR,               // + vector clock, sent as a sparse delta
+    CLOCK_HYBRID                // + hybrid logical clock (wall time aware)
+};
+
+// how processes reach the server: picked by its address ("unix", "shm" or an IP)
+enum transports {
+    TRANSPORT_TCP = 0,          // AF_INET stream socket
+    TRANSPORT_UNIX,             // AF_UNIX stream socket (same host)
+    TRANSPORT_SHM,              // AF_UNIX to connect, then a shared-memory ring per peer
+};
+
+// one line of a static peer list: "<name> <ip_address|unix|shm> <port>"
+struct mesh_entry {
+    char name[NODE_NAME_LEN];
+    char addr[64];
+    int port;
+};
+
+// extra clock carried by a message besides the Lamport clock
+struct clock_stamp {
+    enum clock_modes mode;
+    uint64_t hlc;                       // CLOCK_HYBRID: wall ms << 16 | counter
+    unsigned int vc[MAX_NODE_ID];       // CLOCK_VECTOR: entry i is node "P<i>"
 };
 
 struct message {
-    char origin[20];
+    unsigned int origin;        // node id of the sender ("P2" is node 2)
     enum operations action;
     unsigned int clock_lamport;
+    struct clock_stamp stamp;
+    unsigned int payload_len;   // 0 for the plain operations
+    unsigned char payload[MSG_PAYLOAD_MAX];
+};
+
+// bytes received from one connection that do not form a whole frame yet
+struct rx_buffer {
+    unsigned char data[RX_BUFFER_SIZE];
+    size_t len;
+    unsigned int vc_last[MAX_NODE_ID];  // last vector received: deltas apply on it
+};
+
+// registry entry: a node name interned to a dense id, and its connection
+struct peer {
+    char name[NODE_NAME_LEN];
+    unsigned int node_id;       // node_id_from_name(name), kept for the send path
+    int conn_fd;                // PEER_NO_CONN while the peer is not joined
+    unsigned int generation;    // joins so far: the leave of an older one is ignored
+};
+
+// frames queued for one connection, written together with a single writev()
+// (one per fd, whatever peers it leads to: frames keep the order they were sent in)
+struct out_batch {
+    pthread_mutex_t mutex;
+    int conn_fd;                // connection the queued frames go to (fixed)
+    int count;                  // frames queued
+    long first_ns;              // when the oldest queued frame was queued
+    unsigned int vc_sent[MAX_NODE_ID];  // last vector sent on conn_fd: the next one is a delta
+    unsigned char frames[BATCH_MAX_MSGS][WIRE_MAX_FRAME];
+    struct iovec iov[BATCH_MAX_MSGS];
+        // flow control: frames encoded in order, waiting for credit of conn_fd
+    unsigned char *pending;     // malloc'ed when first needed (deferred sends grow it)
+    size_t pending_cap;         // FLOW_QUEUE_BYTES, or more after deferred sends
+    size_t pending_len;         // bytes queued
+    int pending_count;          // frames queued
+    pthread_cond_t room;        // credit arrived: the queue has room again
+    int max_pending;            // deepest the queue got
+    long queued_total;          // frames that had to wait for credit
+    long stalls;                // sends that found the queue full and waited
+    long stall_ns;              // time those sends waited
+    long would_block;           // try_send_msg() calls refused
+};
+
+// flow control of one connection, as reported by get_flow_stats()
+struct flow_stats {
+    int credits;                // frames the connection can take right now
+    int queued;                 // frames waiting for credit
+    int max_queued;             // deepest the queue got
+    long queued_total;          // frames that had to wait for credit
+    long stalls;                // sends that found the queue full and waited
+    long stall_ns;              // time those sends waited
+    long would_block;           // try_send_msg() calls refused
+};
+
+// first bytes of a binary trace file, events follow
+struct trace_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t node_id;
+    char name[20];
+};
+
+// one SEND or RECV of a message, as recorded in a binary trace file
+struct trace_event {
+    uint64_t mono_ns;           // CLOCK_MONOTONIC: comparable among processes of a host
+    uint32_t lamport;           // Lamport time of the event
+    uint32_t msg_lamport;       // Lamport time the message was sent with
+    uint16_t peer;              // node id at the other end of the message
+    uint8_t type;               // TRACE_SEND or TRACE_RECV
+    uint8_t action;
+    uint32_t reserved;
+};
+
+// ring slot: seq == index + 1 once the event at index is fully written
+struct trace_slot {
+    atomic_ulong seq;
+    struct trace_event ev;
+};
+
+// pool slot: the message must stay the first member (free_msg casts back)
+struct pooled_msg {
+    struct message msg;
+    struct pooled_msg *next;
 };
 
 
+// shared-memory rings (shmring.c), a link per connection fd
+struct shm_link;
+int shm_connect(int sock_fd);
+int shm_accept(int conn_fd);
+void shm_detach(int fd);
+struct shm_link *shm_link_of(int fd);
+ssize_t shm_writev(struct shm_link *link, const struct iovec *iov, int iovcnt);
+ssize_t shm_read(struct shm_link *link, void *buf, size_t len);
+
+
 // GLOBAL VARIABLES:
 char *stub_whoami;          // copy from whoami (see P1, P2 or P3...)
 int sock_status     = 0;    // can take SOCKET_RUNNING or SOCKET_CLOSED as value
-int l_clock         = 0;    // global Lamport clock
+atomic_int l_clock  = 0;    // global Lamport clock (lock-free, see update_clock_lamport)
+unsigned int self_node_id = 0;          // node id of stub_whoami
+
+    // clock modes (set_clock_mode() before starting up)
+enum clock_modes clock_mode = CLOCK_LAMPORT;
+unsigned int v_clock[MAX_NODE_ID];      // vector clock (mutex_vclock)
+atomic_ullong h_clock = 0;              // hybrid logical clock (lock-free)
 
 int sock_sfd        = 0;    // Socket file descriptor (NOT CONNECTION, SOCKET)
-int cli_1_cfd       = 0;    // (server only!) stores the fd of connection P2-P1
-int cli_3_cfd       = 0;    // (server only!) stores the fd of connection P2-P3
+int is_server       = 0;    // clients route peers without connection to sock_sfd
+enum transports transport = TRANSPORT_TCP;  // set by init_socket() from the address
+int server_port     = 0;    // (server only!) names the AF_UNIX socket file
+int mesh_mode       = 0;    // started from a peer list: a connection per peer, no hub
+int mesh_joined     = 0;    // peers with a connection so far (mutex_mesh)
+
+    // upper layers: called by the receiver threads for their operations
+void (*msg_handlers[NUM_OF_OPERATIONS])(int peer_id, const struct message *msg);
+void (*recv_hook)(int peer_id, const struct message *msg) = NULL;  // sees every message first
+
+    // peer registry (ids are dense: peers[0..peer_count-1])
+struct peer peers[MAX_PEERS];
+int peer_count      = 0;                // protected by mutex_peers (as every entry)
+int peer_hash[PEER_HASH_SIZE];          // name hash -> id + 1 (0 = empty slot)
+
+    // output batching (one batch per connection fd, see get_batch)
+struct out_batch *_Atomic conn_batches[CONN_MAX_FDS];  // allocated at the first frame of each fd
+atomic_int conn_batch_top   = 0;    // fds below it may have a batch (the flusher scans them)
+atomic_long batch_window_ns = BATCH_WINDOW_US * 1000L; // 0 = write every frame at once
+atomic_long batch_msgs      = 0;    // frames written by flush_batch()
+atomic_long batch_syscalls  = 0;    // writev() calls done by flush_batch()
+pthread_once_t batch_once   = PTHREAD_ONCE_INIT;
+pthread_t batch_thread;             // flushes the batches whose window expired
+__thread int send_deferred  = 0;    // 1: this thread's frames are queued, never awaited nor written
+__thread int send_never_waits = 0;  // 1: a receiver thread, its sends never wait for credit
+
+    // credit-based flow control (a connection is controlled once conn_open() is called)
+atomic_int flow_credits[CONN_MAX_FDS];  // frames the peer at fd can still take
+atomic_int flow_on[CONN_MAX_FDS];       // 0: fd sends without credit (not a peer link)
+int flow_consumed[CONN_MAX_FDS];        // frames consumed, not returned as credit yet (receiver threads!)
 
 int conn_count      = 0;    // counts connections established with threads
-pthread_t conn_threads[NUM_OF_CLIENTS]; // (server only!) threads to receive from clients
+int num_clients     = NUM_OF_CLIENTS;   // (server only!) connections to accept
+pthread_t conn_threads[MAX_PEERS];      // (server only!) threads to receive from clients
+int conn_unnamed[MAX_PEERS];            // (server only!) fd of each thread until a frame names its peer, -1 after (mutex_shutack)
 pthread_t client_thread;                // (clients only!) thread to receive from server
 
+    // two-phase shutdown (mutex_shutack)
+int shutdown_readys = 0;    // counts the READY_TO_SHUTDOWN's received by the server
 int shutdown_acks   = 0;    // counts the SHUTDOWN_ACK's received by the server
+int shutdown_now    = 0;    // (clients only!) 1: SHUTDOWN_NOW arrived, -1: server gone
+int peer_shutdown[MAX_PEERS];           // SHUT_* state of every peer
+long peer_ack_ns[MAX_PEERS];            // when the SHUTDOWN_ACK of every peer arrived
+long shutdown_sent_ns = 0;              // when SHUTDOWN_NOW was sent to all of them
+
+    // binary trace (trace_start / trace_stop)
+struct trace_slot *trace_ring = NULL;
+atomic_ulong trace_head     = 0;    // next slot to claim (producers)
+atomic_ulong trace_tail     = 0;    // next slot to write to the file (writer only)
+atomic_long trace_dropped   = 0;    // events lost because the ring was full
+atomic_int trace_on         = 0;
+int print_trace             = 1;    // "PX, clock, SEND/RECV" lines on stdout
+FILE *trace_file            = NULL;
+pthread_t trace_thread;
+
+    // message pool (create_empty_msg / free_msg)
+struct pooled_msg *msg_pool_free = NULL;            // shared free-list (mutex_msgpool)
+__thread struct pooled_msg *msg_cache = NULL;       // per-thread free-list (no locking)
+__thread int msg_cache_len = 0;
+__thread int msg_cache_keyed = 0;   // msg_cache_key is set: the cache goes back on exit
+pthread_key_t msg_cache_key;
+pthread_once_t msg_cache_once = PTHREAD_ONCE_INIT;
+atomic_long msg_pool_gets   = 0;    // messages handed out by the pool
+atomic_long msg_pool_slabs  = 0;    // mallocs done by the pool (1 per MSG_POOL_SLAB msgs)
 
 
 // MUTEXES:
-pthread_mutex_t mutex_lclock    = PTHREAD_MUTEX_INITIALIZER; // protects l_clock
-pthread_mutex_t mutex_shutack   = PTHREAD_MUTEX_INITIALIZER; // protects SHUTDOWN_ACKs
+pthread_mutex_t mutex_shutack   = PTHREAD_MUTEX_INITIALIZER; // protects the shutdown state
+pthread_mutex_t mutex_msgpool   = PTHREAD_MUTEX_INITIALIZER; // protects msg_pool_free
+pthread_mutex_t mutex_peers     = PTHREAD_MUTEX_INITIALIZER; // protects interning
+pthread_mutex_t mutex_vclock    = PTHREAD_MUTEX_INITIALIZER; // protects v_clock
+pthread_mutex_t mutex_mesh      = PTHREAD_MUTEX_INITIALIZER; // protects mesh_joined
+pthread_mutex_t mutex_batches   = PTHREAD_MUTEX_INITIALIZER; // protects allocating conn_batches
+
+// CONDITION VARIABLES:
+pthread_cond_t cond_shutdown    = PTHREAD_COND_INITIALIZER;  // shutdown state changed
+pthread_cond_t cond_mesh        = PTHREAD_COND_INITIALIZER;  // one more peer joined the mesh
 
 
 //-- handles sigint signals when received
@@ -93,10 +346,11 @@ void perror_msg(char *msg, int sockfd, int is_socket_running) {
 //-- calls perror_msg with SOCKET_RUNNING as third parameter
 #define perror_msg_sr(msg, sockfd) perror_msg(msg, sockfd, SOCKET_RUNNING)
 
-//-- returns F_SUCCESS in case argc is 3, and F_FAILURE otherwise
+//-- returns F_SUCCESS in case argc is 3 (or 4, with a trace file), and F_FAILURE otherwise
 int check_argnum(int argc) {
-    if (argc != 3) {
-        fprintf(stderr, "usage: ./%s <ip_address> <port>\n", stub_whoami);
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "usage: ./%s <ip_address|unix|shm> <port> [trace_file]\n", stub_whoami);
+        fprintf(stderr, "       ./%s mesh <peer_list> [trace_file]\n", stub_whoami);
         return F_FAILURE;
     }
     return F_SUCCESS;
@@ -119,236 +373,1785 @@ int try_get_port(char *str_port) {
 }
 
 //-- starts up a new socket, returns its fd when success, F_FAILURE otherwise
-int init_socket(struct sockaddr_in *servaddr, char *serv_ip, int serv_port) {
-    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+int init_socket(struct sockaddr_storage *servaddr, socklen_t *addr_len, char *serv_ip, int serv_port) {
+    struct sockaddr_in *inaddr = (struct sockaddr_in *)servaddr;
+    struct sockaddr_un *unaddr = (struct sockaddr_un *)servaddr;
+    int sock_fd;
+
+    // co-located processes skip TCP: "unix" and "shm" name the transport, not a host
+    if (strcmp(serv_ip, "unix") == 0) {
+        transport = TRANSPORT_UNIX;
+    } else if (strcmp(serv_ip, "shm") == 0) {
+        transport = TRANSPORT_SHM;
+    }
 
+    sock_fd = socket((transport == TRANSPORT_TCP) ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
     if (sock_fd < 0) {
         perror_msg("Error creating socket", sock_fd, SOCKET_CLOSED);
         return F_FAILURE;
     }
     printf("Socket successfully created...\n");
 
+    memset(servaddr, 0, sizeof(*servaddr));
+    if (transport != TRANSPORT_TCP) {
+        // the port names the socket file, so several servers can coexist
+        unaddr->sun_family = AF_UNIX;
+        snprintf(unaddr->sun_path, sizeof(unaddr->sun_path), UNIX_PATH_FORMAT, serv_port);
+        *addr_len = sizeof(*unaddr);
+        sock_status = SOCKET_RUNNING;
+        return sock_fd;
+    }
+
     // port and IP configuration for the socket
-    servaddr->sin_family = AF_INET;
-    if (inet_pton(AF_INET, serv_ip, &(servaddr->sin_addr)) <= 0) {
+    inaddr->sin_family = AF_INET;
+    if (inet_pton(AF_INET, serv_ip, &(inaddr->sin_addr)) <= 0) {
         perror_msg_sr("Invalid address / Address not supported", sock_fd);
         return F_FAILURE;
     }
-    servaddr->sin_port = htons(serv_port);
+    inaddr->sin_port = htons(serv_port);
+    *addr_len = sizeof(*inaddr);
+
+    // sock_status is set to SOCKET_RUNNING when success
+    sock_status = SOCKET_RUNNING;
+    return sock_fd;
+}
+
+//-- (server only!) forces near-instant reuse of ports
+void enable_setsockopt(int serv_sfd) {
+    const int ENABLE_SSOPT = 1;
+
+    if (setsockopt(serv_sfd, SOL_SOCKET, SO_REUSEADDR, &ENABLE_SSOPT, sizeof(int)) < 0) {
+        perror_msg_sr("setsockopt(SO_REUSEADDR) failed\n", serv_sfd);
+    }
+}
+
+//-- (server only!) bind and listen
+int bind_and_listen(int serv_sfd, struct sockaddr_storage *servaddr, socklen_t addr_len) {
+    // a socket file left by an earlier run would make bind() fail
+    if (servaddr->ss_family == AF_UNIX) {
+        unlink(((struct sockaddr_un *)servaddr)->sun_path);
+    }
+
+    if (bind(serv_sfd, (struct sockaddr *) servaddr, addr_len) < 0) {
+        perror_msg_sr("bind failed", serv_sfd);
+        return F_FAILURE;
+    }
+    printf("Socket successfully binded...\n");
+
+    // backlog=1 so the server has no trouble listening both clients
+    if (listen(serv_sfd, 1) < 0) {
+        perror_msg_sr("listen failed", serv_sfd);
+        return F_FAILURE;
+    }
+
+    printf("Server listening...\n");
+    return F_SUCCESS;
+}
+
+//-- (server only!) aceepts a client and returns the connection fd related to it
+int accept_client(int serv_sfd, struct sockaddr_storage *cliaddr) {
+    socklen_t cliaddr_len = sizeof(*cliaddr);
+    int conn_fd = accept(serv_sfd, (struct sockaddr * ) cliaddr, &cliaddr_len);
+
+    if (conn_fd < 0) {
+        perror_msg_sr("accept failed", serv_sfd);
+        return F_FAILURE;
+    }
+
+    return conn_fd;
+}
+
+//-- (client only!) tries to connect the client to the server
+int connect_to_server(int cli_sfd, struct sockaddr_storage *servaddr, socklen_t addr_len) {
+    if (connect(cli_sfd, (struct sockaddr *) servaddr, addr_len) < 0) {
+        perror_msg_sr("connect error", cli_sfd);
+        return F_FAILURE;
+    }
+
+    printf("connected to the server...\n");
+    return F_SUCCESS;
+}
+
+//-- updates the global Lamport clock (l_clock) after the current local value
+void update_clock_lamport(int *l_clock_loc) {
+    int cur = atomic_load_explicit(&l_clock, memory_order_relaxed);
+    int next;
+
+    // UPDATE: global_clock = max(global_clock, local_clock) + 1
+    // CAS loop: if another thread moved l_clock meanwhile, cur is refreshed and retried
+    do {
+        next = (*l_clock_loc > cur ? *l_clock_loc : cur) + 1;
+    } while (!atomic_compare_exchange_weak_explicit(&l_clock, &cur, next,
+                                                    memory_order_acq_rel,
+                                                    memory_order_relaxed));
+
+    *l_clock_loc = next; // also updates the local clock received
+}
+
+//-- returns the value of the global Lamport clock (l_clock)
+int get_clock_lamport() {
+    // relaxed is enough: readers only poll the value, they never publish data with it
+    return atomic_load_explicit(&l_clock, memory_order_relaxed);
+}
+
+//-- ticks the global Lamport clock for a local event, returns the event's time
+int next_clock_lamport() {
+    int l_clock_loc = get_clock_lamport();
+
+    update_clock_lamport(&l_clock_loc);
+    return l_clock_loc;
+}
+
+//-- selects the clock carried besides Lamport's (all processes must agree)
+void set_clock_mode(enum clock_modes mode) {
+    clock_mode = mode;
+}
+
+//-- returns the clock mode in use
+enum clock_modes get_clock_mode() {
+    return clock_mode;
+}
+
+//-- returns the wall clock in milliseconds
+uint64_t wall_ms() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+//-- HLC update: new = max(hlc + 1, remote + 1, wall << 16)
+//   with hlc = l << 16 | c this is exactly the (l, c) rules of the HLC paper:
+//   same l -> counter + 1, bigger wall time -> (wall, 0). remote = 0 on sends
+uint64_t update_clock_hybrid(uint64_t remote) {
+    uint64_t cur = atomic_load_explicit(&h_clock, memory_order_relaxed);
+    uint64_t next, pt = wall_ms() << HLC_COUNTER_BITS;
+
+    do {
+        next = cur + 1;
+        if (remote + 1 > next) {
+            next = remote + 1;
+        }
+        if (pt > next) {
+            next = pt;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&h_clock, &cur, next,
+                                                    memory_order_acq_rel,
+                                                    memory_order_relaxed));
+    return next;
+}
+
+//-- stamps an outgoing message with the clock of the current mode
+void clock_stamp_send(struct clock_stamp *stamp) {
+    stamp->mode = clock_mode;
+
+    if (clock_mode == CLOCK_VECTOR) {
+        pthread_mutex_lock(&mutex_vclock);      // lock (X)
+        v_clock[self_node_id]++;                // the send is an event
+        memcpy(stamp->vc, v_clock, sizeof(v_clock));
+        pthread_mutex_unlock(&mutex_vclock);    // unlock (o)
+    } else if (clock_mode == CLOCK_HYBRID) {
+        stamp->hlc = update_clock_hybrid(0);
+    }
+}
+
+//-- merges the clock of a received message into the local clocks
+void clock_stamp_receive(const struct clock_stamp *stamp) {
+    int i;
+
+    if (clock_mode == CLOCK_VECTOR && stamp->mode == CLOCK_VECTOR) {
+        pthread_mutex_lock(&mutex_vclock);      // lock (X)
+        for (i = 0; i < MAX_NODE_ID; i++) {
+            if (stamp->vc[i] > v_clock[i]) {
+                v_clock[i] = stamp->vc[i];
+            }
+        }
+        v_clock[self_node_id]++;                // the receive is an event
+        pthread_mutex_unlock(&mutex_vclock);    // unlock (o)
+    } else if (clock_mode == CLOCK_HYBRID && stamp->mode == CLOCK_HYBRID) {
+        update_clock_hybrid(stamp->hlc);
+    }
+}
+
+//-- updates every clock after receiving msg, returns the new Lamport time
+int clock_on_receive(const struct message *msg) {
+    int l_clock_loc = msg->clock_lamport;
+
+    update_clock_lamport(&l_clock_loc);
+    clock_stamp_receive(&msg->stamp);
+    return l_clock_loc;
+}
+
+//-- copies the current local clock of the current mode to now
+void get_clock_stamp(struct clock_stamp *now) {
+    now->mode = clock_mode;
+    now->hlc = atomic_load_explicit(&h_clock, memory_order_relaxed);
+
+    pthread_mutex_lock(&mutex_vclock);          // lock (X)
+    memcpy(now->vc, v_clock, sizeof(v_clock));
+    pthread_mutex_unlock(&mutex_vclock);        // unlock (o)
+}
+
+//-- orders the events that stamped a and b: CLOCK_BEFORE when a happened before
+//   b, CLOCK_AFTER, CLOCK_EQUAL or (vector clocks only) CLOCK_CONCURRENT
+//   stamps of CLOCK_LAMPORT (no vector kept) or of two modes can't be ordered:
+//   CLOCK_CONCURRENT too
+int clock_compare(const struct clock_stamp *a, const struct clock_stamp *b) {
+    int i, a_less = 0, b_less = 0;
+
+    if (a->mode != b->mode || a->mode == CLOCK_LAMPORT) {
+        return CLOCK_CONCURRENT;
+    }
+    if (a->mode == CLOCK_HYBRID) {
+        return (a->hlc < b->hlc) ? CLOCK_BEFORE : (a->hlc > b->hlc) ? CLOCK_AFTER : CLOCK_EQUAL;
+    }
+
+    for (i = 0; i < MAX_NODE_ID; i++) {
+        if (a->vc[i] < b->vc[i]) {
+            a_less = 1;
+        } else if (a->vc[i] > b->vc[i]) {
+            b_less = 1;
+        }
+    }
+    if (a_less && b_less) {
+        return CLOCK_CONCURRENT;
+    }
+    return a_less ? CLOCK_BEFORE : b_less ? CLOCK_AFTER : CLOCK_EQUAL;
+}
+
+//-- (thread exit) gives the whole cache of the exiting thread to the shared list
+void release_msg_cache(void *unused) {
+    struct pooled_msg *node;
+
+    pthread_mutex_lock(&mutex_msgpool);     // lock (X)
+    while (msg_cache != NULL) {
+        node = msg_cache;
+        msg_cache = node->next;
+        node->next = msg_pool_free;
+        msg_pool_free = node;
+    }
+    msg_cache_len = 0;
+    pthread_mutex_unlock(&mutex_msgpool);   // unlock (o)
+}
+
+void create_msg_cache_key() {
+    pthread_key_create(&msg_cache_key, release_msg_cache);
+}
+
+//-- makes the calling thread give its cache back when it exits (once per thread)
+void key_msg_cache() {
+    if (!msg_cache_keyed) {
+        pthread_once(&msg_cache_once, create_msg_cache_key);
+        pthread_setspecific(msg_cache_key, &msg_cache_keyed);  // (NULL: no destructor)
+        msg_cache_keyed = 1;
+    }
+}
+
+//-- refills the calling thread's cache from the shared free-list or a new slab
+int refill_msg_cache() {
+    struct pooled_msg *slab;
+    int i;
+
+    key_msg_cache();
+    pthread_mutex_lock(&mutex_msgpool);     // lock (X)
+    while (msg_pool_free != NULL && msg_cache_len < MSG_POOL_CACHE / 2) {
+        struct pooled_msg *node = msg_pool_free;
+        msg_pool_free = node->next;
+        node->next = msg_cache;
+        msg_cache = node;
+        msg_cache_len++;
+    }
+    pthread_mutex_unlock(&mutex_msgpool);   // unlock (o)
+
+    if (msg_cache != NULL) {
+        return F_SUCCESS;
+    }
+
+    // shared list was empty too: carve a whole slab (never given back to the heap)
+    slab = malloc(MSG_POOL_SLAB * sizeof(struct pooled_msg));
+    if (slab == NULL) {
+        perror("malloc failed");
+        return F_FAILURE;
+    }
+    atomic_fetch_add_explicit(&msg_pool_slabs, 1, memory_order_relaxed);
+    DEBUG_PRINTF("[!] MSG POOL: new slab of %i messages\n", MSG_POOL_SLAB);
+
+    for (i = 0; i < MSG_POOL_SLAB; i++) {
+        slab[i].next = msg_cache;
+        msg_cache = &slab[i];
+    }
+    msg_cache_len += MSG_POOL_SLAB;
+    return F_SUCCESS;
+}
+
+//-- returns an empty message taken from the message pool
+struct message* create_empty_msg() {
+    struct pooled_msg *node;
+
+    if (msg_cache == NULL && refill_msg_cache() == F_FAILURE) {
+        return NULL;
+    }
+
+    node = msg_cache;
+    msg_cache = node->next;
+    msg_cache_len--;
+    atomic_fetch_add_explicit(&msg_pool_gets, 1, memory_order_relaxed);
+
+    return &node->msg;
+}
+
+//-- returns the node id of a node name ("P2" -> 2), 0 if the name has no number
+unsigned int node_id_from_name(const char *name) {
+    while (*name != '\0' && (*name < '0' || *name > '9')) {
+        name++;
+    }
+    return (unsigned int)strtoul(name, NULL, 10);
+}
+
+//-- returns F_SUCCESS if name is "P<id>" with id < MAX_NODE_ID, F_FAILURE otherwise:
+//   node ids index the vector clocks, so any other name would collide with another node
+int check_node_name(const char *name) {
+    size_t digits = (name[0] == 'P') ? strspn(&name[1], "0123456789") : 0;
+
+    // digits only, no leading zero ("P02" would be a second name of "P2"),
+    // few enough of them for strtoul() not to wrap
+    if (digits == 0 || digits > 9 || name[1 + digits] != '\0' ||
+        (name[1] == '0' && digits > 1) || node_id_from_name(name) >= MAX_NODE_ID) {
+        fprintf(stderr, "error: node name \"%s\" is not P<id> (id < %i)\n", name, MAX_NODE_ID);
+        return F_FAILURE;
+    }
+    return F_SUCCESS;
+}
+
+//-- writes the node name of a node id (2 -> "P2") in name (NODE_NAME_LEN bytes)
+char *node_name_from_id(unsigned int id, char *name) {
+    snprintf(name, NODE_NAME_LEN, "P%u", id);
+    return name;
+}
+
+//-- fills msg in place with the corresponding origin, action and clock values
+void fill_msg(struct message *msg, const char *origin, enum operations action, unsigned int clock) {
+    msg->origin = node_id_from_name(origin);    // only the node id travels
+    msg->action = action;                       // add the action
+    msg->clock_lamport = clock;                 // set the clock
+    msg->payload_len = 0;                       // no payload by default
+}
+
+//-- creates a message with the corresponding origin, action and clock values
+struct message* create_msg(const char *origin, enum operations action, unsigned int clock) {
+    struct message *msg = create_empty_msg();
+
+    if (msg == NULL) {
+        return NULL;
+    }
+    fill_msg(msg, origin, action, clock);
+
+    DEBUG_PRINTF("[!] POOL GET OF <P%u, %u> MSG\n", msg->origin, msg->clock_lamport);
+
+    return msg;
+}
+
+//-- gives the msg it receives as parameter back to the message pool
+void free_msg(struct message* msg) {
+    struct pooled_msg *node = (struct pooled_msg *)msg;
+
+    DEBUG_PRINTF("[!] POOL PUT OF <P%u, %u> MSG\n", msg->origin, msg->clock_lamport);
+
+    key_msg_cache();    // (a thread that only frees keeps a cache too)
+    node->next = msg_cache;
+    msg_cache = node;
+    msg_cache_len++;
+
+    // cache too long (e.g. a thread that only frees): give half to the shared list
+    if (msg_cache_len > MSG_POOL_CACHE) {
+        pthread_mutex_lock(&mutex_msgpool);     // lock (X)
+        while (msg_cache_len > MSG_POOL_CACHE / 2) {
+            node = msg_cache;
+            msg_cache = node->next;
+            msg_cache_len--;
+            node->next = msg_pool_free;
+            msg_pool_free = node;
+        }
+        pthread_mutex_unlock(&mutex_msgpool);   // unlock (o)
+    }
+}
+
+//-- reports how many messages the pool handed out and how many mallocs it needed
+void get_msg_pool_stats(long *gets, long *slab_mallocs) {
+    *gets = atomic_load_explicit(&msg_pool_gets, memory_order_relaxed);
+    *slab_mallocs = atomic_load_explicit(&msg_pool_slabs, memory_order_relaxed);
+}
+
+//-- writes value as an unsigned LEB128 varint, returns the bytes used (max 10)
+int put_varint(unsigned char *buf, uint64_t value) {
+    int n = 0;
+
+    while (value >= 0x80) {
+        buf[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (unsigned char)value;
+    return n;
+}
+
+//-- reads a varint from buf (len bytes), returns the bytes used, 0 if incomplete
+int get_varint(const unsigned char *buf, size_t len, uint64_t *value) {
+    uint64_t result = 0;
+    size_t n = 0;
+    int shift = 0;
+
+    while (n < len && shift < 70) {
+        result |= (uint64_t)(buf[n] & 0x7f) << shift;
+        if ((buf[n++] & 0x80) == 0) {
+            *value = result;
+            return (int)n;
+        }
+        shift += 7;
+    }
+    return (shift >= 70) ? F_FAILURE : 0;  // too long is a corrupt stream
+}
+
+//-- reads the varint at buf[*pos] that must end before end, moving *pos past it,
+//   F_FAILURE if it does not (in a whole frame that is corruption, not a partial read)
+int get_varint_in(const unsigned char *buf, size_t *pos, size_t end, uint64_t *value) {
+    int used;
+
+    if (*pos >= end) {
+        return F_FAILURE;
+    }
+    used = get_varint(&buf[*pos], end - *pos, value);
+    if (used <= 0) {
+        return F_FAILURE;
+    }
+    *pos += used;
+    return F_SUCCESS;
+}
+
+//-- encodes the vector entries that differ from vc_base as (id, value) pairs
+//   (vc_base NULL: from an all-zero vector), then vc_base takes the new vector
+int put_vector_delta(unsigned char *buf, const unsigned int *vc, unsigned int *vc_base) {
+    unsigned char pairs[WIRE_MAX_FRAME];
+    int i, n = 0, pairs_len = 0, count = 0;
+
+    for (i = 0; i < MAX_NODE_ID; i++) {
+        if (vc[i] != (vc_base != NULL ? vc_base[i] : 0)) {
+            pairs_len += put_varint(&pairs[pairs_len], i);
+            pairs_len += put_varint(&pairs[pairs_len], vc[i]);
+            count++;
+        }
+    }
+    if (vc_base != NULL) {
+        memcpy(vc_base, vc, MAX_NODE_ID * sizeof(unsigned int));
+    }
+
+    n = put_varint(buf, count);
+    memcpy(&buf[n], pairs, pairs_len);
+    return n + pairs_len;
+}
+
+//-- encodes msg in frame (WIRE_MAX_FRAME bytes), returns the frame length
+//   frame: varint len | u8 version | varint node id | u8 action | varint clock
+//          [ | u8 clock mode | vector delta or varint hlc ]    (version 2)
+//          [ | varint payload len | payload ]                   (version 3)
+//   len counts the bytes after itself, so newer versions may append fields
+//   vc_base is the last vector sent on the same connection (see put_vector_delta)
+int encode_msg(const struct message *msg, unsigned int *vc_base, unsigned char *frame) {
+    unsigned char body[WIRE_MAX_FRAME];
+    int body_len = 0, prefix_len;
+
+    body[body_len++] = WIRE_VERSION;
+    body_len += put_varint(&body[body_len], msg->origin);
+    body[body_len++] = (unsigned char)msg->action;
+    body_len += put_varint(&body[body_len], msg->clock_lamport);
+
+    if (msg->stamp.mode == CLOCK_VECTOR) {
+        body[body_len++] = CLOCK_VECTOR;
+        body_len += put_vector_delta(&body[body_len], msg->stamp.vc, vc_base);
+    } else if (msg->stamp.mode == CLOCK_HYBRID) {
+        body[body_len++] = CLOCK_HYBRID;
+        body_len += put_varint(&body[body_len], msg->stamp.hlc);
+    } else if (msg->payload_len > 0) {
+        body[body_len++] = CLOCK_LAMPORT;   // the payload needs the mode byte first
+    }   // Lamport only and no payload: nothing else to add
+
+    if (msg->payload_len > 0) {
+        body_len += put_varint(&body[body_len], msg->payload_len);
+        memcpy(&body[body_len], msg->payload, msg->payload_len);
+        body_len += msg->payload_len;
+    }
+
+    prefix_len = put_varint(frame, body_len);
+    memcpy(&frame[prefix_len], body, body_len);
+    return prefix_len + body_len;
+}
+
+//-- decodes one frame from buf, returns the bytes consumed, 0 if the frame is
+//   not complete yet and F_FAILURE if the stream is corrupt
+//   vector entries in the frame overwrite msg->stamp.vc: the caller leaves the
+//   last vector of the connection there to rebuild the whole vector
+int decode_msg(const unsigned char *buf, size_t len, struct message *msg) {
+    uint64_t body_len, value, count, id;
+    int prefix_len, used;
+    size_t pos, end;
+
+    prefix_len = get_varint(buf, len, &body_len);
+    if (prefix_len <= 0) {
+        return prefix_len;
+    }
+    if (body_len < 4 || body_len > WIRE_MAX_FRAME) {
+        return F_FAILURE;
+    }
+    if (len < prefix_len + body_len) {
+        return 0;   // partial frame: wait for more bytes
+    }
+
+    // every field must end inside the frame: a varint or byte running past end
+    // is a corrupt frame (get_varint_in() and the pos < end checks)
+    pos = prefix_len;
+    end = prefix_len + body_len;
+    if (buf[pos++] < 1) {
+        return F_FAILURE;
+    }
+
+    if (get_varint_in(buf, &pos, end, &value) == F_FAILURE || pos >= end) {
+        return F_FAILURE;
+    }
+    msg->origin = (unsigned int)value;
+
+    msg->action = (enum operations)buf[pos++];
+
+    if (get_varint_in(buf, &pos, end, &value) == F_FAILURE) {
+        return F_FAILURE;
+    }
+    msg->clock_lamport = (unsigned int)value;
+
+    // version 1 frames (and Lamport-only ones) end here
+    msg->stamp.mode = (pos < end) ? (enum clock_modes)buf[pos++] : CLOCK_LAMPORT;
+
+    if (msg->stamp.mode == CLOCK_VECTOR) {
+        if (get_varint_in(buf, &pos, end, &count) == F_FAILURE) {
+            return F_FAILURE;
+        }
+        while (count-- > 0) {
+            if (get_varint_in(buf, &pos, end, &id) == F_FAILURE || id >= MAX_NODE_ID ||
+                get_varint_in(buf, &pos, end, &value) == F_FAILURE) {
+                return F_FAILURE;
+            }
+            msg->stamp.vc[id] = (unsigned int)value;
+        }
+    } else if (msg->stamp.mode == CLOCK_HYBRID) {
+        if (get_varint_in(buf, &pos, end, &value) == F_FAILURE) {
+            return F_FAILURE;
+        }
+        msg->stamp.hlc = value;
+    }
+
+    msg->payload_len = 0;
+    if (pos < end) {
+        used = get_varint(&buf[pos], end - pos, &value);
+        if (used <= 0 || value > MSG_PAYLOAD_MAX || value > end - pos - used) {
+            return F_FAILURE;
+        }
+        pos += used;
+        memcpy(msg->payload, &buf[pos], value);
+        msg->payload_len = (unsigned int)value;
+    }
+
+    // any bytes left belong to a newer version: skipped
+    return end;
+}
+
+//-- returns the nanoseconds of CLOCK_MONOTONIC
+long monotonic_ns() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+//-- (any thread!) records an event in the trace ring, never blocks: a full ring drops it
+void trace_record(int type, unsigned int peer_node, unsigned int lamport,
+                  unsigned int msg_lamport, enum operations action) {
+    unsigned long head;
+    struct trace_slot *slot;
+
+    if (!atomic_load_explicit(&trace_on, memory_order_relaxed)) {
+        return;
+    }
+
+    head = atomic_load_explicit(&trace_head, memory_order_relaxed);
+    do {
+        if (head - atomic_load_explicit(&trace_tail, memory_order_acquire) >= TRACE_RING_SIZE) {
+            atomic_fetch_add_explicit(&trace_dropped, 1, memory_order_relaxed);
+            return;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&trace_head, &head, head + 1,
+                                                    memory_order_relaxed,
+                                                    memory_order_relaxed));
+
+    slot = &trace_ring[head & (TRACE_RING_SIZE - 1)];
+    slot->ev.mono_ns = (uint64_t)monotonic_ns();
+    slot->ev.lamport = lamport;
+    slot->ev.msg_lamport = msg_lamport;
+    slot->ev.peer = (uint16_t)peer_node;
+    slot->ev.type = (uint8_t)type;
+    slot->ev.action = (uint8_t)action;
+    slot->ev.reserved = 0;
+    atomic_store_explicit(&slot->seq, head + 1, memory_order_release);   // published
+}
+
+//-- (trace writer!) writes the published events to the trace file
+void trace_drain() {
+    struct trace_event chunk[256];
+    unsigned long tail = atomic_load_explicit(&trace_tail, memory_order_relaxed);
+    int n;
+
+    do {
+        n = 0;
+        while (n < 256) {
+            struct trace_slot *slot = &trace_ring[tail & (TRACE_RING_SIZE - 1)];
+            if (atomic_load_explicit(&slot->seq, memory_order_acquire) != tail + 1) {
+                break;  // not claimed yet, or claimed and still being written
+            }
+            chunk[n++] = slot->ev;
+            tail++;
+        }
+        atomic_store_explicit(&trace_tail, tail, memory_order_release);   // slots free
+        if (n > 0) {
+            fwrite(chunk, sizeof(struct trace_event), n, trace_file);
+        }
+    } while (n == 256);
+    fflush(trace_file);
+}
+
+//-- (thread!) drains the trace ring every TRACE_FLUSH_MS until the trace stops
+void *trace_writer() {
+    struct timespec nap;
+
+    nap.tv_sec = 0;
+    nap.tv_nsec = TRACE_FLUSH_MS * 1000000L;
+    while (atomic_load(&trace_on)) {
+        nanosleep(&nap, NULL);
+        trace_drain();
+    }
+    trace_drain();  // what was recorded before trace_stop()
+    return NULL;
+}
+
+//-- starts recording every SEND and RECV to the binary trace file at path
+int trace_start(const char *path) {
+    struct trace_header header;
+
+    trace_ring = calloc(TRACE_RING_SIZE, sizeof(struct trace_slot));
+    if (trace_ring == NULL) {
+        perror("calloc failed");
+        return F_FAILURE;
+    }
+    trace_file = fopen(path, "wb");
+    if (trace_file == NULL) {
+        perror("trace fopen failed");
+        free(trace_ring);
+        return F_FAILURE;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.node_id = (uint16_t)self_node_id;
+    strncpy(header.name, stub_whoami, sizeof(header.name) - 1);
+    fwrite(&header, sizeof(header), 1, trace_file);
+
+    atomic_store(&trace_on, 1);
+    if (pthread_create(&trace_thread, NULL, trace_writer, NULL) != 0) {
+        perror("pthread_create failed");
+        atomic_store(&trace_on, 0);
+        fclose(trace_file);
+        return F_FAILURE;
+    }
+    return F_SUCCESS;
+}
+
+//-- stops recording, writes what is left in the ring and closes the trace file
+void trace_stop() {
+    if (!atomic_load(&trace_on)) {
+        return;
+    }
+    atomic_store(&trace_on, 0);
+    pthread_join(trace_thread, NULL);
+    fclose(trace_file);
+    free(trace_ring);
+    trace_file = NULL;
+    trace_ring = NULL;
+}
+
+//-- returns the events lost because the trace ring was full
+long get_trace_dropped() {
+    return atomic_load_explicit(&trace_dropped, memory_order_relaxed);
+}
+
+//-- turns the "PX, clock, SEND/RECV (PY), op" stdout lines on (1) or off (0)
+void set_print_trace(int enabled) {
+    print_trace = enabled;
+}
+
+//-- writes all the iovcnt buffers of iov, retrying after partial writes
+int writev_all(int conn_fd, struct iovec *iov, int iovcnt) {
+    struct shm_link *link = shm_link_of(conn_fd);
+    ssize_t written;
+
+    while (iovcnt > 0) {
+        written = (link != NULL) ? shm_writev(link, iov, iovcnt) : writev(conn_fd, iov, iovcnt);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return F_FAILURE;
+        }
+        atomic_fetch_add_explicit(&batch_syscalls, 1, memory_order_relaxed);
+
+        // skip what was written: whole buffers first, then part of the next one
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return F_SUCCESS;
+}
+
+//-- (batch->mutex held!) writes every frame queued in batch with one writev()
+int flush_batch_locked(struct out_batch *batch) {
+    int i, status;
+
+    if (batch->count == 0) {
+        return F_SUCCESS;
+    }
+
+    DEBUG_PRINTF("[fb] flushing %i frames to conn_fd %i\n", batch->count, batch->conn_fd);
+    for (i = 0; i < batch->count; i++) {
+        batch->iov[i].iov_base = batch->frames[i];  // writev_all() moves iov_base
+    }
+
+    status = writev_all(batch->conn_fd, batch->iov, batch->count);
+    if (status == F_FAILURE) {
+        perror("send failed");
+    } else {
+        atomic_fetch_add_explicit(&batch_msgs, batch->count, memory_order_relaxed);
+    }
+    batch->count = 0;
+    return status;
+}
+
+//-- returns the batch of conn_fd if it has one, NULL otherwise
+struct out_batch *batch_of(int conn_fd) {
+    if (conn_fd < 0 || conn_fd >= CONN_MAX_FDS) {
+        return NULL;
+    }
+    return atomic_load(&conn_batches[conn_fd]);
+}
+
+//-- (thread!) flushes the batches whose oldest frame has waited a whole window
+void *batch_flusher() {
+    struct out_batch *batch;
+    struct timespec nap;
+    long window, now, wait_ns;
+    int fd;
+
+    while (1) {
+        window = atomic_load_explicit(&batch_window_ns, memory_order_relaxed);
+        wait_ns = (window > 0) ? window / 2 : BATCH_WINDOW_US * 1000L;
+        nap.tv_sec = wait_ns / 1000000000L;
+        nap.tv_nsec = wait_ns % 1000000000L;
+        nanosleep(&nap, NULL);
+
+        now = monotonic_ns();
+        for (fd = 0; fd < atomic_load(&conn_batch_top); fd++) {
+            if ((batch = batch_of(fd)) == NULL) {
+                continue;
+            }
+            pthread_mutex_lock(&batch->mutex);      // lock (X)
+            if (batch->count > 0 && now - batch->first_ns >= window) {
+                flush_batch_locked(batch);
+            }
+            pthread_mutex_unlock(&batch->mutex);    // unlock (o)
+        }
+    }
+    return NULL;
+}
+
+//-- (once!) starts the flusher thread
+void start_batch_flusher() {
+    if (pthread_create(&batch_thread, NULL, batch_flusher, NULL) != 0) {
+        perror("pthread_create failed");
+    } else {
+        pthread_detach(batch_thread);
+    }
+}
+
+//-- returns the batch that queues frames for conn_fd, allocated at its first frame
+//   (NULL when conn_fd is beyond CONN_MAX_FDS or there is no memory)
+struct out_batch *get_batch(int conn_fd) {
+    struct out_batch *batch = batch_of(conn_fd);
+
+    if (batch != NULL || conn_fd < 0 || conn_fd >= CONN_MAX_FDS) {
+        return batch;
+    }
+    pthread_once(&batch_once, start_batch_flusher);
+
+    pthread_mutex_lock(&mutex_batches);         // lock (X)
+    batch = batch_of(conn_fd);
+    if (batch == NULL && (batch = calloc(1, sizeof(struct out_batch))) != NULL) {
+        pthread_mutex_init(&batch->mutex, NULL);
+        pthread_cond_init(&batch->room, NULL);
+        batch->conn_fd = conn_fd;
+        atomic_store(&conn_batches[conn_fd], batch);
+        if (conn_fd >= atomic_load(&conn_batch_top)) {
+            atomic_store(&conn_batch_top, conn_fd + 1);
+        }
+    } else if (batch == NULL) {
+        perror("calloc failed");
+    }
+    pthread_mutex_unlock(&mutex_batches);       // unlock (o)
+    return batch;
+}
+
+//-- makes conn_fd a new connection: nothing queued for the fd before it is kept,
+//   vector deltas start from zero and FLOW_WINDOW frames may be sent before the
+//   peer returns credit (both ends call it before any frame goes)
+void conn_open(int conn_fd) {
+    struct out_batch *batch = get_batch(conn_fd);
+
+    if (batch == NULL) {
+        return;     // sends without batching nor credit
+    }
+    pthread_mutex_lock(&batch->mutex);          // lock (X)
+    batch->count = 0;
+    memset(batch->vc_sent, 0, sizeof(batch->vc_sent));
+    batch->pending_len = 0;
+    batch->pending_count = 0;
+    pthread_mutex_unlock(&batch->mutex);        // unlock (o)
+
+    atomic_store(&flow_credits[conn_fd], FLOW_WINDOW);
+    flow_consumed[conn_fd] = 0;
+    atomic_store(&flow_on[conn_fd], 1);
+}
+
+//-- takes the credit of one frame for conn_fd, F_FAILURE when there is none left
+int flow_take_credit(int conn_fd) {
+    int credits;
+
+    if (conn_fd < 0 || conn_fd >= CONN_MAX_FDS || !atomic_load(&flow_on[conn_fd])) {
+        return F_SUCCESS;
+    }
+    credits = atomic_load(&flow_credits[conn_fd]);
+    while (credits > 0) {
+        if (atomic_compare_exchange_weak(&flow_credits[conn_fd], &credits, credits - 1)) {
+            return F_SUCCESS;
+        }
+    }
+    return F_FAILURE;
+}
+
+//-- (batch mutex held!) moves to the batch the queued frames there is credit for
+//   and writes them: the peer is waiting for them
+void flow_drain_locked(struct out_batch *batch) {
+    uint64_t body_len;
+    size_t pos = 0;
+    int frame_len;
+
+    while (batch->pending_count > 0 && flow_take_credit(batch->conn_fd) == F_SUCCESS) {
+        frame_len = get_varint(&batch->pending[pos], batch->pending_len - pos, &body_len);
+        if (frame_len <= 0 || body_len > batch->pending_len - pos - frame_len) {
+            // the queue holds whole frames built by encode_msg(): this is a bug, the
+            // rest can't be split into frames and is dropped
+            fprintf(stderr, "[!] corrupt flow queue of connection %i (%i frames dropped)\n",
+                    batch->conn_fd, batch->pending_count);
+            atomic_fetch_add(&flow_credits[batch->conn_fd], 1);
+            pos = batch->pending_len;
+            batch->pending_count = 0;
+            break;
+        }
+        frame_len += (int)body_len;
+        if (batch->count == 0) {
+            batch->first_ns = monotonic_ns();
+        }
+        memcpy(batch->frames[batch->count], &batch->pending[pos], frame_len);
+        batch->iov[batch->count].iov_len = frame_len;
+        if (++batch->count == BATCH_MAX_MSGS) {
+            flush_batch_locked(batch);
+        }
+        pos += frame_len;
+        batch->pending_count--;
+    }
+    batch->pending_len -= pos;
+    memmove(batch->pending, &batch->pending[pos], batch->pending_len);
+
+    flush_batch_locked(batch);
+    pthread_cond_broadcast(&batch->room);
+}
+
+//-- (receiver threads!) adds the credit of a FLOW_CREDIT frame to conn_fd and
+//   sends what was waiting for it
+void flow_on_credit(int conn_fd, const struct message *msg) {
+    struct out_batch *batch = batch_of(conn_fd);
+    uint32_t credit;
+
+    if (batch == NULL || msg->payload_len != sizeof(credit)) {
+        return;
+    }
+    memcpy(&credit, msg->payload, sizeof(credit));
+    atomic_fetch_add(&flow_credits[conn_fd], (int)credit);
+
+    pthread_mutex_lock(&batch->mutex);          // lock (X)
+    if (batch->pending_count > 0) {
+        flow_drain_locked(batch);
+    }
+    pthread_mutex_unlock(&batch->mutex);        // unlock (o)
+}
+
+//-- (receiver threads!) conn_fd is gone: its queued frames are dropped and
+//   the senders waiting for its credit are released
+void flow_close(int conn_fd) {
+    struct out_batch *batch = batch_of(conn_fd);
+
+    if (batch == NULL) {
+        return;
+    }
+    atomic_store(&flow_on[conn_fd], 0);
+
+    pthread_mutex_lock(&batch->mutex);          // lock (X)
+    batch->pending_len = 0;
+    batch->pending_count = 0;
+    pthread_cond_broadcast(&batch->room);
+    pthread_mutex_unlock(&batch->mutex);        // unlock (o)
+}
+
+//-- (batch mutex held!) makes room for one more frame in the credit queue of batch,
+//   growing it only for a deferred send or a receiver thread (the credit it would
+//   wait for comes through a receiver thread): F_SUCCESS, or F_FAILURE if it is full
+int flow_queue_room_locked(struct out_batch *batch) {
+    size_t capacity = batch->pending_cap ? batch->pending_cap : FLOW_QUEUE_BYTES;
+    unsigned char *pending;
+
+    if (batch->pending != NULL && batch->pending_len + WIRE_MAX_FRAME <= batch->pending_cap) {
+        return F_SUCCESS;
+    }
+    if (batch->pending != NULL && !send_deferred && !send_never_waits) {
+        return F_FAILURE;
+    }
+    if (batch->pending != NULL) {
+        capacity *= 2;
+    }
+    if ((pending = realloc(batch->pending, capacity)) == NULL) {
+        perror("realloc failed");
+        return F_FAILURE;
+    }
+    batch->pending = pending;
+    batch->pending_cap = capacity;
+    return F_SUCCESS;
+}
+
+//-- (batch mutex held!) returns 1 when msg may join the batch, 0 when it was
+//   queued to wait for credit instead (status tells how that went)
+//   a full queue blocks the sender until credit makes room (a stall), but a
+//   receiver thread never blocks: it grows the queue, and neither does a
+//   deferred send, which also takes the queue when the batch is full
+//   (flush_batch() sends it on)
+int flow_admit_locked(struct out_batch *batch, const struct message *msg, int *status) {
+    long stall_start = 0;
+    int admitted = -1;
+
+    if (msg->action == FLOW_CREDIT) {
+        return 1;   // credit never waits for credit
+    }
+
+    while (admitted < 0) {
+        if (batch->pending_count == 0 && !(send_deferred && batch->count == BATCH_MAX_MSGS) &&
+            flow_take_credit(batch->conn_fd) == F_SUCCESS) {
+            admitted = 1;
+        } else if (flow_queue_room_locked(batch) == F_SUCCESS) {
+            // encoded now, after the frames queued before it: vector deltas stay in order
+            batch->pending_len += encode_msg(msg, batch->vc_sent, &batch->pending[batch->pending_len]);
+            batch->pending_count++;
+            batch->queued_total++;
+            if (batch->pending_count > batch->max_pending) {
+                batch->max_pending = batch->pending_count;
+            }
+            *status = F_SUCCESS;
+            admitted = 0;
+        } else {
+            if (stall_start == 0) {
+                stall_start = monotonic_ns();
+                batch->stalls++;
+            }
+            pthread_cond_wait(&batch->room, &batch->mutex);
+        }
+    }
+
+    if (stall_start != 0) {
+        batch->stall_ns += monotonic_ns() - stall_start;
+    }
+    return admitted;
+}
+
+//-- queues msg in batch, writing the batch when full or unbatched
+int queue_msg(struct out_batch *batch, const struct message *msg) {
+    int status = F_SUCCESS;
+    long window = atomic_load_explicit(&batch_window_ns, memory_order_relaxed);
+
+    DEBUG_PRINTF("[qm] queueing for conn_fd %i\n", batch->conn_fd);
+
+    pthread_mutex_lock(&batch->mutex);          // lock (X)
+    // out of credit (or frames waiting already): the frame waits in this process
+    if (!flow_admit_locked(batch, msg, &status)) {
+        pthread_mutex_unlock(&batch->mutex);    // unlock (o)
+        return status;
+    }
+
+    if (batch->count == 0) {
+        batch->first_ns = monotonic_ns();
+    }
+    // encoded under the batch mutex: vector deltas go out in the order computed
+    batch->iov[batch->count].iov_len = encode_msg(msg, batch->vc_sent, batch->frames[batch->count]);
+    batch->count++;
+
+    // credit is awaited by a sender: it never waits for company
+    if (!send_deferred &&
+        (batch->count == BATCH_MAX_MSGS || window == 0 || msg->action == FLOW_CREDIT)) {
+        status = flush_batch_locked(batch);
+    }
+    pthread_mutex_unlock(&batch->mutex);        // unlock (o)
+
+    return status;
+}
+
+//-- (batch mutex NOT held!) writes right now every frame queued in batch, and the
+//   ones a deferred send left waiting in the credit queue if there is credit for them
+int flush_batch(struct out_batch *batch) {
+    int status;
+
+    pthread_mutex_lock(&batch->mutex);          // lock (X)
+    if (batch->pending_count > 0) {
+        flow_drain_locked(batch);
+    }
+    status = flush_batch_locked(batch);
+    pthread_mutex_unlock(&batch->mutex);        // unlock (o)
+    return status;
+}
+
+//-- writes right now every frame queued for any peer
+int flush_all_msgs() {
+    struct out_batch *batch;
+    int fd, status = F_SUCCESS;
+
+    for (fd = 0; fd < atomic_load(&conn_batch_top); fd++) {
+        if ((batch = batch_of(fd)) != NULL && flush_batch(batch) == F_FAILURE) {
+            status = F_FAILURE;
+        }
+    }
+    return status;
+}
+
+//-- (per thread!) 1: the sends of the calling thread only queue their frames, they
+//   never wait for credit nor write (flush_all_msgs() writes them), 0: back to normal
+void set_send_deferred(int enabled) {
+    send_deferred = enabled;
+}
+
+//-- sets how long (microseconds) a frame may wait to be coalesced, 0 disables it
+void set_batch_window(long window_us) {
+    atomic_store(&batch_window_ns, window_us * 1000L);
+    if (window_us == 0) {
+        flush_all_msgs();
+    }
+}
+
+//-- reports the frames written and the writev() calls it took
+void get_batch_stats(long *msgs, long *syscalls) {
+    *msgs = atomic_load_explicit(&batch_msgs, memory_order_relaxed);
+    *syscalls = atomic_load_explicit(&batch_syscalls, memory_order_relaxed);
+}
+
+//-- waits until no frame waits for credit (or timeout_ms), F_FAILURE on timeout
+int flow_wait_drained(long timeout_ms) {
+    struct timespec nap = {0, 1000000L};
+    struct out_batch *batch;
+    long deadline = monotonic_ns() + timeout_ms * 1000000L;
+    int fd, waiting = 1;
+
+    while (waiting) {
+        waiting = 0;
+        for (fd = 0; fd < atomic_load(&conn_batch_top) && !waiting; fd++) {
+            if ((batch = batch_of(fd)) == NULL) {
+                continue;
+            }
+            pthread_mutex_lock(&batch->mutex);  // lock (X)
+            waiting = (batch->pending_count > 0);
+            pthread_mutex_unlock(&batch->mutex);// unlock (o)
+        }
+        if (waiting && monotonic_ns() >= deadline) {
+            return F_FAILURE;
+        }
+        if (waiting) {
+            nanosleep(&nap, NULL);
+        }
+    }
+    return F_SUCCESS;
+}
+
+//-- FNV-1a hash of a node name
+unsigned int hash_name(const char *name) {
+    unsigned int hash = 2166136261u;
+
+    while (*name != '\0') {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//-- (mutex_peers held!) returns the hash slot of name: its own or the empty one
+int find_peer_slot(const char *name) {
+    unsigned int slot = hash_name(name) & (PEER_HASH_SIZE - 1);
+
+    while (peer_hash[slot] != 0 && strcmp(peers[peer_hash[slot] - 1].name, name) != 0) {
+        slot = (slot + 1) & (PEER_HASH_SIZE - 1);   // linear probing
+    }
+    return slot;
+}
+
+//-- returns the id of a known node name, F_FAILURE if it was never interned
+int peer_lookup(const char *name) {
+    int id;
+
+    pthread_mutex_lock(&mutex_peers);       // lock (X)
+    id = peer_hash[find_peer_slot(name)] - 1;
+    pthread_mutex_unlock(&mutex_peers);     // unlock (o)
+
+    return (id < 0) ? F_FAILURE : id;
+}
+
+//-- returns the id of name, interning it first if needed (F_FAILURE when full)
+int peer_intern(const char *name) {
+    int slot, id;
+
+    if (check_node_name(name) == F_FAILURE) {
+        return F_FAILURE;   // (its node id would be some other node's one)
+    }
+
+    pthread_mutex_lock(&mutex_peers);       // lock (X)
+    slot = find_peer_slot(name);
+    if (peer_hash[slot] != 0) {
+        id = peer_hash[slot] - 1;
+    } else if (peer_count == MAX_PEERS) {
+        id = F_FAILURE;
+    } else {
+        id = peer_count;
+        strncpy(peers[id].name, name, NODE_NAME_LEN - 1);
+        peers[id].name[NODE_NAME_LEN - 1] = '\0';
+        peers[id].node_id = node_id_from_name(peers[id].name);
+        peers[id].conn_fd = PEER_NO_CONN;
+        peers[id].generation = 0;
+        peer_hash[slot] = id + 1;
+        peer_count++;
+        DEBUG_PRINTF(">>> PEER INTERNED: %s is id %i\n", name, id);
+    }
+    pthread_mutex_unlock(&mutex_peers);     // unlock (o)
+
+    if (id == F_FAILURE) {
+        fprintf(stderr, "error: peer registry full (%i peers)\n", MAX_PEERS);
+    }
+    return id;
+}
+
+//-- returns the name of a peer id (NULL for unknown ids)
+const char *peer_name(int id) {
+    const char *name = NULL;
+
+    pthread_mutex_lock(&mutex_peers);       // lock (X)
+    if (id >= 0 && id < peer_count) {
+        name = peers[id].name;              // (a name never changes once interned)
+    }
+    pthread_mutex_unlock(&mutex_peers);     // unlock (o)
+    return name;
+}
+
+//-- returns the node id of a peer id (the one of "P2" is 2), 0 for unknown ids
+unsigned int peer_node(int id) {
+    unsigned int node_id = 0;
+
+    pthread_mutex_lock(&mutex_peers);       // lock (X)
+    if (id >= 0 && id < peer_count) {
+        node_id = peers[id].node_id;
+    }
+    pthread_mutex_unlock(&mutex_peers);     // unlock (o)
+    return node_id;
+}
+
+//-- returns the connection fd of a peer id, PEER_NO_CONN if it is unknown or not joined
+int peer_conn(int id) {
+    int conn_fd = PEER_NO_CONN;
+
+    pthread_mutex_lock(&mutex_peers);       // lock (X)
+    if (id >= 0 && id < peer_count) {
+        conn_fd = peers[id].conn_fd;
+    }
+    pthread_mutex_unlock(&mutex_peers);     // unlock (o)
+    return conn_fd;
+}
+
+//-- binds name to conn_fd (the peer joins), returns its id and leaves the
+//   generation of this join in *generation (NULL: not wanted) for peer_leave()
+int peer_join(const char *name, int conn_fd, unsigned int *generation) {
+    int id = peer_intern(name);
+
+    if (id != F_FAILURE) {
+        pthread_mutex_lock(&mutex_peers);   // lock (X)
+        peers[id].conn_fd = conn_fd;
+        peers[id].generation++;
+        if (generation != NULL) {
+            *generation = peers[id].generation;
+        }
+        pthread_mutex_unlock(&mutex_peers); // unlock (o)
+        DEBUG_PRINTF(">>> PEER JOINED: %s (id %i) is connection fd %i\n", name, id, conn_fd);
+    }
+    return id;
+}
+
+//-- unbinds the connection of a peer id (the peer leaves, its id is kept), unless
+//   it joined again since the join of generation
+void peer_leave(int id, unsigned int generation) {
+    pthread_mutex_lock(&mutex_peers);       // lock (X)
+    if (id >= 0 && id < peer_count && peers[id].generation == generation) {
+        peers[id].conn_fd = PEER_NO_CONN;
+        DEBUG_PRINTF(">>> PEER LEFT: %s (id %i)\n", peers[id].name, id);
+    }
+    pthread_mutex_unlock(&mutex_peers);     // unlock (o)
+}
+
+//-- converts an action to a readable string
+char *action_to_str(enum operations action) {
+    if (action == READY_TO_SHUTDOWN) {
+        return "READY_TO_SHUTDOWN";
+    }
+    if (action == SHUTDOWN_NOW) {
+        return "SHUTDOWN_NOW";
+    }
+    if (action == SHUTDOWN_ACK) {
+        return "SHUTDOWN_ACK";
+    }
+    if (action == TOM_DATA) {
+        return "TOM_DATA";
+    }
+    if (action == TOM_ACK) {
+        return "TOM_ACK";
+    }
+    if (action == MESH_HELLO) {
+        return "MESH_HELLO";
+    }
+    if (action == SNAP_MARKER) {
+        return "SNAP_MARKER";
+    }
+    if (action == DMX_REQUEST) {
+        return "DMX_REQUEST";
+    }
+    if (action == DMX_REPLY) {
+        return "DMX_REPLY";
+    }
+    if (action == DMX_TOKEN) {
+        return "DMX_TOKEN";
+    }
+    if (action == FLOW_CREDIT) {
+        return "FLOW_CREDIT";
+    }
+    return "UNKNOWN OPERATION";
+}
+
+//-- finds the connection that leads to to_id and its batch, F_FAILURE if none
+int route_to(int to_id, int *connection_fd, struct out_batch **batch) {
+    *connection_fd = peer_conn(to_id);
+
+    // clients reach every peer through the server (sock_sfd)
+    if (*connection_fd == PEER_NO_CONN) {
+        if (is_server) {
+            fprintf(stderr, "error: peer %i is not connected\n", to_id);
+            return F_FAILURE;
+        }
+        *connection_fd = sock_sfd;
+    }
+    *batch = get_batch(*connection_fd);
+    if (*batch == NULL) {
+        fprintf(stderr, "error: connection fd %i can't be batched (%i fds)\n", *connection_fd, CONN_MAX_FDS);
+        return F_FAILURE;
+    }
+    return F_SUCCESS;
+}
+
+//-- writes right now every frame queued for to_id (and the other peers that share
+//   its connection)
+int flush_msgs(int to_id) {
+    struct out_batch *batch;
+    int conn_fd;
+
+    if (route_to(to_id, &conn_fd, &batch) == F_FAILURE) {
+        return F_FAILURE;
+    }
+    return flush_batch(batch);
+}
+
+//-- reports the flow control of the connection to to_id (-1: clients' route to the server)
+void get_flow_stats(int to_id, struct flow_stats *stats) {
+    struct out_batch *batch;
+    int conn_fd;
+
+    memset(stats, 0, sizeof(*stats));
+    if (route_to(to_id, &conn_fd, &batch) == F_FAILURE) {
+        return;
+    }
+    pthread_mutex_lock(&batch->mutex);          // lock (X)
+    stats->credits = atomic_load(&flow_credits[conn_fd]);
+    stats->queued = batch->pending_count;
+    stats->max_queued = batch->max_pending;
+    stats->queued_total = batch->queued_total;
+    stats->stalls = batch->stalls;
+    stats->stall_ns = batch->stall_ns;
+    stats->would_block = batch->would_block;
+    pthread_mutex_unlock(&batch->mutex);        // unlock (o)
+}
+
+//-- starts the deepest-queue mark of the connection to to_id over (at what is queued now)
+void reset_flow_max_queued(int to_id) {
+    struct out_batch *batch;
+    int conn_fd;
+
+    if (route_to(to_id, &conn_fd, &batch) == F_FAILURE) {
+        return;
+    }
+    pthread_mutex_lock(&batch->mutex);          // lock (X)
+    batch->max_pending = batch->pending_count;
+    pthread_mutex_unlock(&batch->mutex);        // unlock (o)
+}
+
+//-- sends ONE message from PX, stamped with Lamport time l_clock_loc (ticked by
+//   the caller), to each of the n_ids peers, returns l_clock_loc or F_FAILURE
+int send_to_many_at(const char *from, int l_clock_loc, const int *to_ids, int n_ids,
+                    enum operations action, const void *payload, unsigned int payload_len) {
+    int i, connection_fd, status = F_SUCCESS;
+    struct out_batch *batch;
+    char *action_string;
+
+    if (payload_len > MSG_PAYLOAD_MAX) {
+        fprintf(stderr, "error: payload of %u bytes (max %i)\n", payload_len, MSG_PAYLOAD_MAX);
+        return F_FAILURE;
+    }
+
+    // build the message to send in place, in this thread's pooled buffer
+    // (l_clock_loc already holds the value assigned to this send)
+    struct message *msg = create_msg(from, action, l_clock_loc);
+    if (msg == NULL) {
+        return F_FAILURE;
+    }
+    clock_stamp_send(&msg->stamp);  // vector / hybrid clock, if any
+    if (payload_len > 0) {
+        memcpy(msg->payload, payload, payload_len);
+        msg->payload_len = payload_len;
+    }
+
+    // print send trace as: "PX, contador_lamport, SEND, operations"
+    action_string = action_to_str(action);
+    if (print_trace) {
+        printf("%s, %i, SEND, %s\n", from, l_clock_loc, action_string);
+    }
+    
+    // the frame waits in the batch of each peer's connection (see flush_msgs() to force it out)
+    for (i = 0; i < n_ids; i++) {
+        if (route_to(to_ids[i], &connection_fd, &batch) == F_FAILURE ||
+            queue_msg(batch, msg) == F_FAILURE) {
+            status = F_FAILURE;
+            continue;   // (nothing sent: nothing to trace)
+        }
+        if (atomic_load_explicit(&trace_on, memory_order_relaxed)) {
+            trace_record(TRACE_SEND, peer_node(to_ids[i]), l_clock_loc, l_clock_loc, action);
+        }
+    }
+    free_msg(msg);  // back to the pool, the next send reuses it
 
-    // sock_status is set to SOCKET_RUNNING when success
-    sock_status = SOCKET_RUNNING;
-    return sock_fd;
+    return (status == F_FAILURE) ? F_FAILURE : l_clock_loc;
 }
 
-//-- (server only!) forces near-instant reuse of ports
-void enable_setsockopt(int serv_sfd) {
-    const int ENABLE_SSOPT = 1;
+//-- sends ONE message (one Lamport tick) from PX to each of the n_ids peers,
+//   returns the Lamport time it was sent with or F_FAILURE
+int send_to_many(const char *from, const int *to_ids, int n_ids, enum operations action,
+                 const void *payload, unsigned int payload_len) {
+    // get lamport clock and update it BEFORE sending the message
+    return send_to_many_at(from, next_clock_lamport(), to_ids, n_ids, action, payload, payload_len);
+}
 
-    if (setsockopt(serv_sfd, SOL_SOCKET, SO_REUSEADDR, &ENABLE_SSOPT, sizeof(int)) < 0) {
-        perror_msg_sr("setsockopt(SO_REUSEADDR) failed\n", serv_sfd);
+//-- sends a message with an action from PX to the peer with id to_id
+int send_msg_id(const char *from, int to_id, enum operations action) {
+    if (send_to_many(from, &to_id, 1, action, NULL, 0) == F_FAILURE) {
+        return F_FAILURE;
     }
+    return F_SUCCESS;
 }
 
-//-- (server only!) bind and listen
-int bind_and_listen(int serv_sfd, struct sockaddr_in *servaddr) {
-    if (bind(serv_sfd, (struct sockaddr *) servaddr, sizeof(*servaddr)) < 0) {
-        perror_msg_sr("bind failed", serv_sfd);
+//-- sends the same message (same Lamport time) with a payload to n_ids peers,
+//   returns that Lamport time or F_FAILURE
+int multicast_msg(const int *to_ids, int n_ids, enum operations action,
+                  const void *payload, unsigned int payload_len) {
+    return send_to_many(stub_whoami, to_ids, n_ids, action, payload, payload_len);
+}
+
+//-- multicast_msg() with a Lamport time the caller took from next_clock_lamport()
+//   (so it can act on the time before the message goes), returns it or F_FAILURE
+int multicast_msg_at(int l_clock_loc, const int *to_ids, int n_ids, enum operations action,
+                     const void *payload, unsigned int payload_len) {
+    return send_to_many_at(stub_whoami, l_clock_loc, to_ids, n_ids, action, payload, payload_len);
+}
+
+//-- sends a message with a payload to to_id only if its connection has credit
+//   left, never waiting for it: returns the Lamport time it was sent with,
+//   F_WOULDBLOCK (nothing sent) or F_FAILURE
+//   (a send racing for the last credit can still leave the frame queued here)
+int try_send_msg(int to_id, enum operations action, const void *payload, unsigned int payload_len) {
+    struct out_batch *batch;
+    int connection_fd, has_credit;
+
+    if (route_to(to_id, &connection_fd, &batch) == F_FAILURE) {
         return F_FAILURE;
     }
-    printf("Socket successfully binded...\n");
 
-    // backlog=1 so the server has no trouble listening both clients
-    if (listen(serv_sfd, 1) < 0) {
-        perror_msg_sr("listen failed", serv_sfd);
-        return F_FAILURE;
+    pthread_mutex_lock(&batch->mutex);          // lock (X)
+    has_credit = (batch->pending_count == 0 &&
+                  (connection_fd < 0 || connection_fd >= CONN_MAX_FDS ||
+                   !atomic_load(&flow_on[connection_fd]) ||
+                   atomic_load(&flow_credits[connection_fd]) > 0));
+    if (!has_credit) {
+        batch->would_block++;
     }
+    pthread_mutex_unlock(&batch->mutex);        // unlock (o)
 
-    printf("Server listening...\n");
-    return F_SUCCESS;
+    if (!has_credit) {
+        return F_WOULDBLOCK;
+    }
+    return send_to_many(stub_whoami, &to_id, 1, action, payload, payload_len);
 }
 
-//-- (server only!) aceepts a client and returns the connection fd related to it
-int accept_client(int serv_sfd, struct sockaddr_in *cliaddr) {
-    socklen_t cliaddr_len = sizeof(*cliaddr);
-    int conn_fd = accept(serv_sfd, (struct sockaddr * ) cliaddr, &cliaddr_len);
+//-- (receiver threads!) counts a frame of conn_fd as consumed, every FLOW_GRANT
+//   of them go back on it as credit (a FLOW_CREDIT frame, no event)
+void flow_consumed_one(int conn_fd) {
+    struct message credit_msg;
+    struct out_batch *batch = batch_of(conn_fd);
+    uint32_t credit;
 
-    if (conn_fd < 0) {
-        perror_msg_sr("accept failed", serv_sfd);
-        return F_FAILURE;
+    if (conn_fd < 0 || conn_fd >= CONN_MAX_FDS || !atomic_load(&flow_on[conn_fd]) ||
+        ++flow_consumed[conn_fd] < FLOW_GRANT) {
+        return;
+    }
+    credit = flow_consumed[conn_fd];
+    flow_consumed[conn_fd] = 0;
+
+    memset(&credit_msg, 0, sizeof(credit_msg));
+    fill_msg(&credit_msg, stub_whoami, FLOW_CREDIT, 0);
+    memcpy(credit_msg.payload, &credit, sizeof(credit));
+    credit_msg.payload_len = sizeof(credit);
+    if (batch != NULL) {
+        queue_msg(batch, &credit_msg);  // back on the connection it was consumed from
     }
-
-    return conn_fd;
 }
 
-//-- (client only!) tries to connect the client to the server
-int connect_to_server(int cli_sfd, struct sockaddr_in *servaddr) {
-    if (connect(cli_sfd, (struct sockaddr *) servaddr, sizeof(*servaddr)) < 0) {
-        perror_msg_sr("connect error", cli_sfd);
-        return F_FAILURE;
+//-- makes the receiver threads call handler for every message with action
+void set_msg_handler(enum operations action, void (*handler)(int peer_id, const struct message *msg)) {
+    if (action >= 0 && action < NUM_OF_OPERATIONS) {
+        msg_handlers[action] = handler;
     }
+}
 
-    printf("connected to the server...\n");
-    return F_SUCCESS;
+//-- (receiver threads!) passes msg to the upper layer handling its action
+void dispatch_msg(int peer_id, const struct message *msg) {
+    if (msg->action >= 0 && msg->action < NUM_OF_OPERATIONS && msg_handlers[msg->action] != NULL) {
+        msg_handlers[msg->action](peer_id, msg);
+    }
 }
 
-//-- updates the global Lamport clock (l_clock) after the current local value
-void update_clock_lamport(int *l_clock_loc) {
-    pthread_mutex_lock(&mutex_lclock);      // lock (X)
+//-- makes the receiver threads give every message to hook instead of its handler,
+//   hook calls dispatch_msg() itself (a layer that must see all the traffic)
+void set_recv_hook(void (*hook)(int peer_id, const struct message *msg)) {
+    recv_hook = hook;
+}
 
-    // UPDATE: global_clock = max(global_clock, local_clock) + 1
-    if (*l_clock_loc > l_clock) {
-        l_clock = *l_clock_loc;
+//-- (receiver threads!) passes msg to the receive hook, or to its handler without one
+void deliver_msg(int peer_id, const struct message *msg) {
+    if (recv_hook != NULL) {
+        recv_hook(peer_id, msg);
+    } else {
+        dispatch_msg(peer_id, msg);
     }
-    l_clock++;
-
-    *l_clock_loc = l_clock; // also updates the local clock received
-    pthread_mutex_unlock(&mutex_lclock);    // unlock (o)
 }
 
-//-- returns the value of the global Lamport clock (l_clock)
-int get_clock_lamport() {
-    int l_clock_copy;
+//-- sends a message with an action from PX to PY using sockets underneath
+int send_msg(const char *from, const char *to, enum operations action) {
+    return send_msg_id(from, peer_intern(to), action);
+}
 
-    pthread_mutex_lock(&mutex_lclock);      // lock (X)
-    l_clock_copy = l_clock;                 // copy the l_clock value
-    pthread_mutex_unlock(&mutex_lclock);    // unlock (o)
+//-- binds the sender of the first frame of a connection to it (peer join)
+int join_from_msg(int conn_fd, struct message *msg, unsigned int *generation) {
+    char origin[NODE_NAME_LEN];
 
-    return l_clock_copy; // return de la copia
+    node_name_from_id(msg->origin, origin);
+    return peer_join(origin, conn_fd, generation);
 }
 
-//-- returns an empty message (allocates memory)
-struct message* create_empty_msg() {
-    DEBUG_PRINTF("[!] creating empty msg...\n");
-    struct message *msg = malloc(sizeof(struct message));
-    return msg;
+//-- empties rx before the first receive_msg() of a connection
+void init_rx_buffer(struct rx_buffer *rx) {
+    rx->len = 0;
+    memset(rx->vc_last, 0, sizeof(rx->vc_last));
 }
 
-//-- creates a message with the corresponding origin, action and clock values
-struct message* create_msg(const char *origin, enum operations action, unsigned int clock) {
-    struct message *msg = create_empty_msg();
-
-    memset(msg->origin, 0, sizeof(msg->origin));
+//-- (used by threads!) blocks until a whole message is received on conn_fd
+//   rx keeps the bytes of a frame split among several recv() calls
+int receive_msg(int conn_fd, struct rx_buffer *rx, struct message *msg) {
+    struct shm_link *link = shm_link_of(conn_fd);
+    int bytes_received, consumed;
 
-    strncpy(msg->origin, origin, sizeof(msg->origin) - 1);  // copy the origin
-    msg->action = action;                                   // add the action
-    msg->clock_lamport = clock;                             // set the clock
+    DEBUG_PRINTF("[rcvm] inside receive_msg() function:\n");
 
-    DEBUG_PRINTF("[!] MALLOC OF <%s, %u> MSG\n", msg->origin, msg->clock_lamport);
+    // vector deltas of this connection apply on the last vector it brought
+    if (clock_mode == CLOCK_VECTOR) {
+        memcpy(msg->stamp.vc, rx->vc_last, sizeof(rx->vc_last));
+    }
 
-    return msg;
-}
+    // decode from the buffer first: one recv() may have brought several frames
+    consumed = decode_msg(rx->data, rx->len, msg);
+    while (consumed == 0) {
+        if (link != NULL) {
+            bytes_received = shm_read(link, &rx->data[rx->len], sizeof(rx->data) - rx->len);
+        } else {
+            bytes_received = recv(conn_fd, &rx->data[rx->len], sizeof(rx->data) - rx->len, 0);
+        }
+        if (bytes_received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("[!] recv failed");
+            return F_FAILURE;
+        }
 
-//-- frees the memory allocated for the msg it receives as parameter
-void free_msg(struct message* msg) {
-    DEBUG_PRINTF("[!] FREE OF <%s, %u> MSG\n", msg->origin, msg->clock_lamport);
-    free(msg);
-}
+        if (bytes_received == 0) {
+            if (!is_server) {
+                sock_status = SOCKET_CLOSED;    // a peer of a server (or mesh) only ends its own link
+            }
+            DEBUG_PRINTF("[!] connection with %i was closed by SHUTDOWN\n", conn_fd);
+            return F_CONN_CLOSE;    // return F_CONN_CLOSE when connection is closed
+        }
 
-//-- sends a struct message via the connection indicated by conn_fd
-int send_through_socket(int conn_fd, struct message *msg) {
-    DEBUG_PRINTF("[sts] inside send_through_socket(), conn_fd = %i\n", conn_fd);
-    DEBUG_PRINTF("[sts] socket status is %i and should be %i\n", sock_status, SOCKET_RUNNING);
+        rx->len += bytes_received;
+        consumed = decode_msg(rx->data, rx->len, msg);
+    }
 
-    if (send(conn_fd, msg, sizeof(struct message), 0) < 0) {
-        perror("send failed");
+    if (consumed < 0) {
+        fprintf(stderr, "[!] corrupt frame received from connection %i\n", conn_fd);
         return F_FAILURE;
     }
 
+    // drop the decoded frame, keep whatever follows it
+    rx->len -= consumed;
+    memmove(rx->data, &rx->data[consumed], rx->len);
+
+    if (msg->stamp.mode == CLOCK_VECTOR) {
+        memcpy(rx->vc_last, msg->stamp.vc, sizeof(rx->vc_last));
+    }
+
+    DEBUG_PRINTF("[!] SUCCESS: received from P%u with clock %u\n", msg->origin, msg->clock_lamport);
+
     return F_SUCCESS;
 }
 
-//-- converts an action to a readable string
-char *action_to_str(enum operations action) {
-    if (action == READY_TO_SHUTDOWN) {
-        return "READY_TO_SHUTDOWN";
+//-- keeps the two-phase shutdown state up to date with a message from peer_id
+void shutdown_on_receive(int peer_id, enum operations action) {
+    if (peer_id < 0 || peer_id >= MAX_PEERS) {
+        return;
     }
-    if (action == SHUTDOWN_NOW) {
-        return "SHUTDOWN_NOW";
-    }
-    if (action == SHUTDOWN_ACK) {
-        return "SHUTDOWN_ACK";
+
+    pthread_mutex_lock(&mutex_shutack);     // lock (X)
+    if (action == READY_TO_SHUTDOWN && peer_shutdown[peer_id] == SHUT_NONE) {
+        peer_shutdown[peer_id] = SHUT_READY;
+        shutdown_readys++;
+        pthread_cond_broadcast(&cond_shutdown);
+    } else if (action == SHUTDOWN_ACK && peer_shutdown[peer_id] != SHUT_ACKED) {
+        peer_shutdown[peer_id] = SHUT_ACKED;
+        peer_ack_ns[peer_id] = monotonic_ns();
+        shutdown_acks++;                    // update shutdown_acks
+        pthread_cond_broadcast(&cond_shutdown);
+    } else if (action == SHUTDOWN_NOW && shutdown_now == 0) {
+        shutdown_now = 1;                   // (mesh only!) clients see it in client_listening()
+        pthread_cond_broadcast(&cond_shutdown);
     }
-    return "UNKNOWN OPERATION";
+    pthread_mutex_unlock(&mutex_shutack);   // unlock (o)
 }
 
-//-- sends a message with an action from PX to PY using sockets underneath
-int send_msg(const char *from, const char *to, enum operations action) {
-    int sts_status, l_clock_loc, connection_fd = sock_sfd;
-    char *action_string;
-
-    // get lamport clock and update it BEFORE sending the message
-    l_clock_loc = get_clock_lamport();
-    update_clock_lamport(&l_clock_loc);
+//-- (server only!) sets how many clients start_up_server() waits for (1..MAX_PEERS)
+void set_num_clients(int n) {
+    if (n >= 1 && n <= MAX_PEERS) {
+        num_clients = n;
+    }
+}
 
-    // create the message to send with the proper origin, action and clock
-    struct message *msg = create_msg(from, action, get_clock_lamport());
+//-- sets deadline (for pthread_cond_timedwait) timeout_ms from now
+void deadline_after(struct timespec *deadline, long timeout_ms) {
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
 
-    // if server is the sender, updates connection_fd to the addressee (receiver)
-    if (strcmp(to, "P1") == 0) {
-        connection_fd = cli_1_cfd;
+//-- (server only!) two-phase shutdown: waits timeout_ms for the READY_TO_SHUTDOWN
+//   of every client, sends ONE SHUTDOWN_NOW to all the ready ones at once and gives
+//   each timeout_ms to answer, returns how many clients were not ready or did not
+//   answer (stragglers, reported on stderr)
+int shutdown_coordinate(const char *whoami, long timeout_ms) {
+    int i, id, n_ids = 0, stragglers = 0, wait_status = 0;
+    int ids[MAX_PEERS];
+    struct timespec deadline;
+
+    // phase 1: every client is ready (or timeout_ms went by)
+    deadline_after(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&mutex_shutack);     // lock (X)
+    while (shutdown_readys < num_clients && sock_status == SOCKET_RUNNING &&
+           wait_status != ETIMEDOUT) {
+        wait_status = pthread_cond_timedwait(&cond_shutdown, &mutex_shutack, &deadline);
     }
-    if (strcmp(to, "P3") == 0) {
-        connection_fd = cli_3_cfd;
+    for (id = 0; id < MAX_PEERS; id++) {
+        if (peer_shutdown[id] == SHUT_READY) {
+            peer_shutdown[id] = SHUT_NOTIFIED;
+            ids[n_ids++] = id;
+        } else if (peer_shutdown[id] == SHUT_NONE && peer_conn(id) != PEER_NO_CONN) {
+            fprintf(stderr, "straggler: %s sent no READY_TO_SHUTDOWN in %li ms\n",
+                    peer_name(id), timeout_ms);
+            stragglers++;
+        }
     }
-
-    // print send trace as: "PX, contador_lamport, SEND, operations"
-    action_string = action_to_str(action);
-    printf("%s, %i, SEND, %s\n", from, l_clock_loc, action_string);
-    
-    // in case of error, send_through_socket() prints the error message
-    sts_status = send_through_socket(connection_fd, msg);
-    if (sts_status == F_FAILURE) {
-        return F_FAILURE;
+    if (n_ids + stragglers < num_clients) {     // connected, but never sent a frame
+        fprintf(stderr, "straggler: %i client(s) sent nothing in %li ms\n",
+                num_clients - n_ids - stragglers, timeout_ms);
+        stragglers = num_clients - n_ids;
     }
+    pthread_mutex_unlock(&mutex_shutack);   // unlock (o)
 
-    return F_SUCCESS;
-}
+    // phase 2: one round trip, whatever the number of clients
+    shutdown_sent_ns = monotonic_ns();
+    send_to_many(whoami, ids, n_ids, SHUTDOWN_NOW, NULL, 0);
+    flush_all_msgs();
 
-//-- updates cli_1_cfd or cli_3_cfd when necessary
-void associate_if_server(int conn_fd, char *origin) {
-    DEBUG_PRINTF("SERVER ASOCIATING:\n");
-    // associates "P1" or "P3" to its connection fd as needed
+    deadline_after(&deadline, timeout_ms);
+    wait_status = 0;
 
-    if (strcmp(origin, "P1") == 0 && cli_1_cfd != conn_fd) {
-        DEBUG_PRINTF(">>> ASOCIATION DONE: P1 is connection fd %i\n", conn_fd);
-        cli_1_cfd = conn_fd;        // P3 association
-    } else {
-        if (strcmp(origin, "P3") == 0 && cli_3_cfd != conn_fd) {
-            DEBUG_PRINTF(">>> ASOCIATION DONE: P3 is connection fd %i\n", conn_fd);
-            cli_3_cfd = conn_fd;    // P3 association
+    pthread_mutex_lock(&mutex_shutack);     // lock (X)
+    while (shutdown_acks < n_ids && wait_status != ETIMEDOUT) {
+        wait_status = pthread_cond_timedwait(&cond_shutdown, &mutex_shutack, &deadline);
+    }
+    for (i = 0; i < n_ids; i++) {
+        if (peer_shutdown[ids[i]] != SHUT_ACKED) {
+            fprintf(stderr, "straggler: %s sent no SHUTDOWN_ACK in %li ms\n",
+                    peer_name(ids[i]), timeout_ms);
+            stragglers++;
+        } else {
+            DEBUG_PRINTF("%s: SHUTDOWN_ACK after %li us\n", peer_name(ids[i]),
+                         (peer_ack_ns[ids[i]] - shutdown_sent_ns) / 1000);
         }
     }
+    pthread_mutex_unlock(&mutex_shutack);   // unlock (o)
+
+    return stragglers;
 }
 
-//-- (used by threads!) blocks until a message is received
-int receive_msg(int conn_fd, struct message *msg) {
-    DEBUG_PRINTF("[rcvm] inside receive_msg() function:\n");
+//-- removes the AF_UNIX socket file this process listens at (if any)
+void remove_unix_socket() {
+    char unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
 
-    int bytes_received = recv(conn_fd, msg, sizeof(struct message), 0);
-    if (bytes_received < 0) {
-        perror("[!] recv failed");
-        return F_FAILURE;
+    if (transport != TRANSPORT_TCP) {
+        snprintf(unix_path, sizeof(unix_path), UNIX_PATH_FORMAT, server_port);
+        unlink(unix_path);
     }
+}
 
-    if (bytes_received == 0) {
-        sock_status = SOCKET_CLOSED;
-        DEBUG_PRINTF("[!] connection with %i was closed by SHUTDOWN\n", conn_fd);
-        return F_CONN_CLOSE;    // return F_CONN_CLOSE when connection is closed
+//-- (mesh only!) closes every peer connection and terminates with indicated status
+void terminate_mesh(int exit_status) {
+    int id, conn_fd;
+
+    flow_wait_drained(FLOW_DRAIN_MS);   // frames waiting for credit go first
+    flush_all_msgs();   // nothing queued may be lost with the connections
+
+    // end of stream to every peer: a receiver thread returns once its peer does the same
+    for (id = 0; id < MAX_PEERS; id++) {
+        conn_fd = peer_conn(id);
+        if (conn_fd != PEER_NO_CONN) {
+            shutdown(conn_fd, SHUT_WR);
+        }
+    }
+    while (conn_count > 0) {
+        pthread_join(conn_threads[conn_count - 1], NULL);
+        conn_count--;
     }
-    
-    associate_if_server(conn_fd, msg->origin); // only server really uses this
 
-    DEBUG_PRINTF("[!] SUCCESS: received from %s with clock %u\n", msg->origin, msg->clock_lamport);
+    sock_status = SOCKET_CLOSED;
+    close(sock_sfd);
+    remove_unix_socket();
+    trace_stop();   // the last events reach the trace file
 
-    return F_SUCCESS;
+    exit(exit_status);
+}
+
+//-- (server only!) conn_fd no longer needs terminate_server() to find it by fd: its peer
+//   is named (the registry has it) or its thread is closing it
+void conn_named(int conn_fd) {
+    int i;
+
+    pthread_mutex_lock(&mutex_shutack);     // lock (X)
+    for (i = 0; i < MAX_PEERS; i++) {   // (conn_count may not count it yet)
+        if (conn_unnamed[i] == conn_fd) {
+            conn_unnamed[i] = -1;
+        }
+    }
+    pthread_mutex_unlock(&mutex_shutack);   // unlock (o)
 }
 
 //-- (server only!) closes the server socket and terminates with indicated status
 void terminate_server(int exit_status) {
-    int final_clock = get_clock_lamport();
+    int i, id, conn_fd, final_clock = get_clock_lamport();
+
+    flow_wait_drained(FLOW_DRAIN_MS);   // frames waiting for credit go first
+    flush_all_msgs();   // nothing queued may be lost with the connections
     printf("Los clientes fueron correctamente apagados en t(lamport) = %i\n", final_clock);
 
+    // stragglers never close their end: unblock their threads from here
+    pthread_mutex_lock(&mutex_shutack);     // lock (X)
+    for (id = 0; id < MAX_PEERS; id++) {
+        conn_fd = peer_conn(id);
+        if (peer_shutdown[id] != SHUT_ACKED && conn_fd != PEER_NO_CONN) {
+            shutdown(conn_fd, SHUT_RDWR);
+        }
+    }
+    for (i = 0; i < conn_count; i++) {  // ...nor do the ones that never sent a frame
+        if (conn_unnamed[i] >= 0) {
+            shutdown(conn_unnamed[i], SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&mutex_shutack);   // unlock (o)
+
+    // the other peers may still be talking among themselves
+    if (mesh_mode) {
+        terminate_mesh(exit_status);
+    }
+
     // waits for all threads with pthread join
     while (conn_count > 0) {
         pthread_join(conn_threads[conn_count - 1], NULL);
@@ -357,23 +2160,41 @@ void terminate_server(int exit_status) {
 
     sock_status = SOCKET_CLOSED;
     close(sock_sfd);
+    remove_unix_socket();
+    trace_stop();   // the last events reach the trace file
 
     exit(exit_status);
 }
 
+//-- (mesh only!) counts one more peer with a connection
+void mesh_peer_up() {
+    pthread_mutex_lock(&mutex_mesh);        // lock (X)
+    mesh_joined++;
+    pthread_cond_broadcast(&cond_mesh);
+    pthread_mutex_unlock(&mutex_mesh);      // unlock (o)
+}
+
 //-- (server only!) function called by a thread, receives in loop
 int server_listening(int *cfd) {
     char *action_string;
-    int l_clock_loc, recv_status = F_SUCCESS, conn_fd = *((int*)cfd);
+    struct rx_buffer rx;
+    int l_clock_loc, recv_status = F_SUCCESS, conn_fd = *((int*)cfd), peer_id = F_FAILURE;
+    unsigned int peer_generation = 0;
     struct message *buffer_msg = create_empty_msg();
 
     free(cfd);
+    if (buffer_msg == NULL) {
+        close(conn_fd);
+        return F_FAILURE;
+    }
 
+    init_rx_buffer(&rx);
+    send_never_waits = 1;   // the credit a send waits for arrives through this thread
     DEBUG_PRINTF(" (!thread) SERVER LISTENING\n");
 
     // while server has not received 1 SHUTDOWN_ACK for each client and socket is RUNNING
-    while (shutdown_acks < NUM_OF_CLIENTS && sock_status == SOCKET_RUNNING) {
-        recv_status = receive_msg(conn_fd, buffer_msg);
+    while (shutdown_acks < num_clients && sock_status == SOCKET_RUNNING) {
+        recv_status = receive_msg(conn_fd, &rx, buffer_msg);
         DEBUG_PRINTF(" (!thread) recv() clear with status %i and it should be %i\n", recv_status, F_SUCCESS);
 
         // in case recv_status is not F_SUCCESS
@@ -382,39 +2203,261 @@ int server_listening(int *cfd) {
             break;
         }
 
-        // update Lamport clock after the receive
-        l_clock_loc = buffer_msg->clock_lamport;
-        update_clock_lamport(&l_clock_loc);
+        // the first frame tells who is at the other end of this connection
+        if (peer_id == F_FAILURE) {
+            peer_id = join_from_msg(conn_fd, buffer_msg, &peer_generation);
+            conn_named(conn_fd);
+        }
+        if (buffer_msg->action == MESH_HELLO) {
+            mesh_peer_up();     // only names the peer: no clock update nor trace
+            continue;
+        }
+        if (buffer_msg->action == FLOW_CREDIT) {
+            flow_on_credit(conn_fd, buffer_msg);    // no clock update nor trace either
+            continue;
+        }
+
+        // update Lamport clock (and vector / hybrid one) after the receive
+        l_clock_loc = clock_on_receive(buffer_msg);
 
         // print recv trace as: "PX, contador_lamport, RECV (PY), operations"
         action_string = action_to_str(buffer_msg->action);
-        printf("%s, %i, RECV (%s), %s\n", stub_whoami, l_clock_loc, buffer_msg->origin, action_string);
-
-        if (buffer_msg->action == SHUTDOWN_ACK) {
-            pthread_mutex_lock(&mutex_shutack);     // lock (X)
-            shutdown_acks++;                        // update shutdown_acks
-            pthread_mutex_unlock(&mutex_shutack);   // unlock (o)
+        if (print_trace) {
+            printf("%s, %i, RECV (%s), %s\n", stub_whoami, l_clock_loc, peer_name(peer_id), action_string);
         }
+        trace_record(TRACE_RECV, buffer_msg->origin, l_clock_loc,
+                     buffer_msg->clock_lamport, buffer_msg->action);
+        deliver_msg(peer_id, buffer_msg);
+        flow_consumed_one(conn_fd);
+        shutdown_on_receive(peer_id, buffer_msg->action);
         DEBUG_PRINTF(" (!thread) loop...\n...\n");
     }
 
     free_msg(buffer_msg);   // free the message struct reserved previously
+    peer_leave(peer_id, peer_generation);  // nobody can send to this peer from now on
+    conn_named(conn_fd);    // (if it never sent a frame) nor shut it down by fd
+    flow_close(conn_fd);    // nor wait for its credit
+    shm_detach(conn_fd);    // its ring too (if any)
     close(conn_fd);         // close the connection (of this thread)
     return recv_status;     // return
 }
 
+//-- (server only!) creates the receiver thread of connection conn_fd (conn_count++)
+int spawn_listener(int conn_fd) {
+    // copy the connection fd to a pointer (malloc needed)
+    int *conn_fd_ptr = malloc(sizeof(int));
+    if (conn_fd_ptr == NULL) {
+        perror("malloc failed");
+        return F_FAILURE;
+    }
+    *conn_fd_ptr = conn_fd;
+    conn_open(conn_fd);     // before any frame can go either way
+    pthread_mutex_lock(&mutex_shutack);     // lock (X)
+    conn_unnamed[conn_count] = conn_fd;
+    pthread_mutex_unlock(&mutex_shutack);   // unlock (o)
+
+    if (pthread_create(&conn_threads[conn_count], NULL,
+                        (void*)server_listening, (void*)conn_fd_ptr) != 0) {
+        free(conn_fd_ptr);
+        perror("pthread_create failed");
+        return F_FAILURE;
+    }
+    conn_count++;   // update connection counter
+    return F_SUCCESS;
+}
+
+//-- (mesh only!) reads the static peer list at path, returns its entries or F_FAILURE
+int read_peer_list(const char *path, struct mesh_entry *entries) {
+    char line[MESH_LINE_LEN];
+    int n_entries = 0, line_num = 0;
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        perror(path);
+        return F_FAILURE;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_num++;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#') {
+            continue;   // blank line or comment
+        }
+        if (n_entries == MAX_PEERS ||
+            sscanf(line, "%19s %63s %i", entries[n_entries].name,
+                   entries[n_entries].addr, &entries[n_entries].port) != 3) {
+            fprintf(stderr, "error: %s:%i: expected \"<name> <ip_address|unix|shm> <port>\""
+                    " (%i peers at most)\n", path, line_num, MAX_PEERS);
+            fclose(file);
+            return F_FAILURE;
+        }
+        if (check_node_name(entries[n_entries].name) == F_FAILURE) {
+            fprintf(stderr, "error: %s:%i: bad peer name\n", path, line_num);
+            fclose(file);
+            return F_FAILURE;
+        }
+        n_entries++;
+    }
+    fclose(file);
+    return n_entries;
+}
+
+//-- (mesh only!) connects to the peer of entry, retrying while it is not listening
+//   yet (MESH_CONNECT_MS at most), returns the connection fd or F_FAILURE
+int mesh_connect(const struct mesh_entry *entry) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    long deadline_ns = monotonic_ns() + MESH_CONNECT_MS * 1000000L;
+    int conn_fd, error;
+
+    conn_fd = init_socket(&addr, &addr_len, (char *)entry->addr, entry->port);
+    while (conn_fd != F_FAILURE && connect(conn_fd, (struct sockaddr *)&addr, addr_len) < 0) {
+        error = errno;
+        close(conn_fd);     // a failed connect() leaves the socket unusable
+        if ((error != ECONNREFUSED && error != ENOENT && error != EINTR) ||
+            monotonic_ns() > deadline_ns) {
+            fprintf(stderr, "error: can't connect to %s (%s %i): %s\n",
+                    entry->name, entry->addr, entry->port, strerror(error));
+            return F_FAILURE;
+        }
+        usleep(MESH_RETRY_MS * 1000);
+        conn_fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    }
+    return conn_fd;
+}
+
+//-- (mesh only!) tells the peer at the other end of conn_fd who connected
+int send_hello(int conn_fd) {
+    unsigned char frame[WIRE_MAX_FRAME];
+    struct message hello;
+    struct iovec iov;
+
+    memset(&hello, 0, sizeof(hello));
+    fill_msg(&hello, stub_whoami, MESH_HELLO, 0);
+    iov.iov_base = frame;
+    iov.iov_len = encode_msg(&hello, NULL, frame);
+    return writev_all(conn_fd, &iov, 1);
+}
+
+//-- (mesh only!) connects this process to every peer of the static list argv[2]:
+//   listens at its own entry, connects to the peers listed before it and accepts
+//   the ones listed after it, then waits until every peer is joined
+void start_up_mesh(int argc, char *argv[]) {
+    struct mesh_entry entries[MAX_PEERS];
+    struct sockaddr_storage addr;
+    struct timespec deadline;
+    socklen_t addr_len;
+    int n_entries, self = F_FAILURE, i, conn_fd, wait_status = 0;
+
+    if (check_argnum(argc) == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+    n_entries = read_peer_list(argv[2], entries);
+    if (n_entries == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n_entries; i++) {
+        if (strcmp(entries[i].name, stub_whoami) == 0) {
+            self = i;
+        }
+    }
+    if (self == F_FAILURE) {
+        fprintf(stderr, "error: %s is not in the peer list %s\n", stub_whoami, argv[2]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc == 4 && trace_start(argv[3]) == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+
+    mesh_mode = 1;
+    is_server = 1;                  // every peer has its own connection: no route to fall back to
+    num_clients = n_entries - 1;    // shutdown_coordinate() waits for all of them
+
+    // the ids follow the list, whoever connects first
+    for (i = 0; i < n_entries; i++) {
+        peer_intern(entries[i].name);
+    }
+
+    sock_sfd = init_socket(&addr, &addr_len, entries[self].addr, entries[self].port);
+    if (sock_sfd == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+    server_port = entries[self].port;
+    if (transport == TRANSPORT_TCP) {
+        enable_setsockopt(sock_sfd);
+    }
+    if (bind_and_listen(sock_sfd, &addr, addr_len) == F_FAILURE ||
+        listen(sock_sfd, MAX_PEERS) < 0) {  // every later peer may connect at once
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGINT, handle_sigint);
+
+    // the peers listed before this one are listening already (or soon)...
+    for (i = 0; i < self; i++) {
+        conn_fd = mesh_connect(&entries[i]);
+        if (conn_fd == F_FAILURE ||
+            (transport == TRANSPORT_SHM && shm_connect(conn_fd) == F_FAILURE) ||
+            send_hello(conn_fd) == F_FAILURE) {
+            exit(EXIT_FAILURE);
+        }
+        // joined before its listener runs: the listener's join (at the first frame) is
+        // the last one, and its leave is the one that counts
+        peer_join(entries[i].name, conn_fd, NULL);
+        if (spawn_listener(conn_fd) == F_FAILURE) {
+            exit(EXIT_FAILURE);
+        }
+        mesh_peer_up();
+    }
+
+    // ...and the ones listed after it connect to this one
+    while (conn_count < num_clients && sock_status == SOCKET_RUNNING) {
+        conn_fd = accept(sock_sfd, NULL, NULL);
+        if (conn_fd < 0) {
+            perror("accept failed");
+            continue;
+        }
+        if ((transport == TRANSPORT_SHM && shm_accept(conn_fd) == F_FAILURE) ||
+            spawn_listener(conn_fd) == F_FAILURE) {
+            close(conn_fd);
+        }
+    }
+
+    // an accepted peer is known once its MESH_HELLO arrives
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += MESH_CONNECT_MS / 1000;
+    pthread_mutex_lock(&mutex_mesh);        // lock (X)
+    while (mesh_joined < num_clients && wait_status != ETIMEDOUT) {
+        wait_status = pthread_cond_timedwait(&cond_mesh, &mutex_mesh, &deadline);
+    }
+    pthread_mutex_unlock(&mutex_mesh);      // unlock (o)
+    if (wait_status == ETIMEDOUT) {
+        fprintf(stderr, "error: %i of %i peers joined the mesh\n", mesh_joined, num_clients);
+        exit(EXIT_FAILURE);
+    }
+    printf("Mesh of %i peers ready...\n", n_entries);
+}
+
 //-- (server only!) inits the server with its fd and creates one thread per client
 void start_up_server(int argc, char *argv[], char *whoami) {
     int port, conn_fd;
-    struct sockaddr_in servaddr, cliaddr;
-    socklen_t cliaddr_len = sizeof(cliaddr);
+    struct sockaddr_storage servaddr, cliaddr;
+    socklen_t servaddr_len, cliaddr_len = sizeof(cliaddr);
     char *server_ip;
 
     stub_whoami = whoami;   // as it enters, updates global stub_whoami
+    if (check_node_name(whoami) == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+    self_node_id = node_id_from_name(whoami);
+    is_server = 1;
 
     // Disable buffering when printing messages
     setbuf(stdout, NULL);
 
+    // a static peer list instead of the server address: full mesh
+    if (argc >= 3 && strcmp(argv[1], "mesh") == 0) {
+        start_up_mesh(argc, argv);
+        return;
+    }
+
     // does several verifications while initializing the server...
     if (check_argnum(argc) == F_FAILURE) {
         exit(EXIT_FAILURE);
@@ -425,19 +2468,25 @@ void start_up_server(int argc, char *argv[], char *whoami) {
     if (port == F_FAILURE) {
         exit(EXIT_FAILURE);
     }
+    if (argc == 4 && trace_start(argv[3]) == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
 
-    sock_sfd = init_socket(&servaddr, server_ip, port); // establishes sock_sfd
+    sock_sfd = init_socket(&servaddr, &servaddr_len, server_ip, port); // establishes sock_sfd
     if (sock_sfd == F_FAILURE) {
         sock_status = SOCKET_CLOSED;
         exit(EXIT_FAILURE);
     }
+    server_port = port;
 
     DEBUG_PRINTF("INIT CLEAR\n");
     DEBUG_PRINTF("-> socket has sock_sfd = %i\n", sock_sfd);
 
-    enable_setsockopt(sock_sfd);
+    if (transport == TRANSPORT_TCP) {
+        enable_setsockopt(sock_sfd);
+    }
 
-    if (bind_and_listen(sock_sfd, &servaddr) == F_FAILURE) {
+    if (bind_and_listen(sock_sfd, &servaddr, servaddr_len) == F_FAILURE) {
         close(sock_sfd);
         sock_status = SOCKET_CLOSED;
         exit(EXIT_FAILURE);
@@ -449,8 +2498,8 @@ void start_up_server(int argc, char *argv[], char *whoami) {
     
     signal(SIGINT, handle_sigint);
 
-    // creates new threads until it is 1 per client specified (NUM_OF_CLIENTS)
-    while (conn_count < NUM_OF_CLIENTS && sock_status == SOCKET_RUNNING) {
+    // creates new threads until it is 1 per client specified (set_num_clients)
+    while (conn_count < num_clients && sock_status == SOCKET_RUNNING) {
 
         // accept new client 
         conn_fd = accept(sock_sfd, (struct sockaddr*)&cliaddr, &cliaddr_len);
@@ -458,37 +2507,59 @@ void start_up_server(int argc, char *argv[], char *whoami) {
             perror("accept failed");
             continue;
         }
-        conn_count++;   // update connection counter
-
-        DEBUG_PRINTF("NEW CONNECTION ACCEPTED: %i\n", conn_fd);
-
-        // copy the connection fd to a pointer (malloc needed)
-        int *conn_fd_ptr = malloc(sizeof(int));
-        if (conn_fd_ptr == NULL) {
-            perror("malloc failed");
+        // the client sends its ring before any frame
+        if (transport == TRANSPORT_SHM && shm_accept(conn_fd) == F_FAILURE) {
             close(conn_fd);
-            conn_count--;
             continue;
         }
-        *conn_fd_ptr = conn_fd;
+
+        DEBUG_PRINTF("NEW CONNECTION ACCEPTED: %i\n", conn_fd);
 
         // new thread to handle the accepted connection
-        if (pthread_create(&conn_threads[conn_count - 1], NULL, 
-                            (void*)server_listening, (void*)conn_fd_ptr) != 0) {
-            free(conn_fd_ptr);
-            perror("pthread_create failed");
+        if (spawn_listener(conn_fd) == F_FAILURE) {
             close(conn_fd);
-            continue;
         }
     }
 }
 
+//-- (clients only!) tells the coordinator it is READY_TO_SHUTDOWN, waits for its
+//   SHUTDOWN_NOW and answers with a SHUTDOWN_ACK
+int shutdown_participate(const char *whoami, const char *coordinator) {
+    int status;
+
+    if (send_msg(whoami, coordinator, READY_TO_SHUTDOWN) == F_FAILURE) {
+        return F_FAILURE;
+    }
+    flush_all_msgs();
+
+    pthread_mutex_lock(&mutex_shutack);     // lock (X)
+    while (shutdown_now == 0) {
+        pthread_cond_wait(&cond_shutdown, &mutex_shutack);
+    }
+    status = shutdown_now;
+    pthread_mutex_unlock(&mutex_shutack);   // unlock (o)
+
+    if (status != 1) {
+        fprintf(stderr, "error: connection lost before SHUTDOWN_NOW\n");
+        return F_FAILURE;
+    }
+    return send_msg(whoami, coordinator, SHUTDOWN_ACK);
+}
+
 //-- (client only!) loses the client fd and terminates
 void terminate_client(int exit_status) {
+    if (mesh_mode) {
+        terminate_mesh(exit_status);    // no client_thread: a receiver per peer
+    }
+
+    flow_wait_drained(FLOW_DRAIN_MS);   // frames waiting for credit go first
+    flush_all_msgs();                   // queued frames go out before closing
     pthread_join(client_thread, NULL);  // waits first for the receiver thread
 
     sock_status = SOCKET_CLOSED;
+    shm_detach(sock_sfd);
     close(sock_sfd);
+    trace_stop();   // the last events reach the trace file
 
     exit(exit_status);
 }
@@ -496,24 +2567,48 @@ void terminate_client(int exit_status) {
 //-- (server only!) function called by a thread, receives until SHUTDOWN_NOW
 int client_listening() {
     char *action_string;
-    int l_clock_loc, recv_status;
+    struct rx_buffer rx;
+    int l_clock_loc, recv_status, peer_id = F_FAILURE;
+    unsigned int peer_generation = 0;
     struct message *buffer_msg = create_empty_msg();
 
+    if (buffer_msg == NULL) {
+        return F_FAILURE;
+    }
+
     DEBUG_PRINTF(" (!thread) CLIENT LISTENING with sock_status = %i and should be %i\n", sock_status, SOCKET_RUNNING);
 
+    init_rx_buffer(&rx);
+    send_never_waits = 1;   // the credit a send waits for arrives through this thread
     recv_status = F_SUCCESS;
     // While receive is succeeding, keeps repeating this action
     while (recv_status == F_SUCCESS && sock_status == SOCKET_RUNNING) {
-        recv_status = receive_msg(sock_sfd, buffer_msg);
+        recv_status = receive_msg(sock_sfd, &rx, buffer_msg);
         DEBUG_PRINTF(" (!thread) recv() clear with status %i and it should be %i\n", recv_status, F_SUCCESS);
+        if (recv_status != F_SUCCESS) {
+            break;  // nothing was received: no clock update nor trace
+        }
+
+        if (peer_id == F_FAILURE) {
+            peer_id = join_from_msg(sock_sfd, buffer_msg, &peer_generation);
+        }
+        if (buffer_msg->action == FLOW_CREDIT) {
+            flow_on_credit(sock_sfd, buffer_msg);   // no clock update nor trace
+            continue;
+        }
 
-        // update Lamport clock after the receive
-        l_clock_loc = buffer_msg->clock_lamport;
-        update_clock_lamport(&l_clock_loc);
+        // update Lamport clock (and vector / hybrid one) after the receive
+        l_clock_loc = clock_on_receive(buffer_msg);
 
         // print recv trace as: "PX, contador_lamport, RECV (PY), operations"
         action_string = action_to_str(buffer_msg->action);
-        printf("%s, %i, RECV (%s), %s\n", stub_whoami, l_clock_loc, buffer_msg->origin, action_string);
+        if (print_trace) {
+            printf("%s, %i, RECV (%s), %s\n", stub_whoami, l_clock_loc, peer_name(peer_id), action_string);
+        }
+        trace_record(TRACE_RECV, buffer_msg->origin, l_clock_loc,
+                     buffer_msg->clock_lamport, buffer_msg->action);
+        deliver_msg(peer_id, buffer_msg);
+        flow_consumed_one(sock_sfd);
 
         // when SHUTDOWN_NOT is received, terminate thread execution (break loop)
         if (buffer_msg->action == SHUTDOWN_NOW) {
@@ -521,21 +2616,40 @@ int client_listening() {
         }
     }
 
+    // wakes shutdown_participate() (SHUTDOWN_NOW, or no server to wait for)
+    pthread_mutex_lock(&mutex_shutack);     // lock (X)
+    shutdown_now = (buffer_msg->action == SHUTDOWN_NOW && recv_status == F_SUCCESS) ? 1 : -1;
+    pthread_cond_broadcast(&cond_shutdown);
+    pthread_mutex_unlock(&mutex_shutack);   // unlock (o)
+
     free_msg(buffer_msg);   // free the message struct reserved previously
+    peer_leave(peer_id, peer_generation);
+    flow_close(sock_sfd);
     return recv_status;     // return (do not close sock_sfd before this!)
 }
 
 //-- (client only!) inits the client with its fd and creates a receiver thread
 void start_up_client(int argc, char *argv[], char *whoami) {
     int port;
-    struct sockaddr_in servaddr;
+    struct sockaddr_storage servaddr;
+    socklen_t servaddr_len;
     char *server_ip;
 
     stub_whoami = whoami;   // as it enters, updates global stub_whoami
+    if (check_node_name(whoami) == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+    self_node_id = node_id_from_name(whoami);
 
     // disable buffering when printing messages
     setbuf(stdout, NULL);
 
+    // a static peer list instead of the server address: full mesh
+    if (argc >= 3 && strcmp(argv[1], "mesh") == 0) {
+        start_up_mesh(argc, argv);
+        return;
+    }
+
     // does several verifications while initializing the client...
     if (check_argnum(argc) == F_FAILURE) {
         sock_status = SOCKET_CLOSED;
@@ -548,8 +2662,12 @@ void start_up_client(int argc, char *argv[], char *whoami) {
         sock_status = SOCKET_CLOSED;
         exit(EXIT_FAILURE);
     }
+    if (argc == 4 && trace_start(argv[3]) == F_FAILURE) {
+        sock_status = SOCKET_CLOSED;
+        exit(EXIT_FAILURE);
+    }
 
-    sock_sfd = init_socket(&servaddr, server_ip, port); // establishes sock_sfd
+    sock_sfd = init_socket(&servaddr, &servaddr_len, server_ip, port); // establishes sock_sfd
     if (sock_sfd == F_FAILURE) {
         sock_status = SOCKET_CLOSED;
         exit(EXIT_FAILURE);
@@ -558,7 +2676,8 @@ void start_up_client(int argc, char *argv[], char *whoami) {
     DEBUG_PRINTF("INIT CLEAR\n");
     DEBUG_PRINTF("-> socket has sock_sfd = %i\n", sock_sfd);
 
-    if (connect_to_server(sock_sfd, &servaddr) == F_FAILURE) {
+    if (connect_to_server(sock_sfd, &servaddr, servaddr_len) == F_FAILURE ||
+        (transport == TRANSPORT_SHM && shm_connect(sock_sfd) == F_FAILURE)) {
         close(sock_sfd);
         sock_status = SOCKET_CLOSED;
         exit(EXIT_FAILURE);
@@ -568,6 +2687,8 @@ void start_up_client(int argc, char *argv[], char *whoami) {
     
     signal(SIGINT, handle_sigint);
 
+    conn_open(sock_sfd);    // before any frame can go either way
+
     // Create a SINGLE thread for listening the messages sent from the server
     if (pthread_create(&client_thread, NULL, 
                         (void*)client_listening, (void*)NULL) != 0) {
@@ -14,6 +14,15 @@
 #include <signal.h>
 #include <err.h>
 #include <errno.h>
+#include <stdint.h>
+
+
+#define F_FAILURE           -1
+#define F_SUCCESS           0
+#define F_CONN_CLOSE        -3
+#define F_WOULDBLOCK        -4  // try_send_msg(): the peer has no credit left
+
+#define SHUTDOWN_TIMEOUT_MS 2000    // time each client has to answer SHUTDOWN_NOW
 
 
 #ifdef DEBUG
@@ -23,24 +32,147 @@
 #endif
 
 
+#define MAX_NODE_ID         64  // node ids ("P<id>") index vector clocks: 0..MAX_NODE_ID-1
+
+#define CLOCK_EQUAL         0   // clock_compare() results
+#define CLOCK_BEFORE        -1
+#define CLOCK_AFTER         1
+#define CLOCK_CONCURRENT    2
+
+
+#define MSG_PAYLOAD_MAX     64  // application bytes a message can carry
+#define WIRE_MAX_FRAME      512 // biggest encoded frame (a full vector clock fits)
+#define MAX_PEERS           64  // nodes a process can know (dense ids 0..MAX_PEERS-1)
+#define FLOW_WINDOW         256 // frames a sender may have unconsumed per connection
+
+
+#define TRACE_MAGIC         "SDCT"
+#define TRACE_VERSION       1   // read back as 256 when the byte order differs
+#define TRACE_SEND          1   // trace_event.type
+#define TRACE_RECV          2
+
+
 enum operations {
     READY_TO_SHUTDOWN = 0,
     SHUTDOWN_NOW,
-    SHUTDOWN_ACK
+    SHUTDOWN_ACK,
+    TOM_DATA,                   // totally ordered multicast (see tomcast.c)
+    TOM_ACK,
+    MESH_HELLO,                 // names the connector of a mesh connection (no event)
+    SNAP_MARKER,                // Chandy-Lamport marker (see snapshot.c)
+    DMX_REQUEST,                // distributed lock (see dmutex.c)
+    DMX_REPLY,
+    DMX_TOKEN,
+    FLOW_CREDIT,                // frames the receiver consumed: the sender may send more (no event)
+    NUM_OF_OPERATIONS           // keep last
+};
+
+enum clock_modes {
+    CLOCK_LAMPORT = 0,          // scalar Lamport clock only (default)
+    CLOCK_VECTOR,               // + vector clock, sent as a sparse delta
+    CLOCK_HYBRID                // + hybrid logical clock (wall time aware)
+};
+
+struct clock_stamp {
+    enum clock_modes mode;
+    uint64_t hlc;                       // CLOCK_HYBRID: wall ms << 16 | counter
+    unsigned int vc[MAX_NODE_ID];       // CLOCK_VECTOR: entry i is node "P<i>"
 };
 
 struct message {
-    char origin[20];
+    unsigned int origin;        // node id of the sender ("P2" is node 2)
     enum operations action;
     unsigned int clock_lamport;
+    struct clock_stamp stamp;
+    unsigned int payload_len;   // 0 for the plain operations
+    unsigned char payload[MSG_PAYLOAD_MAX];
+};
+
+// first bytes of a binary trace file (see trace_start), events follow
+struct trace_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t node_id;           // node id of the process that wrote it
+    char name[20];
+};
+
+// one SEND or RECV of a message, as recorded in a binary trace file
+struct trace_event {
+    uint64_t mono_ns;           // CLOCK_MONOTONIC: comparable among processes of a host
+    uint32_t lamport;           // Lamport time of the event
+    uint32_t msg_lamport;       // Lamport time the message was sent with
+    uint16_t peer;              // node id at the other end of the message
+    uint8_t type;               // TRACE_SEND or TRACE_RECV
+    uint8_t action;
+    uint32_t reserved;
+};
+
+// flow control of one connection, as reported by get_flow_stats()
+struct flow_stats {
+    int credits;                // frames the connection can take right now
+    int queued;                 // frames waiting for credit
+    int max_queued;             // deepest the queue got
+    long queued_total;          // frames that had to wait for credit
+    long stalls;                // sends that found the queue full and waited
+    long stall_ns;              // time those sends waited
+    long would_block;           // try_send_msg() calls refused
 };
 
 
 extern int sock_status;
 extern int sock_sfd;
+extern char *stub_whoami;
 
 int get_clock_lamport();
+int next_clock_lamport();
+long monotonic_ns();
+unsigned int node_id_from_name(const char *name);
+void update_clock_lamport(int *l_clock_loc);
+
+void set_clock_mode(enum clock_modes mode);
+enum clock_modes get_clock_mode();
+void get_clock_stamp(struct clock_stamp *now);
+int clock_compare(const struct clock_stamp *a, const struct clock_stamp *b);
 int send_msg(const char *from, const char *to, enum operations action);
+int send_msg_id(const char *from, int to_id, enum operations action);
+int multicast_msg(const int *to_ids, int n_ids, enum operations action,
+                  const void *payload, unsigned int payload_len);
+int multicast_msg_at(int l_clock_loc, const int *to_ids, int n_ids, enum operations action,
+                     const void *payload, unsigned int payload_len);
+void set_msg_handler(enum operations action, void (*handler)(int peer_id, const struct message *msg));
+void set_recv_hook(void (*hook)(int peer_id, const struct message *msg));
+void dispatch_msg(int peer_id, const struct message *msg);
+
+int flush_msgs(int to_id);
+int flush_all_msgs();
+void set_batch_window(long window_us);
+void set_send_deferred(int enabled);
+void get_batch_stats(long *msgs, long *syscalls);
+
+int try_send_msg(int to_id, enum operations action, const void *payload, unsigned int payload_len);
+void get_flow_stats(int to_id, struct flow_stats *stats);
+void reset_flow_max_queued(int to_id);
+
+int peer_intern(const char *name);
+int peer_lookup(const char *name);
+const char *peer_name(int id);
+unsigned int peer_node(int id);
+int peer_conn(int id);
+int peer_join(const char *name, int conn_fd, unsigned int *generation);
+void peer_leave(int id, unsigned int generation);
+void get_msg_pool_stats(long *gets, long *slab_mallocs);
+
+int encode_msg(const struct message *msg, unsigned int *vc_base, unsigned char *frame);
+int decode_msg(const unsigned char *buf, size_t len, struct message *msg);
+
+int trace_start(const char *path);
+void trace_stop();
+long get_trace_dropped();
+void set_print_trace(int enabled);
+
+void set_num_clients(int n);
+int shutdown_coordinate(const char *whoami, long timeout_ms);
+int shutdown_participate(const char *whoami, const char *coordinator);
 
 void terminate_server(int exit_status);
 int start_up_server(int argc, char *argv[], char *whoami);
@@ -0,0 +1,267 @@
+#include "./tomcast.h"
+#include <pthread.h>
+#include <time.h>
+
+
+// GLOBAL VARIABLES (stub glue, one group per process):
+struct tom_group tom_grp;                   // protected by mutex_tom
+int tom_peer_ids[TOM_MAX_MEMBERS];          // member index -> stub peer id
+int tom_member_of[MAX_PEERS];               // stub peer id -> member index (-1: none)
+int tom_others[TOM_MAX_MEMBERS];            // peer ids of every member but self
+void (*tom_deliver)(const char *sender, unsigned int ts, const void *payload, unsigned int len);
+pthread_t tom_ack_thread;
+
+long tom_data_sent  = 0;    // TOM_DATA multicasts (mutex_tom)
+long tom_acks_sent  = 0;    // TOM_ACK multicasts that could not ride on data (mutex_tom)
+long tom_delivered  = 0;    // messages given to the application (mutex_tom)
+
+pthread_mutex_t mutex_tom = PTHREAD_MUTEX_INITIALIZER; // protects tom_grp and counters
+pthread_mutex_t mutex_tom_send = PTHREAD_MUTEX_INITIALIZER; // our TOM frames leave in time order
+    // (taken before mutex_tom, and never by the receiver threads: a send blocked on a
+    //  full socket leaves them free to drain theirs)
+
+
+//-- returns 1 when hold-back entry a goes before b: (ts, sender) order
+int tom_entry_less(const struct tom_entry *a, const struct tom_entry *b) {
+    return a->ts < b->ts || (a->ts == b->ts && a->sender < b->sender);
+}
+
+//-- starts the protocol state of member self in a group of n_members
+void tom_init(struct tom_group *g, int self, int n_members) {
+    int i;
+
+    g->self = self;
+    g->n_members = n_members;
+    g->ack_owed = 0;
+    g->heap_len = 0;
+    memset(g->last_ts, 0, sizeof(g->last_ts));
+
+    g->free_len = TOM_HOLDBACK_MAX;
+    for (i = 0; i < TOM_HOLDBACK_MAX; i++) {
+        g->free_slots[i] = TOM_HOLDBACK_MAX - 1 - i;
+    }
+}
+
+//-- records that sender is at Lamport time ts (any message counts as an ack)
+void tom_heard(struct tom_group *g, int sender, unsigned int ts) {
+    if (ts > g->last_ts[sender]) {
+        g->last_ts[sender] = ts;
+    }
+}
+
+//-- puts a multicast message in the hold-back queue (own ones too)
+int tom_hold(struct tom_group *g, int sender, unsigned int ts, const void *payload, unsigned int len) {
+    struct tom_entry entry, tmp;
+    int pos, parent;
+
+    if (g->free_len == 0 || len > MSG_PAYLOAD_MAX) {
+        fprintf(stderr, "error: tomcast hold-back queue full\n");
+        return F_FAILURE;
+    }
+
+    entry.ts = ts;
+    entry.sender = sender;
+    entry.slot = g->free_slots[--g->free_len];
+    g->slots[entry.slot].len = len;
+    memcpy(g->slots[entry.slot].payload, payload, len);
+
+    // sift up
+    pos = g->heap_len++;
+    g->heap[pos] = entry;
+    while (pos > 0) {
+        parent = (pos - 1) / 2;
+        if (!tom_entry_less(&g->heap[pos], &g->heap[parent])) {
+            break;
+        }
+        tmp = g->heap[pos];
+        g->heap[pos] = g->heap[parent];
+        g->heap[parent] = tmp;
+        pos = parent;
+    }
+
+    tom_heard(g, sender, ts);
+    if (sender != g->self) {
+        g->ack_owed = 1;    // unless data leaves first and carries the ack
+    }
+    return F_SUCCESS;
+}
+
+//-- takes the head of the hold-back queue out when every member has been heard
+//   at its time or later (nobody can send anything ordered before it anymore)
+//   returns 1 and fills out when something was delivered, 0 otherwise
+int tom_next(struct tom_group *g, struct tom_delivery *out) {
+    struct tom_entry head, tmp;
+    int i, pos, child;
+
+    if (g->heap_len == 0) {
+        return 0;
+    }
+
+    head = g->heap[0];
+    for (i = 0; i < g->n_members; i++) {
+        if (i != g->self && i != head.sender && g->last_ts[i] < head.ts) {
+            return 0;
+        }
+    }
+
+    out->ts = head.ts;
+    out->sender = head.sender;
+    out->len = g->slots[head.slot].len;
+    memcpy(out->payload, g->slots[head.slot].payload, out->len);
+    g->free_slots[g->free_len++] = head.slot;
+
+    // sift down
+    g->heap[0] = g->heap[--g->heap_len];
+    pos = 0;
+    while ((child = 2 * pos + 1) < g->heap_len) {
+        if (child + 1 < g->heap_len && tom_entry_less(&g->heap[child + 1], &g->heap[child])) {
+            child++;
+        }
+        if (!tom_entry_less(&g->heap[child], &g->heap[pos])) {
+            break;
+        }
+        tmp = g->heap[pos];
+        g->heap[pos] = g->heap[child];
+        g->heap[child] = tmp;
+        pos = child;
+    }
+    return 1;
+}
+
+
+//-- (mutex_tom held!) hands every deliverable message to the application
+void tom_deliver_ready() {
+    struct tom_delivery d;
+
+    while (tom_next(&tom_grp, &d)) {
+        tom_delivered++;
+        if (tom_deliver != NULL) {
+            tom_deliver(peer_name(tom_peer_ids[d.sender]), d.ts, d.payload, d.len);
+        }
+    }
+}
+
+//-- (receiver threads!) TOM_DATA and TOM_ACK handler
+void tom_on_msg(int peer_id, const struct message *msg) {
+    int member;
+
+    if (peer_id < 0 || peer_id >= MAX_PEERS || tom_member_of[peer_id] < 0) {
+        return;     // not from a member of the group
+    }
+    member = tom_member_of[peer_id];
+
+    pthread_mutex_lock(&mutex_tom);         // lock (X)
+    if (msg->action == TOM_DATA) {
+        tom_hold(&tom_grp, member, msg->clock_lamport, msg->payload, msg->payload_len);
+    } else {
+        tom_heard(&tom_grp, member, msg->clock_lamport);
+    }
+    tom_deliver_ready();
+    pthread_mutex_unlock(&mutex_tom);       // unlock (o)
+}
+
+//-- (thread!) sends a TOM_ACK when data arrived and no data of ours carried the ack
+void *tom_ack_sender() {
+    struct timespec nap;
+    int ack_owed;
+
+    nap.tv_sec = 0;
+    nap.tv_nsec = TOM_ACK_DELAY_US * 1000L;
+    while (1) {
+        nanosleep(&nap, NULL);
+
+        pthread_mutex_lock(&mutex_tom_send);    // lock (X)
+        pthread_mutex_lock(&mutex_tom);         // lock (X)
+        ack_owed = tom_grp.ack_owed;
+        tom_grp.ack_owed = 0;
+        tom_acks_sent += ack_owed;
+        pthread_mutex_unlock(&mutex_tom);       // unlock (o)
+        if (ack_owed) {
+            multicast_msg(tom_others, tom_grp.n_members - 1, TOM_ACK, NULL, 0);
+        }
+        pthread_mutex_unlock(&mutex_tom_send);  // unlock (o)
+    }
+    return NULL;
+}
+
+//-- joins this process to the group of member_names (same list, same order, in
+//   every member) and sets the function messages are delivered to in total order
+//   every member has to be connected to every other one
+//   deliver runs with the group locked: it must not call tom_broadcast()
+int tom_start(char **member_names, int n_members,
+              void (*deliver)(const char *sender, unsigned int ts, const void *payload, unsigned int len)) {
+    int i, self = F_FAILURE, n_others = 0;
+
+    if (n_members < 1 || n_members > TOM_MAX_MEMBERS) {
+        fprintf(stderr, "error: tomcast groups have 1 to %i members\n", TOM_MAX_MEMBERS);
+        return F_FAILURE;
+    }
+
+    for (i = 0; i < MAX_PEERS; i++) {
+        tom_member_of[i] = -1;
+    }
+    for (i = 0; i < n_members; i++) {
+        tom_peer_ids[i] = peer_intern(member_names[i]);
+        if (tom_peer_ids[i] == F_FAILURE) {
+            return F_FAILURE;
+        }
+        tom_member_of[tom_peer_ids[i]] = i;
+        if (strcmp(member_names[i], stub_whoami) == 0) {
+            self = i;
+        } else {
+            tom_others[n_others++] = tom_peer_ids[i];
+        }
+    }
+    if (self == F_FAILURE) {
+        fprintf(stderr, "error: %s is not a member of the tomcast group\n", stub_whoami);
+        return F_FAILURE;
+    }
+
+    tom_init(&tom_grp, self, n_members);
+    tom_deliver = deliver;
+    set_msg_handler(TOM_DATA, tom_on_msg);
+    set_msg_handler(TOM_ACK, tom_on_msg);
+
+    if (pthread_create(&tom_ack_thread, NULL, tom_ack_sender, NULL) != 0) {
+        perror("pthread_create failed");
+        return F_FAILURE;
+    }
+    pthread_detach(tom_ack_thread);
+    return F_SUCCESS;
+}
+
+//-- multicasts payload to the group; every member delivers it in the same order
+int tom_broadcast(const void *payload, unsigned int len) {
+    int ts, status;
+
+    pthread_mutex_lock(&mutex_tom_send);    // lock (X)
+    // the send time and the hold-back insertion go together: nothing ordered
+    // after our message may be delivered before it is in the queue
+    pthread_mutex_lock(&mutex_tom);         // lock (X)
+    ts = next_clock_lamport();
+    status = tom_hold(&tom_grp, tom_grp.self, ts, payload, len);
+    if (status == F_SUCCESS) {
+        tom_grp.ack_owed = 0;               // our data carries the ack
+        tom_data_sent++;
+        tom_deliver_ready();
+    }
+    pthread_mutex_unlock(&mutex_tom);       // unlock (o)
+
+    // sent without the group locked: the receiver threads go on taking it
+    if (status == F_SUCCESS &&
+        multicast_msg_at(ts, tom_others, tom_grp.n_members - 1, TOM_DATA, payload, len) == F_FAILURE) {
+        status = F_FAILURE;
+    }
+    pthread_mutex_unlock(&mutex_tom_send);  // unlock (o)
+
+    return status;
+}
+
+//-- reports the multicasts sent (data and standalone acks) and the deliveries
+void tom_get_stats(long *data_sent, long *acks_sent, long *delivered) {
+    pthread_mutex_lock(&mutex_tom);         // lock (X)
+    *data_sent = tom_data_sent;
+    *acks_sent = tom_acks_sent;
+    *delivered = tom_delivered;
+    pthread_mutex_unlock(&mutex_tom);       // unlock (o)
+}
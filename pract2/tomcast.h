@@ -0,0 +1,58 @@
+#ifndef TOMCAST_H
+#define TOMCAST_H
+
+#include "./stub.h"
+
+
+#define TOM_MAX_MEMBERS     MAX_PEERS
+#define TOM_HOLDBACK_MAX    4096    // messages a member can hold back at once
+#define TOM_ACK_DELAY_US    500     // time an ack waits for data to ride on
+
+
+// hold-back heap entry, ordered by (ts, sender)
+struct tom_entry {
+    unsigned int ts;
+    int sender;                 // member index
+    int slot;                   // where its payload is (tom_group.slots)
+};
+
+struct tom_slot {
+    unsigned int len;
+    unsigned char payload[MSG_PAYLOAD_MAX];
+};
+
+// a message leaving the hold-back queue, in total order
+struct tom_delivery {
+    unsigned int ts;
+    int sender;
+    unsigned int len;
+    unsigned char payload[MSG_PAYLOAD_MAX];
+};
+
+// state of the total order protocol in one member (no transport in here)
+struct tom_group {
+    int self;                   // member index of this process
+    int n_members;
+    unsigned int last_ts[TOM_MAX_MEMBERS];  // biggest Lamport time heard from each
+    int ack_owed;               // data arrived and nothing was sent since
+    int heap_len;
+    struct tom_entry heap[TOM_HOLDBACK_MAX];
+    int free_len;
+    int free_slots[TOM_HOLDBACK_MAX];
+    struct tom_slot slots[TOM_HOLDBACK_MAX];
+};
+
+
+// protocol engine (the caller moves the messages and keeps the Lamport clock)
+void tom_init(struct tom_group *g, int self, int n_members);
+int tom_hold(struct tom_group *g, int sender, unsigned int ts, const void *payload, unsigned int len);
+void tom_heard(struct tom_group *g, int sender, unsigned int ts);
+int tom_next(struct tom_group *g, struct tom_delivery *out);
+
+// on top of the stub (one group per process)
+int tom_start(char **member_names, int n_members,
+              void (*deliver)(const char *sender, unsigned int ts, const void *payload, unsigned int len));
+int tom_broadcast(const void *payload, unsigned int len);
+void tom_get_stats(long *data_sent, long *acks_sent, long *delivered);
+
+#endif // TOMCAST_H
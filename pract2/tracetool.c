@@ -0,0 +1,287 @@
+#include "./stub.h"
+
+
+#define TOOL_MAX_FILES      MAX_NODE_ID
+#define TOOL_CELL_WIDTH     14      // chars per process column in the diagram
+
+
+// one event read back from a trace file
+struct tool_event {
+    struct trace_event ev;
+    int proc;                   // index of the file it came from
+    uint16_t node;              // node id that recorded it
+    long match;                 // index of the matching SEND / RECV (-1: none)
+};
+
+struct tool_proc {
+    char name[21];
+    uint16_t node;
+    long n_events;
+};
+
+
+// GLOBAL VARIABLES:
+struct tool_event *events = NULL;   // every event of every file
+long n_events = 0;
+struct tool_proc procs[TOOL_MAX_FILES];
+int n_procs = 0;
+
+
+//-- returns a short name for the action (diagram cells are narrow)
+const char *action_short(int action) {
+    static char other[16];
+
+    switch (action) {
+    case READY_TO_SHUTDOWN: return "RDY";
+    case SHUTDOWN_NOW:      return "SNOW";
+    case SHUTDOWN_ACK:      return "SACK";
+    case TOM_DATA:          return "TDATA";
+    case TOM_ACK:           return "TACK";
+    case SNAP_MARKER:       return "MARK";
+    case DMX_REQUEST:       return "LREQ";
+    case DMX_REPLY:         return "LREP";
+    case DMX_TOKEN:         return "LTOK";
+    default:
+        snprintf(other, sizeof(other), "op%i", action);
+        return other;
+    }
+}
+
+//-- returns the name of the process with node id node ("P<node>" if no file has it)
+const char *node_str(uint16_t node) {
+    static char fallback[16];
+    int i;
+
+    for (i = 0; i < n_procs; i++) {
+        if (procs[i].node == node) {
+            return procs[i].name;
+        }
+    }
+    snprintf(fallback, sizeof(fallback), "P%u", node);
+    return fallback;
+}
+
+//-- appends the events of the trace file at path to events[]
+int load_trace(const char *path) {
+    struct trace_header header;
+    struct trace_event ev;
+    struct tool_proc *proc;
+    long capacity = n_events;
+    FILE *file;
+
+    if (n_procs == TOOL_MAX_FILES) {
+        fprintf(stderr, "error: more than %i trace files\n", TOOL_MAX_FILES);
+        return F_FAILURE;
+    }
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return F_FAILURE;
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION) {
+        fprintf(stderr, "error: %s is not a version %i trace file\n", path, TRACE_VERSION);
+        fclose(file);
+        return F_FAILURE;
+    }
+
+    proc = &procs[n_procs];
+    memcpy(proc->name, header.name, sizeof(header.name));
+    proc->name[sizeof(header.name)] = '\0';
+    proc->node = header.node_id;
+    proc->n_events = 0;
+
+    while (fread(&ev, sizeof(ev), 1, file) == 1) {
+        if (n_events == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            events = realloc(events, capacity * sizeof(struct tool_event));
+            if (events == NULL) {
+                perror("realloc failed");
+                fclose(file);
+                return F_FAILURE;
+            }
+        }
+        events[n_events].ev = ev;
+        events[n_events].proc = n_procs;
+        events[n_events].node = header.node_id;
+        events[n_events].match = -1;
+        n_events++;
+        proc->n_events++;
+    }
+    fclose(file);
+    n_procs++;
+    return F_SUCCESS;
+}
+
+//-- returns the node id that sent the message of event e
+unsigned int msg_from(const struct tool_event *e) {
+    return (e->ev.type == TRACE_SEND) ? e->node : e->ev.peer;
+}
+
+//-- returns the node id the message of event e was sent to
+unsigned int msg_to(const struct tool_event *e) {
+    return (e->ev.type == TRACE_SEND) ? e->ev.peer : e->node;
+}
+
+//-- orders messages by (sender, receiver, Lamport time sent, action), 0 if the same one
+int cmp_msg(const struct tool_event *a, const struct tool_event *b) {
+    if (msg_from(a) != msg_from(b)) return (msg_from(a) < msg_from(b)) ? -1 : 1;
+    if (msg_to(a) != msg_to(b)) return (msg_to(a) < msg_to(b)) ? -1 : 1;
+    if (a->ev.msg_lamport != b->ev.msg_lamport) {
+        return (a->ev.msg_lamport < b->ev.msg_lamport) ? -1 : 1;
+    }
+    if (a->ev.action != b->ev.action) return (a->ev.action < b->ev.action) ? -1 : 1;
+    return 0;
+}
+
+//-- (qsort) orders events by message, its SEND before the RECV
+int cmp_msg_key(const void *pa, const void *pb) {
+    const struct tool_event *a = &events[*(const long *)pa];
+    const struct tool_event *b = &events[*(const long *)pb];
+    int by_msg = cmp_msg(a, b);
+
+    if (by_msg != 0) return by_msg;
+    return (a->ev.type < b->ev.type) ? -1 : (a->ev.type > b->ev.type);
+}
+
+//-- (qsort) orders events by Lamport time, then process (space-time diagram rows)
+int cmp_lamport(const void *pa, const void *pb) {
+    const struct tool_event *a = &events[*(const long *)pa];
+    const struct tool_event *b = &events[*(const long *)pb];
+
+    if (a->ev.lamport != b->ev.lamport) return (a->ev.lamport < b->ev.lamport) ? -1 : 1;
+    if (a->proc != b->proc) return (a->proc < b->proc) ? -1 : 1;
+    return (*(const long *)pa < *(const long *)pb) ? -1 : 1;
+}
+
+//-- (qsort) orders latencies
+int cmp_long(const void *pa, const void *pb) {
+    long a = *(const long *)pa, b = *(const long *)pb;
+    return (a < b) ? -1 : (a > b);
+}
+
+//-- pairs every RECV with its SEND, reports clock condition violations and latencies
+void check_messages(long *order) {
+    long i, j, n_matched = 0, n_lost = 0, n_orphan = 0, n_violations = 0;
+    long *latencies = malloc((n_events + 1) * sizeof(long));
+    long latency_sum = 0;
+
+    for (i = 0; i < n_events; i++) {
+        order[i] = i;
+    }
+    qsort(order, n_events, sizeof(long), cmp_msg_key);
+
+    // equal keys are adjacent, the SEND first: walk each run of them
+    for (i = 0; i < n_events; i = j) {
+        struct tool_event *send = NULL;
+
+        for (j = i; j < n_events && cmp_msg(&events[order[i]], &events[order[j]]) == 0; j++) {
+            struct tool_event *e = &events[order[j]];
+
+            if (e->ev.type == TRACE_SEND) {
+                if (send != NULL && send->match == -1) {
+                    n_lost++;
+                }
+                send = e;
+                continue;
+            }
+            if (send == NULL) {
+                n_orphan++;     // its sender wrote no trace (or dropped the event)
+                continue;
+            }
+            send->match = order[j];
+            e->match = send - events;
+            n_matched++;
+
+            // clock condition: send -> receive implies C(send) < C(receive)
+            if (e->ev.lamport <= send->ev.lamport) {
+                n_violations++;
+                printf("VIOLATION: %s SEND %s at %u -> %s RECV at %u\n",
+                       procs[send->proc].name, action_short(send->ev.action),
+                       send->ev.lamport, procs[e->proc].name, e->ev.lamport);
+            }
+            latencies[n_matched - 1] = (long)(e->ev.mono_ns - send->ev.mono_ns);
+            latency_sum += latencies[n_matched - 1];
+        }
+        if (send != NULL && send->match == -1) {
+            n_lost++;
+        }
+    }
+
+    printf("messages: %li matched, %li never received, %li without a traced send\n",
+           n_matched, n_lost, n_orphan);
+    printf("clock condition: %li violation(s)\n", n_violations);
+    if (n_matched > 0) {
+        qsort(latencies, n_matched, sizeof(long), cmp_long);
+        printf("latency (us, same host only): min %.1f  avg %.1f  p50 %.1f  p99 %.1f  max %.1f\n",
+               latencies[0] / 1e3, (double)latency_sum / n_matched / 1e3,
+               latencies[n_matched / 2] / 1e3, latencies[(n_matched * 99) / 100] / 1e3,
+               latencies[n_matched - 1] / 1e3);
+    }
+    free(latencies);
+}
+
+//-- prints one row per Lamport time and one column per process
+void print_diagram(long *order) {
+    char cell[sizeof(procs[0].name) + 20];     // arrow, name, action (op<int>) and "?"
+    long i;
+    int p;
+
+    for (i = 0; i < n_events; i++) {
+        order[i] = i;
+    }
+    qsort(order, n_events, sizeof(long), cmp_lamport);
+
+    printf("\n%6s", "t");
+    for (p = 0; p < n_procs; p++) {
+        printf(" | %-*s", TOOL_CELL_WIDTH, procs[p].name);
+    }
+    printf("\n");
+
+    for (i = 0; i < n_events; i++) {
+        struct tool_event *e = &events[order[i]];
+        const char *arrow = (e->ev.type == TRACE_SEND) ? "->" : "<-";
+
+        snprintf(cell, sizeof(cell), "%s%s %s%s", arrow, node_str(e->ev.peer),
+                 action_short(e->ev.action), (e->match == -1) ? "?" : "");
+        printf("%6u", e->ev.lamport);
+        for (p = 0; p < n_procs; p++) {
+            printf(" | %-*.*s", TOOL_CELL_WIDTH, TOOL_CELL_WIDTH, (p == e->proc) ? cell : "");
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int i, first = 1, diagram = 0;
+    long *order;
+
+    if (argc > 1 && strcmp(argv[1], "-d") == 0) {
+        diagram = 1;
+        first = 2;
+    }
+    if (argc <= first) {
+        fprintf(stderr, "usage: ./tracetool [-d] <trace_file>...\n");
+        return EXIT_FAILURE;
+    }
+
+    for (i = first; i < argc; i++) {
+        if (load_trace(argv[i]) == F_FAILURE) {
+            return EXIT_FAILURE;
+        }
+    }
+    for (i = 0; i < n_procs; i++) {
+        printf("%s (node %u): %li events\n", procs[i].name, procs[i].node, procs[i].n_events);
+    }
+
+    order = malloc((n_events + 1) * sizeof(long));
+    check_messages(order);
+    if (diagram) {
+        print_diagram(order);
+    }
+
+    free(order);
+    free(events);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,959 @@
+#include "./wal.h"
+#include "./rwlock.h"
+#include "./connq.h"
+#include "./combine.h"
+#include "./pool.h"
+#include "./kv.h"
+#include "./proto.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/wait.h>
+#include <netinet/tcp.h>
+#include <time.h>
+#include <sys/stat.h>
+
+
+#define BENCH_WAL_THREADS   16      // writers of the counter at once
+#define BENCH_WAL_WRITES    20000   // writes per row (all the threads)
+#define BENCH_WAL_REPLAY    1000000 // records replayed by the recovery row
+#define BENCH_WAL_DIR       "/tmp/sdc-bench-wal"
+#define BENCH_LEGACY_FILE   BENCH_WAL_DIR "/server_output.txt"
+
+#define BENCH_RW_THREADS    8       // readers and writers of the counter at once
+#define BENCH_RW_OPS        400000  // operations per row (all the threads)
+#define BENCH_RW_WORK       64      // loop turns inside the critical section, and outside
+#define BENCH_SEQ_WRITE_WORK 2048   // (seqlock rows) loop turns of a write: long writers
+
+#define BENCH_CQ_ITEMS      200000  // connections handed to the pool per row
+#define BENCH_CQ_CONSUMERS  4       // pool threads
+#define BENCH_CQ_WORK       2000    // loop turns a pool thread spends on a connection
+#define BENCH_CQ_LIFO       600     // slots of the stack the server had (MAX_SERVER_THREADS)
+
+#define BENCH_SESSION_PORT  5060    // of the ./server the session rows talk to
+#define BENCH_SESSION_DIR   "/tmp/sdc-bench-session"
+#define BENCH_SESSION_REQS  20000   // requests of a session row
+#define BENCH_CONNECT_REQS  2000    // requests of the connection-per-request row
+#define BENCH_MAX_PIPELINE  64
+
+#define BENCH_FC_WRITES     4000    // increments per row (all the threads)
+#define BENCH_FC_HOLD_US    100     // an exclusive section sleeps this long (as --hold-us)
+
+#define BENCH_POOL_BURST    800     // connections opened at once, a READ on each
+#define BENCH_POOL_HOLD_US  "2000"  // --hold-us of the server: the READs overlap
+#define BENCH_POOL_IDLE_MS  "500"   // --pool-idle-ms of the server
+
+#define BENCH_KV_KEYS       1000000 // named counters in the table (all there before a row)
+#define BENCH_KV_THREADS    8
+#define BENCH_KV_OPS        2000000 // operations per row (all the threads)
+#define BENCH_KV_GET_PCT    90      // GETs out of 100 operations, the rest INCR by 1
+#define BENCH_KV_ZIPF       0.99    // exponent of the skewed rows
+
+
+// a counter store under test: one write of the counter, done by many threads
+struct wal_bench_row {
+    const char *name;
+    int legacy;                 // 1: the fopen() store, 0: the log
+    int legacy_fsync;           // (legacy) fsync after every write
+    enum wal_sync_modes mode;   // (log) fsync policy
+    long every;
+};
+
+
+// one thread of a rwlock row and what it measured
+struct rw_bench_thread {
+    pthread_t thread;
+    struct rw_lock *lock;
+    int read_pct;               // reads out of 100 operations
+    int seqlock;                // reads copy what the writers publish, without the lock
+    int write_work;             // loop turns inside a write
+    long *read_lat;             // (if not NULL) ns of every read, for its percentiles
+    unsigned int seed;
+    long reads, writes;
+    long read_ns, write_ns;     // from asking for the lock to leaving it
+};
+
+
+int64_t bench_counter = 0;          // protected by mutex_bench (the writers' lock)
+pthread_mutex_t mutex_bench = PTHREAD_MUTEX_INITIALIZER;
+long rw_bench_value = 0;            // protected by the lock of the rwlock row
+atomic_long rw_bench_pub = 0;       // rw_bench_value as published to the seqlock reads
+volatile long rw_bench_sink = 0;    // the work loops write it: not optimized out
+
+
+//-- CLOCK_MONOTONIC in nanoseconds
+long now_ns() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+//-- removes the files a row leaves in BENCH_WAL_DIR
+void clean_wal_dir() {
+    unlink(BENCH_WAL_DIR "/" WAL_FILE);
+    unlink(BENCH_WAL_DIR "/" WAL_SNAP_FILE);
+    unlink(BENCH_LEGACY_FILE);
+}
+
+//-- one write as the server did it before the log: open, read, rewrite, close
+void legacy_write(int with_fsync) {
+    char buff[32];
+    FILE *output = fopen(BENCH_LEGACY_FILE, "r+");
+    long value = 0;
+
+    if (output == NULL) {
+        output = fopen(BENCH_LEGACY_FILE, "w+");
+    }
+    if (fgets(buff, sizeof(buff), output) != NULL) {
+        value = strtol(buff, NULL, 10);
+    }
+    fseek(output, 0, SEEK_SET);
+    fprintf(output, "%ld\n", value + 1);
+    if (with_fsync) {
+        fflush(output);
+        fsync(fileno(output));
+    }
+    fclose(output);
+}
+
+//-- (threads!) writes the counter BENCH_WAL_WRITES / BENCH_WAL_THREADS times
+void *wal_bench_writer(void *arg) {
+    const struct wal_bench_row *row = arg;
+    uint64_t lsn;
+    int i;
+
+    for (i = 0; i < BENCH_WAL_WRITES / BENCH_WAL_THREADS; i++) {
+        pthread_mutex_lock(&mutex_bench);
+        if (row->legacy) {
+            legacy_write(row->legacy_fsync);
+            pthread_mutex_unlock(&mutex_bench);
+            continue;
+        }
+        lsn = wal_append(++bench_counter);
+        pthread_mutex_unlock(&mutex_bench);
+        wal_wait(lsn);  // as do_write(): answered once committed
+    }
+    return NULL;
+}
+
+//-- runs one row: the writers, then (log) a recovery to check the value
+void run_wal_row(const struct wal_bench_row *row) {
+    pthread_t writers[BENCH_WAL_THREADS];
+    long records, groups, syncs, snaps, records_after, groups_after, syncs_after, beginning, ending;
+    int64_t recovered = 0;
+    int i;
+
+    clean_wal_dir();
+    bench_counter = 0;
+    if (!row->legacy && wal_open(BENCH_WAL_DIR, row->mode, row->every, 0, &bench_counter) == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+    wal_get_stats(&records, &groups, &syncs, &snaps);
+
+    beginning = now_ns();
+    for (i = 0; i < BENCH_WAL_THREADS; i++) {
+        pthread_create(&writers[i], NULL, wal_bench_writer, (void *)row);
+    }
+    for (i = 0; i < BENCH_WAL_THREADS; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    ending = now_ns();
+
+    if (row->legacy) {
+        printf("%16s %12.0f %12s %10s %10s\n", row->name,
+               BENCH_WAL_WRITES / ((ending - beginning) / 1e9), "-", "-", "-");
+        return;
+    }
+    wal_get_stats(&records_after, &groups_after, &syncs_after, &snaps);
+    wal_close();
+    if (wal_open(BENCH_WAL_DIR, row->mode, row->every, 0, &recovered) == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+    wal_close();
+
+    printf("%16s %12.0f %12.1f %10li %10s\n", row->name,
+           BENCH_WAL_WRITES / ((ending - beginning) / 1e9),
+           (groups_after > groups) ? (double)(records_after - records) / (groups_after - groups) : 0,
+           syncs_after - syncs, (recovered == bench_counter) ? "ok" : "LOST");
+}
+
+//-- times the recovery of BENCH_WAL_REPLAY writes, with and without snapshots
+void run_wal_recovery(long snap_every) {
+    long beginning, ending;
+    int64_t value = 0;
+    int i;
+
+    clean_wal_dir();
+    if (wal_open(BENCH_WAL_DIR, WAL_SYNC_NONE, 1, snap_every, &value) == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+    for (i = 1; i <= BENCH_WAL_REPLAY; i++) {
+        wal_append(i);
+    }
+    wal_close();
+
+    value = 0;
+    beginning = now_ns();
+    if (wal_open(BENCH_WAL_DIR, WAL_SYNC_NONE, 1, snap_every, &value) == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+    ending = now_ns();
+    wal_close();
+    printf("%16li %12.2f %12s\n", snap_every, (ending - beginning) / 1e6,
+           (value == BENCH_WAL_REPLAY) ? "ok" : "LOST");
+}
+
+void bench_wal() {
+    struct wal_bench_row rows[] = {
+        {"fopen (before)", 1, 0, WAL_SYNC_NONE, 0},
+        {"fopen + fsync", 1, 1, WAL_SYNC_NONE, 0},
+        {"log, no fsync", 0, 0, WAL_SYNC_NONE, 1},
+        {"log, fsync 1", 0, 0, WAL_SYNC_RECORDS, 1},
+        {"log, fsync 64", 0, 0, WAL_SYNC_RECORDS, 64},
+        {"log, fsync 10ms", 0, 0, WAL_SYNC_MS, 10},
+    };
+    int i;
+
+    mkdir(BENCH_WAL_DIR, 0755);
+    printf("# wal: %i writes of the counter by %i threads per row\n", BENCH_WAL_WRITES, BENCH_WAL_THREADS);
+    printf("%16s %12s %12s %10s %10s\n", "store", "writes/s", "recs/group", "fsyncs", "recovery");
+    for (i = 0; i < (int)(sizeof(rows) / sizeof(rows[0])); i++) {
+        run_wal_row(&rows[i]);
+    }
+
+    printf("# recovery of %i writes\n", BENCH_WAL_REPLAY);
+    printf("%16s %12s %12s\n", "snapshot every", "open ms", "value");
+    run_wal_recovery(BENCH_WAL_REPLAY * 2L);    // never: the whole log is replayed
+    run_wal_recovery(WAL_SNAP_EVERY);
+    clean_wal_dir();
+    rmdir(BENCH_WAL_DIR);
+}
+
+//-- some work that does not touch the counter
+void rw_bench_work(int turns) {
+    int i;
+
+    for (i = 0; i < turns; i++) {
+        rw_bench_sink++;
+    }
+}
+
+//-- (threads!) reads or increments rw_bench_value, read_pct reads out of 100
+void *rw_bench_worker(void *arg) {
+    struct rw_bench_thread *me = arg;
+    long beginning, loc, lat;
+    unsigned int seq;
+    int i;
+
+    for (i = 0; i < BENCH_RW_OPS / BENCH_RW_THREADS; i++) {
+        beginning = now_ns();
+        if ((int)(rand_r(&me->seed) % 100) < me->read_pct) {
+            if (me->seqlock) {
+                do {
+                    seq = rw_seq_read_begin(me->lock);
+                    loc = atomic_load_explicit(&rw_bench_pub, memory_order_relaxed);
+                } while (rw_seq_read_retry(me->lock, seq));
+                rw_bench_work(BENCH_RW_WORK);
+            } else {
+                rw_read_lock(me->lock);
+                loc = rw_bench_value;
+                rw_bench_work(BENCH_RW_WORK);
+                rw_read_unlock(me->lock);
+            }
+            rw_bench_sink += loc;
+            lat = now_ns() - beginning;
+            if (me->read_lat != NULL) {
+                me->read_lat[me->reads] = lat;
+            }
+            me->read_ns += lat;
+            me->reads++;
+        } else {
+            rw_write_lock(me->lock);
+            rw_bench_value++;
+            rw_bench_work(me->write_work);
+            rw_seq_write_begin(me->lock);
+            atomic_store_explicit(&rw_bench_pub, rw_bench_value, memory_order_relaxed);
+            rw_seq_write_end(me->lock);
+            rw_write_unlock(me->lock);
+            me->write_ns += now_ns() - beginning;
+            me->writes++;
+        }
+        rw_bench_work(BENCH_RW_WORK);
+    }
+    return NULL;
+}
+
+//-- runs one engine at one mix: throughput, mean wait + hold of each side, and
+//   whether every write got in alone
+void run_rw_row(enum rw_engines engine, int read_pct) {
+    struct rw_bench_thread threads[BENCH_RW_THREADS];
+    struct rw_lock *lock = rw_create(engine, RW_PRI_NONE);
+    long reads = 0, writes = 0, read_ns = 0, write_ns = 0, beginning, ending;
+    int i;
+
+    if (lock == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    rw_bench_value = 0;
+    memset(threads, 0, sizeof(threads));
+
+    beginning = now_ns();
+    for (i = 0; i < BENCH_RW_THREADS; i++) {
+        threads[i].lock = lock;
+        threads[i].read_pct = read_pct;
+        threads[i].write_work = BENCH_RW_WORK;
+        threads[i].seed = i + 1;
+        pthread_create(&threads[i].thread, NULL, rw_bench_worker, &threads[i]);
+    }
+    for (i = 0; i < BENCH_RW_THREADS; i++) {
+        pthread_join(threads[i].thread, NULL);
+        reads += threads[i].reads;
+        writes += threads[i].writes;
+        read_ns += threads[i].read_ns;
+        write_ns += threads[i].write_ns;
+    }
+    ending = now_ns();
+    rw_free(lock);
+
+    printf("%12s %3i/%-3i %12.0f %10.0f %10.0f %8s\n", rw_engine_name(engine), read_pct, 100 - read_pct,
+           (reads + writes) / ((ending - beginning) / 1e9),
+           (reads > 0) ? (double)read_ns / reads : 0, (writes > 0) ? (double)write_ns / writes : 0,
+           (rw_bench_value == writes) ? "ok" : "LOST");
+}
+
+void bench_rwlock() {
+    int mixes[] = {100, 95, 50, 5};     // reads out of 100
+    int i, engine;
+
+    printf("# rwlock: %i operations by %i threads per row\n", BENCH_RW_OPS, BENCH_RW_THREADS);
+    printf("%12s %7s %12s %10s %10s %8s\n", "engine", "r/w", "ops/s", "read ns", "write ns", "writes");
+    for (i = 0; i < (int)(sizeof(mixes) / sizeof(mixes[0])); i++) {
+        for (engine = 0; engine < RW_NUM_ENGINES; engine++) {
+            run_rw_row(engine, mixes[i]);
+        }
+    }
+}
+
+int cmp_long(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+
+    return (x > y) - (x < y);
+}
+
+//-- runs one read path at one mix with long writers: percentiles of the reads
+void run_seq_row(enum rw_engines engine, int seqlock, int read_pct) {
+    struct rw_bench_thread threads[BENCH_RW_THREADS];
+    struct rw_lock *lock = rw_create(engine, RW_PRI_NONE);
+    long *lat = malloc(sizeof(long) * BENCH_RW_OPS);
+    long n_lat = 0, writes = 0, beginning, ending;
+    int i;
+
+    if (lock == NULL || lat == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    rw_bench_value = 0;
+    atomic_store(&rw_bench_pub, 0);
+    memset(threads, 0, sizeof(threads));
+
+    beginning = now_ns();
+    for (i = 0; i < BENCH_RW_THREADS; i++) {
+        threads[i].lock = lock;
+        threads[i].read_pct = read_pct;
+        threads[i].seqlock = seqlock;
+        threads[i].write_work = BENCH_SEQ_WRITE_WORK;
+        threads[i].read_lat = lat + (long)i * (BENCH_RW_OPS / BENCH_RW_THREADS);
+        threads[i].seed = i + 1;
+        pthread_create(&threads[i].thread, NULL, rw_bench_worker, &threads[i]);
+    }
+    for (i = 0; i < BENCH_RW_THREADS; i++) {
+        pthread_join(threads[i].thread, NULL);
+        // (each thread filled the front of its part of lat)
+        memmove(lat + n_lat, threads[i].read_lat, sizeof(long) * threads[i].reads);
+        n_lat += threads[i].reads;
+        writes += threads[i].writes;
+    }
+    ending = now_ns();
+    rw_free(lock);
+
+    qsort(lat, n_lat, sizeof(long), cmp_long);
+    printf("%12s %3i/%-3i %10li %10li %10li %12.0f %8s\n",
+           seqlock ? "seqlock" : rw_engine_name(engine), read_pct, 100 - read_pct,
+           lat[n_lat / 2], lat[n_lat * 99 / 100], lat[n_lat * 999 / 1000],
+           writes / ((ending - beginning) / 1e9),
+           (rw_bench_value == writes && atomic_load(&rw_bench_pub) == writes) ? "ok" : "LOST");
+    free(lat);
+}
+
+void bench_seqlock() {
+    int mixes[] = {100, 95};    // reads out of 100: no writer, then 5% long writers
+    int i, engine;
+
+    printf("# seqlock: %i operations by %i threads per row, writes %i times longer than reads\n",
+           BENCH_RW_OPS, BENCH_RW_THREADS, BENCH_SEQ_WRITE_WORK / BENCH_RW_WORK);
+    printf("%12s %7s %10s %10s %10s %12s %8s\n", "reads", "r/w", "p50 ns", "p99 ns", "p99.9 ns",
+           "writes/s", "writes");
+    for (i = 0; i < (int)(sizeof(mixes) / sizeof(mixes[0])); i++) {
+        for (engine = 0; engine < RW_NUM_ENGINES; engine++) {
+            run_seq_row(engine, 0, mixes[i]);
+        }
+        run_seq_row(RW_MUTEX_COND, 1, mixes[i]);    // (the writers still take the mutex one)
+    }
+}
+
+//// connq: the stack + mutex + semaphore the server had, against the ring
+
+struct lifo_item {
+    int fd;
+    long queued_ns;
+};
+
+struct lifo_item lifo_items[BENCH_CQ_LIFO];     // protected by mutex_lifo
+int lifo_index = 0;
+struct connq_stats lifo_stats;                  // protected by mutex_lifo
+struct hist lifo_wait;
+pthread_mutex_t mutex_lifo = PTHREAD_MUTEX_INITIALIZER;
+sem_t lifo_full;                                // connections in the stack
+sem_t lifo_room;                                // free slots (the server had no bound)
+int cq_use_ring = 0;
+
+//-- (lifo) pushes fd as server_control_loop() did
+void lifo_push(int fd) {
+    if (sem_trywait(&lifo_room) != 0) {
+        lifo_stats.overflows++;     // (one pusher: nobody else writes it)
+        sem_wait(&lifo_room);
+    }
+    pthread_mutex_lock(&mutex_lifo);        // lock (X)
+    lifo_items[lifo_index].fd = fd;
+    lifo_items[lifo_index].queued_ns = now_ns();
+    lifo_index++;
+    lifo_stats.pushed++;
+    pthread_mutex_unlock(&mutex_lifo);      // unlock (o)
+    sem_post(&lifo_full);
+}
+
+//-- (lifo) pops the newest fd as server_handler() did, accounting for its wait
+int lifo_pop() {
+    long queued_ns;
+    int fd;
+
+    sem_wait(&lifo_full);
+    pthread_mutex_lock(&mutex_lifo);        // lock (X)
+    lifo_index--;
+    fd = lifo_items[lifo_index].fd;
+    queued_ns = lifo_items[lifo_index].queued_ns;
+    pthread_mutex_unlock(&mutex_lifo);      // unlock (o)
+    hist_add(&lifo_wait, now_ns() - queued_ns);
+    sem_post(&lifo_room);
+    return fd;
+}
+
+//-- (threads!) handles "connections" until it pops a -1
+void *cq_consumer() {
+    long queued_ns;
+    int fd;
+
+    do {
+        fd = cq_use_ring ? connq_pop(&queued_ns) : lifo_pop();
+        rw_bench_work(BENCH_CQ_WORK);
+    } while (fd != -1);
+    return NULL;
+}
+
+//-- hands BENCH_CQ_ITEMS fds to the consumers as fast as they take them
+void run_cq_row(int use_ring) {
+    pthread_t consumers[BENCH_CQ_CONSUMERS];
+    struct connq_stats stats;
+    long beginning, ending;
+    int i;
+
+    cq_use_ring = use_ring;
+    connq_init();
+    memset(&lifo_stats, 0, sizeof(lifo_stats));
+    hist_reset(&lifo_wait);
+    lifo_stats.wait = &lifo_wait;
+    sem_init(&lifo_full, 0, 0);
+    sem_init(&lifo_room, 0, BENCH_CQ_LIFO);
+
+    beginning = now_ns();
+    for (i = 0; i < BENCH_CQ_CONSUMERS; i++) {
+        pthread_create(&consumers[i], NULL, cq_consumer, NULL);
+    }
+    for (i = 0; i < BENCH_CQ_ITEMS + BENCH_CQ_CONSUMERS; i++) {
+        // the last ones stop the consumers
+        if (use_ring) {
+            connq_push((i < BENCH_CQ_ITEMS) ? i : -1);
+        } else {
+            lifo_push((i < BENCH_CQ_ITEMS) ? i : -1);
+        }
+    }
+    for (i = 0; i < BENCH_CQ_CONSUMERS; i++) {
+        pthread_join(consumers[i], NULL);
+    }
+    ending = now_ns();
+
+    if (use_ring) {
+        connq_get_stats(&stats);
+    } else {
+        stats = lifo_stats;
+    }
+    sem_destroy(&lifo_full);
+    sem_destroy(&lifo_room);
+    printf("%22s %10.0f %10.3f %10.3f %10.3f %10.3f %10li\n", use_ring ? "ring (FIFO)" : "stack + sem (before)",
+           hist_count(stats.wait) / ((ending - beginning) / 1e9), hist_mean(stats.wait) / 1e6,
+           hist_percentile(stats.wait, 500) / 1e6, hist_percentile(stats.wait, 990) / 1e6,
+           hist_max(stats.wait) / 1e6, stats.overflows);
+}
+
+void bench_connq() {
+    printf("# connq: %i connections, %i pool threads, the pool slower than the producer\n",
+           BENCH_CQ_ITEMS, BENCH_CQ_CONSUMERS);
+    printf("%22s %10s %10s %10s %10s %10s %10s\n", "queue", "conns/s", "mean ms", "p50 ms <",
+           "p99 ms <", "max ms", "full");
+    run_cq_row(0);
+    run_cq_row(1);
+}
+
+//// session: one connection per request against sessions, pipelined or not
+
+//-- sends or receives all len bytes of buf (F_FAILURE if the server went away)
+int bench_io(int fd, void *buf, size_t len, int sending) {
+    char *bytes = buf;
+    ssize_t done;
+
+    while (len > 0) {
+        done = sending ? send(fd, bytes, len, MSG_NOSIGNAL) : recv(fd, bytes, len, 0);
+        if (done <= 0) {
+            return F_FAILURE;
+        }
+        bytes += done;
+        len -= done;
+    }
+    return F_SUCCESS;
+}
+
+//-- a connection to the bench's server, F_FAILURE while it does not listen yet
+int bench_connect() {
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_STREAM, 0), nodelay = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(BENCH_SESSION_PORT);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return F_FAILURE;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    return fd;
+}
+
+//-- starts ./server with no fsync and the options of extra (NULL-terminated, at most
+//   8), returns its pid once it takes connections
+pid_t start_bench_server(char *const extra[]) {
+    char port[16], *argv[20] = {"server", "--port", port, "--fsync", "none",
+                                "--data-dir", BENCH_SESSION_DIR};
+    pid_t pid;
+    int fd, i, argc = 7;
+
+    mkdir(BENCH_SESSION_DIR, 0755);
+    snprintf(port, sizeof(port), "%i", BENCH_SESSION_PORT);
+    for (i = 0; extra[i] != NULL && i < 8; i++) {
+        argv[argc++] = extra[i];
+    }
+    argv[argc] = NULL;
+    fflush(stdout);     // (or the child prints it again)
+    pid = fork();
+    if (pid == 0) {
+        freopen("/dev/null", "w", stdout);  // a line per request
+        execv("./server", argv);
+        perror("exec ./server");
+        _exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < 10000; i++) {
+        if ((fd = bench_connect()) != F_FAILURE) {
+            close(fd);
+            return pid;
+        }
+        usleep(200);
+    }
+    fprintf(stderr, "error: ./server did not start (make it first)\n");
+    kill(pid, SIGKILL);
+    exit(EXIT_FAILURE);
+}
+
+//-- n READs: over a new connection each (depth 0) or one session, depth in flight
+void run_session_row(const char *name, int n, int depth) {
+    struct request req = {.action = READ, .id = 1};     // (no REQ_TRACE: no trace after the responses)
+    struct response resp;
+    long sent_ns[BENCH_MAX_PIPELINE], beginning, rtt_sum = 0;
+    unsigned int sent = 0, received = 0;
+    int fd = -1, bad_ids = 0;
+
+    beginning = now_ns();
+    if (depth > 0) {
+        fd = bench_connect();
+    }
+    while (received < (unsigned int)n) {
+        if (depth == 0) {
+            fd = bench_connect();
+        }
+        // the server answers a session in order: the oldest in flight comes back first
+        while (sent < (unsigned int)n && sent - received < (unsigned int)((depth > 0) ? depth : 1)) {
+            req.req_id = ++sent;
+            sent_ns[req.req_id % BENCH_MAX_PIPELINE] = now_ns();
+            if (fd == F_FAILURE || bench_io(fd, &req, sizeof(req), 1) == F_FAILURE) {
+                fprintf(stderr, "error: the server closed the connection\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (bench_io(fd, &resp, sizeof(resp), 0) == F_FAILURE) {
+            fprintf(stderr, "error: the server closed the connection\n");
+            exit(EXIT_FAILURE);
+        }
+        received++;
+        bad_ids += (resp.req_id != received);
+        rtt_sum += now_ns() - sent_ns[resp.req_id % BENCH_MAX_PIPELINE];
+        if (depth == 0) {
+            close(fd);
+        }
+    }
+    if (depth > 0) {
+        close(fd);
+    }
+
+    printf("%24s %12.0f %12.1f %8s\n", name, n / ((now_ns() - beginning) / 1e9),
+           rtt_sum / 1e3 / n, (bad_ids == 0) ? "ok" : "BAD");
+}
+
+//-- stops the bench's server and removes its log
+void stop_bench_server(pid_t server) {
+    kill(server, SIGINT);
+    waitpid(server, NULL, 0);
+    unlink(BENCH_SESSION_DIR "/" WAL_FILE);
+    unlink(BENCH_SESSION_DIR "/" WAL_SNAP_FILE);
+    rmdir(BENCH_SESSION_DIR);
+}
+
+void bench_session() {
+    char *const extra[] = {"--hold-us", "0", NULL};
+    pid_t server = start_bench_server(extra);
+
+    printf("# session: READs against ./server --hold-us 0 --fsync none, one connection per row\n");
+    printf("%24s %12s %12s %8s\n", "connection", "requests/s", "rtt us", "req ids");
+    run_session_row("one per request (before)", BENCH_CONNECT_REQS, 0);
+    run_session_row("session", BENCH_SESSION_REQS, 1);
+    run_session_row("session, pipeline 8", BENCH_SESSION_REQS, 8);
+    run_session_row("session, pipeline 64", BENCH_SESSION_REQS, 64);
+
+    stop_bench_server(server);
+}
+
+//// combine: a write per exclusive section against the writes combined in one
+
+struct rw_lock *fc_bench_lock = NULL;   // the write side guards rw_bench_value
+struct fc *fc_bench = NULL;             // NULL: one exclusive section per write
+
+//-- (combiner!) applies n increments in one exclusive section
+void fc_bench_apply(int n, const int64_t *args, int64_t *results, uint64_t *aux) {
+    int i;
+
+    rw_write_lock(fc_bench_lock);
+    for (i = 0; i < n; i++) {
+        results[i] = ++rw_bench_value;
+        aux[i] = args[i];
+    }
+    usleep(BENCH_FC_HOLD_US);
+    rw_write_unlock(fc_bench_lock);
+}
+
+//-- (threads!) increments rw_bench_value its share of BENCH_FC_WRITES times, checks
+//   it got back values that only grow
+void *fc_bench_writer(void *arg) {
+    long n = (long)arg, i;
+    int64_t value, last = 0;
+    uint64_t aux;
+
+    for (i = 0; i < n; i++) {
+        if (fc_bench != NULL) {
+            value = fc_submit(fc_bench, 1, &aux);
+        } else {
+            fc_bench_apply(1, &(int64_t){1}, &value, &aux);
+        }
+        if (value <= last) {
+            fprintf(stderr, "error: a writer got %li after %li\n", (long)value, (long)last);
+        }
+        last = value;
+    }
+    return NULL;
+}
+
+void run_fc_row(int n_threads, int combined) {
+    pthread_t writers[64];
+    long beginning, ending, batches = 0, applied = 0;
+    int i;
+
+    fc_bench_lock = rw_create(RW_MUTEX_COND, RW_PRI_NONE);
+    fc_bench = combined ? fc_create(fc_bench_apply) : NULL;
+    if (fc_bench_lock == NULL || (combined && fc_bench == NULL)) {
+        exit(EXIT_FAILURE);
+    }
+    rw_bench_value = 0;
+
+    beginning = now_ns();
+    for (i = 0; i < n_threads; i++) {
+        pthread_create(&writers[i], NULL, fc_bench_writer, (void *)(long)(BENCH_FC_WRITES / n_threads));
+    }
+    for (i = 0; i < n_threads; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    ending = now_ns();
+
+    if (combined) {
+        fc_get_stats(fc_bench, &batches, &applied);
+        fc_free(fc_bench);
+    }
+    rw_free(fc_bench_lock);
+    printf("%10s %8i %12.0f %12.1f %8s\n", combined ? "combine" : "lock", n_threads,
+           rw_bench_value / ((ending - beginning) / 1e9),
+           combined ? (double)applied / batches : 1.0,
+           (rw_bench_value == (BENCH_FC_WRITES / n_threads) * n_threads) ? "ok" : "LOST");
+}
+
+void bench_combine() {
+    int threads[] = {1, 2, 4, 8, 16, 32, 64};
+    int i;
+
+    printf("# combine: %i increments per row, an exclusive section takes %i us\n",
+           BENCH_FC_WRITES, BENCH_FC_HOLD_US);
+    printf("%10s %8s %12s %12s %8s\n", "writes", "threads", "writes/s", "per section", "value");
+    for (i = 0; i < (int)(sizeof(threads) / sizeof(threads[0])); i++) {
+        run_fc_row(threads[i], 0);
+        run_fc_row(threads[i], 1);
+    }
+}
+
+//// pool: the fixed pool of 600 threads against the elastic one
+
+//-- a field of /proc/pid/status ("VmRSS", "Threads"...), F_FAILURE if not there
+long proc_status_field(pid_t pid, const char *field) {
+    char path[64], line[256];
+    long value = F_FAILURE;
+    size_t len = strlen(field);
+    FILE *status;
+
+    snprintf(path, sizeof(path), "/proc/%i/status", (int)pid);
+    if ((status = fopen(path, "r")) == NULL) {
+        return F_FAILURE;
+    }
+    while (fgets(line, sizeof(line), status) != NULL) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            value = strtol(line + len + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(status);
+    return value;
+}
+
+//-- starts the server with pool_args, lets it idle, opens BENCH_POOL_BURST connections
+//   at once with a READ each and waits for the answers, then lets it idle again
+void run_pool_row(const char *name, const char *pool_min, const char *pool_max) {
+    char *const extra[] = {"--hold-us", BENCH_POOL_HOLD_US, "--pool-idle-ms", BENCH_POOL_IDLE_MS,
+                           "--pool-min", (char *)pool_min, "--pool-max", (char *)pool_max, NULL};
+    struct request req = {.action = READ, .id = 1, .req_id = 1};
+    struct response resp;
+    static int fds[BENCH_POOL_BURST];
+    static long sent_ns[BENCH_POOL_BURST];
+    struct hist *burst = hist_create();
+    long beginning = now_ns(), startup_ns, idle_rss, peak_threads;
+    pid_t server = start_bench_server(extra);
+    int i, fd;
+
+    // started: it answers (listen() takes connections before the pool is there)
+    fd = bench_connect();
+    if (bench_io(fd, &req, sizeof(req), 1) == F_FAILURE || bench_io(fd, &resp, sizeof(resp), 0) == F_FAILURE) {
+        fprintf(stderr, "error: the server closed the connection\n");
+        exit(EXIT_FAILURE);
+    }
+    startup_ns = now_ns() - beginning;
+    close(fd);
+    usleep(200000);
+    idle_rss = proc_status_field(server, "VmRSS");
+
+    for (i = 0; i < BENCH_POOL_BURST; i++) {
+        fds[i] = bench_connect();
+        sent_ns[i] = now_ns();
+        if (fds[i] == F_FAILURE || bench_io(fds[i], &req, sizeof(req), 1) == F_FAILURE) {
+            fprintf(stderr, "error: the server closed the connection\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < BENCH_POOL_BURST; i++) {
+        if (bench_io(fds[i], &resp, sizeof(resp), 0) == F_FAILURE) {
+            fprintf(stderr, "error: the server closed the connection\n");
+            exit(EXIT_FAILURE);
+        }
+        hist_add(burst, now_ns() - sent_ns[i]);
+        close(fds[i]);      // (its thread is free for the connections behind)
+    }
+    peak_threads = proc_status_field(server, "Threads");
+    usleep(atoi(BENCH_POOL_IDLE_MS) * 2000);
+
+    printf("%18s %10.1f %10.1f %10.1f %10.1f %10.1f %8li %8li\n", name, startup_ns / 1e6,
+           idle_rss / 1024.0, hist_percentile(burst, 500) / 1e6, hist_percentile(burst, 990) / 1e6,
+           hist_max(burst) / 1e6, peak_threads, proc_status_field(server, "Threads"));
+    stop_bench_server(server);
+    free(burst);
+}
+
+void bench_pool() {
+    printf("# pool: ./server --hold-us %s, %i connections at once (a READ each), threads idle"
+           " %s ms leave\n", BENCH_POOL_HOLD_US, BENCH_POOL_BURST, BENCH_POOL_IDLE_MS);
+    printf("%18s %10s %10s %10s %10s %10s %8s %8s\n", "pool", "start ms", "idle MiB", "p50 ms <",
+           "p99 ms <", "max ms", "threads", "after");
+    run_pool_row("fixed 600 (before)", "600", "600");
+    run_pool_row("elastic 16..600", "16", "600");
+    run_pool_row("elastic 16..1000", "16", "1000");
+}
+
+//// kv: the named counters, sharded or behind one lock, uniform keys or skewed
+
+// one thread of a kv row and what it measured
+struct kv_bench_thread {
+    pthread_t thread;
+    struct kv *kv;
+    unsigned int seed;
+    long gets, incrs;
+    struct hist *latency;       // ns of every operation
+};
+
+char (*kv_bench_keys)[KV_KEY_SIZE] = NULL;  // "key:0", "key:1"...
+double *kv_bench_cdf = NULL;                // NULL: uniform rows
+
+//-- (threads!) GETs and INCRs its share of BENCH_KV_OPS on keys drawn from the row's law
+void *kv_bench_worker(void *arg) {
+    struct kv_bench_thread *me = arg;
+    int64_t value;
+    long i, key, beginning;
+    double u;
+
+    for (i = 0; i < BENCH_KV_OPS / BENCH_KV_THREADS; i++) {
+        u = (double)rand_r(&me->seed) / ((double)RAND_MAX + 1);
+        key = (kv_bench_cdf != NULL) ? kv_zipf_pick(kv_bench_cdf, BENCH_KV_KEYS, u) : (long)(u * BENCH_KV_KEYS);
+        beginning = now_ns();
+        if ((int)(rand_r(&me->seed) % 100) < BENCH_KV_GET_PCT) {
+            kv_get(me->kv, kv_bench_keys[key], &value);
+            me->gets++;
+        } else {
+            kv_incr(me->kv, kv_bench_keys[key], 1, &value);
+            me->incrs++;
+        }
+        hist_add(me->latency, now_ns() - beginning);
+    }
+    return NULL;
+}
+
+void run_kv_row(int n_shards, enum rw_engines engine, int skewed) {
+    struct kv_bench_thread threads[BENCH_KV_THREADS];
+    struct kv *kv = kv_create(n_shards, BENCH_KV_KEYS, engine);
+    struct hist *latency = hist_create();
+    long incrs = 0, beginning, ending, key;
+    int64_t value, sum = 0;
+    int i;
+
+    if (kv == NULL || latency == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    for (key = 0; key < BENCH_KV_KEYS; key++) {
+        if (kv_set(kv, kv_bench_keys[key], 0) == F_FAILURE) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    kv_bench_cdf = skewed ? kv_zipf_cdf(BENCH_KV_KEYS, BENCH_KV_ZIPF) : NULL;
+    memset(threads, 0, sizeof(threads));
+
+    beginning = now_ns();
+    for (i = 0; i < BENCH_KV_THREADS; i++) {
+        threads[i].kv = kv;
+        threads[i].seed = i + 1;
+        threads[i].latency = latency;
+        pthread_create(&threads[i].thread, NULL, kv_bench_worker, &threads[i]);
+    }
+    for (i = 0; i < BENCH_KV_THREADS; i++) {
+        pthread_join(threads[i].thread, NULL);
+        incrs += threads[i].incrs;
+    }
+    ending = now_ns();
+
+    // every INCR landed on one counter or another
+    for (key = 0; key < BENCH_KV_KEYS; key++) {
+        sum += (kv_get(kv, kv_bench_keys[key], &value) == F_SUCCESS) ? value : 0;
+    }
+    printf("%8i %12s %10s %12.0f %10.0f %10li %10li %8s\n", kv->n_shards, rw_engine_name(engine),
+           skewed ? "zipf" : "uniform", BENCH_KV_OPS / ((ending - beginning) / 1e9), hist_mean(latency),
+           hist_percentile(latency, 990), hist_max(latency),
+           (sum == incrs && kv_count(kv) == BENCH_KV_KEYS) ? "ok" : "LOST");
+    free(kv_bench_cdf);
+    kv_bench_cdf = NULL;
+    free(latency);
+    kv_free(kv);
+}
+
+void bench_kv() {
+    const int shards[] = {1, 16, 256};
+    long key;
+    int i, skewed;
+
+    kv_bench_keys = malloc(BENCH_KV_KEYS * sizeof(*kv_bench_keys));
+    if (kv_bench_keys == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    for (key = 0; key < BENCH_KV_KEYS; key++) {
+        snprintf(kv_bench_keys[key], KV_KEY_SIZE, "key:%li", key);
+    }
+
+    printf("# kv: %i counters, %i threads, %i%% GET %i%% INCR, zipf s=%.2f\n", BENCH_KV_KEYS,
+           BENCH_KV_THREADS, BENCH_KV_GET_PCT, 100 - BENCH_KV_GET_PCT, BENCH_KV_ZIPF);
+    printf("%8s %12s %10s %12s %10s %10s %10s %8s\n", "shards", "lock", "keys", "ops/s",
+           "mean ns", "p99 ns <", "max ns", "incrs");
+    for (skewed = 0; skewed <= 1; skewed++) {
+        for (i = 0; i < (int)(sizeof(shards) / sizeof(shards[0])); i++) {
+            run_kv_row(shards[i], RW_MUTEX_COND, skewed);
+        }
+        run_kv_row(256, RW_PHASE_FAIR, skewed);
+    }
+    free(kv_bench_keys);
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s wal|rwlock|seqlock|connq|session|combine|pool|kv\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (strcmp(argv[1], "wal") == 0) {
+        bench_wal();
+    } else if (strcmp(argv[1], "rwlock") == 0) {
+        bench_rwlock();
+    } else if (strcmp(argv[1], "seqlock") == 0) {
+        bench_seqlock();
+    } else if (strcmp(argv[1], "connq") == 0) {
+        bench_connq();
+    } else if (strcmp(argv[1], "session") == 0) {
+        bench_session();
+    } else if (strcmp(argv[1], "combine") == 0) {
+        bench_combine();
+    } else if (strcmp(argv[1], "pool") == 0) {
+        bench_pool();
+    } else if (strcmp(argv[1], "kv") == 0) {
+        bench_kv();
+    } else {
+        fprintf(stderr, "error: unknown benchmark '%s'\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,176 @@
+#include "./combine.h"
+#include <sched.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+
+// GLOBAL VARIABLES:
+atomic_int fc_threads = 0;          // slots ever taken: the combiners look at these
+atomic_int fc_owned[FC_MAX_THREADS];    // 1: a live thread has the slot (the same one in every fc)
+__thread int fc_my_slot = -1;
+pthread_key_t fc_exit_key;          // gives the slot back when its thread exits
+pthread_once_t fc_exit_once = PTHREAD_ONCE_INIT;
+
+
+//-- (thread exit) frees the slot of the thread for the next one
+void fc_release_slot(void *slot) {
+    atomic_store(&fc_owned[(intptr_t)slot - 1], 0);
+}
+
+void fc_create_exit_key() {
+    pthread_key_create(&fc_exit_key, fc_release_slot);
+}
+
+//-- slot of the calling thread: one a thread that exited left, or a new one
+//   (F_FAILURE once every slot is taken)
+int fc_slot_of_thread() {
+    int n_slots, i, idle = 0;
+
+    while (fc_my_slot == -1) {
+        n_slots = atomic_load(&fc_threads);
+        for (i = 0; i < n_slots && fc_my_slot == -1; i++) {
+            if (atomic_compare_exchange_strong(&fc_owned[i], &idle, 1)) {
+                fc_my_slot = i;
+            }
+            idle = 0;
+        }
+        if (fc_my_slot == -1 && n_slots >= FC_MAX_THREADS) {
+            return F_FAILURE;   // (it asks again next time: one may be free by then)
+        }
+        if (fc_my_slot == -1) {
+            // one more slot, for us or whoever takes it first
+            atomic_compare_exchange_strong(&fc_threads, &n_slots, n_slots + 1);
+        }
+    }
+    pthread_once(&fc_exit_once, fc_create_exit_key);
+    pthread_setspecific(fc_exit_key, (void *)(intptr_t)(fc_my_slot + 1));  // (NULL: nothing to free)
+    return fc_my_slot;
+}
+
+//-- wakes the owner of slot (sleeping on its state)
+void fc_wake(struct fc_slot *slot) {
+    syscall(SYS_futex, &slot->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+//-- (combiner only) applies what is pending now, returns how many it applied
+int fc_apply_pending(struct fc *fc) {
+    int n_slots = atomic_load(&fc_threads), n = 0, i;
+    unsigned int state;
+
+    if (n_slots > FC_MAX_THREADS) {
+        n_slots = FC_MAX_THREADS;
+    }
+    for (i = 0; i < n_slots; i++) {
+        state = atomic_load(&fc->slots[i].state);
+        if (state == FC_PENDING || state == FC_NUDGED) {
+            fc->args[n] = fc->slots[i].arg;
+            fc->batch_slots[n++] = i;
+        }
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    fc->apply(n, fc->args, fc->results, fc->aux);
+    for (i = 0; i < n; i++) {
+        fc->slots[fc->batch_slots[i]].result = fc->results[i];
+        fc->slots[fc->batch_slots[i]].aux = fc->aux[i];
+        atomic_store(&fc->slots[fc->batch_slots[i]].state, FC_DONE);
+        fc_wake(&fc->slots[fc->batch_slots[i]]);
+    }
+    atomic_fetch_add(&fc->batches, 1);
+    atomic_fetch_add(&fc->applied, n);
+    return n;
+}
+
+//-- (a combiner that just left) somebody may have published after its last pass and
+//   failed to combine while it was still in: it sleeps, so one of them tries again
+void fc_nudge_one(struct fc *fc) {
+    int n_slots = atomic_load(&fc_threads), i;
+    unsigned int pending = FC_PENDING;
+
+    for (i = 0; i < n_slots && i < FC_MAX_THREADS; i++) {
+        if (atomic_compare_exchange_strong(&fc->slots[i].state, &pending, FC_NUDGED)) {
+            fc_wake(&fc->slots[i]);
+            return;
+        }
+        pending = FC_PENDING;
+    }
+}
+
+//-- becomes the combiner if nobody is, returns 1 if it was (and applied the pending)
+int fc_try_combine(struct fc *fc) {
+    int idle = 0, passes;
+
+    if (!atomic_compare_exchange_strong(&fc->combining, &idle, 1)) {
+        return 0;
+    }
+    for (passes = 0; passes < FC_PASSES && fc_apply_pending(fc) > 0; passes++) {
+    }
+    atomic_store(&fc->combining, 0);
+    fc_nudge_one(fc);
+    return 1;
+}
+
+//-- allocates a combiner of operations that apply runs (NULL if out of memory)
+struct fc *fc_create(fc_apply_fn apply) {
+    struct fc *fc = aligned_alloc(_Alignof(struct fc), sizeof(struct fc));
+
+    if (fc == NULL) {
+        perror("aligned_alloc");
+        return NULL;
+    }
+    memset(fc, 0, sizeof(*fc));     // every slot FC_EMPTY, nobody combining
+    fc->apply = apply;
+    return fc;
+}
+
+void fc_free(struct fc *fc) {
+    free(fc);
+}
+
+//-- applies arg (with the operations of other threads, by whoever combines), returns
+//   its result and leaves its aux in *aux
+int64_t fc_submit(struct fc *fc, int64_t arg, uint64_t *aux) {
+    int my_slot = fc_slot_of_thread();
+    unsigned int nudged = FC_NUDGED;
+    struct fc_slot *slot;
+    int64_t result;
+
+    if (my_slot == F_FAILURE) {
+        // no slot: applied alone, as a combiner with a batch of one
+        while (atomic_exchange(&fc->combining, 1) != 0) {
+            sched_yield();
+        }
+        fc->apply(1, &arg, &result, aux);
+        atomic_store(&fc->combining, 0);
+        fc_nudge_one(fc);
+        return result;
+    }
+
+    slot = &fc->slots[my_slot];
+    slot->arg = arg;
+    atomic_store(&slot->state, FC_PENDING);
+    while (atomic_load(&slot->state) != FC_DONE) {
+        if (fc_try_combine(fc)) {
+            continue;   // applied ours too (it was pending)
+        }
+        // nudged: the combiner left without seeing us, try again
+        if (atomic_compare_exchange_strong(&slot->state, &nudged, FC_PENDING)) {
+            continue;
+        }
+        nudged = FC_NUDGED;
+        syscall(SYS_futex, &slot->state, FUTEX_WAIT_PRIVATE, FC_PENDING, NULL, NULL, 0);
+    }
+
+    result = slot->result;
+    *aux = slot->aux;
+    atomic_store(&slot->state, FC_EMPTY);
+    return result;
+}
+
+void fc_get_stats(struct fc *fc, long *batches, long *applied) {
+    *batches = atomic_load(&fc->batches);
+    *applied = atomic_load(&fc->applied);
+}
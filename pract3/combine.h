@@ -0,0 +1,50 @@
+#ifndef COMBINE_H
+#define COMBINE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "./stub.h"
+
+
+#define FC_MAX_THREADS      1024    // threads with a slot: the rest apply theirs alone
+#define FC_PASSES           4       // batches a combiner applies at most before it leaves
+
+
+enum fc_states {
+    FC_EMPTY = 0,
+    FC_PENDING,                 // published, waiting for a combiner
+    FC_NUDGED,                  // pending, and told to try to combine itself
+    FC_DONE                     // applied: result and aux are ready
+};
+
+// a thread's slot of the publication list
+struct fc_slot {
+    _Alignas(64) atomic_uint state;
+    int64_t arg;
+    int64_t result;
+    uint64_t aux;
+};
+
+// applies n operations at once (in one exclusive section): args[i] in, results[i]
+// and aux[i] out, in the order they are given
+typedef void (*fc_apply_fn)(int n, const int64_t *args, int64_t *results, uint64_t *aux);
+
+struct fc {
+    fc_apply_fn apply;
+    _Alignas(64) atomic_int combining;  // 1: a thread is applying the pending ones
+    atomic_long batches, applied;       // (stats) combiner passes and operations in them
+    struct fc_slot slots[FC_MAX_THREADS];
+    int64_t args[FC_MAX_THREADS];       // (combiner only) the batch being applied
+    int64_t results[FC_MAX_THREADS];
+    uint64_t aux[FC_MAX_THREADS];
+    int batch_slots[FC_MAX_THREADS];
+};
+
+
+// flat combining: any number of threads submit, one applies them all
+struct fc *fc_create(fc_apply_fn apply);
+void fc_free(struct fc *fc);
+int64_t fc_submit(struct fc *fc, int64_t arg, uint64_t *aux);
+void fc_get_stats(struct fc *fc, long *batches, long *applied);
+
+#endif // COMBINE_H
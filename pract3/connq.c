@@ -0,0 +1,240 @@
+#include "./connq.h"
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+
+// GLOBAL VARIABLES:
+struct connq_cell connq_ring[CONNQ_SIZE];
+_Alignas(64) atomic_size_t connq_tail = 0;      // next push
+_Alignas(64) atomic_size_t connq_head = 0;      // next pop
+
+    // parking: a thread sleeps on an event count, the other side bumps it
+_Alignas(64) atomic_uint connq_pushes = 0;      // bumped after every push (poppers sleep on it)
+atomic_uint connq_pop_sleepers = 0;
+_Alignas(64) atomic_uint connq_pops = 0;        // bumped after every pop (pushers sleep on it)
+atomic_uint connq_push_sleepers = 0;
+
+    // stats
+atomic_long connq_pushed = 0;
+atomic_long connq_overflows = 0;
+atomic_long connq_overflow_ns = 0;
+struct hist connq_wait;
+
+
+//-- CLOCK_MONOTONIC in nanoseconds
+long connq_now_ns() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+//-- sleeps on word while it holds seen (timeout_ns at most, < 0: no limit)
+void connq_sleep(atomic_uint *word, unsigned int seen, long timeout_ns) {
+    struct timespec timeout;
+
+    timeout.tv_sec = timeout_ns / 1000000000L;
+    timeout.tv_nsec = timeout_ns % 1000000000L;
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, (timeout_ns < 0) ? NULL : &timeout, NULL, 0);
+}
+
+//-- bumps word and wakes one of its sleepers (if any)
+void connq_bump(atomic_uint *word, atomic_uint *sleepers) {
+    atomic_fetch_add(word, 1);
+    // seq_cst: either the sleeper is counted here or it reads the bumped word
+    if (atomic_load(sleepers) > 0) {
+        syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+//-- (ring) puts fd in the ring, returns F_FAILURE when it is full
+int connq_try_push(int fd) {
+    size_t pos = atomic_load_explicit(&connq_tail, memory_order_relaxed), seq;
+    struct connq_cell *cell;
+    long diff;
+
+    for (;;) {
+        cell = &connq_ring[pos & (CONNQ_SIZE - 1)];
+        seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        diff = (long)seq - (long)pos;
+        if (diff == 0) {
+            // our turn at this cell if no other pusher takes pos first
+            if (atomic_compare_exchange_weak_explicit(&connq_tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return F_FAILURE;   // the pop of a lap ago did not free it yet: full
+        } else {
+            pos = atomic_load_explicit(&connq_tail, memory_order_relaxed);
+        }
+    }
+    cell->fd = fd;
+    cell->queued_ns = connq_now_ns();
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return F_SUCCESS;
+}
+
+//-- (ring) takes the oldest connection out of the ring, returns F_FAILURE if empty
+int connq_try_pop(int *fd, long *queued_ns) {
+    size_t pos = atomic_load_explicit(&connq_head, memory_order_relaxed), seq;
+    struct connq_cell *cell;
+    long diff;
+
+    for (;;) {
+        cell = &connq_ring[pos & (CONNQ_SIZE - 1)];
+        seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        diff = (long)seq - (long)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&connq_head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return F_FAILURE;   // not pushed yet: empty
+        } else {
+            pos = atomic_load_explicit(&connq_head, memory_order_relaxed);
+        }
+    }
+    *fd = cell->fd;
+    *queued_ns = cell->queued_ns;
+    // free for the push one lap ahead
+    atomic_store_explicit(&cell->seq, pos + CONNQ_SIZE, memory_order_release);
+    return F_SUCCESS;
+}
+
+//-- empties the ring and its stats (nobody may use it meanwhile)
+void connq_init() {
+    size_t i;
+
+    for (i = 0; i < CONNQ_SIZE; i++) {
+        atomic_store(&connq_ring[i].seq, i);
+    }
+    atomic_store(&connq_tail, 0);
+    atomic_store(&connq_head, 0);
+    atomic_store(&connq_pushed, 0);
+    atomic_store(&connq_overflows, 0);
+    atomic_store(&connq_overflow_ns, 0);
+    hist_reset(&connq_wait);
+}
+
+//-- queues fd for the pool; with the ring full it waits for a pop (the connections
+//   behind wait in the listen() backlog meanwhile), and counts it as an overflow
+void connq_push(int fd) {
+    long beginning = 0;
+    unsigned int seen;
+    int i, pushed = (connq_try_push(fd) == F_SUCCESS);
+
+    if (!pushed) {
+        beginning = connq_now_ns();
+        atomic_fetch_add(&connq_overflows, 1);
+    }
+    while (!pushed) {
+        for (i = 0; i < CONNQ_SPIN && !pushed; i++) {
+            pushed = (connq_try_push(fd) == F_SUCCESS);
+        }
+        if (pushed) {
+            break;
+        }
+        // counted first, then the last look: a pop after it bumps what we sleep on
+        atomic_fetch_add(&connq_push_sleepers, 1);
+        seen = atomic_load(&connq_pops);
+        pushed = (connq_try_push(fd) == F_SUCCESS);
+        if (!pushed) {
+            connq_sleep(&connq_pops, seen, -1);
+        }
+        atomic_fetch_sub(&connq_push_sleepers, 1);
+    }
+
+    if (beginning != 0) {
+        atomic_fetch_add(&connq_overflow_ns, connq_now_ns() - beginning);
+    }
+    atomic_fetch_add(&connq_pushed, 1);
+    connq_bump(&connq_pushes, &connq_pop_sleepers);
+}
+
+//-- (threads!) waits timeout_ns at most (< 0: no limit) for the oldest queued
+//   connection: its fd and when it was pushed (accepted) go to fd and queued_ns,
+//   F_FAILURE if none came meanwhile
+int connq_pop_within(int *fd, long *queued_ns, long timeout_ns) {
+    long deadline = (timeout_ns < 0) ? -1 : connq_now_ns() + timeout_ns, left = -1;
+    unsigned int seen;
+    int i, popped = 0;
+
+    while (!popped) {
+        for (i = 0; i < CONNQ_SPIN && !popped; i++) {
+            popped = (connq_try_pop(fd, queued_ns) == F_SUCCESS);
+        }
+        if (popped) {
+            break;
+        }
+        if (deadline >= 0 && (left = deadline - connq_now_ns()) <= 0) {
+            return F_FAILURE;
+        }
+        // counted first, then the last look: a push after it bumps what we sleep on
+        atomic_fetch_add(&connq_pop_sleepers, 1);
+        seen = atomic_load(&connq_pushes);
+        popped = (connq_try_pop(fd, queued_ns) == F_SUCCESS);
+        if (!popped) {
+            connq_sleep(&connq_pushes, seen, left);
+        }
+        atomic_fetch_sub(&connq_pop_sleepers, 1);
+    }
+
+    connq_bump(&connq_pops, &connq_push_sleepers);
+    hist_add(&connq_wait, connq_now_ns() - *queued_ns);
+    return F_SUCCESS;
+}
+
+//-- (threads!) waits for the oldest queued connection and returns its fd (and when it
+//   was pushed: accepted, in queued_ns)
+int connq_pop(long *queued_ns) {
+    int fd;
+
+    connq_pop_within(&fd, queued_ns, -1);
+    return fd;
+}
+
+//-- connections queued now (a glimpse: pushes and pops go on meanwhile)
+long connq_length() {
+    long length = (long)(atomic_load(&connq_tail) - atomic_load(&connq_head));
+
+    return (length > 0) ? length : 0;
+}
+
+//-- when the oldest queued connection was pushed, 0 if none is (a glimpse too)
+long connq_oldest_ns() {
+    size_t pos = atomic_load(&connq_head);
+    struct connq_cell *cell = &connq_ring[pos & (CONNQ_SIZE - 1)];
+
+    // pushed, and not popped yet: the cell holds the connection of pos
+    if (atomic_load_explicit(&cell->seq, memory_order_acquire) != pos + 1) {
+        return 0;
+    }
+    return cell->queued_ns;
+}
+
+void connq_get_stats(struct connq_stats *stats) {
+    stats->pushed = atomic_load(&connq_pushed);
+    stats->overflows = atomic_load(&connq_overflows);
+    stats->overflow_ns = atomic_load(&connq_overflow_ns);
+    stats->wait = &connq_wait;
+}
+
+//-- prints how the queue did (the server does it on exit)
+void connq_report() {
+    struct connq_stats stats;
+
+    connq_get_stats(&stats);
+    if (stats.pushed == 0) {
+        return;
+    }
+    printf("Connection queue: %li queued, wait mean %.3f ms p50 < %.3f ms p99 < %.3f ms max %.3f ms\n",
+           stats.pushed, hist_mean(stats.wait) / 1e6, hist_percentile(stats.wait, 500) / 1e6,
+           hist_percentile(stats.wait, 990) / 1e6, hist_max(stats.wait) / 1e6);
+    if (stats.overflows > 0) {
+        printf("Connection queue: full %li times (%i connections), accept() waited %.3f ms\n",
+               stats.overflows, CONNQ_SIZE, stats.overflow_ns / 1e6);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef CONNQ_H
+#define CONNQ_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include "./hist.h"
+
+
+#define CONNQ_SIZE          1024    // accepted connections waiting at most (a power of two)
+#define CONNQ_SPIN          64      // polls of the ring before a thread sleeps on it
+
+
+// a slot of the ring (Vyukov): its sequence says whose turn it is
+struct connq_cell {
+    atomic_size_t seq;          // pos: free for the push of pos, pos + 1: holds it for its pop
+    int fd;
+    long queued_ns;             // CLOCK_MONOTONIC when it was pushed
+};
+
+// what the queue went through since connq_init()
+struct connq_stats {
+    long pushed;
+    long overflows;             // pushes that found the ring full and waited for room
+    long overflow_ns;           // time they waited
+    struct hist *wait;          // ns every popped connection spent queued
+};
+
+
+// queue of accepted connections (FIFO, many pushers and poppers, one per process)
+void connq_init();
+void connq_push(int fd);
+int connq_pop(long *queued_ns);
+int connq_pop_within(int *fd, long *queued_ns, long timeout_ns);
+long connq_length();
+long connq_oldest_ns();
+void connq_get_stats(struct connq_stats *stats);
+void connq_report();
+
+#endif // CONNQ_H
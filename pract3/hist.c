@@ -0,0 +1,74 @@
+#include "./hist.h"
+
+
+//-- allocates an empty histogram (NULL if out of memory)
+struct hist *hist_create() {
+    struct hist *h = malloc(sizeof(struct hist));
+
+    if (h == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    hist_reset(h);
+    return h;
+}
+
+//-- empties h (nobody may add to it meanwhile)
+void hist_reset(struct hist *h) {
+    int i;
+
+    atomic_store(&h->count, 0);
+    atomic_store(&h->sum, 0);
+    atomic_store(&h->max, 0);
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        atomic_store(&h->buckets[i], 0);
+    }
+}
+
+void hist_add(struct hist *h, long value) {
+    long max = atomic_load(&h->max);
+    int bucket = 0;
+
+    if (value < 0) {
+        value = 0;
+    }
+    while (bucket < HIST_BUCKETS - 1 && (value >> (bucket + 1)) > 0) {
+        bucket++;
+    }
+    atomic_fetch_add(&h->buckets[bucket], 1);
+    atomic_fetch_add(&h->sum, value);
+    while (value > max && !atomic_compare_exchange_weak(&h->max, &max, value)) {
+    }
+    atomic_fetch_add(&h->count, 1);
+}
+
+long hist_count(struct hist *h) {
+    return atomic_load(&h->count);
+}
+
+double hist_mean(struct hist *h) {
+    long count = atomic_load(&h->count);
+
+    return (count > 0) ? (double)atomic_load(&h->sum) / count : 0;
+}
+
+long hist_max(struct hist *h) {
+    return atomic_load(&h->max);
+}
+
+//-- upper bound of per_mille / 1000 of the values: their bucket's, or the max
+long hist_percentile(struct hist *h, int per_mille) {
+    long count = 0, seen = 0, max = atomic_load(&h->max);
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        count += atomic_load(&h->buckets[i]);
+    }
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += atomic_load(&h->buckets[i]);
+        if (seen > 0 && seen * 1000 >= count * per_mille) {
+            return ((2L << i) < max) ? (2L << i) : max;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdatomic.h>
+#include "./stub.h"
+
+
+#define HIST_BUCKETS        40      // bucket i counts the values in [2^i, 2^(i+1))
+
+
+// latencies (ns) added by any thread at once
+struct hist {
+    atomic_long count;
+    atomic_long sum;
+    atomic_long max;
+    atomic_long buckets[HIST_BUCKETS];
+};
+
+
+struct hist *hist_create();
+void hist_reset(struct hist *h);
+void hist_add(struct hist *h, long value);
+long hist_count(struct hist *h);
+double hist_mean(struct hist *h);
+long hist_max(struct hist *h);
+long hist_percentile(struct hist *h, int per_mille);
+
+#endif // HIST_H
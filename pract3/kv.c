@@ -0,0 +1,261 @@
+#include "./kv.h"
+#include <math.h>
+
+
+//-- hash of key (FNV-1a, then mixed: the shard takes its high bits, the slot its low
+//   ones), never 0
+uint64_t kv_hash(const char *key) {
+    uint64_t hash = 14695981039346656037ull;
+    int i;
+
+    for (i = 0; i < KV_KEY_SIZE && key[i] != '\0'; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ull;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return (hash != 0) ? hash : 1;
+}
+
+struct kv_shard *kv_shard_of(struct kv *kv, uint64_t hash) {
+    return &kv->shards[(hash >> 40) & (kv->n_shards - 1)];
+}
+
+//-- (shard locked) the slot of key, or the empty one where it would go
+struct kv_slot *kv_find(struct kv_shard *shard, uint64_t hash, const char *key) {
+    size_t i = hash & shard->mask;
+    struct kv_slot *slot = &shard->slots[i];
+
+    while (slot->hash != 0 &&
+           (slot->hash != hash || strncmp(slot->key, key, KV_KEY_SIZE) != 0)) {
+        i = (i + 1) & shard->mask;
+        slot = &shard->slots[i];
+    }
+    return slot;
+}
+
+//-- (shard write-locked) doubles the slots of shard, F_FAILURE if out of memory
+int kv_grow(struct kv_shard *shard) {
+    size_t old_size = shard->mask + 1, i, j;
+    struct kv_slot *old_slots = shard->slots;
+    struct kv_slot *slots = calloc(old_size * 2, sizeof(struct kv_slot));
+
+    if (slots == NULL) {
+        perror("calloc");
+        return F_FAILURE;
+    }
+    for (i = 0; i < old_size; i++) {
+        if (old_slots[i].hash == 0) {
+            continue;
+        }
+        for (j = old_slots[i].hash & (old_size * 2 - 1); slots[j].hash != 0; j = (j + 1) & (old_size * 2 - 1)) {
+        }
+        slots[j] = old_slots[i];
+    }
+    shard->slots = slots;
+    shard->mask = old_size * 2 - 1;
+    free(old_slots);
+    return F_SUCCESS;
+}
+
+//-- (shard write-locked) the slot of key, added with value 0 if it was not there
+//   (NULL if out of memory)
+struct kv_slot *kv_find_or_add(struct kv_shard *shard, uint64_t hash, const char *key) {
+    struct kv_slot *slot = kv_find(shard, hash, key);
+
+    if (slot->hash != 0) {
+        return slot;
+    }
+    if ((shard->used + 1) * 100 > (shard->mask + 1) * KV_MAX_LOAD_PCT) {
+        if (kv_grow(shard) == F_FAILURE) {
+            return NULL;
+        }
+        slot = kv_find(shard, hash, key);
+    }
+    slot->hash = hash;
+    slot->value = 0;
+    strncpy(slot->key, key, KV_KEY_SIZE - 1);
+    slot->key[KV_KEY_SIZE - 1] = '\0';
+    shard->used++;
+    return slot;
+}
+
+//-- allocates a table of n_shards (rounded up to a power of two) with room for
+//   capacity keys before any shard grows, its locks of engine (NULL if out of memory)
+struct kv *kv_create(int n_shards, long capacity, enum rw_engines engine) {
+    struct kv *kv = malloc(sizeof(struct kv));
+    size_t slots = KV_MIN_SLOTS;
+    int shards = 1, i;
+
+    if (kv == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    while (shards < n_shards && shards < KV_MAX_SHARDS) {
+        shards *= 2;
+    }
+    while (slots * KV_MAX_LOAD_PCT / 100 < (size_t)(capacity / shards)) {
+        slots *= 2;
+    }
+
+    kv->n_shards = shards;
+    kv->shards = aligned_alloc(_Alignof(struct kv_shard), shards * sizeof(struct kv_shard));
+    if (kv->shards == NULL) {
+        perror("aligned_alloc");
+        free(kv);
+        return NULL;
+    }
+    memset(kv->shards, 0, shards * sizeof(struct kv_shard));
+    for (i = 0; i < shards; i++) {
+        kv->shards[i].lock = rw_create(engine, RW_PRI_NONE);
+        kv->shards[i].slots = calloc(slots, sizeof(struct kv_slot));
+        kv->shards[i].mask = slots - 1;
+        if (kv->shards[i].lock == NULL || kv->shards[i].slots == NULL) {
+            if (kv->shards[i].slots == NULL) {
+                perror("calloc");   // (a lock that failed was reported by rw_create())
+            }
+            kv->n_shards = i + 1;
+            kv_free(kv);
+            return NULL;
+        }
+    }
+    return kv;
+}
+
+//-- frees a table nobody uses
+void kv_free(struct kv *kv) {
+    int i;
+
+    for (i = 0; i < kv->n_shards; i++) {
+        if (kv->shards[i].lock != NULL) {
+            rw_free(kv->shards[i].lock);
+        }
+        free(kv->shards[i].slots);
+    }
+    free(kv->shards);
+    free(kv);
+}
+
+//-- leaves the counter of key in value, F_FAILURE if there is none
+int kv_get(struct kv *kv, const char *key, int64_t *value) {
+    uint64_t hash = kv_hash(key);
+    struct kv_shard *shard = kv_shard_of(kv, hash);
+    struct kv_slot *slot;
+    int status = F_FAILURE;
+
+    rw_read_lock(shard->lock);          // lock (R)
+    slot = kv_find(shard, hash, key);
+    if (slot->hash != 0) {
+        *value = slot->value;
+        status = F_SUCCESS;
+    }
+    rw_read_unlock(shard->lock);        // unlock (o)
+    return status;
+}
+
+//-- sets the counter of key (adding it), F_FAILURE if there was no room to add it
+int kv_set(struct kv *kv, const char *key, int64_t value) {
+    uint64_t hash = kv_hash(key);
+    struct kv_shard *shard = kv_shard_of(kv, hash);
+    struct kv_slot *slot;
+    int status = F_FAILURE;
+
+    rw_write_lock(shard->lock);         // lock (X)
+    slot = kv_find_or_add(shard, hash, key);
+    if (slot != NULL) {
+        slot->value = value;
+        status = F_SUCCESS;
+    }
+    rw_write_unlock(shard->lock);       // unlock (o)
+    return status;
+}
+
+//-- adds delta to the counter of key (from 0 if there was none), leaves the result
+//   in value, F_FAILURE if there was no room to add it
+int kv_incr(struct kv *kv, const char *key, int64_t delta, int64_t *value) {
+    uint64_t hash = kv_hash(key);
+    struct kv_shard *shard = kv_shard_of(kv, hash);
+    struct kv_slot *slot;
+    int status = F_FAILURE;
+
+    rw_write_lock(shard->lock);         // lock (X)
+    slot = kv_find_or_add(shard, hash, key);
+    if (slot != NULL) {
+        *value = (slot->value += delta);
+        status = F_SUCCESS;
+    }
+    rw_write_unlock(shard->lock);       // unlock (o)
+    return status;
+}
+
+//-- sets the counter of key to desired if it holds expected (a missing key holds 0),
+//   leaves in current what it holds now, F_FAILURE if it held another value
+int kv_cas(struct kv *kv, const char *key, int64_t expected, int64_t desired, int64_t *current) {
+    uint64_t hash = kv_hash(key);
+    struct kv_shard *shard = kv_shard_of(kv, hash);
+    struct kv_slot *slot;
+    int status = F_FAILURE;
+
+    rw_write_lock(shard->lock);         // lock (X)
+    slot = kv_find(shard, hash, key);
+    *current = (slot->hash != 0) ? slot->value : 0;
+    if (*current == expected) {
+        slot = (slot->hash != 0) ? slot : kv_find_or_add(shard, hash, key);
+        if (slot != NULL) {
+            slot->value = desired;
+            *current = desired;
+            status = F_SUCCESS;
+        }
+    }
+    rw_write_unlock(shard->lock);       // unlock (o)
+    return status;
+}
+
+//-- keys in the table
+long kv_count(struct kv *kv) {
+    long count = 0;
+    int i;
+
+    for (i = 0; i < kv->n_shards; i++) {
+        rw_read_lock(kv->shards[i].lock);
+        count += kv->shards[i].used;
+        rw_read_unlock(kv->shards[i].lock);
+    }
+    return count;
+}
+
+//-- cumulative probabilities of n keys under Zipf's law of exponent s (key i, from
+//   0, drawn with probability proportional to 1 / (i + 1)^s), NULL if out of memory
+double *kv_zipf_cdf(long n, double s) {
+    double *cdf = malloc(n * sizeof(double)), sum = 0;
+    long i;
+
+    if (cdf == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        sum += 1.0 / pow(i + 1, s);
+        cdf[i] = sum;
+    }
+    for (i = 0; i < n; i++) {
+        cdf[i] /= sum;
+    }
+    return cdf;
+}
+
+//-- the key (0 to n - 1) a uniform u in [0, 1) falls on in cdf
+long kv_zipf_pick(const double *cdf, long n, double u) {
+    long low = 0, high = n - 1, mid;
+
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (cdf[mid] <= u) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
@@ -0,0 +1,48 @@
+#ifndef KV_H
+#define KV_H
+
+#include <stdint.h>
+#include "./rwlock.h"
+
+
+#define KV_KEY_SIZE         24      // bytes of a key, its NUL included
+#define KV_MAX_SHARDS       4096
+#define KV_MIN_SLOTS        16      // of a shard (a power of two)
+#define KV_MAX_LOAD_PCT     75      // a shard doubles its slots past this load
+
+
+// a named counter: open addressing, linear probing (no deletes: no tombstones)
+struct kv_slot {
+    uint64_t hash;              // 0: empty
+    int64_t value;
+    char key[KV_KEY_SIZE];
+};
+
+// a part of the table with its own lock: the hash picks it
+struct kv_shard {
+    _Alignas(64) struct rw_lock *lock;  // read side: GET, write side: the rest
+    struct kv_slot *slots;
+    size_t mask;                // slots - 1
+    size_t used;
+};
+
+struct kv {
+    int n_shards;               // a power of two
+    struct kv_shard *shards;
+};
+
+
+// named counters, sharded by key, each shard behind a reader-writer lock
+struct kv *kv_create(int n_shards, long capacity, enum rw_engines engine);
+void kv_free(struct kv *kv);
+int kv_get(struct kv *kv, const char *key, int64_t *value);
+int kv_set(struct kv *kv, const char *key, int64_t value);
+int kv_incr(struct kv *kv, const char *key, int64_t delta, int64_t *value);
+int kv_cas(struct kv *kv, const char *key, int64_t expected, int64_t desired, int64_t *current);
+long kv_count(struct kv *kv);
+
+// key distributions of the benchmarks
+double *kv_zipf_cdf(long n, double s);
+long kv_zipf_pick(const double *cdf, long n, double u);
+
+#endif // KV_H
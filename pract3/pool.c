@@ -0,0 +1,182 @@
+#include "./pool.h"
+#include "./connq.h"
+#include <pthread.h>
+#include <time.h>
+
+
+// GLOBAL VARIABLES:
+int pool_min_threads = 0;
+int pool_max_threads = 0;
+long pool_idle_ns = 0;
+long pool_target_ns = 0;
+pool_serve_fn pool_serve = NULL;
+pthread_attr_t pool_attr;                   // detached, POOL_STACK_SIZE stacks
+
+atomic_int pool_threads = 0;                // alive (counted before they start)
+atomic_int pool_idle = 0;                   // waiting for a connection
+    // stats
+atomic_int pool_peak = 0;
+atomic_long pool_started = 0;
+atomic_long pool_retired = 0;
+
+    // the manager sleeps on pool_cond while every queued connection has an idle thread
+pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pool_cond;
+
+
+//-- CLOCK_MONOTONIC in nanoseconds
+long pool_now_ns() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+//-- (a thread that idled out) leaves the pool unless it is down to pool_min_threads,
+//   returns 1 if it left
+int pool_try_retire() {
+    int threads = atomic_load(&pool_threads);
+
+    while (threads > pool_min_threads) {
+        if (atomic_compare_exchange_weak(&pool_threads, &threads, threads - 1)) {
+            atomic_fetch_add(&pool_retired, 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//-- (threads!) serves connections until it idles out for pool_idle_ns
+void *pool_worker() {
+    long queued_ns;
+    int fd, got, retired = 0;
+
+    while (!retired) {
+        atomic_fetch_add(&pool_idle, 1);
+        got = connq_pop_within(&fd, &queued_ns, pool_idle_ns);
+        atomic_fetch_sub(&pool_idle, 1);
+        if (got == F_SUCCESS) {
+            pool_serve(fd, queued_ns);
+        } else {
+            retired = pool_try_retire();
+        }
+    }
+    return NULL;
+}
+
+//-- starts up to n more threads (pool_max_threads at most), returns how many it started
+int pool_grow(int n) {
+    pthread_t thread;
+    int threads = atomic_load(&pool_threads), peak, grown = 0;
+
+    while (grown < n && threads < pool_max_threads) {
+        if (!atomic_compare_exchange_weak(&pool_threads, &threads, threads + 1)) {
+            continue;
+        }
+        if (pthread_create(&thread, &pool_attr, pool_worker, NULL) != 0) {
+            perror("pthread_create");
+            atomic_fetch_sub(&pool_threads, 1);
+            break;
+        }
+        grown++;
+        threads++;
+        peak = atomic_load(&pool_peak);
+        while (threads > peak && !atomic_compare_exchange_weak(&pool_peak, &peak, threads)) {
+        }
+    }
+    atomic_fetch_add(&pool_started, grown);
+    return grown;
+}
+
+//-- connections queued with no idle thread to take them
+long pool_unserved() {
+    return connq_length() - atomic_load(&pool_idle);
+}
+
+//-- (manager) grows the pool once the oldest queued connection waited pool_target_ns,
+//   with a thread for every connection nobody takes; sleeps while there is none
+void *pool_manager() {
+    struct timespec deadline;
+    long oldest, waited;
+
+    for (;;) {
+        pthread_mutex_lock(&pool_mutex);        // lock (X)
+        while (pool_unserved() <= 0) {
+            // (timed: an idle thread counted by a push may be taking another one)
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += POOL_TICK_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&pool_cond, &pool_mutex, &deadline);
+        }
+        pthread_mutex_unlock(&pool_mutex);      // unlock (o)
+
+        oldest = connq_oldest_ns();
+        waited = (oldest != 0) ? pool_now_ns() - oldest : 0;
+        if (waited < pool_target_ns) {
+            usleep((pool_target_ns - waited) / 1000 + 1);   // not late yet: again when it would be
+        } else if (pool_grow(pool_unserved()) == 0) {
+            // at pool_max_threads (or out of threads): only a thread that frees up helps,
+            // no spinning meanwhile (--pool-wait-us 0 is late at once)
+            usleep(POOL_TICK_MS * 1000);
+        }
+    }
+    return NULL;
+}
+
+//-- (server only!) starts min_threads (and the manager that adds the rest), serve
+//   gets the connections
+int pool_start(int min_threads, int max_threads, long idle_ns, long target_wait_ns,
+               pool_serve_fn serve) {
+    pthread_condattr_t cond_attr;
+    pthread_t manager;
+
+    if (min_threads < 1 || max_threads < min_threads || max_threads > POOL_HARD_CAP) {
+        fprintf(stderr, "error: the pool takes 1 <= min <= max <= %i threads\n", POOL_HARD_CAP);
+        return F_FAILURE;
+    }
+    pool_min_threads = min_threads;
+    pool_max_threads = max_threads;
+    pool_idle_ns = idle_ns;
+    pool_target_ns = target_wait_ns;
+    pool_serve = serve;
+
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    pthread_attr_init(&pool_attr);
+    pthread_attr_setdetachstate(&pool_attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&pool_attr, POOL_STACK_SIZE);
+
+    if (pool_grow(pool_min_threads) < pool_min_threads ||
+        pthread_create(&manager, &pool_attr, pool_manager, NULL) != 0) {
+        fprintf(stderr, "error: could not start the pool\n");
+        return F_FAILURE;
+    }
+    return F_SUCCESS;
+}
+
+//-- (acceptor) tells the manager when the connection it just pushed has no idle
+//   thread to take it
+void pool_notify_push() {
+    if (pool_unserved() > 0) {
+        pthread_mutex_lock(&pool_mutex);        // lock (X)
+        pthread_cond_signal(&pool_cond);
+        pthread_mutex_unlock(&pool_mutex);      // unlock (o)
+    }
+}
+
+int pool_size() {
+    return atomic_load(&pool_threads);
+}
+
+//-- prints how the pool did (the server does it on exit)
+void pool_report() {
+    if (pool_max_threads == 0) {
+        return;     // (never started)
+    }
+    printf("Thread pool: %i threads (%i idle), peak %i, %li started, %li retired (min %i, max %i)\n",
+           atomic_load(&pool_threads), atomic_load(&pool_idle), atomic_load(&pool_peak),
+           atomic_load(&pool_started), atomic_load(&pool_retired), pool_min_threads, pool_max_threads);
+}
@@ -0,0 +1,25 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdatomic.h>
+#include "./stub.h"
+
+
+#define POOL_HARD_CAP       1024    // threads the pool never goes beyond (--pool-max)
+#define POOL_STACK_SIZE     (256 * 1024)    // of a pool thread (the default is 8 MiB)
+#define POOL_TICK_MS        100     // the manager looks at the queue at least this often
+
+
+// serves a connection popped from connq (queued_ns: when it was accepted)
+typedef void (*pool_serve_fn)(int fd, long queued_ns);
+
+
+// elastic pool of threads serving connq: min_threads to max_threads, more while the
+// oldest connection waits over target_wait_ns, fewer once one idles over idle_ns
+int pool_start(int min_threads, int max_threads, long idle_ns, long target_wait_ns,
+               pool_serve_fn serve);
+void pool_notify_push();
+int pool_size();
+void pool_report();
+
+#endif // POOL_H
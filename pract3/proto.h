@@ -0,0 +1,68 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdint.h>
+#include "./kv.h"
+
+
+#define REQ_TRACE           0x1 // request flag: its response is followed by a struct trace
+
+
+// WRITE and READ act on holy_counter, the rest on the named counter of the request
+enum operations {
+    WRITE = 0,
+    READ,
+    GET,
+    SET,                        // to value
+    INCR,                       // by value
+    CAS,                        // to value, if it holds expected
+    N_OPERATIONS                // keep last
+};
+
+// as it goes on the wire (client, server and ./bench): a session carries any number of
+// them: req_id matches each response with its request
+struct request {
+    enum operations action;
+    unsigned int id;
+    unsigned int req_id;        // chosen by the client, unique among those in flight
+    unsigned int flags;         // REQ_TRACE
+    char key[KV_KEY_SIZE];      // (GET, SET, INCR, CAS) name of the counter
+    int64_t value;
+    int64_t expected;           // (CAS)
+};
+
+struct response {
+    enum operations action;
+    unsigned int counter;
+    long latency_time;
+    unsigned int req_id;        // of the request it answers
+    int status;                 // F_FAILURE: GET of a missing one, CAS that failed, a WRITE
+                                //  (READ) the log failed to commit
+    int64_t value;              // what the counter holds after it (counter: its low 32 bits)
+};
+
+// where a request spent its time: server CLOCK_MONOTONIC (ns) at each step (the
+// client's connect() happens before the server sees it: the client times it itself)
+struct trace {
+    long accept_ns;             // its connection was accepted (and queued for the pool)
+    long dequeue_ns;            // a pool thread took the connection
+    long received_ns;           // the request was read
+    long lock_wait_ns;          // it started waiting for counter_lock (or the combiner)
+    long acquired_ns;           // it got it
+    long cs_done_ns;            // the critical section (and its hold) ended
+    long committed_ns;          // its record reached the log
+    long sent_ns;               // the response was handed to send()
+};
+
+// spans of a trace, aggregated by the server and the --trace clients
+enum trace_stages {
+    STAGE_QUEUE = 0,            // accept -> dequeue (once per connection)
+    STAGE_LOCK_WAIT,            // lock wait -> acquired
+    STAGE_HOLD,                 // acquired -> critical section done
+    STAGE_COMMIT,               // critical section done -> committed
+    STAGE_REPLY,                // committed -> sent
+    STAGE_TOTAL,                // received -> sent
+    TRACE_STAGES
+};
+
+#endif // PROTO_H
@@ -0,0 +1,340 @@
+#define _GNU_SOURCE     // sched_getcpu()
+#include "./rwlock.h"
+#include <limits.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+
+#define PF_RINC             0x100   // one reader in rin / rout
+#define PF_WBITS            0x3     // low bits of rin: a writer is present, and its phase
+#define PF_PRES             0x2
+#define PF_PHID             0x1
+
+
+// GLOBAL VARIABLES:
+__thread int rw_slot_held = 0;      // (big-reader) counter the thread's read_lock() went up
+
+
+//-- sleeps while word still holds seen: polls RW_SPIN times first, the holder may be
+//   about to leave (the caller checks its condition again either way)
+void rw_wait_while(struct rw_word *word, unsigned int seen) {
+    int i;
+
+    for (i = 0; i < RW_SPIN; i++) {
+        if (atomic_load(&word->value) != seen) {
+            return;
+        }
+    }
+    atomic_fetch_add(&word->sleepers, 1);
+    syscall(SYS_futex, &word->value, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+    atomic_fetch_sub(&word->sleepers, 1);
+}
+
+//-- wakes every thread sleeping on word (after its value changed)
+void rw_wake(struct rw_word *word) {
+    // seq_cst: either the sleeper is counted here or its futex_wait() sees the new value
+    if (atomic_load(&word->sleepers) > 0) {
+        syscall(SYS_futex, &word->value, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+//-- waits until word holds wanted
+void rw_wait_for(struct rw_word *word, unsigned int wanted) {
+    unsigned int seen;
+
+    while ((seen = atomic_load(&word->value)) != wanted) {
+        rw_wait_while(word, seen);
+    }
+}
+
+
+//// RW_MUTEX_COND: the lock do_read() and do_write() had inline
+
+void mc_read_lock(struct rw_lock *lock) {
+    pthread_mutex_lock(&lock->mutex);       // lock (X)
+    lock->readers_waiting++;
+    // wait if (there is a writer inside OR there are writers waiting and they have priority)
+    while (lock->writer_in != 0 || (lock->writers_waiting > 0 && lock->priority == RW_PRI_WRITER)) {
+        pthread_cond_wait(&lock->r_cond, &lock->mutex);
+    }
+    lock->readers_waiting--;
+    lock->readers_in++;
+    pthread_mutex_unlock(&lock->mutex);     // unlock (o)
+}
+
+void mc_read_unlock(struct rw_lock *lock) {
+    pthread_mutex_lock(&lock->mutex);       // lock (X)
+    lock->readers_in--;
+    if (lock->readers_in == 0) {
+        pthread_cond_signal(&lock->w_cond);
+    }
+    pthread_mutex_unlock(&lock->mutex);     // unlock (o)
+}
+
+void mc_write_lock(struct rw_lock *lock) {
+    pthread_mutex_lock(&lock->mutex);       // lock (X)
+    lock->writers_waiting++;
+    // wait if (there is anybody inside OR there are readers waiting and they have priority)
+    while (lock->writer_in != 0 || lock->readers_in != 0 ||
+           (lock->readers_waiting > 0 && lock->priority == RW_PRI_READER)) {
+        pthread_cond_wait(&lock->w_cond, &lock->mutex);
+    }
+    lock->writers_waiting--;
+    lock->writer_in = 1;
+    pthread_mutex_unlock(&lock->mutex);     // unlock (o)
+}
+
+void mc_write_unlock(struct rw_lock *lock) {
+    pthread_mutex_lock(&lock->mutex);       // lock (X)
+    lock->writer_in = 0;
+    pthread_cond_broadcast(&lock->r_cond);
+    pthread_cond_signal(&lock->w_cond);
+    pthread_mutex_unlock(&lock->mutex);     // unlock (o)
+}
+
+
+//// RW_BIG_READER: a reader only writes the counter of its CPU, a writer visits them all
+
+//-- counter of the CPU the thread runs on
+int br_slot() {
+    int cpu = sched_getcpu();
+
+    return (cpu < 0) ? 0 : cpu % RW_BR_SLOTS;
+}
+
+void br_read_lock(struct rw_lock *lock) {
+    struct rw_word *slot;
+    unsigned int seen;
+
+    rw_slot_held = br_slot();
+    slot = &lock->slots[rw_slot_held];
+    for (;;) {
+        while ((seen = atomic_load(&lock->writer.value)) != 0) {
+            rw_wait_while(&lock->writer, seen);
+        }
+        atomic_fetch_add(&slot->value, 1);
+        // seq_cst against write_lock(): either it sees us or we see it
+        if (atomic_load(&lock->writer.value) == 0) {
+            return;
+        }
+        if (atomic_fetch_sub(&slot->value, 1) == 1) {
+            rw_wake(slot);  // the writer may be waiting for this counter
+        }
+    }
+}
+
+void br_read_unlock(struct rw_lock *lock) {
+    struct rw_word *slot = &lock->slots[rw_slot_held];     // (the thread may have moved)
+
+    if (atomic_fetch_sub(&slot->value, 1) == 1) {
+        rw_wake(slot);
+    }
+}
+
+void br_write_lock(struct rw_lock *lock) {
+    int i;
+
+    pthread_mutex_lock(&lock->writers);     // lock (X)
+    atomic_store(&lock->writer.value, 1);   // no reader gets in from now on
+    for (i = 0; i < RW_BR_SLOTS; i++) {
+        rw_wait_for(&lock->slots[i], 0);
+    }
+}
+
+void br_write_unlock(struct rw_lock *lock) {
+    atomic_store(&lock->writer.value, 0);
+    rw_wake(&lock->writer);
+    pthread_mutex_unlock(&lock->writers);   // unlock (o)
+}
+
+
+//// RW_PHASE_FAIR: readers that arrive while a writer is in wait for it only, a writer
+//   waits for the readers ahead of it only: neither side can starve the other
+
+void pf_read_lock(struct rw_lock *lock) {
+    unsigned int phase = atomic_fetch_add(&lock->rin.value, PF_RINC) & PF_WBITS;
+    unsigned int seen;
+
+    if (phase == 0) {
+        return;     // no writer: in at once
+    }
+    // a writer is present: wait until its phase ends
+    while (((seen = atomic_load(&lock->rin.value)) & PF_WBITS) == phase) {
+        rw_wait_while(&lock->rin, seen);
+    }
+}
+
+void pf_read_unlock(struct rw_lock *lock) {
+    atomic_fetch_add(&lock->rout.value, PF_RINC);
+    rw_wake(&lock->rout);
+}
+
+void pf_write_lock(struct rw_lock *lock) {
+    unsigned int ticket = atomic_fetch_add(&lock->win, 1);
+    unsigned int readers_before;
+
+    rw_wait_for(&lock->wout, ticket);       // writers in ticket order
+    // present from now on (new readers wait), then wait for the readers already in
+    readers_before = atomic_fetch_add(&lock->rin.value, PF_PRES | (ticket & PF_PHID));
+    rw_wait_for(&lock->rout, readers_before & ~PF_WBITS);
+}
+
+void pf_write_unlock(struct rw_lock *lock) {
+    atomic_fetch_and(&lock->rin.value, ~PF_WBITS);  // the readers that waited get in
+    rw_wake(&lock->rin);
+    atomic_fetch_add(&lock->wout.value, 1);
+    rw_wake(&lock->wout);
+}
+
+
+//// RW_WRITER_TICKET: writers take tickets and keep readers out while any is waiting
+
+void wt_read_lock(struct rw_lock *lock) {
+    unsigned int seen;
+
+    for (;;) {
+        while ((seen = atomic_load(&lock->wwanted.value)) != 0) {
+            rw_wait_while(&lock->wwanted, seen);
+        }
+        atomic_fetch_add(&lock->active.value, 1);
+        if (atomic_load(&lock->wwanted.value) == 0) {
+            return;
+        }
+        if (atomic_fetch_sub(&lock->active.value, 1) == 1) {
+            rw_wake(&lock->active);     // a writer came meanwhile: let it go first
+        }
+    }
+}
+
+void wt_read_unlock(struct rw_lock *lock) {
+    if (atomic_fetch_sub(&lock->active.value, 1) == 1) {
+        rw_wake(&lock->active);
+    }
+}
+
+void wt_write_lock(struct rw_lock *lock) {
+    unsigned int ticket;
+
+    atomic_fetch_add(&lock->wwanted.value, 1);
+    ticket = atomic_fetch_add(&lock->wticket, 1);
+    rw_wait_for(&lock->wserving, ticket);
+    rw_wait_for(&lock->active, 0);
+}
+
+void wt_write_unlock(struct rw_lock *lock) {
+    atomic_fetch_add(&lock->wserving.value, 1);
+    rw_wake(&lock->wserving);
+    if (atomic_fetch_sub(&lock->wwanted.value, 1) == 1) {
+        rw_wake(&lock->wwanted);
+    }
+}
+
+
+// ENGINES (indexed by enum rw_engines):
+const struct rw_ops rw_engine_ops[RW_NUM_ENGINES] = {
+    {"mutex",       mc_read_lock, mc_read_unlock, mc_write_lock, mc_write_unlock},
+    {"brlock",      br_read_lock, br_read_unlock, br_write_lock, br_write_unlock},
+    {"phase-fair",  pf_read_lock, pf_read_unlock, pf_write_lock, pf_write_unlock},
+    {"ticket",      wt_read_lock, wt_read_unlock, wt_write_lock, wt_write_unlock},
+};
+
+
+//-- returns the engine called name (as given to --rwlock) or F_FAILURE
+int rw_engine_from_name(const char *name) {
+    int i;
+
+    for (i = 0; i < RW_NUM_ENGINES; i++) {
+        if (strcmp(rw_engine_ops[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return F_FAILURE;
+}
+
+const char *rw_engine_name(enum rw_engines engine) {
+    return rw_engine_ops[engine].name;
+}
+
+//-- allocates an unlocked lock of the engine (NULL if out of memory)
+struct rw_lock *rw_create(enum rw_engines engine, enum rw_priorities priority) {
+    struct rw_lock *lock = aligned_alloc(_Alignof(struct rw_lock), sizeof(struct rw_lock));
+
+    if (lock == NULL) {
+        perror("aligned_alloc");
+        return NULL;
+    }
+    memset(lock, 0, sizeof(*lock));     // every counter and word at 0: unlocked
+    lock->ops = &rw_engine_ops[engine];
+    lock->priority = priority;
+    pthread_mutex_init(&lock->mutex, NULL);
+    pthread_cond_init(&lock->r_cond, NULL);
+    pthread_cond_init(&lock->w_cond, NULL);
+    pthread_mutex_init(&lock->writers, NULL);
+    return lock;
+}
+
+//-- frees a lock nobody holds or waits for
+void rw_free(struct rw_lock *lock) {
+    pthread_mutex_destroy(&lock->mutex);
+    pthread_cond_destroy(&lock->r_cond);
+    pthread_cond_destroy(&lock->w_cond);
+    pthread_mutex_destroy(&lock->writers);
+    free(lock);
+}
+
+void rw_read_lock(struct rw_lock *lock) {
+    lock->ops->read_lock(lock);
+}
+
+void rw_read_unlock(struct rw_lock *lock) {
+    lock->ops->read_unlock(lock);
+}
+
+void rw_write_lock(struct rw_lock *lock) {
+    lock->ops->write_lock(lock);
+}
+
+void rw_write_unlock(struct rw_lock *lock) {
+    lock->ops->write_unlock(lock);
+}
+
+
+//// seqlock read path: a writer (holding the write side, or the only one) makes seq odd, publishes its
+//   values in atomics and makes seq even again; a reader copies them and tries again
+//   if seq was odd or changed meanwhile. Readers never wait for the lock, and writers
+//   never wait for them
+
+//-- returns the (even) sequence the reader's copy starts at
+unsigned int rw_seq_read_begin(struct rw_lock *lock) {
+    unsigned int begin;
+    int spins = 0;
+
+    while ((begin = atomic_load_explicit(&lock->seq, memory_order_acquire)) & 1) {
+        if (++spins % RW_SEQ_SPIN == 0) {
+            sched_yield();  // the writer may be off the CPU in the middle of publishing
+        }
+    }
+    return begin;
+}
+
+//-- returns 1 if a writer published while the reader copied (the copy is torn)
+int rw_seq_read_retry(struct rw_lock *lock, unsigned int begin) {
+    // the copy's relaxed loads may not move below the check
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&lock->seq, memory_order_relaxed) != begin;
+}
+
+//-- (write side held, or the only writer!) before the writer publishes
+void rw_seq_write_begin(struct rw_lock *lock) {
+    atomic_store_explicit(&lock->seq, atomic_load_explicit(&lock->seq, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    // the publishing stores may not move above the odd sequence
+    atomic_thread_fence(memory_order_release);
+}
+
+//-- (write side held, or the only writer!) after the writer published
+void rw_seq_write_end(struct rw_lock *lock) {
+    atomic_store_explicit(&lock->seq, atomic_load_explicit(&lock->seq, memory_order_relaxed) + 1,
+                          memory_order_release);
+}
@@ -0,0 +1,91 @@
+#ifndef RWLOCK_H
+#define RWLOCK_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "./stub.h"
+
+
+#define RW_BR_SLOTS         64      // reader counters of the big-reader lock (one per CPU)
+#define RW_SPIN             100     // polls of a lock word before sleeping on it
+#define RW_SEQ_SPIN         64      // polls of an odd sequence before yielding the CPU
+
+
+enum rw_engines {
+    RW_MUTEX_COND = 0,          // one mutex, two condition variables (the server's first lock)
+    RW_BIG_READER,              // a reader counter per CPU: readers share no cache line
+    RW_PHASE_FAIR,              // ticket phase-fair: reader and writer phases alternate
+    RW_WRITER_TICKET,           // writers in ticket order, ahead of any reader waiting
+    RW_NUM_ENGINES              // keep last
+};
+
+// who goes first when both wait (RW_MUTEX_COND only, the others have their own policy)
+enum rw_priorities {
+    RW_PRI_NONE = 0,
+    RW_PRI_READER,
+    RW_PRI_WRITER
+};
+
+// a word threads sleep on (futex), alone in its cache line
+struct rw_word {
+    _Alignas(64) atomic_uint value;
+    atomic_uint sleepers;       // threads in futex_wait() on value: no wake-up syscall if 0
+};
+
+struct rw_lock;
+
+// one engine: how its readers and writers get in and out
+struct rw_ops {
+    const char *name;           // as given to --rwlock
+    void (*read_lock)(struct rw_lock *lock);
+    void (*read_unlock)(struct rw_lock *lock);
+    void (*write_lock)(struct rw_lock *lock);
+    void (*write_unlock)(struct rw_lock *lock);
+};
+
+struct rw_lock {
+    const struct rw_ops *ops;
+    enum rw_priorities priority;
+
+        // RW_MUTEX_COND
+    pthread_mutex_t mutex;
+    pthread_cond_t r_cond, w_cond;          // -protected by mutex
+    int readers_in, writer_in, readers_waiting, writers_waiting;
+
+        // RW_BIG_READER
+    struct rw_word slots[RW_BR_SLOTS];      // readers inside, by the CPU they entered on
+    struct rw_word writer;                  // 1: a writer is in or waits for the readers to leave
+    pthread_mutex_t writers;                // writers among themselves
+
+        // RW_PHASE_FAIR (Brandenburg & Anderson's PF-T)
+    struct rw_word rin;                     // readers in << 8 | writer present | phase
+    struct rw_word rout;                    // readers out << 8
+    atomic_uint win;                        // writer tickets taken
+    struct rw_word wout;                    // writer tickets served
+
+        // RW_WRITER_TICKET
+    atomic_uint wticket;                    // writer tickets taken
+    struct rw_word wserving;                // writer tickets served
+    struct rw_word wwanted;                 // writers in or waiting: readers stay out
+    struct rw_word active;                  // readers inside
+
+        // seqlock read path (any engine: its writers publish, those readers take no lock)
+    _Alignas(64) atomic_uint seq;           // odd while a writer publishes
+};
+
+
+// reader-writer lock of the counter (any engine behind the same calls)
+int rw_engine_from_name(const char *name);
+const char *rw_engine_name(enum rw_engines engine);
+struct rw_lock *rw_create(enum rw_engines engine, enum rw_priorities priority);
+void rw_free(struct rw_lock *lock);
+void rw_read_lock(struct rw_lock *lock);
+void rw_read_unlock(struct rw_lock *lock);
+void rw_write_lock(struct rw_lock *lock);
+void rw_write_unlock(struct rw_lock *lock);
+unsigned int rw_seq_read_begin(struct rw_lock *lock);
+int rw_seq_read_retry(struct rw_lock *lock, unsigned int begin);
+void rw_seq_write_begin(struct rw_lock *lock);
+void rw_seq_write_end(struct rw_lock *lock);
+
+#endif // RWLOCK_H
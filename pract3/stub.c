@@ -1,101 +1,124 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+#include "./stub.h"
+#include "./wal.h"
+#include "./rwlock.h"
+#include "./combine.h"
+#include "./connq.h"
+#include "./pool.h"
+#include "./kv.h"
+#include "./hist.h"
+#include "./proto.h"
 #include <getopt.h>
-#include <sys/select.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <signal.h>
-#include <err.h>
-#include <errno.h>
 #include <pthread.h> 
-#include <semaphore.h>
 #include <time.h>
 #include <stdint.h>
-
-
-#ifdef DEBUG
-    #define DEBUG_PRINTF(...) fprintf(stdout, "DEBUG: "__VA_ARGS__)
-#else
-    #define DEBUG_PRINTF(...)
-#endif
+#include <stdatomic.h>
+#include <sys/un.h>
+#include <netinet/tcp.h>
+#include <math.h>
 
 
 // CONSTANT VALUES:
 #define SOCKET_RUNNING      1
 #define SOCKET_CLOSED       -1
 
-#define F_FAILURE           -1  // function failed
-#define F_SUCCESS           0   // function succeded
-#define F_CONN_CLOSE        -3  // recv() returns 0 bytes read
-
 #define STUB_EXIT_SIGINT    12  // exit status when terminating by sigint
 
-#define MAX_SERVER_THREADS  600
+#define MAX_SERVER_THREADS  600     // default --pool-max (the size of the pool when it was fixed)
+#define MIN_SERVER_THREADS  16      // default --pool-min
 #define MAX_BACKLOG         1024
-#define RW_BUFFER_SIZE      32  // buffer size to readers and writers
+#define RW_BUFFER_SIZE      32  // buffer size to read the legacy counter file
+#define LEGACY_OUTPUT       "server_output.txt" // where the counter was kept before the log
 
-#define WR_IN               2
-#define WR_OUT              -2
+#define UNIX_PATH_FORMAT    "/tmp/sdc-%i.sock"  // AF_UNIX socket of the server at port %i
 
+#define CONNECT_TRIES       8       // connect()s of a client before it gives up
+#define CONNECT_BACKOFF_MS  10      // wait after the first failed one, doubled after each
+#define CONNECT_BACKOFF_MAX_MS  1000    // (the longest wait between two tries)
 
-// ENUMS AND STRUCTS:
-enum operations {
-    WRITE = 0,
-    READ
-};
+#define KV_SHARDS           64  // default --kv-shards
+#define KV_CAPACITY         65536   // default --kv-capacity: keys before the table grows
 
-struct request {
-    enum operations action;
-    unsigned int id;
-};
 
-struct response {
-    enum operations action;
-    unsigned int counter;
-    long latency_time;
-};
 
+// ENUMS AND STRUCTS:
 struct client_data {
+    int conn_fd;                // (connected by its own thread)
+    unsigned int id;
+    struct sockaddr_storage *servaddr;
+    socklen_t servaddr_len;
+};
+
+// (client only!) an open-loop connection: what its sender did, for its receiver
+struct load_conn {
     int conn_fd;
     unsigned int id;
+    unsigned int n;             // requests it sends
+    unsigned int received;
+    enum operations *actions;   // per request (req_id - 1), written before its send
+    long *intended_ns;          // when the schedule said to send it
+    long *sent_ns;              // when it was sent
 };
 
 
+
 // GLOBAL VARIABLES:
-int holy_counter    = 0;    // server's internal counter. Has to be protected at all costs
+int64_t holy_counter = 0;   // server's internal counter. Has to be protected at all costs
+struct rw_lock *counter_lock = NULL;    // (server only!) protects holy_counter
+atomic_llong pub_counter    = 0;        // (server only!) holy_counter as last committed,
+                                        //  published by the log's syncer for seqlock READs
+int seqlock_reads           = 0;        // (server only!) READs take no lock (--read-path seqlock)
+struct fc *write_combiner   = NULL;     // (server only!) WRITEs are combined (--write-path combine)
+struct kv *counters         = NULL;     // (server only!) the named counters
+struct hist *stage_hists[TRACE_STAGES]; // (server only!) every request's trace, by stage
+const char *stage_names[TRACE_STAGES] = {"queue", "lock wait", "hold", "commit", "reply", "total"};
 
     // options
 int port            = 0;
 char *serv_pri      = NULL;
+char *rwlock_engine = NULL; // (server only!) "mutex" (default), "brlock", "phase-fair" or "ticket"
+char *read_path     = NULL; // (server only!) "lock" (default) or "seqlock"
+char *write_path    = NULL; // (server only!) "lock" (default) or "combine"
 char *ip            = NULL;
 char *cli_mode      = NULL;
 int cli_threads     = 0;
+int cli_requests    = 1;    // (client only!) requests each client sends over its connection
+int cli_pipeline    = 1;    // (client only!) requests a client keeps in flight at once
+int cli_trace       = 0;    // (client only!) asks for the trace of every request (--trace)
+int cli_rate        = 0;    // (client only!) open loop: requests/s of all the clients (0: closed loop)
+int cli_read_pct    = 50;   // (client only!) READs (GETs) out of 100 requests of --mode mixed (kv)
+long cli_keys       = 1000; // (client only!) named counters the requests spread over
+double cli_zipf     = 0;    // (client only!) Zipf exponent of the key drawn (0: uniform)
+double *cli_zipf_cdf = NULL;    // (client only!) of the cli_keys keys, when cli_zipf > 0
+int64_t cli_value   = 1;    // (client only!) of SET, INCR and CAS (--value)
+int64_t cli_expected = 0;   // (client only!) of CAS (--expected)
+char *cli_key       = NULL; // (client only!) the named counter of every request (--key), none drawn
+int kv_shards       = KV_SHARDS;    // (server only!) shards of the named counters
+long kv_capacity    = KV_CAPACITY;  // (server only!) keys they take before growing
+char *transport     = NULL; // "tcp" (default) or "unix" (server and clients on one host)
+char *fsync_policy  = NULL; // (server only!) "none", "records" (default) or "ms"
+long fsync_every    = 1;    // (server only!) N records or T ms between two fsync
+char *data_dir      = NULL; // (server only!) where the log and its snapshot are (".")
+long snapshot_every = 0;    // (server only!) records between two snapshots (0: default)
+int got_sigint      = 0;    // (server only!) CTRL+C stopped the accept loop
+long hold_us        = 150000;   // (server only!) the critical section sleeps hold_us/2 to hold_us
+int pool_min        = MIN_SERVER_THREADS;   // (server only!) threads the pool keeps
+int pool_max        = MAX_SERVER_THREADS;   // (server only!) threads the pool grows to
+long pool_idle_ms   = 2000;     // (server only!) a thread idle this long leaves (down to pool_min)
+long pool_wait_us   = 1000;     // (server only!) the pool grows once a connection waited this long
 
     // sockets & connections
 int sock_status     = 0;
 int sock_sfd        = 0;
-int conn_cfds[MAX_SERVER_THREADS];  // (server only!) stores all connection fds with clients
-int conn_index      = 0;            // protected by conn_index (ci!>)
+
+    // latencies of the open loop (client only!), by action: since the schedule said
+    // to send (coordinated omission corrected) and since it was sent
+struct hist *load_latency[N_OPERATIONS];
+struct hist *load_service[N_OPERATIONS];
+atomic_long load_late_ns = 0;   // what the sends fell behind the schedule
 
     // semaphores, mutexes & cond variables
-sem_t conn_sem;
-pthread_mutex_t conn_mutex = PTHREAD_MUTEX_INITIALIZER; // to protect conn_index
-pthread_mutex_t clid_mutex = PTHREAD_MUTEX_INITIALIZER; // to protect client_data 
-pthread_mutex_t rwait_mutex = PTHREAD_MUTEX_INITIALIZER; // to protect readers_waiting
-pthread_mutex_t wwait_mutex = PTHREAD_MUTEX_INITIALIZER; // to protect writers_waiting
-pthread_mutex_t rw_mutex = PTHREAD_MUTEX_INITIALIZER;   // to protect read and write operations
-pthread_cond_t r_cond = PTHREAD_COND_INITIALIZER;       //  -protected by rw_mutex
-pthread_cond_t w_cond = PTHREAD_COND_INITIALIZER;       //  -protected by rw_mutex
-
-    // thread 'queues'
-int writers_waiting = 0;
-int readers_waiting = 0;
-int readers_in      = 0;
-int writer_in       = 0;
+pthread_barrier_t load_barrier; // (client only!) the open-loop clients start together
+long load_start_ns = 0;         // (client only!) when, set between two waits of load_barrier
 
 // FUNCTION DEFINITION:
 
@@ -113,14 +136,32 @@ void perror_msg(char *msg, int sockfd, int is_socket_running) {
 #define perror_msg_sr(msg, sockfd) perror_msg(msg, sockfd, SOCKET_RUNNING)
 #define perror_msg_cl(msg) perror_msg(msg, 0, SOCKET_CLOSED)
 
-//-- handles sigint signals when received
+//-- handles sigint signals when received: stops the accept loop (interrupted,
+//   see catch_sigint), the server terminates from there committing the log first
 void handle_sigint(int sig) {
-    if (sock_status == SOCKET_RUNNING) {    // closes the socket if necessary
-        close(sock_sfd);
-        DEBUG_PRINTF("---------------- SOCKET CLOSED ----------------\n");
-        sock_status = SOCKET_CLOSED;
-    }
-    exit(STUB_EXIT_SIGINT);
+    DEBUG_PRINTF("---------------- SOCKET CLOSED ----------------\n");
+    sock_status = SOCKET_CLOSED;
+    got_sigint = 1;
+}
+
+//-- (server only!) blocks (or unblocks) SIGINT in the calling thread and the
+//   threads it creates meanwhile: only the accept loop must get it
+void block_sigint(int block) {
+    sigset_t sigint_set;
+
+    sigemptyset(&sigint_set);
+    sigaddset(&sigint_set, SIGINT);
+    pthread_sigmask(block ? SIG_BLOCK : SIG_UNBLOCK, &sigint_set, NULL);
+}
+
+//-- (server only!) installs handle_sigint without SA_RESTART: accept() returns EINTR
+void catch_sigint() {
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_sigint;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
 }
 
 
@@ -148,11 +189,22 @@ int get_cli_args(int argc, char **argv) {
         {"port",    required_argument, 0, 'p'},
         {"mode",    required_argument, 0, 'm'},
         {"threads", required_argument, 0, 't'},
+        {"transport", required_argument, 0, 'x'},
+        {"requests", required_argument, 0, 'n'},
+        {"pipeline", required_argument, 0, 'P'},
+        {"trace",   no_argument,       0, 'T'},
+        {"rate",    required_argument, 0, 'r'},
+        {"read-pct", required_argument, 0, 'R'},
+        {"keys",    required_argument, 0, 'k'},
+        {"zipf",    required_argument, 0, 'z'},
+        {"value",   required_argument, 0, 'v'},
+        {"expected", required_argument, 0, 'e'},
+        {"key",     required_argument, 0, 'K'},
         {0, 0, 0, 0}
     };  // Required client arguments (ip, port, mode and num of threads)
 
     // Parse through all possible options 
-    while ((op = getopt_long(argc, argv, "i:p:m:t:", cli_options, &index)) != -1) {
+    while ((op = getopt_long(argc, argv, "i:p:m:t:x:n:P:Tr:R:k:z:v:e:K:", cli_options, &index)) != -1) {
         switch (op) {
             case 'i':
                 ip = strdup(optarg);
@@ -166,10 +218,45 @@ int get_cli_args(int argc, char **argv) {
             case 't':
                 cli_threads = get_int_from_char(optarg);
                 break;
+            case 'x':
+                transport = strdup(optarg);
+                break;
+            case 'n':
+                cli_requests = get_int_from_char(optarg);
+                break;
+            case 'P':
+                cli_pipeline = get_int_from_char(optarg);
+                break;
+            case 'T':
+                cli_trace = 1;
+                break;
+            case 'r':
+                cli_rate = get_int_from_char(optarg);
+                break;
+            case 'R':
+                cli_read_pct = get_int_from_char(optarg);
+                break;
+            case 'k':
+                cli_keys = get_int_from_char(optarg);
+                break;
+            case 'z':
+                cli_zipf = strtod(optarg, NULL);
+                break;
+            case 'v':
+                cli_value = strtoll(optarg, NULL, 10);
+                break;
+            case 'e':
+                cli_expected = strtoll(optarg, NULL, 10);
+                break;
+            case 'K':
+                cli_key = strdup(optarg);
+                break;
             default:
                 // any other option causes failure after printing usage
                 fprintf(stderr, 
-                        "usage: %s --ip IP --port PORT --mode writer/reader --threads 100\n", argv[0]);
+                        "usage: %s --ip IP --port PORT --mode writer/reader/mixed --threads 100 [--transport tcp/unix]\n"
+                        "          [--requests N] [--pipeline N] [--trace] [--rate R [--read-pct P]]\n"
+                        "       %s ... --mode get/set/incr/cas/kv [--keys N] [--zipf S] [--key K] [--value N] [--expected N]\n", argv[0], argv[0]);
                 return F_FAILURE;
         }
     }
@@ -177,6 +264,30 @@ int get_cli_args(int argc, char **argv) {
     if (port == F_FAILURE || cli_threads == F_FAILURE) {
         return F_FAILURE;
     }
+    if (cli_requests < 1 || cli_pipeline < 1) {
+        fprintf(stderr, "error: --requests and --pipeline take 1 or more\n");
+        return F_FAILURE;
+    }
+    if (cli_rate < 0 || cli_read_pct < 0 || cli_read_pct > 100) {
+        fprintf(stderr, "error: --rate takes 0 or more, --read-pct 0 to 100\n");
+        return F_FAILURE;
+    }
+    if (cli_rate == 0 && cli_mode != NULL && (strcmp(cli_mode, "mixed") == 0 || strcmp(cli_mode, "kv") == 0)) {
+        fprintf(stderr, "error: --mode %s needs --rate\n", cli_mode);
+        return F_FAILURE;
+    }
+    if (cli_keys < 1 || cli_zipf < 0) {
+        fprintf(stderr, "error: --keys takes 1 or more, --zipf 0 (uniform) or more\n");
+        return F_FAILURE;
+    }
+    if (cli_key != NULL && (cli_key[0] == '\0' || strlen(cli_key) >= KV_KEY_SIZE)) {
+        fprintf(stderr, "error: --key takes a name of 1 to %i bytes\n", KV_KEY_SIZE - 1);
+        return F_FAILURE;
+    }
+    if (cli_rate > 0 && cli_trace) {
+        fprintf(stderr, "error: --trace is for closed-loop runs (no --rate)\n");
+        return F_FAILURE;
+    }
     return F_SUCCESS;
 }
 
@@ -187,11 +298,26 @@ int get_serv_args(int argc, char **argv) {
     struct option serv_options[] = {
         {"port",        required_argument, 0, 'p'},
         {"priority",    required_argument, 0, 'q'},
+        {"transport",   required_argument, 0, 'x'},
+        {"fsync",       required_argument, 0, 'f'},
+        {"fsync-every", required_argument, 0, 'e'},
+        {"data-dir",    required_argument, 0, 'd'},
+        {"snapshot-every", required_argument, 0, 's'},
+        {"rwlock",      required_argument, 0, 'r'},
+        {"read-path",   required_argument, 0, 'R'},
+        {"hold-us",     required_argument, 0, 'H'},
+        {"write-path",  required_argument, 0, 'W'},
+        {"pool-min",    required_argument, 0, 'm'},
+        {"pool-max",    required_argument, 0, 'M'},
+        {"pool-idle-ms", required_argument, 0, 'I'},
+        {"pool-wait-us", required_argument, 0, 'w'},
+        {"kv-shards",   required_argument, 0, 'S'},
+        {"kv-capacity", required_argument, 0, 'C'},
         {0, 0, 0, 0}
     };  // Required server arguments (ip, port and priority)
 
     // Parse through all possible options 
-    while ((op = getopt_long(argc, argv, "p:q:", serv_options, &index)) != -1) {
+    while ((op = getopt_long(argc, argv, "p:q:x:f:e:d:s:r:R:H:W:m:M:I:w:S:C:", serv_options, &index)) != -1) {
         switch (op) {
             case 'p':
                 port = get_int_from_char(optarg);
@@ -199,14 +325,68 @@ int get_serv_args(int argc, char **argv) {
             case 'q':
                 serv_pri = strdup(optarg);
                 break;
+            case 'x':
+                transport = strdup(optarg);
+                break;
+            case 'f':
+                fsync_policy = strdup(optarg);
+                break;
+            case 'e':
+                fsync_every = get_int_from_char(optarg);
+                break;
+            case 'd':
+                data_dir = strdup(optarg);
+                break;
+            case 's':
+                snapshot_every = get_int_from_char(optarg);
+                break;
+            case 'r':
+                rwlock_engine = strdup(optarg);
+                break;
+            case 'R':
+                read_path = strdup(optarg);
+                break;
+            case 'H':
+                hold_us = get_int_from_char(optarg);
+                break;
+            case 'W':
+                write_path = strdup(optarg);
+                break;
+            case 'm':
+                pool_min = get_int_from_char(optarg);
+                break;
+            case 'M':
+                pool_max = get_int_from_char(optarg);
+                break;
+            case 'I':
+                pool_idle_ms = get_int_from_char(optarg);
+                break;
+            case 'w':
+                pool_wait_us = get_int_from_char(optarg);
+                break;
+            case 'S':
+                kv_shards = get_int_from_char(optarg);
+                break;
+            case 'C':
+                kv_capacity = get_int_from_char(optarg);
+                break;
             default:
                 fprintf(stderr, 
-                        "usage: %s --port PORT --priority writer/reader\n", argv[0]);
+                        "usage: %s --port PORT --priority writer/reader [--transport tcp/unix]\n"
+                        "          [--fsync none/records/ms] [--fsync-every N] [--data-dir DIR]"
+                        " [--snapshot-every N]\n"
+                        "          [--rwlock mutex/brlock/phase-fair/ticket] [--read-path lock/seqlock]"
+                        " [--write-path lock/combine]\n          [--hold-us N]"
+                        " [--pool-min N] [--pool-max N] [--pool-idle-ms T] [--pool-wait-us T]\n"
+                        "          [--kv-shards N] [--kv-capacity N]\n",
+                        argv[0]);
                 return F_FAILURE;
         }
     }
 
-    if (port == F_FAILURE || cli_threads == F_FAILURE) {
+    if (port == F_FAILURE || cli_threads == F_FAILURE ||
+        fsync_every == F_FAILURE || snapshot_every == F_FAILURE || hold_us < 0 ||
+        pool_idle_ms < 0 || pool_wait_us < 0 || kv_shards < 1 || kv_capacity < 0) {
         return F_FAILURE;
     }
     return F_SUCCESS;
@@ -215,15 +395,40 @@ int get_serv_args(int argc, char **argv) {
 //-- frees all memory stored for the server / client args
 void free_args() {
     free(ip);
+    free(serv_pri);
+    free(rwlock_engine);
+    free(read_path);
+    free(write_path);
+    free(transport);
+    free(fsync_policy);
+    free(data_dir);
+    free(cli_key);
+    free(cli_zipf_cdf);
+    cli_zipf_cdf = NULL;
     if (cli_threads != 0) {
         free(cli_mode);
     }
 }
 
 
+//-- returns 1 when the processes talk through an AF_UNIX socket (--transport unix)
+int use_unix_socket() {
+    return transport != NULL && strcmp(transport, "unix") == 0;
+}
+
+//-- fills servaddr with the AF_UNIX socket file of port, returns its length
+socklen_t config_unix_addr(struct sockaddr_storage *servaddr, int serv_port) {
+    struct sockaddr_un *unaddr = (struct sockaddr_un *)servaddr;
+
+    memset(servaddr, 0, sizeof(*servaddr));
+    unaddr->sun_family = AF_UNIX;
+    snprintf(unaddr->sun_path, sizeof(unaddr->sun_path), UNIX_PATH_FORMAT, serv_port);
+    return sizeof(*unaddr);
+}
+
 //-- starts up a new socket, returns its fd when success, F_FAILURE otherwise
-int init_socket(struct sockaddr_in *servaddr, int serv_port) {
-    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+int init_socket(struct sockaddr_storage *servaddr, int serv_port) {
+    int sock_fd = socket(use_unix_socket() ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
 
     if (sock_fd < 0) {
         perror_msg("Error creating socket", sock_fd, SOCKET_CLOSED);
@@ -244,9 +449,25 @@ void enable_setsockopt(int serv_sfd) {
     }
 }
 
+//-- sends every small write of a session at once (TCP only): Nagle would hold a
+//   request or a response back until the previous one is acknowledged
+void enable_nodelay(int conn_fd) {
+    const int ENABLE_NODELAY = 1;
+
+    if (!use_unix_socket() &&
+        setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, &ENABLE_NODELAY, sizeof(int)) < 0) {
+        perror("setsockopt(TCP_NODELAY) failed");
+    }
+}
+
 //-- (server only!) bind and listen
-int bind_and_listen(int serv_sfd, struct sockaddr_in *servaddr) {
-    if (bind(serv_sfd, (struct sockaddr *) servaddr, sizeof(*servaddr)) < 0) {
+int bind_and_listen(int serv_sfd, struct sockaddr_storage *servaddr, socklen_t addr_len) {
+    // a socket file left by an earlier run would make bind() fail
+    if (servaddr->ss_family == AF_UNIX) {
+        unlink(((struct sockaddr_un *)servaddr)->sun_path);
+    }
+
+    if (bind(serv_sfd, (struct sockaddr *) servaddr, addr_len) < 0) {
         perror_msg_sr("bind failed", serv_sfd);
         return F_FAILURE;
     }
@@ -261,7 +482,7 @@ int bind_and_listen(int serv_sfd, struct sockaddr_in *servaddr) {
 }
 
 //-- (server only!) aceepts a client and returns the connection fd related to it
-int accept_client(int serv_sfd, struct sockaddr_in *cliaddr) {
+int accept_client(int serv_sfd, struct sockaddr_storage *cliaddr) {
     socklen_t cliaddr_len = sizeof(*cliaddr);
     int conn_fd = accept(serv_sfd, (struct sockaddr * ) cliaddr, &cliaddr_len);
 
@@ -274,8 +495,8 @@ int accept_client(int serv_sfd, struct sockaddr_in *cliaddr) {
 }
 
 //-- (client only!) tries to connect the client to the server
-int connect_to_server(int cli_sfd, struct sockaddr_in *servaddr) {
-    if (connect(cli_sfd, (struct sockaddr *) servaddr, sizeof(*servaddr)) < 0) {
+int connect_to_server(int cli_sfd, struct sockaddr_storage *servaddr, socklen_t addr_len) {
+    if (connect(cli_sfd, (struct sockaddr *) servaddr, addr_len) < 0) {
         perror_msg_sr("connect error", cli_sfd);
         return F_FAILURE;
     }
@@ -289,6 +510,11 @@ struct request create_req(enum operations action, unsigned int id) {
 
     req.action = action;
     req.id = id;
+    req.req_id = 0;
+    req.flags = 0;
+    memset(req.key, 0, sizeof(req.key));
+    req.value = 0;
+    req.expected = 0;
     return req;
 }
 
@@ -301,6 +527,9 @@ struct response create_resp(enum operations action, unsigned int count, long lat
     resp.action = action;
     resp.counter = count;
     resp.latency_time = lat;
+    resp.req_id = 0;
+    resp.status = F_SUCCESS;
+    resp.value = 0;
     return resp;
 }
 
@@ -314,18 +543,76 @@ enum operations get_action_from_mode() {
     if (strcmp(cli_mode, "writer") == 0) {
         return WRITE;
     }
+    if (strcmp(cli_mode, "get") == 0) {
+        return GET;
+    }
+    if (strcmp(cli_mode, "set") == 0) {
+        return SET;
+    }
+    if (strcmp(cli_mode, "incr") == 0) {
+        return INCR;
+    }
+    if (strcmp(cli_mode, "cas") == 0) {
+        return CAS;
+    }
     return 0;
 }
 
+//-- returns the action of the next request: --mode mixed (kv) draws a READ (GET) or a
+//   WRITE (INCR), cli_read_pct reads out of 100, with seed; the others always have
+//   the same
+enum operations choose_action(unsigned int *seed) {
+    int is_read = ((int)(rand_r(seed) % 100) < cli_read_pct);
+
+    if (strcmp(cli_mode, "mixed") == 0) {
+        return is_read ? READ : WRITE;
+    }
+    if (strcmp(cli_mode, "kv") == 0) {
+        return is_read ? GET : INCR;
+    }
+    return get_action_from_mode();
+}
+
+//-- (client only!) fills the named counter of a GET, SET, INCR or CAS request: cli_key,
+//   or a key of cli_keys drawn with seed (uniform, or Zipf's law with cli_zipf), and
+//   the values
+void fill_kv_req(struct request *req, unsigned int *seed) {
+    double u;
+    long key;
+
+    if (req->action < GET) {
+        return;     // (holy_counter)
+    }
+    req->value = cli_value;
+    req->expected = cli_expected;
+    if (cli_key != NULL) {
+        strncpy(req->key, cli_key, sizeof(req->key) - 1);     // (--key: always the same one)
+        return;
+    }
+    u = ((double)rand_r(seed) * ((double)RAND_MAX + 1) + rand_r(seed)) /
+        (((double)RAND_MAX + 1) * ((double)RAND_MAX + 1));      // uniform in [0, 1)
+    key = (cli_zipf_cdf != NULL) ? kv_zipf_pick(cli_zipf_cdf, cli_keys, u) : (long)(u * cli_keys);
+    snprintf(req->key, sizeof(req->key), "key:%li", key);
+}
+
 //-- converts an action to a readable string
 char *action_to_str(enum operations action) {
-    if (action == READ) {
-        return "Lector";
+    switch (action) {
+        case READ:
+            return "Lector";
+        case WRITE:
+            return "Escritor";
+        case GET:
+            return "Consulta";
+        case SET:
+            return "Asignacion";
+        case INCR:
+            return "Incremento";
+        case CAS:
+            return "CAS";
+        default:
+            return "Saboteador";
     }
-    if (action == WRITE) {
-        return "Escritor";
-    }
-    return "Saboteador";
 }
 
 //-- returns the latency calculated from beginning to ending (in nanoseconds)
@@ -341,10 +628,81 @@ long get_latency(const struct timespec *beginning, const struct timespec *ending
     return lat_sec * 1000000000 + lat_nano;
 }
 
+//-- CLOCK_MONOTONIC in nanoseconds (what a trace holds)
+long now_ns() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+//-- returns how long a request spent in stage (see trace_stages)
+long trace_span(const struct trace *tr, enum trace_stages stage) {
+    switch (stage) {
+        case STAGE_QUEUE:
+            return tr->dequeue_ns - tr->accept_ns;
+        case STAGE_LOCK_WAIT:
+            return tr->acquired_ns - tr->lock_wait_ns;
+        case STAGE_HOLD:
+            return tr->cs_done_ns - tr->acquired_ns;
+        case STAGE_COMMIT:
+            return tr->committed_ns - tr->cs_done_ns;
+        case STAGE_REPLY:
+            return tr->sent_ns - tr->committed_ns;
+        case STAGE_TOTAL:
+            return tr->sent_ns - tr->received_ns;
+        default:
+            return 0;
+    }
+}
+
+
+//-- (threads!) sends the len bytes of buf (send() may take only part of them); no
+//   SIGPIPE if the peer left, F_FAILURE instead
+int send_all(int conn_fd, const void *buf, size_t len) {
+    const char *bytes = buf;
+    ssize_t sent;
+
+    while (len > 0) {
+        sent = send(conn_fd, bytes, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0) {
+            return F_FAILURE;
+        }
+        bytes += sent;
+        len -= sent;
+    }
+    return F_SUCCESS;
+}
+
+//-- (threads!) receives len bytes into buf: a session's stream may split a struct
+//   (or bring several at once), F_CONN_CLOSE if the peer closed before the first byte
+int recv_all(int conn_fd, void *buf, size_t len) {
+    char *bytes = buf;
+    size_t got = 0;
+    ssize_t received;
+
+    while (got < len) {
+        received = recv(conn_fd, bytes + got, len - got, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0) {
+            return F_FAILURE;
+        }
+        if (received == 0) {
+            return (got == 0) ? F_CONN_CLOSE : F_FAILURE;
+        }
+        got += received;
+    }
+    return F_SUCCESS;
+}
 
 //-- (threads!) sends a struct REQUEST via the connection indicated by conn_fd
 int send_req_through(int conn_fd, struct request *req) {
-    if (send(conn_fd, req, sizeof(struct request), 0) < 0) {
+    if (send_all(conn_fd, req, sizeof(struct request)) == F_FAILURE) {
         perror("send failed");
         return F_FAILURE;
     }
@@ -353,10 +711,7 @@ int send_req_through(int conn_fd, struct request *req) {
 
 //-- (threads!) sends a struct RESPONSE via the connection indicated by conn_fd
 int send_resp_through(int conn_fd, struct response *resp) {
-    ssize_t sent;
-
-    sent = send(conn_fd, resp, sizeof(struct response), 0);
-    if (sent < 0) {
+    if (send_all(conn_fd, resp, sizeof(struct response)) == F_FAILURE) {
         perror("send failed");
         return F_FAILURE;
     }
@@ -364,239 +719,475 @@ int send_resp_through(int conn_fd, struct response *resp) {
     return F_SUCCESS;
 }
 
+//-- (threads!) sends the TRACE of a request (after its response)
+int send_trace_through(int conn_fd, struct trace *tr) {
+    if (send_all(conn_fd, tr, sizeof(struct trace)) == F_FAILURE) {
+        perror("send failed");
+        return F_FAILURE;
+    }
+    return F_SUCCESS;
+}
+
 //-- (threads!) blocks until a REQUEST is received
 int receive_req(int conn_fd, struct request *req) {
-    int bytes_received = recv(conn_fd, req, sizeof(struct request), 0);
+    int status = recv_all(conn_fd, req, sizeof(struct request));
 
-    if (bytes_received < 0) {
+    if (status == F_FAILURE) {
         perror("[!] recv failed");
-        return F_FAILURE;
     }
-
-    if (bytes_received == 0) {
-        return F_CONN_CLOSE;
-    }
-
-    return F_SUCCESS;
+    return status;
 }
 
 //-- (threads!) blocks until a RESPONSE is received
 int receive_resp(int conn_fd, struct response *resp) {
-    int bytes_received = recv(conn_fd, resp, sizeof(struct response), 0);
+    int status = recv_all(conn_fd, resp, sizeof(struct response));
 
-    if (bytes_received < 0) {
+    if (status == F_FAILURE) {
         perror("[!] recv failed");
-        return F_FAILURE;
     }
+    return status;
+}
+
+//-- (threads!) blocks until the TRACE that follows a response is received
+int receive_trace(int conn_fd, struct trace *tr) {
+    int status = recv_all(conn_fd, tr, sizeof(struct trace));
 
-    if (bytes_received == 0) {
-        return F_CONN_CLOSE;
+    if (status == F_FAILURE) {
+        perror("[!] recv failed");
     }
+    return status;
+}
 
-    return F_SUCCESS;
+
+//-- sleeps hold_us/2 to hold_us in the critical section (75 to 150 ms by default)
+void hold_critical_section() {
+    if (hold_us > 0) {
+        usleep((rand() % (hold_us - hold_us / 2 + 1)) + hold_us / 2);
+    }
 }
 
+//-- (the log's syncer only!) publishes the counter left by the record lsn, once it
+//   committed, to the seqlock READs: they never see a write the log may still lose
+void publish_counter(uint64_t lsn, int64_t hc) {
+    rw_seq_write_begin(counter_lock);
+    atomic_store_explicit(&pub_counter, hc, memory_order_relaxed);
+    rw_seq_write_end(counter_lock);
+}
 
-//-- function called from a server thread to read a protected value
-int do_read(int reader_id) {
-    int loc_hc;
-    char rbuff[RW_BUFFER_SIZE];
-    FILE *server_output;
+//-- function called from a server thread to read a protected value into value (tr
+//   gets when it waited, entered and left), F_FAILURE if the write that left it
+//   never committed
+int do_read(int reader_id, int64_t *value, struct trace *tr) {
+    int64_t loc_hc;
+    uint64_t loc_lsn;
+    unsigned int seq;
     struct timespec now;
-
-    pthread_mutex_lock(&rw_mutex);      // crit reader entrance -{
-    // wait if (there are writers inside OR there are writers waiting and they have priority)
-    while (writer_in != 0 || (writers_waiting > 0 && strcmp(serv_pri, "writer") == 0)) {
-        pthread_cond_wait(&r_cond, &rw_mutex);
+    int status;
+
+    tr->lock_wait_ns = now_ns();
+    if (seqlock_reads) {
+        // no lock: copies the last committed value, again if one was published meanwhile
+        do {                                                // READ -r-{
+            seq = rw_seq_read_begin(counter_lock);
+            loc_hc = atomic_load_explicit(&pub_counter, memory_order_relaxed);
+        } while (rw_seq_read_retry(counter_lock, seq));     // }-r- READ
+        tr->acquired_ns = now_ns();     // (the retries were its wait)
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        fprintf(stdout, "[%li.%li][LECTOR %i] lee contador con valor %lli\n", now.tv_sec, now.tv_nsec, reader_id, (long long)loc_hc);
+        hold_critical_section();    // (holding nothing)
+        tr->cs_done_ns = tr->committed_ns = now_ns();    // (committed already)
+
+        *value = loc_hc;
+        return F_SUCCESS;
     }
-    readers_in++;
-    pthread_mutex_unlock(&rw_mutex);    // }- crit reader entrance
+
+    rw_read_lock(counter_lock);         // crit reader entrance -{}-
+    tr->acquired_ns = now_ns();
 
     // ## CRITICAL REGION ##
-    server_output = fopen("server_output.txt" ,"r");        // READ -r-{
-    if (fgets(rbuff, sizeof(rbuff), server_output) != NULL) {
-        loc_hc = strtol(rbuff, NULL, 10);
-    } else {
-        loc_hc = -1;
-    }
-    fclose(server_output);                                  // }-r- READ
+    loc_hc = holy_counter;                                  // READ -r-{
+    loc_lsn = wal_last_lsn();   // (the write that left it)    }-r- READ
     // ## EOCR ##
     
     clock_gettime(CLOCK_MONOTONIC, &now);
-    fprintf(stdout, "[%li.%li][LECTOR %i] lee contador con valor %i\n", now.tv_sec, now.tv_nsec, reader_id, loc_hc);
-    usleep((rand() % (150000 - 75000 + 1)) + 75000);
+    fprintf(stdout, "[%li.%li][LECTOR %i] lee contador con valor %lli\n", now.tv_sec, now.tv_nsec, reader_id, (long long)loc_hc);
+    hold_critical_section();
 
-    pthread_mutex_lock(&rw_mutex);      // }- crit reader exit
-    readers_in--;
-    if (readers_in == 0) {
-        pthread_cond_signal(&w_cond);
-    }
-    pthread_mutex_unlock(&rw_mutex);    // }- crit reader entrance
-    return loc_hc;
+    rw_read_unlock(counter_lock);       // crit reader exit -{}-
+    tr->cs_done_ns = now_ns();
+
+    *value = loc_hc;
+    status = wal_wait(loc_lsn);     // only committed values are answered
+    tr->committed_ns = now_ns();
+    return status;
 }
 
-//-- function called from a server thread to overwrite a protected value
-int do_write(int writer_id) {
-    int loc_hc;
-    char wbuff[RW_BUFFER_SIZE];
-    FILE *server_output;
+// a WRITE handed to the combiner (its arg points to it)
+struct write_op {
+    int writer_id;
+    struct trace *tr;
+};
+
+#define write_op_of(arg) ((struct write_op *)(intptr_t)(arg))
+
+//-- (combiner!) applies n WRITEs (args: their struct write_op) in one exclusive
+//   section, the writers get their own value each (and the record that left it)
+void apply_writes(int n, const int64_t *args, int64_t *results, uint64_t *lsns) {
     struct timespec now;
+    long acquired_ns, cs_done_ns;
+    int i;
 
-    pthread_mutex_lock(&rw_mutex);      // crit writer entrance -{
-    // wait if (there are writers or readers inside OR there are readers waiting and they have priority)
-    while (writer_in != 0 || readers_in != 0 || (readers_waiting > 0 && strcmp(serv_pri, "reader") == 0)) {
-        pthread_cond_wait(&w_cond, &rw_mutex);
-    }
-    writer_in++;
-    pthread_mutex_unlock(&rw_mutex);    // }- crit writer entrance
+    rw_write_lock(counter_lock);        // crit writer entrance -{}-
+    acquired_ns = now_ns();
 
     // ## CRITICAL REGION ##
-    server_output = fopen("server_output.txt", "r+");       // WRITE -w-{
-    if (fgets(wbuff, sizeof(wbuff), server_output) != NULL) {
-        loc_hc = strtol(wbuff, NULL, 10);
-    } else {
-        loc_hc = -1;
+    for (i = 0; i < n; i++) {
+        results[i] = ++holy_counter;                        // WRITE -w-{
+        lsns[i] = wal_append(results[i]);   // (in order)      }-w- WRITE
+    }
+    // ## EOCR ##
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (i = 0; i < n; i++) {
+        fprintf(stdout, "[%li.%li][ESCRITOR #%i] modifica contador con valor %lli\n", now.tv_sec, now.tv_nsec, write_op_of(args[i])->writer_id, (long long)results[i]);
     }
+    hold_critical_section();    // once for the n of them
 
-    loc_hc++;   // increment counter after reading it from file
-    fseek(server_output, 0, SEEK_SET);
-    fprintf(server_output, "%d\n", loc_hc); // write loc_hc to server_output
-    fclose(server_output);                                  // }-w- WRITE
+    rw_write_unlock(counter_lock);      // crit writer exit -{}-
+    cs_done_ns = now_ns();
+    for (i = 0; i < n; i++) {
+        write_op_of(args[i])->tr->acquired_ns = acquired_ns;
+        write_op_of(args[i])->tr->cs_done_ns = cs_done_ns;
+    }
+}
+
+//-- function called from a server thread to overwrite a protected value, leaves the
+//   new one in value (tr gets when it waited, entered and left), F_FAILURE if the log
+//   did not commit it: the client is never told a lost write went through
+int do_write(int writer_id, int64_t *value, struct trace *tr) {
+    int64_t loc_hc;
+    uint64_t loc_lsn;
+    struct timespec now;
+    struct write_op op;
+    int status;
+
+    tr->lock_wait_ns = now_ns();
+    if (write_combiner != NULL) {
+        // whoever combines applies ours along with the others waiting
+        op.writer_id = writer_id;
+        op.tr = tr;
+        loc_hc = fc_submit(write_combiner, (intptr_t)&op, &loc_lsn);
+        *value = loc_hc;
+        status = (loc_lsn == 0) ? F_FAILURE : wal_wait(loc_lsn);     // (0: never logged)
+        tr->committed_ns = now_ns();
+        return status;
+    }
+
+    rw_write_lock(counter_lock);        // crit writer entrance -{}-
+    tr->acquired_ns = now_ns();
+
+    // ## CRITICAL REGION ##
+    loc_hc = ++holy_counter;                                // WRITE -w-{
+    loc_lsn = wal_append(loc_hc);   // (in the order written)  }-w- WRITE
     // ## EOCR ##
 
     clock_gettime(CLOCK_MONOTONIC, &now);
-    fprintf(stdout, "[%li.%li][ESCRITOR #%i] modifica contador con valor %i\n", now.tv_sec, now.tv_nsec, writer_id, loc_hc);
-    usleep((rand() % (150000 - 75000 + 1)) + 75000);
-
-    pthread_mutex_lock(&rw_mutex);      // crit writer exit -{
-    writer_in = 0;
-    pthread_cond_broadcast(&r_cond);
-    pthread_cond_signal(&w_cond);
-    pthread_mutex_unlock(&rw_mutex);    // }- crit writer exit
-    return loc_hc;
-}
-
-//-- action determinates the waiter type (r/w) and io_wait the direction (to wait / to go)
-void waiting_room(enum operations action, int io) {
-    if (action == READ) {
-        if (io == WR_IN) {              // reader enters the waiting room
-            pthread_mutex_lock(&rwait_mutex);
-            readers_waiting++;
-            pthread_mutex_unlock(&rwait_mutex);
-        } else if (io == WR_OUT) {      // reader leaves the waiting room
-            pthread_mutex_lock(&rwait_mutex);
-            readers_waiting--;
-            pthread_mutex_unlock(&rwait_mutex);
-        }
-    } else if (action == WRITE) {
-        if (io == WR_IN) {              // writer enters the waiting room
-            pthread_mutex_lock(&wwait_mutex);
-            writers_waiting++;
-            pthread_mutex_unlock(&wwait_mutex);
-        } else if (io == WR_OUT) {      // writer leaves the waiting room
-            pthread_mutex_lock(&wwait_mutex);
-            writers_waiting--;
-            pthread_mutex_unlock(&wwait_mutex);
+    fprintf(stdout, "[%li.%li][ESCRITOR #%i] modifica contador con valor %lli\n", now.tv_sec, now.tv_nsec, writer_id, (long long)loc_hc);
+    hold_critical_section();
+
+    rw_write_unlock(counter_lock);      // crit writer exit -{}-
+    tr->cs_done_ns = now_ns();
+
+    // outside the lock: the writers behind commit in the same group
+    *value = loc_hc;
+    status = (loc_lsn == 0) ? F_FAILURE : wal_wait(loc_lsn);     // (0: never logged)
+    tr->committed_ns = now_ns();
+    return status;
+}
+
+//-- function called from a server thread to run a GET, SET, INCR or CAS on the named
+//   counter of req (in memory: the log keeps holy_counter only), leaves in value what
+//   it holds after it, returns F_FAILURE for a missing GET, a failed CAS or a new key
+//   the table had no room for
+int do_kv(const struct request *req, int64_t *value, struct trace *tr) {
+    char key[KV_KEY_SIZE];
+    int status = F_SUCCESS;
+
+    memcpy(key, req->key, KV_KEY_SIZE);
+    key[KV_KEY_SIZE - 1] = '\0';       // (whatever the client sent)
+    *value = 0;
+
+    // (the shard's lock is taken inside kv.c: its wait counts as hold)
+    tr->lock_wait_ns = tr->acquired_ns = now_ns();
+    switch (req->action) {
+        case GET:
+            status = kv_get(counters, key, value);
+            break;
+        case SET:
+            status = kv_set(counters, key, req->value);
+            *value = (status == F_SUCCESS) ? req->value : 0;
+            break;
+        case INCR:
+            status = kv_incr(counters, key, req->value, value);
+            break;
+        case CAS:
+            status = kv_cas(counters, key, req->expected, req->value, value);
+            break;
+        default:
+            status = F_FAILURE;
+    }
+    tr->cs_done_ns = tr->committed_ns = now_ns();
+    DEBUG_PRINTF("[%s] %s -> %lli (%i)\n", action_to_str(req->action), key, (long long)*value, status);
+    return status;
+}
+
+//-- (server only!) creates the table of named counters, its shards behind locks of
+//   the --rwlock engine
+int create_counters() {
+    int engine = rw_engine_from_name((rwlock_engine != NULL) ? rwlock_engine : "mutex");
+
+    counters = kv_create(kv_shards, kv_capacity, engine);
+    return (counters != NULL) ? F_SUCCESS : F_FAILURE;
+}
+
+//-- (server only!) creates the histograms of the request stages
+int create_stage_hists() {
+    int i;
+
+    for (i = 0; i < TRACE_STAGES; i++) {
+        stage_hists[i] = hist_create();
+        if (stage_hists[i] == NULL) {
+            return F_FAILURE;
         }
     }
+    return F_SUCCESS;
+}
+
+//-- (server threads!) adds the stages of a request to their histograms (its queue
+//   only for the first request of a connection)
+void account_trace(const struct trace *tr, int first) {
+    int i;
+
+    for (i = first ? STAGE_QUEUE : STAGE_QUEUE + 1; i < TRACE_STAGES; i++) {
+        hist_add(stage_hists[i], trace_span(tr, i));
+    }
+}
+
+//-- (server only!) prints where the requests spent their time (on exit)
+void report_stages() {
+    int i;
+
+    if (stage_hists[STAGE_TOTAL] == NULL || hist_count(stage_hists[STAGE_TOTAL]) == 0) {
+        return;
+    }
+    printf("Request stages (us): %10s %10s %10s %10s %10s\n", "count", "mean", "p50 <", "p99 <", "max");
+    for (i = 0; i < TRACE_STAGES; i++) {
+        printf("%19s: %10li %10.1f %10.1f %10.1f %10.1f\n", stage_names[i], hist_count(stage_hists[i]),
+               hist_mean(stage_hists[i]) / 1e3, hist_percentile(stage_hists[i], 500) / 1e3,
+               hist_percentile(stage_hists[i], 990) / 1e3, hist_max(stage_hists[i]) / 1e3);
+    }
 }
 
 //-- (server only!) closes the server socket and terminates with indicated status
 void terminate_server(int exit_status) {
+    struct sockaddr_storage unaddr;
+
+    wal_close();    // what was written reaches the log (and the disk)
+    connq_report();
+    report_stages();
+    pool_report();
+    if (counters != NULL && kv_count(counters) > 0) {
+        printf("Named counters: %li\n", kv_count(counters));
+    }
     sock_status = SOCKET_CLOSED;
     close(sock_sfd);
+    if (use_unix_socket()) {
+        config_unix_addr(&unaddr, port);
+        unlink(((struct sockaddr_un *)&unaddr)->sun_path);
+    }
     free_args();
     exit(exit_status);
 }
 
-//-- (server threads!) waits for a new connection, handles it and closes its fd afterwards
-int *server_handler() {
-    int ccfd, cci, hc;
+//-- (server threads!) answers the requests of a connection the pool took from the
+//   queue (accepted at accept_ns) one after another (a session) until the client
+//   closes it, and closes its fd afterwards; every request is traced, the client
+//   gets its trace if it asked (REQ_TRACE)
+void server_handler(int ccfd, long accept_ns) {
+    int first, status;
     long clat;
+    int64_t value;
     struct request creq;
     struct response cresp;
+    struct trace tr;
     struct timespec lat_beginning, lat_ending;
 
-    while (sock_status == SOCKET_RUNNING) {
-        sem_wait(&conn_sem);    // wait for a new connection
-        DEBUG_PRINTF("_> SEM POST RECEIVED: NEW CONNECTION\n");
-
-        pthread_mutex_lock(&conn_mutex);    // protects conn_cfds[] and conn_index
-        cci = conn_index - 1;
-        ccfd = conn_cfds[cci];
-        conn_cfds[cci] = 0;
-        conn_index--;
-        pthread_mutex_unlock(&conn_mutex);
-
-        creq = create_empty_req();
-        if (receive_req(ccfd, &creq) == F_SUCCESS) {    // ignores 0-byte receives
-            clock_gettime(CLOCK_MONOTONIC, &lat_beginning);     // <> clock beginning
-
-            waiting_room(creq.action, WR_IN);
-
-            // critical access here
-            hc = -1; // if hc remains -1, an error ocurred
-            if (creq.action == READ) {
-                hc = do_read(creq.id);
-            } else if (creq.action == WRITE) {
-                hc = do_write(creq.id);
-            }
-
-            waiting_room(creq.action, WR_OUT);
-
-            clock_gettime(CLOCK_MONOTONIC, &lat_ending);        // <> clock ending
-            clat = get_latency(&lat_beginning, &lat_ending);
-
-            cresp = create_resp(creq.action, hc, clat);
-            send_resp_through(ccfd, &cresp);
+    memset(&tr, 0, sizeof(tr));
+    tr.accept_ns = accept_ns;
+    tr.dequeue_ns = now_ns();
+    DEBUG_PRINTF("_> NEW CONNECTION %i\n", ccfd);
+
+    creq = create_empty_req();
+    for (first = 1; receive_req(ccfd, &creq) == F_SUCCESS; first = 0) {   // ends with 0-byte receives
+        clock_gettime(CLOCK_MONOTONIC, &lat_beginning);     // <> clock beginning
+        tr.received_ns = now_ns();
+
+        // critical access here
+        status = F_FAILURE;     // (an unknown action)
+        value = 0;
+        if (creq.action == READ) {
+            status = do_read(creq.id, &value, &tr);
+        } else if (creq.action == WRITE) {
+            status = do_write(creq.id, &value, &tr);
+        } else if (creq.action < N_OPERATIONS) {
+            status = do_kv(&creq, &value, &tr);
         }
 
-        close(ccfd);    // close connection after handling
+        clock_gettime(CLOCK_MONOTONIC, &lat_ending);        // <> clock ending
+        clat = get_latency(&lat_beginning, &lat_ending);
+
+        cresp = create_resp(creq.action, (unsigned int)value, clat);
+        cresp.req_id = creq.req_id;
+        cresp.status = status;
+        cresp.value = value;
+        tr.sent_ns = now_ns();
+        if (send_resp_through(ccfd, &cresp) == F_FAILURE ||
+            ((creq.flags & REQ_TRACE) && send_trace_through(ccfd, &tr) == F_FAILURE)) {
+            break;  // the client left
+        }
+        account_trace(&tr, first);
     }
-    return NULL;
-}
 
-//-- (server only!) creates a thread pool for the server
-void create_server_thread_pool() {
-    pthread_t threads[MAX_SERVER_THREADS];
-    int pool_index = 0;
+    close(ccfd);    // close connection after handling
+}
 
-    sem_init(&conn_sem, 0, 0);  // initializes connection semaphore
-    while (pool_index < MAX_SERVER_THREADS) {
-        pthread_create(&threads[pool_index], NULL, 
-                        (void*)server_handler, (void*)NULL);
-        pool_index++;
-    }
+//-- (server only!) starts the pool of threads that serve the queued connections:
+//   pool_min of them, up to pool_max while connections wait over pool_wait_us
+int create_server_thread_pool() {
+    connq_init();   // initializes the connection queue
+    return pool_start(pool_min, pool_max, pool_idle_ms * 1000000L, pool_wait_us * 1000L,
+                      server_handler);
 }
 
 //-- (server only!) executes continuously, managing clients as they arrive
 void server_control_loop() {
-    struct sockaddr_in cliaddr;
+    struct sockaddr_storage cliaddr;
     socklen_t cliaddr_len = sizeof(cliaddr);
     int new_cfd;
 
-    create_server_thread_pool();    // thread creation
+    if (create_server_thread_pool() == F_FAILURE) {
+        sock_status = SOCKET_CLOSED;
+        return;
+    }
+    block_sigint(0);                // CTRL+C interrupts accept() from now on
 
     while (sock_status == SOCKET_RUNNING) {
         new_cfd = accept(sock_sfd, (struct sockaddr*)&cliaddr, &cliaddr_len);
 
         if (new_cfd < 0) {
-            perror("accept failed");
+            if (sock_status == SOCKET_RUNNING) {    // not stopped by CTRL+C
+                perror("accept failed");
+            }
             continue;
         } else {
-            pthread_mutex_lock(&conn_mutex);    // L[ conn_mutex ]
-            conn_cfds[conn_index] = new_cfd;
-            conn_index++;
-            pthread_mutex_unlock(&conn_mutex);  // U[ conn_mutex ]
+            enable_nodelay(new_cfd);
+            connq_push(new_cfd);    // advertise new connection (1 thread manages it)
+            pool_notify_push();     // (more threads if nobody is idle to take it)
+        }
+    }
+}
+
+//-- (server only!) returns the counter kept in LEGACY_OUTPUT before the log, 0 if none
+int64_t read_legacy_counter() {
+    char buff[RW_BUFFER_SIZE];
+    int64_t value = 0;
+    FILE *legacy = fopen(LEGACY_OUTPUT, "r");
+
+    if (legacy != NULL) {
+        if (fgets(buff, sizeof(buff), legacy) != NULL) {
+            value = strtoll(buff, NULL, 10);
+        }
+        fclose(legacy);
+    }
+    return value;
+}
+
+//-- (server only!) recovers holy_counter from its log (--data-dir) with the fsync
+//   policy of the options, the legacy file seeds a directory without log
+int open_counter() {
+    enum wal_sync_modes mode = WAL_SYNC_RECORDS;
+    int64_t value = read_legacy_counter();
+
+    if (fsync_policy != NULL && strcmp(fsync_policy, "none") == 0) {
+        mode = WAL_SYNC_NONE;
+    } else if (fsync_policy != NULL && strcmp(fsync_policy, "ms") == 0) {
+        mode = WAL_SYNC_MS;
+    } else if (fsync_policy != NULL && strcmp(fsync_policy, "records") != 0) {
+        fprintf(stderr, "error: unknown fsync policy '%s' (none, records or ms)\n", fsync_policy);
+        return F_FAILURE;
+    }
+
+    if (wal_open((data_dir != NULL) ? data_dir : ".", mode, fsync_every,
+                 snapshot_every, &value) == F_FAILURE) {
+        return F_FAILURE;
+    }
+    holy_counter = value;
+    printf("Counter recovered with value %lli...\n", (long long)holy_counter);
+    return F_SUCCESS;
+}
+
+//-- (server only!) creates counter_lock with the engine of --rwlock (the priority only
+//   matters to "mutex": the other engines have a policy of their own), and sets the
+//   READs' path of --read-path: through it, or lock-free over what the log commits,
+//   and the WRITEs' of --write-path: one by one through it, or combined
+int create_counter_lock() {
+    int engine = rw_engine_from_name((rwlock_engine != NULL) ? rwlock_engine : "mutex");
+    enum rw_priorities priority = RW_PRI_NONE;
+
+    if (engine == F_FAILURE) {
+        fprintf(stderr, "error: unknown rwlock '%s' (mutex, brlock, phase-fair or ticket)\n", rwlock_engine);
+        return F_FAILURE;
+    }
+    if (serv_pri != NULL && strcmp(serv_pri, "writer") == 0) {
+        priority = RW_PRI_WRITER;
+    } else if (serv_pri != NULL && strcmp(serv_pri, "reader") == 0) {
+        priority = RW_PRI_READER;
+    }
 
-            sem_post(&conn_sem);    // advertise new connection (1 thread manages it)
+    if (read_path != NULL && strcmp(read_path, "seqlock") == 0) {
+        seqlock_reads = 1;
+    } else if (read_path != NULL && strcmp(read_path, "lock") != 0) {
+        fprintf(stderr, "error: unknown read path '%s' (lock or seqlock)\n", read_path);
+        return F_FAILURE;
+    }
+
+    counter_lock = rw_create(engine, priority);
+    if (counter_lock == NULL) {
+        return F_FAILURE;
+    }
+    if (write_path != NULL && strcmp(write_path, "combine") == 0) {
+        write_combiner = fc_create(apply_writes);
+        if (write_combiner == NULL) {
+            return F_FAILURE;
         }
+    } else if (write_path != NULL && strcmp(write_path, "lock") != 0) {
+        fprintf(stderr, "error: unknown write path '%s' (lock or combine)\n", write_path);
+        return F_FAILURE;
+    }
+    publish_counter(wal_last_lsn(), holy_counter);  // (no writer yet: the syncer is idle)
+    if (seqlock_reads) {
+        wal_set_commit_hook(publish_counter);
     }
+    DEBUG_PRINTF("Counter protected by the %s lock\n", rw_engine_name(engine));
+    return F_SUCCESS;
 }
 
 //-- (server only!) inits the server with its fd and creates one thread per client
 void start_up_server(int argc, char *argv[]) {
-    struct sockaddr_in servaddr;
+    struct sockaddr_storage servaddr;
+    struct sockaddr_in *inaddr = (struct sockaddr_in *)&servaddr;
+    socklen_t servaddr_len = sizeof(*inaddr);
 
     setbuf(stdout, NULL);
     srand(time(NULL));
@@ -606,30 +1197,41 @@ void start_up_server(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    block_sigint(1);    // the log thread and the pool are created without it
+    if (open_counter() == F_FAILURE || create_counter_lock() == F_FAILURE ||
+        create_counters() == F_FAILURE || create_stage_hists() == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+
     sock_sfd = init_socket(&servaddr, port); // establishes sock_sfd
     if (sock_sfd == F_FAILURE) {
         sock_status = SOCKET_CLOSED;
         exit(EXIT_FAILURE);
     }
 
-    enable_setsockopt(sock_sfd);
+    if (use_unix_socket()) {
+        servaddr_len = config_unix_addr(&servaddr, port);
+    } else {
+        enable_setsockopt(sock_sfd);
 
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    servaddr.sin_port = htons(port);
+        memset(&servaddr, 0, sizeof(servaddr));
+        inaddr->sin_family = AF_INET;
+        inaddr->sin_addr.s_addr = htonl(INADDR_ANY);
+        inaddr->sin_port = htons(port);
+    }
 
-    if (bind_and_listen(sock_sfd, &servaddr) == F_FAILURE) {
+    if (bind_and_listen(sock_sfd, &servaddr, servaddr_len) == F_FAILURE) {
         close(sock_sfd);
         sock_status = SOCKET_CLOSED;
         exit(EXIT_FAILURE);
     }
     
-    signal(SIGINT, handle_sigint);
+    catch_sigint();
 
     // server logic inside server_control_loop()
     server_control_loop();
 
-    terminate_server(EXIT_FAILURE);
+    terminate_server(got_sigint ? STUB_EXIT_SIGINT : EXIT_FAILURE);
 }
 
 
@@ -641,75 +1243,329 @@ void terminate_client(int exit_status) {
     exit(exit_status);
 }
 
-//-- (client only!) configs servaddr struct before launching any client
-int config_servaddr(struct sockaddr_in *servaddr) {
-    servaddr->sin_family = AF_INET;
-    if (inet_pton(AF_INET, ip, &(servaddr->sin_addr)) <= 0) {
+//-- (client only!) configs servaddr struct before launching any client, returns its length
+int config_servaddr(struct sockaddr_storage *servaddr) {
+    struct sockaddr_in *inaddr = (struct sockaddr_in *)servaddr;
+
+    if (use_unix_socket()) {
+        return config_unix_addr(servaddr, port);   // --ip is not needed
+    }
+
+    memset(servaddr, 0, sizeof(*servaddr));
+    inaddr->sin_family = AF_INET;
+    if (inet_pton(AF_INET, ip, &(inaddr->sin_addr)) <= 0) {
         perror_msg_cl("Invalid address / Address not supported");
         return F_FAILURE;
     }
-    servaddr->sin_port = htons(port);
+    inaddr->sin_port = htons(port);
 
-    return F_SUCCESS;
+    return sizeof(*inaddr);
+}
+
+//-- (client only!) prints where its requests spent their time (means of n traces:
+//   span_sums per stage, connect_ns and queue_ns of the connection, net_sum what
+//   the round trips took beyond the server)
+void print_trace_summary(unsigned int my_id, unsigned int n, const long *span_sums,
+                         long connect_ns, long queue_ns, long net_sum) {
+    if (n == 0) {
+        return;
+    }
+    fprintf(stdout, "[Cliente #%i] traza (ns): conexion=%ld, cola=%ld, espera cerrojo=%ld, seccion critica=%ld,"
+            " commit=%ld, respuesta=%ld, servidor=%ld, red=%ld\n", my_id, connect_ns, queue_ns,
+            span_sums[STAGE_LOCK_WAIT] / n, span_sums[STAGE_HOLD] / n, span_sums[STAGE_COMMIT] / n,
+            span_sums[STAGE_REPLY] / n, span_sums[STAGE_TOTAL] / n, net_sum / n);
+}
+
+//-- (client only!) connects the calling client to the server (CONNECT_TRIES times at
+//   most, waiting longer after each failed one) and returns the connection fd, or
+//   F_FAILURE if it could not
+int connect_client(struct client_data *cli_data) {
+    int cli_sfd, tries, backoff_ms = CONNECT_BACKOFF_MS;
+
+    for (tries = 1; ; tries++) {
+        cli_sfd = socket(cli_data->servaddr->ss_family, SOCK_STREAM, 0);
+        if (cli_sfd < 0) {
+            perror("socket creation failed");
+            return F_FAILURE;
+        }
+        DEBUG_PRINTF("    _> CLIENT %u CONNECTING [SFD = %i] \n", cli_data->id, cli_sfd);
+        // (a failed connect_to_server() closes the socket: the next try needs a new one)
+        if (connect_to_server(cli_sfd, cli_data->servaddr, cli_data->servaddr_len) == F_SUCCESS) {
+            break;
+        }
+        if (tries == CONNECT_TRIES) {
+            fprintf(stderr, "[Cliente #%i] sin conexion tras %i intentos\n", cli_data->id, tries);
+            return F_FAILURE;
+        }
+        usleep(backoff_ms * 1000);
+        backoff_ms = (backoff_ms * 2 < CONNECT_BACKOFF_MAX_MS) ? backoff_ms * 2 : CONNECT_BACKOFF_MAX_MS;
+    }
+    DEBUG_PRINTF("        _> CONNECTED TO SERVER...\n");
+    enable_nodelay(cli_sfd);
+    return cli_sfd;
 }
 
-//-- (client only!) contains the inner code of 1 client managed by 1 thread
+//-- (client only!) contains the inner code of 1 client managed by 1 thread: sends
+//   cli_requests over its connection, cli_pipeline of them in flight at most
 int *client_handler(struct client_data *cli_data) {
-    int my_cfd = cli_data->conn_fd, recv_status;
-    unsigned int my_id = cli_data->id;
+    long connect_ns = now_ns();     // (the trace starts at accept(): the client times its connect())
+    int my_cfd = connect_client(cli_data), slot, stage;
+    unsigned int my_id = cli_data->id, sent = 0, received = 0;
+    int64_t last_counter = 0;   // (holy_counter, or the named one of the last response)
+    unsigned int seed = my_id * 2654435761u ^ (unsigned int)time(NULL);
+    unsigned int *in_flight;    // req_id per slot (0: free)
+    struct timespec *sent_at;
+    struct timespec beginning, now;
+    long rtt, rtt_sum = 0, net_sum = 0, queue_ns = 0, span_sums[TRACE_STAGES] = {0};
     struct request creq;
     struct response cresp;
+    struct trace tr;
 
-    pthread_mutex_unlock(&clid_mutex);
+    connect_ns = now_ns() - connect_ns;
+    cli_data->conn_fd = my_cfd;
+    if (my_cfd == F_FAILURE) {
+        return NULL;    // (its requests are never sent)
+    }
+    in_flight = calloc(cli_pipeline, sizeof(unsigned int));
+    sent_at = calloc(cli_pipeline, sizeof(struct timespec));
+    if (in_flight == NULL || sent_at == NULL) {
+        perror("calloc failed");
+        exit(EXIT_FAILURE);
+    }
 
-    creq = create_req(get_action_from_mode(), my_id);    
-    send_req_through(my_cfd, &creq);
+    clock_gettime(CLOCK_MONOTONIC, &beginning);
+    while (received < (unsigned int)cli_requests) {
+        // fills the pipeline: the server reads them while we wait for the first answer
+        for (slot = 0; slot < cli_pipeline && sent < (unsigned int)cli_requests; slot++) {
+            if (in_flight[slot] != 0) {
+                continue;
+            }
+            creq = create_req(get_action_from_mode(), my_id);
+            fill_kv_req(&creq, &seed);
+            creq.req_id = ++sent;
+            creq.flags = cli_trace ? REQ_TRACE : 0;
+            in_flight[slot] = creq.req_id;
+            clock_gettime(CLOCK_MONOTONIC, &sent_at[slot]);
+            if (send_req_through(my_cfd, &creq) == F_FAILURE) {
+                break;
+            }
+        }
 
-    cresp = create_empty_resp();
-    recv_status = receive_resp(my_cfd, &cresp);
-    while (recv_status != F_SUCCESS) {
-        recv_status = receive_resp(my_cfd, &cresp);
+        cresp = create_empty_resp();
+        if (receive_resp(my_cfd, &cresp) != F_SUCCESS) {
+            fprintf(stderr, "[Cliente #%i] conexion cerrada con %u peticiones sin respuesta\n",
+                    my_id, sent - received);
+            break;
+        }
+        for (slot = 0; slot < cli_pipeline && in_flight[slot] != cresp.req_id; slot++) {
+        }
+        if (cresp.req_id == 0 || slot == cli_pipeline) {
+            fprintf(stderr, "[Cliente #%i] respuesta a una peticion desconocida (%u)\n", my_id, cresp.req_id);
+            break;
+        }
+        if (cli_trace && receive_trace(my_cfd, &tr) != F_SUCCESS) {
+            fprintf(stderr, "[Cliente #%i] conexion cerrada antes de la traza\n", my_id);
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        rtt = get_latency(&sent_at[slot], &now);
+        rtt_sum += rtt;
+        if (cli_trace) {
+            for (stage = 0; stage < TRACE_STAGES; stage++) {
+                span_sums[stage] += trace_span(&tr, stage);
+            }
+            queue_ns = trace_span(&tr, STAGE_QUEUE);    // (the same in all of them)
+            net_sum += rtt - trace_span(&tr, STAGE_TOTAL);
+        }
+        in_flight[slot] = 0;
+        last_counter = cresp.value;
+        received++;
+
+        if (cli_requests == 1) {
+            if (creq.action >= GET) {
+                fprintf(stdout, "[Cliente #%i] %s %s, valor=%lli%s, tiempo=%ld ns\n", my_id, action_to_str(creq.action),
+                        creq.key, (long long)cresp.value, (cresp.status == F_SUCCESS) ? "" : " (fallida)", cresp.latency_time);
+            } else {
+                fprintf(stdout, "[Cliente #%i] %s, contador=%lli%s, tiempo=%ld ns\n", my_id, action_to_str(creq.action),
+                        (long long)cresp.value, (cresp.status == F_SUCCESS) ? "" : " (fallida)", cresp.latency_time);
+            }
+        }
     }
 
-    fprintf(stdout, "[Cliente #%i] %s, contador=%i, tiempo=%ld ns\n", my_id, action_to_str(creq.action), cresp.counter, cresp.latency_time);
+    if (cli_requests > 1) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        fprintf(stdout, "[Cliente #%i] %s, %u peticiones, ultimo contador=%lli, %.0f peticiones/s, ida y vuelta media=%ld ns\n",
+                my_id, action_to_str(get_action_from_mode()), received, (long long)last_counter,
+                received / (get_latency(&beginning, &now) / 1e9), (received > 0) ? rtt_sum / received : 0);
+    }
+    if (cli_trace) {
+        print_trace_summary(my_id, received, span_sums, connect_ns, queue_ns, net_sum);
+    }
 
+    free(in_flight);
+    free(sent_at);
     close(my_cfd);
     return NULL;
 }
 
-//-- creates a thread pool and then launches 1 new client per thread
-void launch_n_clients(struct sockaddr_in *servaddr) {
-    int launched = 0, *cli_sfds = malloc(cli_threads * sizeof(int));
-    pthread_t *clients = malloc(cli_threads * sizeof(pthread_t));
-    struct client_data cli_data;
+//-- (client only!) open loop: takes the responses of conn as they come, adding
+//   their latencies to load_latency and load_service
+void *load_receiver(struct load_conn *conn) {
+    struct response cresp;
+    unsigned int req;
 
-    DEBUG_PRINTF("_> INSIDE LAUNCH N CLIENTS...\n");
-    if (cli_sfds == NULL) {
+    while (conn->received < conn->n) {
+        if (receive_resp(conn->conn_fd, &cresp) != F_SUCCESS) {
+            fprintf(stderr, "[Cliente #%i] conexion cerrada con %u peticiones sin respuesta\n",
+                    conn->id, conn->n - conn->received);
+            break;
+        }
+        req = cresp.req_id - 1;
+        if (cresp.req_id == 0 || req >= conn->n) {
+            fprintf(stderr, "[Cliente #%i] respuesta a una peticion desconocida (%u)\n", conn->id, cresp.req_id);
+            break;
+        }
+        // (the sender wrote them before the send that got this response)
+        hist_add(load_latency[conn->actions[req]], now_ns() - conn->intended_ns[req]);
+        hist_add(load_service[conn->actions[req]], now_ns() - conn->sent_ns[req]);
+        conn->received++;
+    }
+    return NULL;
+}
+
+//-- (client only!) open loop: sends cli_requests at cli_rate / cli_threads requests/s
+//   whatever the server answers (the responses are taken by load_receiver), and
+//   measures each from when the schedule said to send it: a stalled server delays
+//   the requests behind, and they count it
+int *load_handler(struct client_data *cli_data) {
+    struct load_conn conn;
+    struct request creq;
+    struct timespec wake;
+    pthread_t receiver;
+    unsigned int seed = cli_data->id * 2654435761u ^ (unsigned int)time(NULL);
+    long period_ns = 1000000000L * cli_threads / cli_rate, intended;
+
+    creq = create_empty_req();
+    conn.conn_fd = connect_client(cli_data);
+    if (conn.conn_fd == F_FAILURE) {
+        exit(EXIT_FAILURE);     // (the others would wait for it at load_barrier)
+    }
+    conn.id = cli_data->id;
+    conn.n = cli_requests;
+    conn.received = 0;
+    conn.actions = malloc(conn.n * sizeof(enum operations));
+    conn.intended_ns = malloc(conn.n * sizeof(long));
+    conn.sent_ns = malloc(conn.n * sizeof(long));
+    if (conn.actions == NULL || conn.intended_ns == NULL || conn.sent_ns == NULL) {
         perror("malloc failed");
         exit(EXIT_FAILURE);
     }
-    if (clients == NULL) {
+    cli_data->conn_fd = conn.conn_fd;
+    pthread_create(&receiver, NULL, (void*)load_receiver, (void*)&conn);
+
+    // everybody connected: one of them sets the start
+    if (pthread_barrier_wait(&load_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+        load_start_ns = now_ns();
+    }
+    pthread_barrier_wait(&load_barrier);
+
+    for (creq.req_id = 1; creq.req_id <= conn.n; creq.req_id++) {
+        // the clients take turns: the sends of all of them are cli_rate per second
+        intended = load_start_ns + (long)(creq.req_id - 1) * period_ns +
+                   period_ns * (long)(conn.id - 1) / cli_threads;
+        wake.tv_sec = intended / 1000000000L;
+        wake.tv_nsec = intended % 1000000000L;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR) {
+        }
+
+        creq.action = choose_action(&seed);
+        creq.id = conn.id;
+        creq.flags = 0;
+        fill_kv_req(&creq, &seed);
+        conn.actions[creq.req_id - 1] = creq.action;
+        conn.intended_ns[creq.req_id - 1] = intended;
+        conn.sent_ns[creq.req_id - 1] = now_ns();   // (late if the send before blocked)
+        atomic_fetch_add(&load_late_ns, conn.sent_ns[creq.req_id - 1] - intended);
+        if (send_req_through(conn.conn_fd, &creq) == F_FAILURE) {
+            shutdown(conn.conn_fd, SHUT_RDWR);      // (the receiver stops too)
+            break;
+        }
+    }
+
+    pthread_join(receiver, NULL);
+    free(conn.actions);
+    free(conn.intended_ns);
+    free(conn.sent_ns);
+    close(conn.conn_fd);
+    return NULL;
+}
+
+//-- (client only!) creates the histograms of the open loop
+void create_load_hists() {
+    int i;
+
+    for (i = 0; i < N_OPERATIONS; i++) {
+        load_latency[i] = hist_create();
+        load_service[i] = hist_create();
+        if (load_latency[i] == NULL || load_service[i] == NULL) {
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+//-- (client only!) prints the latencies of the open loop by action, once for all the
+//   clients (elapsed_ns: from the start to the last response)
+void report_load(long elapsed_ns) {
+    enum operations action;
+    long answered = 0;
+
+    for (action = WRITE; action < N_OPERATIONS; action++) {
+        answered += hist_count(load_latency[action]);
+    }
+
+    fprintf(stdout, "Carga abierta: %i peticiones/s pedidas, %.0f respondidas/s, retraso medio de envio=%.1f us\n",
+            cli_rate, answered / (elapsed_ns / 1e9),
+            (answered > 0) ? atomic_load(&load_late_ns) / 1e3 / answered : 0);
+    fprintf(stdout, "%10s %10s %10s %10s %10s %10s %10s %14s\n", "(us)", "peticiones", "p50 <", "p90 <",
+            "p99 <", "p99.9 <", "max", "p99 servicio <");
+    for (action = WRITE; action < N_OPERATIONS; action++) {
+        if (hist_count(load_latency[action]) == 0) {
+            continue;
+        }
+        fprintf(stdout, "%10s %10li %10.1f %10.1f %10.1f %10.1f %10.1f %14.1f\n", action_to_str(action),
+                hist_count(load_latency[action]), hist_percentile(load_latency[action], 500) / 1e3,
+                hist_percentile(load_latency[action], 900) / 1e3, hist_percentile(load_latency[action], 990) / 1e3,
+                hist_percentile(load_latency[action], 999) / 1e3, hist_max(load_latency[action]) / 1e3,
+                hist_percentile(load_service[action], 990) / 1e3);
+    }
+}
+
+//-- launches 1 new client per thread (each connects on its own), closed loop or
+//   open loop (--rate), and waits for them
+void launch_n_clients(struct sockaddr_storage *servaddr, socklen_t servaddr_len) {
+    int launched = 0;
+    struct client_data *cli_data = malloc(cli_threads * sizeof(struct client_data));
+    pthread_t *clients = malloc(cli_threads * sizeof(pthread_t));
+
+    DEBUG_PRINTF("_> INSIDE LAUNCH N CLIENTS...\n");
+    if (cli_data == NULL || clients == NULL) {
         perror("malloc failed");
         exit(EXIT_FAILURE);
     }
+    if (cli_rate > 0) {
+        create_load_hists();
+        pthread_barrier_init(&load_barrier, NULL, cli_threads);
+    }
 
     while (launched < cli_threads) {
-        cli_sfds[launched] = socket(AF_INET, SOCK_STREAM, 0);
-        DEBUG_PRINTF("    _> INSIDE WHILE LOOP: [CLI_SFDS[%i] = %i] \n", launched, cli_sfds[launched]);
-        
-        if (connect_to_server(cli_sfds[launched], servaddr) == F_SUCCESS) {
-            DEBUG_PRINTF("        _> CONNECTED TO SERVER...\n");
-            pthread_mutex_lock(&clid_mutex);
-            cli_data.conn_fd = cli_sfds[launched];
-            cli_data.id = launched + 1;
-            pthread_create(&clients[launched], NULL, 
-                            (void*)client_handler, (void*)&cli_data);
-            DEBUG_PRINTF("        _> PTHREAD CREATE CLEAR WITH [LAUNCHED=%i++]\n", launched);
-            launched++;
-        } else {
-            DEBUG_PRINTF("        _> -- CONTINUE -- \n");
-            continue;
-        }
+        // its own client_data: the thread reads it whenever it starts
+        cli_data[launched].id = launched + 1;
+        cli_data[launched].servaddr = servaddr;
+        cli_data[launched].servaddr_len = servaddr_len;
+        pthread_create(&clients[launched], NULL, (cli_rate > 0) ? (void*)load_handler : (void*)client_handler,
+                       (void*)&cli_data[launched]);
+        DEBUG_PRINTF("        _> PTHREAD CREATE CLEAR WITH [LAUNCHED=%i++]\n", launched);
+        launched++;
     }
 
     // wait for all threads
@@ -717,12 +1573,19 @@ void launch_n_clients(struct sockaddr_in *servaddr) {
         launched--;
 		pthread_join(clients[launched], NULL);
     }
+    if (cli_rate > 0) {
+        report_load(now_ns() - load_start_ns);
+        pthread_barrier_destroy(&load_barrier);
+    }
+    free(cli_data);
+    free(clients);
     DEBUG_PRINTF("_> ...END OF LAUNCH N CLIENTS\n");
 }
 
 //-- (client only!) inits the client with its fd and creates a receiver thread
 void start_up_client(int argc, char *argv[]) {
-    struct sockaddr_in servaddr;
+    struct sockaddr_storage servaddr;
+    int servaddr_len;
 
     setbuf(stdout, NULL);
 
@@ -731,11 +1594,15 @@ void start_up_client(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    if (config_servaddr(&servaddr) == F_FAILURE) {
+    servaddr_len = config_servaddr(&servaddr);
+    if (servaddr_len == F_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+    if (cli_zipf > 0 && (cli_zipf_cdf = kv_zipf_cdf(cli_keys, cli_zipf)) == NULL) {
         exit(EXIT_FAILURE);
     }
 
-    launch_n_clients(&servaddr);
+    launch_n_clients(&servaddr, servaddr_len);
 
     terminate_client(EXIT_SUCCESS);
 }
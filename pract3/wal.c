@@ -0,0 +1,432 @@
+#include "./wal.h"
+#include <pthread.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <time.h>
+
+
+#define WAL_DIR_LEN         256     // longest --data-dir
+#define WAL_PATH_LEN        320     // a file inside it
+#define WAL_READ_RECORDS    256     // records read at once while recovering
+
+
+// GLOBAL VARIABLES:
+char wal_dir[WAL_DIR_LEN];
+int wal_fd              = -1;       // the log, opened O_APPEND (syncer only once open)
+enum wal_sync_modes wal_mode = WAL_SYNC_RECORDS;
+long wal_every          = 1;        // N records (WAL_SYNC_RECORDS) or T ms (WAL_SYNC_MS)
+long wal_snap_every     = WAL_SNAP_EVERY;
+
+    // group commit (mutex_wal)
+struct wal_record *wal_group = NULL;    // appended, waiting for the next group commit
+struct wal_record *wal_spare = NULL;    // the syncer writes it meanwhile
+int wal_group_len       = 0;
+uint64_t wal_next_lsn   = 1;
+uint64_t wal_done_lsn   = 0;        // written (and synced when the policy says so)
+int wal_running         = 0;
+int wal_failed          = 0;        // 1 once a write or a sync failed: nothing commits anymore
+long wal_records        = 0;        // records appended
+long wal_groups         = 0;        // write() calls that carried them
+long wal_syncs          = 0;        // fdatasync() calls
+long wal_snapshots      = 0;        // snapshots written
+wal_commit_fn wal_on_commit = NULL; // (optional) told each group before its writers wake
+
+    // syncer thread only
+long wal_unsynced       = 0;        // records written since the last fdatasync()
+long wal_last_sync_ns   = 0;
+uint64_t wal_snap_lsn   = 0;        // last record covered by the snapshot file
+pthread_t wal_thread;
+
+// MUTEXES & CONDITION VARIABLES:
+pthread_mutex_t mutex_wal   = PTHREAD_MUTEX_INITIALIZER;    // protects the group commit state
+pthread_cond_t cond_wal_work = PTHREAD_COND_INITIALIZER;    // records were appended
+pthread_cond_t cond_wal_done = PTHREAD_COND_INITIALIZER;    // a group was committed (or swapped)
+
+
+//-- FNV-1a hash of len bytes (records and snapshots check themselves with it)
+uint32_t wal_crc(const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    uint32_t hash = 2166136261u;
+
+    while (len-- > 0) {
+        hash ^= *bytes++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//-- CLOCK_MONOTONIC in nanoseconds
+long wal_now_ns() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+//-- writes the len bytes of buf to fd, F_FAILURE if it could not
+int wal_write_all(int fd, const void *buf, size_t len) {
+    const char *bytes = buf;
+    ssize_t written;
+
+    while (len > 0) {
+        written = write(fd, bytes, len);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            perror("wal write failed");
+            return F_FAILURE;
+        }
+        bytes += written;
+        len -= written;
+    }
+    return F_SUCCESS;
+}
+
+//-- fills path with the file name inside the log directory
+char *wal_path(char *path, const char *name) {
+    snprintf(path, WAL_PATH_LEN, "%s/%s", wal_dir, name);
+    return path;
+}
+
+//-- (syncer thread!) 1 when the policy wants the written records on disk now
+int wal_sync_due() {
+    if (wal_unsynced == 0) {
+        return 0;
+    }
+    if (wal_mode == WAL_SYNC_RECORDS) {
+        return wal_unsynced >= wal_every;
+    }
+    if (wal_mode == WAL_SYNC_MS) {
+        return wal_now_ns() - wal_last_sync_ns >= wal_every * 1000000L;
+    }
+    return 0;
+}
+
+//-- (syncer thread!) writes a snapshot of value at lsn aside, renames it over the
+//   old one and empties the log: every record in it is covered
+int wal_write_snapshot(uint64_t lsn, int64_t value) {
+    char path[WAL_PATH_LEN], tmp_path[WAL_PATH_LEN + 8];
+    struct wal_snapshot snap;
+    int fd;
+
+    memset(&snap, 0, sizeof(snap));
+    memcpy(snap.magic, WAL_SNAP_MAGIC, sizeof(snap.magic));
+    snap.version = WAL_VERSION;
+    snap.lsn = lsn;
+    snap.value = value;
+    snap.crc = wal_crc(&snap, offsetof(struct wal_snapshot, crc));
+
+    wal_path(path, WAL_SNAP_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(tmp_path);
+        return F_FAILURE;
+    }
+    if (wal_write_all(fd, &snap, sizeof(snap)) == F_FAILURE || fsync(fd) < 0) {
+        close(fd);
+        return F_FAILURE;
+    }
+    close(fd);
+    if (rename(tmp_path, path) < 0) {
+        perror("rename failed");
+        return F_FAILURE;
+    }
+
+    // the rename must be on disk before the records it replaces are gone
+    fd = open(wal_dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    if (ftruncate(wal_fd, 0) < 0) {
+        perror("ftruncate failed");     // harmless: recovery skips covered records
+    }
+    wal_snap_lsn = lsn;
+    wal_unsynced = 0;
+    return F_SUCCESS;
+}
+
+//-- (thread!) group commit: writes whatever the writers appended with a single
+//   write(), syncs it as the policy says and wakes the writers waiting for it;
+//   a failed write or sync stops it: those records (and any after them) are never
+//   committed, their writers are told so
+void *wal_syncer() {
+    struct wal_record *group;
+    struct timespec deadline;
+    wal_commit_fn on_commit;
+    long due_ns;
+    int n, written, synced, snapped;
+
+    pthread_mutex_lock(&mutex_wal);         // lock (X)
+    while (1) {
+        while (wal_group_len == 0 && wal_running && !wal_sync_due()) {
+            if (wal_mode == WAL_SYNC_MS && wal_unsynced > 0) {
+                // records on the page cache only: sync them T ms after the last sync
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                due_ns = wal_last_sync_ns + wal_every * 1000000L - wal_now_ns();
+                deadline.tv_sec += (deadline.tv_nsec + due_ns) / 1000000000L;
+                deadline.tv_nsec = (deadline.tv_nsec + due_ns) % 1000000000L;
+                pthread_cond_timedwait(&cond_wal_work, &mutex_wal, &deadline);
+            } else {
+                pthread_cond_wait(&cond_wal_work, &mutex_wal);
+            }
+        }
+        if (wal_group_len == 0 && !wal_running && !wal_sync_due()) {
+            break;
+        }
+
+        // the writers fill the other buffer while this group is written
+        group = wal_group;
+        n = wal_group_len;
+        wal_group = wal_spare;
+        wal_spare = group;
+        wal_group_len = 0;
+        on_commit = wal_on_commit;
+        pthread_cond_broadcast(&cond_wal_done);
+        pthread_mutex_unlock(&mutex_wal);   // unlock (o)
+
+        written = (n == 0 || wal_write_all(wal_fd, group, n * sizeof(struct wal_record)) == F_SUCCESS);
+        if (written) {
+            wal_unsynced += n;
+        }
+        synced = written && wal_sync_due();
+        if (synced && fdatasync(wal_fd) < 0) {
+            perror("wal fdatasync failed");
+            written = synced = 0;   // on the page cache at most: not committed
+        } else if (synced) {
+            wal_unsynced = 0;
+            wal_last_sync_ns = wal_now_ns();
+        }
+        snapped = (written && n > 0 && group[n - 1].lsn - wal_snap_lsn >= (uint64_t)wal_snap_every &&
+                   wal_write_snapshot(group[n - 1].lsn, group[n - 1].value) == F_SUCCESS);
+        if (written && n > 0 && on_commit != NULL) {
+            on_commit(group[n - 1].lsn, group[n - 1].value);    // (before its writers answer)
+        }
+
+        pthread_mutex_lock(&mutex_wal);     // lock (X)
+        if (!written) {
+            fprintf(stderr, "error: the log failed after record %llu, nothing more is committed\n",
+                    (unsigned long long)wal_done_lsn);
+            wal_failed = 1;
+            wal_running = 0;
+            pthread_cond_broadcast(&cond_wal_done);
+            break;
+        }
+        if (n > 0) {
+            wal_done_lsn = group[n - 1].lsn;
+            wal_groups++;
+        }
+        wal_syncs += synced;
+        wal_snapshots += snapped;
+        pthread_cond_broadcast(&cond_wal_done);
+    }
+    pthread_mutex_unlock(&mutex_wal);       // unlock (o)
+    return NULL;
+}
+
+//-- reads the snapshot file (if any) into lsn and value, F_FAILURE if it is corrupt
+int wal_read_snapshot(uint64_t *lsn, int64_t *value) {
+    char path[WAL_PATH_LEN];
+    struct wal_snapshot snap;
+    ssize_t got;
+    int fd = open(wal_path(path, WAL_SNAP_FILE), O_RDONLY);
+
+    if (fd < 0) {
+        return (errno == ENOENT) ? F_SUCCESS : F_FAILURE;   // none yet: keep the defaults
+    }
+    got = read(fd, &snap, sizeof(snap));
+    close(fd);
+    if (got != sizeof(snap) || memcmp(snap.magic, WAL_SNAP_MAGIC, sizeof(snap.magic)) != 0 ||
+        snap.version != WAL_VERSION || snap.crc != wal_crc(&snap, offsetof(struct wal_snapshot, crc))) {
+        fprintf(stderr, "error: %s is not a valid counter snapshot\n", path);
+        return F_FAILURE;
+    }
+    *lsn = snap.lsn;
+    *value = snap.value;
+    return F_SUCCESS;
+}
+
+//-- replays the log on top of lsn and value, cuts a torn tail off,
+//   returns the records applied or F_FAILURE
+long wal_replay(uint64_t *lsn, int64_t *value) {
+    struct wal_record records[WAL_READ_RECORDS];
+    off_t good_end = 0;
+    ssize_t got;
+    long applied = 0;
+    int i, n, torn = 0;
+
+    // a partial record can only be the last bytes of the file
+    while (!torn && (got = read(wal_fd, records, sizeof(records))) > 0) {
+        n = got / sizeof(struct wal_record);
+        for (i = 0; i < n && !torn; i++) {
+            if (records[i].crc != wal_crc(&records[i], offsetof(struct wal_record, crc)) ||
+                records[i].lsn > *lsn + 1) {
+                torn = 1;   // a crash in the middle of a write: nothing after it counts
+            } else {
+                if (records[i].lsn == *lsn + 1) {   // older ones: covered by the snapshot
+                    *lsn = records[i].lsn;
+                    *value = records[i].value;
+                    applied++;
+                }
+                good_end += sizeof(struct wal_record);
+            }
+        }
+        torn = torn || (got % sizeof(struct wal_record) != 0);
+    }
+    if (got < 0) {
+        perror("wal read failed");
+        return F_FAILURE;
+    }
+    if (torn) {
+        fprintf(stderr, "warning: torn log tail dropped after record %llu\n", (unsigned long long)*lsn);
+        if (ftruncate(wal_fd, good_end) < 0) {
+            perror("ftruncate failed");
+            return F_FAILURE;
+        }
+    }
+    return applied;
+}
+
+//-- recovers the counter kept in dir (snapshot + log) into value, which holds the
+//   starting value when dir has none yet, and starts the group commit thread
+//   mode and every: fsync policy, snap_every: records between two snapshots
+int wal_open(const char *dir, enum wal_sync_modes mode, long every, long snap_every, int64_t *value) {
+    char path[WAL_PATH_LEN];
+    uint64_t lsn = 0;
+    long applied;
+
+    snprintf(wal_dir, sizeof(wal_dir), "%s", dir);
+    wal_mode = mode;
+    wal_every = (every > 0) ? every : 1;
+    wal_snap_every = (snap_every > 0) ? snap_every : WAL_SNAP_EVERY;
+
+    if (wal_read_snapshot(&lsn, value) == F_FAILURE) {
+        return F_FAILURE;
+    }
+    wal_snap_lsn = lsn;
+
+    wal_fd = open(wal_path(path, WAL_FILE), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (wal_fd < 0) {
+        perror(path);
+        return F_FAILURE;
+    }
+    applied = wal_replay(&lsn, value);
+    if (applied == F_FAILURE) {
+        close(wal_fd);
+        return F_FAILURE;
+    }
+    DEBUG_PRINTF("[wal] snapshot at record %llu + %li log records\n",
+                 (unsigned long long)wal_snap_lsn, applied);
+
+    wal_group = malloc(WAL_GROUP_MAX * sizeof(struct wal_record));
+    wal_spare = malloc(WAL_GROUP_MAX * sizeof(struct wal_record));
+    if (wal_group == NULL || wal_spare == NULL) {
+        perror("malloc failed");
+        close(wal_fd);
+        return F_FAILURE;
+    }
+    wal_next_lsn = lsn + 1;
+    wal_done_lsn = lsn;
+    wal_unsynced = 0;
+    wal_last_sync_ns = wal_now_ns();
+    wal_running = 1;
+    if (pthread_create(&wal_thread, NULL, wal_syncer, NULL) != 0) {
+        perror("pthread_create failed");
+        wal_running = 0;
+        close(wal_fd);
+        return F_FAILURE;
+    }
+    return F_SUCCESS;
+}
+
+//-- appends the new value of the counter to the log, returns its lsn (wal_wait()
+//   tells when it is committed) or 0 once closed, writers call it in the order they write
+uint64_t wal_append(int64_t value) {
+    struct wal_record record;
+
+    memset(&record, 0, sizeof(record));
+    record.value = value;
+
+    pthread_mutex_lock(&mutex_wal);         // lock (X)
+    while (wal_group_len == WAL_GROUP_MAX && wal_running) {
+        pthread_cond_wait(&cond_wal_done, &mutex_wal);  // the syncer is behind
+    }
+    if (!wal_running) {
+        pthread_mutex_unlock(&mutex_wal);   // unlock (o)
+        return 0;   // shutting down (or failed): nothing is logged anymore
+    }
+    record.lsn = wal_next_lsn++;
+    record.crc = wal_crc(&record, offsetof(struct wal_record, crc));
+    wal_group[wal_group_len++] = record;
+    wal_records++;
+    pthread_cond_signal(&cond_wal_work);
+    pthread_mutex_unlock(&mutex_wal);       // unlock (o)
+
+    return record.lsn;
+}
+
+//-- returns the lsn of the last record appended (the one the counter shows)
+uint64_t wal_last_lsn() {
+    uint64_t lsn;
+
+    pthread_mutex_lock(&mutex_wal);         // lock (X)
+    lsn = wal_next_lsn - 1;
+    pthread_mutex_unlock(&mutex_wal);       // unlock (o)
+    return lsn;
+}
+
+//-- blocks until the record lsn is committed (written, synced if the policy says so),
+//   returns F_SUCCESS once it is, F_FAILURE if the log failed before it was
+int wal_wait(uint64_t lsn) {
+    int status;
+
+    pthread_mutex_lock(&mutex_wal);         // lock (X)
+    while (wal_done_lsn < lsn && wal_running) {
+        pthread_cond_wait(&cond_wal_done, &mutex_wal);
+    }
+    status = (wal_done_lsn >= lsn) ? F_SUCCESS : F_FAILURE;
+    pthread_mutex_unlock(&mutex_wal);       // unlock (o)
+    return status;
+}
+
+//-- sets the function the syncer tells each committed group (NULL: none)
+void wal_set_commit_hook(wal_commit_fn on_commit) {
+    pthread_mutex_lock(&mutex_wal);         // lock (X)
+    wal_on_commit = on_commit;
+    pthread_mutex_unlock(&mutex_wal);       // unlock (o)
+}
+
+//-- commits what is left, syncs it and stops the group commit thread
+void wal_close() {
+    pthread_mutex_lock(&mutex_wal);         // lock (X)
+    if ((!wal_running && !wal_failed) || wal_fd < 0) {
+        pthread_mutex_unlock(&mutex_wal);   // unlock (o)
+        return;     // never opened, or closed already
+    }
+    wal_running = 0;
+    pthread_cond_signal(&cond_wal_work);
+    pthread_mutex_unlock(&mutex_wal);       // unlock (o)
+
+    pthread_join(wal_thread, NULL);
+    if (!wal_failed && fdatasync(wal_fd) < 0) {
+        perror("wal fdatasync failed");
+    }
+    close(wal_fd);
+    wal_fd = -1;
+    free(wal_group);
+    free(wal_spare);
+    wal_group = wal_spare = NULL;
+}
+
+//-- reports the records appended, the group commits (write() calls) they took,
+//   the fdatasync() calls and the snapshots written
+void wal_get_stats(long *records, long *groups, long *syncs, long *snapshots) {
+    pthread_mutex_lock(&mutex_wal);         // lock (X)
+    *records = wal_records;
+    *groups = wal_groups;
+    *syncs = wal_syncs;
+    *snapshots = wal_snapshots;
+    pthread_mutex_unlock(&mutex_wal);       // unlock (o)
+}
@@ -0,0 +1,54 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdint.h>
+#include "./stub.h"
+
+
+#define WAL_FILE            "counter.wal"   // records since the last snapshot
+#define WAL_SNAP_FILE       "counter.snap"  // value of the counter at some record
+#define WAL_SNAP_MAGIC      "SDCW"
+#define WAL_VERSION         1
+#define WAL_GROUP_MAX       4096    // records one group commit writes at most
+#define WAL_SNAP_EVERY      10000   // default records between two snapshots
+
+
+enum wal_sync_modes {
+    WAL_SYNC_NONE = 0,          // write() only: the kernel decides when it reaches the disk
+    WAL_SYNC_RECORDS,           // fsync once every N records (1: before answering any)
+    WAL_SYNC_MS                 // fsync at most T ms after a record is written
+};
+
+// one write of the counter, as appended to the log
+struct wal_record {
+    uint64_t lsn;               // log sequence number: 1, 2, 3...
+    int64_t value;              // the counter after the write
+    uint32_t crc;               // FNV-1a of the fields above: a torn tail does not match
+    uint32_t reserved;
+};
+
+// told the last record of each group once it commits (by the syncer, in lsn order)
+typedef void (*wal_commit_fn)(uint64_t lsn, int64_t value);
+
+// the snapshot file (written aside and renamed over the old one)
+struct wal_snapshot {
+    char magic[4];
+    uint16_t version;
+    uint16_t reserved;
+    uint64_t lsn;               // last record it covers: the log restarts after it
+    int64_t value;
+    uint32_t crc;               // FNV-1a of the fields above
+    uint32_t reserved2;
+};
+
+
+// durable counter (one log per process, records appended by the writers in order)
+int wal_open(const char *dir, enum wal_sync_modes mode, long every, long snap_every, int64_t *value);
+uint64_t wal_append(int64_t value);
+uint64_t wal_last_lsn();
+int wal_wait(uint64_t lsn);
+void wal_set_commit_hook(wal_commit_fn on_commit);
+void wal_close();
+void wal_get_stats(long *records, long *groups, long *syncs, long *snapshots);
+
+#endif // WAL_H